@@ -35,6 +35,9 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include  "usbd_ioreq.h"
+#if (USBD_STATUS_DRIVE == 1)
+#include  "usbd_msc.h"
+#endif
 
 /** @addtogroup STM32_USB_DEVICE_LIBRARY
   * @{
@@ -53,6 +56,10 @@
 #define CDC_DATA_INTERFACE_1                         0x01  /* First Interface for Bulk transfer */
 #define CDC_CMD_INTERFACE_2                          0x02  /* Second Interface for Command transfer */
 #define CDC_DATA_INTERFACE_2                         0x03  /* Second Interface for Bulk transfer */
+#define DFU_RT_INTERFACE                             0x04  /* DFU runtime interface, no endpoint */
+#define HID_CTL_INTERFACE                            0x05  /* HID control channel interface */
+#define CAPTURE_INTERFACE                            0x06  /* UART capture interface, isochronous */
+#define MSC_DRIVE_INTERFACE                          0x07  /* Status drive, mass storage; USBD_STATUS_DRIVE only */
 
 #define CDC_IN_EP1                                   0x81  /* EP1 for data IN */
 #define CDC_OUT_EP1                                  0x01  /* EP1 for data OUT */
@@ -62,12 +69,24 @@
 #define CDC_OUT_EP2                                  0x02  /* EP2 for data OUT */
 #define CDC_CMD_EP2                                  0x84  /* EP2 for CDC commands */
 
+#define HID_CTL_IN_EP                                0x85  /* EP5 for control channel reports IN */
+#define HID_CTL_OUT_EP                               0x05  /* EP5 for control channel reports OUT */
+
+#define CAPTURE_IN_EP                                0x86  /* EP6 for capture packets IN */
+
+#define CDC_PORT_COUNT                               2     /* Ports, each with the interfaces and endpoints above */
+#define CDC_PORT_NONE                                0xFF
+
 /* CDC Endpoints parameters: you can fine tune these values depending on the needed baudrates and performance. */
 #define CDC_DATA_HS_MAX_PACKET_SIZE                 512  /* Endpoint IN & OUT Packet size */
 #define CDC_DATA_FS_MAX_PACKET_SIZE                 64  /* Endpoint IN & OUT Packet size */
-#define CDC_CMD_PACKET_SIZE                         8  /* Control Endpoint Packet size */ 
+#define CDC_CMD_PACKET_SIZE                         16  /* Control Endpoint Packet size: holds a whole SERIAL_STATE notification */ 
 
-#define USB_CDC_CONFIG_DESC_SIZ                     141
+#if (USBD_STATUS_DRIVE == 1)
+#define USB_CDC_CONFIG_DESC_SIZ                     255   /* With the status drive interface */
+#else
+#define USB_CDC_CONFIG_DESC_SIZ                     232
+#endif
 #define CDC_DATA_HS_IN_PACKET_SIZE                  CDC_DATA_HS_MAX_PACKET_SIZE
 #define CDC_DATA_HS_OUT_PACKET_SIZE                 CDC_DATA_HS_MAX_PACKET_SIZE
 
@@ -87,6 +106,60 @@
 #define CDC_SET_CONTROL_LINE_STATE                  0x22
 #define CDC_SEND_BREAK                              0x23
 
+/* Notification sent on the command endpoint */
+#define CDC_NOTIFICATION_SERIAL_STATE               0x20
+#define CDC_NOTIFICATION_SIZE                       10
+
+/* SERIAL_STATE bits: DCD and DSR follow the line level, the other bits
+   report an event and are cleared once sent */
+#define CDC_SERIAL_STATE_DCD                        0x0001  /* bRxCarrier */
+#define CDC_SERIAL_STATE_DSR                        0x0002  /* bTxCarrier */
+#define CDC_SERIAL_STATE_BREAK                      0x0004
+#define CDC_SERIAL_STATE_RING                       0x0008
+#define CDC_SERIAL_STATE_FRAMING                    0x0010
+#define CDC_SERIAL_STATE_PARITY                     0x0020
+#define CDC_SERIAL_STATE_OVERRUN                    0x0040
+#define CDC_SERIAL_STATE_EVENTS                     0x007C
+
+/*---------------------------------------------------------------------*/
+/*  DFU runtime definitions                                            */
+/*---------------------------------------------------------------------*/
+#define DFU_RT_DETACH                               0x00
+#define DFU_RT_GETSTATUS                            0x03
+#define DFU_RT_GETSTATE                             0x05
+#define DFU_RT_STATUS_SIZE                          6
+#define DFU_RT_STATE_APP_IDLE                       0x00
+#define DFU_RT_STATE_APP_DETACH                     0x01
+#define DFU_RT_DETACH_TIMEOUT                       1000  /* ms the host may wait for the loader */
+#define DFU_RT_TRANSFER_SIZE                        1024  /* One flash page */
+
+/*---------------------------------------------------------------------*/
+/*  HID control channel definitions                                    */
+/*---------------------------------------------------------------------*/
+#define HID_CTL_DESCRIPTOR_TYPE                     0x21
+#define HID_CTL_REPORT_DESC_TYPE                    0x22
+#define HID_CTL_DESC_OFFSET                         168   /* HID descriptor in the configuration */
+#define HID_CTL_DESC_SIZE                           9
+#define HID_CTL_REPORT_DESC_SIZE                    27
+#define HID_CTL_REPORT_SIZE                         64    /* One vendor report each way, no report ID */
+#define HID_CTL_POLL_INTERVAL                       1     /* ms */
+#define HID_CTL_REQ_GET_REPORT                      0x01
+#define HID_CTL_REQ_GET_IDLE                        0x02
+#define HID_CTL_REQ_GET_PROTOCOL                    0x03
+#define HID_CTL_REQ_SET_IDLE                        0x0A
+#define HID_CTL_REQ_SET_PROTOCOL                    0x0B
+
+/*---------------------------------------------------------------------*/
+/*  Capture interface definitions                                      */
+/*---------------------------------------------------------------------*/
+#define CAPTURE_ALT_OFF                             0     /* No endpoint, no bandwidth */
+#define CAPTURE_ALT_PORT_X                          1     /* Each streaming alternate setting reserves */
+#define CAPTURE_ALT_PORT_Y                          2     /* CAPTURE_PACKET_SIZE bytes in every frame */
+#define CAPTURE_ALT_COUNT                           3
+#define CAPTURE_MISSED                              0xFF  /* Told instead of a setting: a packet was not taken in its frame */
+#define CAPTURE_PACKET_SIZE                         176
+#define CAPTURE_INTERVAL                            1     /* Frame */
+
 #define APP_RX_DATA_SIZE  256
 #define APP_TX_DATA_SIZE  256
 /**
@@ -115,6 +188,11 @@ typedef struct _USBD_CDC_Itf
   int8_t (* DeInit)        (void);
   int8_t (* Control)       (uint8_t, uint8_t * , uint16_t);   
   int8_t (* Receive)       (uint8_t *, uint32_t *);  
+  int8_t (* TransmitCplt)  (uint8_t *, uint32_t *, uint8_t);
+  int8_t (* Detach)        (uint16_t);                        /* DFU_DETACH, first port only */
+  int8_t (* Report)        (uint8_t *, uint32_t);             /* HID OUT report, NULL once the IN report is taken; first port only */
+  int8_t (* Sof)           (void);                            /* Start of frame, every ms; first port only */
+  int8_t (* Capture)       (uint8_t);                         /* CAPTURE_ALT_xxx set by the host, or CAPTURE_MISSED; first port only */
 
 }USBD_CDC_ItfTypeDef;
 
@@ -132,9 +210,20 @@ typedef struct
   
   __IO uint32_t TxState;     
   __IO uint32_t RxState;    
+
+  uint8_t  Notification[CDC_NOTIFICATION_SIZE];
+  __IO uint32_t NotifyState;
 }
 USBD_CDC_HandleTypeDef; 
 
+/* Memory taken from USBD_malloc, one handle and one interface per port */
+#define USBD_CDC_CLASS_DATA_SIZE                    (CDC_PORT_COUNT * sizeof (USBD_CDC_HandleTypeDef))
+#define USBD_CDC_USER_DATA_SIZE                     (CDC_PORT_COUNT * sizeof (USBD_CDC_ItfTypeDef*))
+#if (USBD_STATUS_DRIVE == 1)
+#define USBD_CDC_MSC_DATA_SIZE                      (sizeof (USBD_MSC_BOT_HandleTypeDef))
+#else
+#define USBD_CDC_MSC_DATA_SIZE                      0
+#endif
 
 
 /** @defgroup USBD_CORE_Exported_Macros
@@ -161,6 +250,11 @@ extern USBD_ClassTypeDef  USBD_CDC;
 uint8_t  USBD_CDC_RegisterInterface  (USBD_HandleTypeDef   *pdev, 
                                       USBD_CDC_ItfTypeDef *fops);
 
+#if (USBD_STATUS_DRIVE == 1)
+uint8_t  USBD_CDC_RegisterStorage    (USBD_HandleTypeDef   *pdev, 
+                                      USBD_StorageTypeDef *fops);
+#endif
+
 uint8_t  USBD_CDC_SetTxBuffer        (USBD_HandleTypeDef   *pdev,
                                       uint8_t  *pbuff,
                                       uint16_t length,
@@ -172,9 +266,24 @@ uint8_t  USBD_CDC_SetRxBuffer        (USBD_HandleTypeDef   *pdev,
   
 uint8_t  USBD_CDC_ReceivePacket      (USBD_HandleTypeDef *pdev, uint32_t Port);
 
+uint8_t  USBD_CDC_SendReport         (USBD_HandleTypeDef *pdev,
+                                      uint8_t *report,
+                                      uint16_t len);
+
+uint8_t  USBD_CDC_SendCapture        (USBD_HandleTypeDef *pdev,
+                                      uint8_t *packet,
+                                      uint16_t len);
+
 uint8_t  USBD_CDC_TransmitPacket     (USBD_HandleTypeDef *pdev,
                                       uint8_t             epnum);
 
+uint8_t  USBD_CDC_NotifySerialState  (USBD_HandleTypeDef *pdev,
+                                      uint32_t            Port,
+                                      uint16_t            SerialState);
+
+uint8_t  USBD_CDC_CtlReply           (USBD_HandleTypeDef *pdev,
+                                      uint8_t             status);
+
 /**
   * @}
   */ 
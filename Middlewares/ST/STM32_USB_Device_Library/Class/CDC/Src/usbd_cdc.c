@@ -76,6 +76,15 @@
 /** @defgroup USBD_CDC_Private_TypesDefinitions
 * @{
 */ 
+/* Endpoints and command interface of a port */
+typedef struct
+{
+  uint8_t InEp;
+  uint8_t OutEp;
+  uint8_t CmdEp;
+  uint8_t CmdItf;
+}
+USBD_CDC_PortTypeDef;
 /**
 * @}
 */ 
@@ -92,6 +101,8 @@
 /** @defgroup USBD_CDC_Private_Macros
 * @{
 */ 
+#define CDC_EP_PORT(epnum)     (USBD_CDC_EpPort[(epnum) & 0x0F])
+#define CDC_ITF_PORT(itf)      (((itf) < sizeof (USBD_CDC_ItfPort)) ? USBD_CDC_ItfPort[(itf)] : CDC_PORT_NONE)
 
 /**
 * @}
@@ -120,6 +131,27 @@ static uint8_t  USBD_CDC_DataOut (USBD_HandleTypeDef *pdev,
 
 static uint8_t  USBD_CDC_EP0_RxReady (USBD_HandleTypeDef *pdev);
 
+static uint8_t  USBD_CDC_SOF (USBD_HandleTypeDef *pdev);
+
+static uint8_t  USBD_CDC_IsoINIncomplete (USBD_HandleTypeDef *pdev, 
+                                          uint8_t epnum);
+
+static uint8_t  USBD_CDC_DfuSetup (USBD_HandleTypeDef *pdev, 
+                                   USBD_SetupReqTypedef *req);
+
+static uint8_t  USBD_CDC_HidSetup (USBD_HandleTypeDef *pdev, 
+                                   USBD_SetupReqTypedef *req);
+
+static uint8_t  USBD_CDC_SetCapture (USBD_HandleTypeDef *pdev, 
+                                     USBD_SetupReqTypedef *req);
+
+#if (USBD_STATUS_DRIVE == 1)
+static uint8_t  USBD_CDC_MscSetup (USBD_HandleTypeDef *pdev, 
+                                   USBD_SetupReqTypedef *req);
+
+static void  USBD_CDC_MscSwap (USBD_HandleTypeDef *pdev);
+#endif
+
 static uint8_t  *USBD_CDC_GetFSCfgDesc (uint16_t *length);
 
 static uint8_t  *USBD_CDC_GetHSCfgDesc (uint16_t *length);
@@ -133,10 +165,84 @@ uint8_t  *USBD_CDC_GetDeviceQualifierDescriptor (uint16_t *length);
 static uint8_t *USBD_CDC_GetUsrStrDescriptor1 (uint16_t *length);
 static uint8_t *USBD_CDC_GetUsrStrDescriptor2 (uint16_t *length);
 
-uint8_t UserRxBuffer[2][APP_RX_DATA_SIZE];/* Received Data over USB are stored in this buffer */
-uint8_t UserTxBuffer[2][APP_TX_DATA_SIZE];/* Received Data over UART (CDC interface) are stored in this buffer */
+uint8_t UserRxBuffer[CDC_PORT_COUNT][APP_RX_DATA_SIZE];/* Received Data over USB are stored in this buffer */
+uint8_t UserTxBuffer[CDC_PORT_COUNT][APP_TX_DATA_SIZE];/* Received Data over UART (CDC interface) are stored in this buffer */
+
+/* Port addressed by the control request in progress */
+static uint8_t CurrentPort = CDC_PORT_NONE;
+
+/* Port whose IN data stage waits for USBD_CDC_CtlReply, and its length */
+static uint8_t CtlOwed = CDC_PORT_NONE;
+static uint16_t CtlOwedLength;
+
+/* DFU runtime: appIDLE until the host asks for the loader */
+static uint8_t DfuState = DFU_RT_STATE_APP_IDLE;
+static uint8_t DfuStatus[DFU_RT_STATUS_SIZE];
+
+/* HID control channel: one report each way */
+static uint32_t HidOutReport[HID_CTL_REPORT_SIZE / 4];
+static uint8_t HidInBusy;
+static uint8_t HidIdle;
+static uint8_t HidProtocol;
+
+/* Capture interface: the alternate setting chosen by the host, and the
+   packet of the current frame not taken yet */
+static uint8_t CaptureAlt;
+static uint8_t CaptureBusy;
+
+#if (USBD_STATUS_DRIVE == 1)
+/* Status drive: the BOT handle and the storage of the MSC class, which
+   takes them from pClassData and pUserData */
+static void *MscClassData;
+static void *MscUserData;
+#endif
+
+/* Vendor defined reports of HID_CTL_REPORT_SIZE bytes, no report ID */
+__ALIGN_BEGIN static const uint8_t USBD_CDC_HidReportDesc[HID_CTL_REPORT_DESC_SIZE] __ALIGN_END =
+{
+  0x06, 0x00, 0xFF,     /* USAGE_PAGE (Vendor Defined 0xFF00) */
+  0x09, 0x01,           /* USAGE (1) */
+  0xA1, 0x01,           /* COLLECTION (Application) */
+  0x15, 0x00,           /*   LOGICAL_MINIMUM (0) */
+  0x26, 0xFF, 0x00,     /*   LOGICAL_MAXIMUM (255) */
+  0x75, 0x08,           /*   REPORT_SIZE (8) */
+  0x95, HID_CTL_REPORT_SIZE, /*   REPORT_COUNT */
+  0x09, 0x02,           /*   USAGE (2) */
+  0x81, 0x02,           /*   INPUT (Data,Var,Abs) */
+  0x95, HID_CTL_REPORT_SIZE, /*   REPORT_COUNT */
+  0x09, 0x03,           /*   USAGE (3) */
+  0x91, 0x02,           /*   OUTPUT (Data,Var,Abs) */
+  0xC0                  /* END_COLLECTION */
+};
+
+static const USBD_CDC_PortTypeDef USBD_CDC_Port[CDC_PORT_COUNT] =
+{
+  {CDC_IN_EP1, CDC_OUT_EP1, CDC_CMD_EP1, CDC_CMD_INTERFACE_1},
+  {CDC_IN_EP2, CDC_OUT_EP2, CDC_CMD_EP2, CDC_CMD_INTERFACE_2},
+};
+
+/* Port of each endpoint number: the IN and OUT endpoints of a port share
+   their number, the command endpoint has its own */
+static const uint8_t USBD_CDC_EpPort[16] =
+{
+  CDC_PORT_NONE,        /* EP0: control */
+  0,                    /* CDC_IN_EP1, CDC_OUT_EP1 */
+  1,                    /* CDC_IN_EP2, CDC_OUT_EP2 */
+  0,                    /* CDC_CMD_EP1 */
+  1,                    /* CDC_CMD_EP2 */
+  CDC_PORT_NONE, CDC_PORT_NONE, CDC_PORT_NONE,
+  CDC_PORT_NONE, CDC_PORT_NONE, CDC_PORT_NONE, CDC_PORT_NONE,
+  CDC_PORT_NONE, CDC_PORT_NONE, CDC_PORT_NONE, CDC_PORT_NONE,
+};
 
-uint32_t CurrentwIndx = 0xff;
+/* Port of each interface */
+static const uint8_t USBD_CDC_ItfPort[4] =
+{
+  0,                    /* CDC_CMD_INTERFACE_1 */
+  0,                    /* CDC_DATA_INTERFACE_1 */
+  1,                    /* CDC_CMD_INTERFACE_2 */
+  1,                    /* CDC_DATA_INTERFACE_2 */
+};
 
 
 
@@ -176,8 +282,8 @@ USBD_ClassTypeDef  USBD_CDC =
   USBD_CDC_EP0_RxReady,
   USBD_CDC_DataIn,
   USBD_CDC_DataOut,
-  NULL,
-  NULL,
+  USBD_CDC_SOF,
+  USBD_CDC_IsoINIncomplete,
   NULL,     
   USBD_CDC_GetHSCfgDesc,  
   USBD_CDC_GetFSCfgDesc,    
@@ -195,7 +301,7 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgHSDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   USB_DESC_TYPE_CONFIGURATION,      /* bDescriptorType: Configuration */  
   USB_CDC_CONFIG_DESC_SIZ,                /* wTotalLength:no of returned bytes */
   0x00,
-  0x04,   /* bNumInterfaces: 4 interface */
+  USBD_MAX_NUM_INTERFACES,   /* bNumInterfaces: 7 interfaces, 8 with the status drive */
   0x01,   /* bConfigurationValue: Configuration value */
   0x00,   /* iConfiguration: Index of string descriptor describing the configuration */
   0xC0,   /* bmAttributes: self powered */
@@ -243,7 +349,7 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgHSDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   0x04,   /* bFunctionLength */
   0x24,   /* bDescriptorType: CS_INTERFACE */
   0x02,   /* bDescriptorSubtype: Abstract Control Management desc */
-  0x02,   /* bmCapabilities */
+  0x06,   /* bmCapabilities: D1 line coding and state, D2 Send_Break */
   
   /*Union Functional Descriptor*/
   0x05,   /* bFunctionLength */
@@ -331,7 +437,7 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgHSDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   0x04,   /* bFunctionLength */
   0x24,   /* bDescriptorType: CS_INTERFACE */
   0x02,   /* bDescriptorSubtype: Abstract Control Management desc */
-  0x02,   /* bmCapabilities */
+  0x06,   /* bmCapabilities: D1 line coding and state, D2 Send_Break */
   
   /*Union Functional Descriptor*/
   0x05,   /* bFunctionLength */
@@ -379,6 +485,149 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgHSDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   HIBYTE(CDC_DATA_HS_MAX_PACKET_SIZE),
   0x00,                               /* bInterval: ignore for Bulk transfer */
   
+  /*DFU runtime interface descriptor*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  DFU_RT_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x00,   /* bNumEndpoints: control endpoint only */
+  0xFE,   /* bInterfaceClass: Application Specific */
+  0x01,   /* bInterfaceSubClass: Device Firmware Upgrade */
+  0x01,   /* bInterfaceProtocol: Runtime protocol */
+  0x00,   /* iInterface: */
+  
+  /*DFU Functional Descriptor*/
+  0x09,   /* bLength */
+  0x21,   /* bDescriptorType: DFU FUNCTIONAL */
+  0x09,   /* bmAttributes: bitWillDetach, bitCanDnload */
+  LOBYTE(DFU_RT_DETACH_TIMEOUT),   /* wDetachTimeOut */
+  HIBYTE(DFU_RT_DETACH_TIMEOUT),
+  LOBYTE(DFU_RT_TRANSFER_SIZE),    /* wTransferSize */
+  HIBYTE(DFU_RT_TRANSFER_SIZE),
+  0x10,   /* bcdDFUVersion: 1.1 */
+  0x01,
+  
+  /*HID control channel interface descriptor*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  HID_CTL_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x02,   /* bNumEndpoints: Two endpoints used */
+  0x03,   /* bInterfaceClass: HID */
+  0x00,   /* bInterfaceSubClass: no boot interface */
+  0x00,   /* bInterfaceProtocol: none */
+  0x00,   /* iInterface: */
+  
+  /*HID Descriptor*/
+  HID_CTL_DESC_SIZE,   /* bLength */
+  HID_CTL_DESCRIPTOR_TYPE,   /* bDescriptorType: HID */
+  0x11,   /* bcdHID: 1.11 */
+  0x01,
+  0x00,   /* bCountryCode: not localized */
+  0x01,   /* bNumDescriptors */
+  HID_CTL_REPORT_DESC_TYPE,   /* bDescriptorType: Report */
+  LOBYTE(HID_CTL_REPORT_DESC_SIZE),   /* wItemLength */
+  HIBYTE(HID_CTL_REPORT_DESC_SIZE),
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  HID_CTL_IN_EP,                      /* bEndpointAddress */
+  0x03,                              /* bmAttributes: Interrupt */
+  LOBYTE(HID_CTL_REPORT_SIZE),        /* wMaxPacketSize: */
+  HIBYTE(HID_CTL_REPORT_SIZE),
+  HID_CTL_POLL_INTERVAL,             /* bInterval: */
+  
+  /*Endpoint OUT Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  HID_CTL_OUT_EP,                     /* bEndpointAddress */
+  0x03,                              /* bmAttributes: Interrupt */
+  LOBYTE(HID_CTL_REPORT_SIZE),        /* wMaxPacketSize: */
+  HIBYTE(HID_CTL_REPORT_SIZE),
+  HID_CTL_POLL_INTERVAL,             /* bInterval: */
+  
+  /*Capture interface descriptor: no endpoint, no bandwidth*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  CAPTURE_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  CAPTURE_ALT_OFF,   /* bAlternateSetting: Alternate setting */
+  0x00,   /* bNumEndpoints: No endpoint used */
+  0xFF,   /* bInterfaceClass: Vendor specific */
+  0x00,   /* bInterfaceSubClass */
+  0x00,   /* bInterfaceProtocol */
+  0x00,   /* iInterface: */
+  
+  /*Capture interface descriptor: port X streaming*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  CAPTURE_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  CAPTURE_ALT_PORT_X,   /* bAlternateSetting: Alternate setting */
+  0x01,   /* bNumEndpoints: One endpoint used */
+  0xFF,   /* bInterfaceClass: Vendor specific */
+  0x00,   /* bInterfaceSubClass */
+  0x00,   /* bInterfaceProtocol */
+  0x00,   /* iInterface: */
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  CAPTURE_IN_EP,                      /* bEndpointAddress */
+  0x05,                              /* bmAttributes: Isochronous, asynchronous */
+  LOBYTE(CAPTURE_PACKET_SIZE),        /* wMaxPacketSize: */
+  HIBYTE(CAPTURE_PACKET_SIZE),
+  CAPTURE_INTERVAL,                  /* bInterval: */
+  
+  /*Capture interface descriptor: port Y streaming*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  CAPTURE_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  CAPTURE_ALT_PORT_Y,   /* bAlternateSetting: Alternate setting */
+  0x01,   /* bNumEndpoints: One endpoint used */
+  0xFF,   /* bInterfaceClass: Vendor specific */
+  0x00,   /* bInterfaceSubClass */
+  0x00,   /* bInterfaceProtocol */
+  0x00,   /* iInterface: */
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  CAPTURE_IN_EP,                      /* bEndpointAddress */
+  0x05,                              /* bmAttributes: Isochronous, asynchronous */
+  LOBYTE(CAPTURE_PACKET_SIZE),        /* wMaxPacketSize: */
+  HIBYTE(CAPTURE_PACKET_SIZE),
+  CAPTURE_INTERVAL,                  /* bInterval: */
+#if (USBD_STATUS_DRIVE == 1)
+  
+  /*Status drive interface descriptor*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  MSC_DRIVE_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x02,   /* bNumEndpoints: Two endpoints used */
+  0x08,   /* bInterfaceClass: Mass Storage */
+  0x06,   /* bInterfaceSubClass: SCSI transparent */
+  0x50,   /* bInterfaceProtocol: Bulk-Only Transport */
+  0x00,   /* iInterface: */
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  MSC_EPIN_ADDR,                      /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(MSC_MAX_HS_PACKET),          /* wMaxPacketSize: */
+  HIBYTE(MSC_MAX_HS_PACKET),
+  0x00,                              /* bInterval: ignore for Bulk transfer */
+  
+  /*Endpoint OUT Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  MSC_EPOUT_ADDR,                     /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(MSC_MAX_HS_PACKET),          /* wMaxPacketSize: */
+  HIBYTE(MSC_MAX_HS_PACKET),
+  0x00,                              /* bInterval: ignore for Bulk transfer */
+#endif
 } ;
 
 
@@ -390,7 +639,7 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgFSDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   USB_DESC_TYPE_CONFIGURATION,      /* bDescriptorType: Configuration */
   USB_CDC_CONFIG_DESC_SIZ,                /* wTotalLength:no of returned bytes */
   0x00,
-  0x04,   /* bNumInterfaces: 4 interface */
+  USBD_MAX_NUM_INTERFACES,   /* bNumInterfaces: 7 interfaces, 8 with the status drive */
   0x01,   /* bConfigurationValue: Configuration value */
   0x00,   /* iConfiguration: Index of string descriptor describing the configuration */
   0xC0,   /* bmAttributes: self powered */
@@ -438,7 +687,7 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgFSDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   0x04,   /* bFunctionLength */
   0x24,   /* bDescriptorType: CS_INTERFACE */
   0x02,   /* bDescriptorSubtype: Abstract Control Management desc */
-  0x02,   /* bmCapabilities */
+  0x06,   /* bmCapabilities: D1 line coding and state, D2 Send_Break */
   
   /*Union Functional Descriptor*/
   0x05,   /* bFunctionLength */
@@ -526,7 +775,7 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgFSDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   0x04,   /* bFunctionLength */
   0x24,   /* bDescriptorType: CS_INTERFACE */
   0x02,   /* bDescriptorSubtype: Abstract Control Management desc */
-  0x02,   /* bmCapabilities */
+  0x06,   /* bmCapabilities: D1 line coding and state, D2 Send_Break */
   
   /*Union Functional Descriptor*/
   0x05,   /* bFunctionLength */
@@ -572,8 +821,150 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgFSDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   0x02,                              /* bmAttributes: Bulk */
   LOBYTE(CDC_DATA_FS_MAX_PACKET_SIZE),  /* wMaxPacketSize: */
   HIBYTE(CDC_DATA_FS_MAX_PACKET_SIZE),
-  0x00                               /* bInterval: ignore for Bulk transfer */
-    
+  0x00,                              /* bInterval: ignore for Bulk transfer */  
+  /*DFU runtime interface descriptor*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  DFU_RT_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x00,   /* bNumEndpoints: control endpoint only */
+  0xFE,   /* bInterfaceClass: Application Specific */
+  0x01,   /* bInterfaceSubClass: Device Firmware Upgrade */
+  0x01,   /* bInterfaceProtocol: Runtime protocol */
+  0x00,   /* iInterface: */
+  
+  /*DFU Functional Descriptor*/
+  0x09,   /* bLength */
+  0x21,   /* bDescriptorType: DFU FUNCTIONAL */
+  0x09,   /* bmAttributes: bitWillDetach, bitCanDnload */
+  LOBYTE(DFU_RT_DETACH_TIMEOUT),   /* wDetachTimeOut */
+  HIBYTE(DFU_RT_DETACH_TIMEOUT),
+  LOBYTE(DFU_RT_TRANSFER_SIZE),    /* wTransferSize */
+  HIBYTE(DFU_RT_TRANSFER_SIZE),
+  0x10,   /* bcdDFUVersion: 1.1 */
+  0x01,
+  
+  /*HID control channel interface descriptor*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  HID_CTL_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x02,   /* bNumEndpoints: Two endpoints used */
+  0x03,   /* bInterfaceClass: HID */
+  0x00,   /* bInterfaceSubClass: no boot interface */
+  0x00,   /* bInterfaceProtocol: none */
+  0x00,   /* iInterface: */
+  
+  /*HID Descriptor*/
+  HID_CTL_DESC_SIZE,   /* bLength */
+  HID_CTL_DESCRIPTOR_TYPE,   /* bDescriptorType: HID */
+  0x11,   /* bcdHID: 1.11 */
+  0x01,
+  0x00,   /* bCountryCode: not localized */
+  0x01,   /* bNumDescriptors */
+  HID_CTL_REPORT_DESC_TYPE,   /* bDescriptorType: Report */
+  LOBYTE(HID_CTL_REPORT_DESC_SIZE),   /* wItemLength */
+  HIBYTE(HID_CTL_REPORT_DESC_SIZE),
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  HID_CTL_IN_EP,                      /* bEndpointAddress */
+  0x03,                              /* bmAttributes: Interrupt */
+  LOBYTE(HID_CTL_REPORT_SIZE),        /* wMaxPacketSize: */
+  HIBYTE(HID_CTL_REPORT_SIZE),
+  HID_CTL_POLL_INTERVAL,             /* bInterval: */
+  
+  /*Endpoint OUT Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  HID_CTL_OUT_EP,                     /* bEndpointAddress */
+  0x03,                              /* bmAttributes: Interrupt */
+  LOBYTE(HID_CTL_REPORT_SIZE),        /* wMaxPacketSize: */
+  HIBYTE(HID_CTL_REPORT_SIZE),
+  HID_CTL_POLL_INTERVAL,             /* bInterval: */
+  
+  /*Capture interface descriptor: no endpoint, no bandwidth*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  CAPTURE_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  CAPTURE_ALT_OFF,   /* bAlternateSetting: Alternate setting */
+  0x00,   /* bNumEndpoints: No endpoint used */
+  0xFF,   /* bInterfaceClass: Vendor specific */
+  0x00,   /* bInterfaceSubClass */
+  0x00,   /* bInterfaceProtocol */
+  0x00,   /* iInterface: */
+  
+  /*Capture interface descriptor: port X streaming*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  CAPTURE_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  CAPTURE_ALT_PORT_X,   /* bAlternateSetting: Alternate setting */
+  0x01,   /* bNumEndpoints: One endpoint used */
+  0xFF,   /* bInterfaceClass: Vendor specific */
+  0x00,   /* bInterfaceSubClass */
+  0x00,   /* bInterfaceProtocol */
+  0x00,   /* iInterface: */
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  CAPTURE_IN_EP,                      /* bEndpointAddress */
+  0x05,                              /* bmAttributes: Isochronous, asynchronous */
+  LOBYTE(CAPTURE_PACKET_SIZE),        /* wMaxPacketSize: */
+  HIBYTE(CAPTURE_PACKET_SIZE),
+  CAPTURE_INTERVAL,                  /* bInterval: */
+  
+  /*Capture interface descriptor: port Y streaming*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  CAPTURE_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  CAPTURE_ALT_PORT_Y,   /* bAlternateSetting: Alternate setting */
+  0x01,   /* bNumEndpoints: One endpoint used */
+  0xFF,   /* bInterfaceClass: Vendor specific */
+  0x00,   /* bInterfaceSubClass */
+  0x00,   /* bInterfaceProtocol */
+  0x00,   /* iInterface: */
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  CAPTURE_IN_EP,                      /* bEndpointAddress */
+  0x05,                              /* bmAttributes: Isochronous, asynchronous */
+  LOBYTE(CAPTURE_PACKET_SIZE),        /* wMaxPacketSize: */
+  HIBYTE(CAPTURE_PACKET_SIZE),
+  CAPTURE_INTERVAL,                  /* bInterval: */
+#if (USBD_STATUS_DRIVE == 1)
+  
+  /*Status drive interface descriptor*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  MSC_DRIVE_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x02,   /* bNumEndpoints: Two endpoints used */
+  0x08,   /* bInterfaceClass: Mass Storage */
+  0x06,   /* bInterfaceSubClass: SCSI transparent */
+  0x50,   /* bInterfaceProtocol: Bulk-Only Transport */
+  0x00,   /* iInterface: */
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  MSC_EPIN_ADDR,                      /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(MSC_MAX_FS_PACKET),          /* wMaxPacketSize: */
+  HIBYTE(MSC_MAX_FS_PACKET),
+  0x00,                              /* bInterval: ignore for Bulk transfer */
+  
+  /*Endpoint OUT Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  MSC_EPOUT_ADDR,                     /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(MSC_MAX_FS_PACKET),          /* wMaxPacketSize: */
+  HIBYTE(MSC_MAX_FS_PACKET),
+  0x00,                              /* bInterval: ignore for Bulk transfer */
+#endif
 } ;
 
 __ALIGN_BEGIN uint8_t USBD_CDC_OtherSpeedCfgDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
@@ -582,7 +973,7 @@ __ALIGN_BEGIN uint8_t USBD_CDC_OtherSpeedCfgDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIG
   USB_DESC_TYPE_OTHER_SPEED_CONFIGURATION,   
   USB_CDC_CONFIG_DESC_SIZ,
   0x00,
-  0x04,   /* bNumInterfaces: 4 interfaces */
+  USBD_MAX_NUM_INTERFACES,   /* bNumInterfaces: 7 interfaces, 8 with the status drive */
   0x01,   /* bConfigurationValue: */
   0x04,   /* iConfiguration: */
   0xC0,   /* bmAttributes: */
@@ -628,7 +1019,7 @@ __ALIGN_BEGIN uint8_t USBD_CDC_OtherSpeedCfgDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIG
   0x04,   /* bFunctionLength */
   0x24,   /* bDescriptorType: CS_INTERFACE */
   0x02,   /* bDescriptorSubtype: Abstract Control Management desc */
-  0x02,   /* bmCapabilities */
+  0x06,   /* bmCapabilities: D1 line coding and state, D2 Send_Break */
   
   /*Union Functional Descriptor*/
   0x05,   /* bFunctionLength */
@@ -717,7 +1108,7 @@ __ALIGN_BEGIN uint8_t USBD_CDC_OtherSpeedCfgDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIG
   0x04,   /* bFunctionLength */
   0x24,   /* bDescriptorType: CS_INTERFACE */
   0x02,   /* bDescriptorSubtype: Abstract Control Management desc */
-  0x02,   /* bmCapabilities */
+  0x06,   /* bmCapabilities: D1 line coding and state, D2 Send_Break */
   
   /*Union Functional Descriptor*/
   0x05,   /* bFunctionLength */
@@ -764,7 +1155,150 @@ __ALIGN_BEGIN uint8_t USBD_CDC_OtherSpeedCfgDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIG
   0x02,                             /* bmAttributes: Bulk */
   0x40,                             /* wMaxPacketSize: */
   0x00,
-  0x00                              /* bInterval */
+  0x00,                             /* bInterval */  
+  /*DFU runtime interface descriptor*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  DFU_RT_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x00,   /* bNumEndpoints: control endpoint only */
+  0xFE,   /* bInterfaceClass: Application Specific */
+  0x01,   /* bInterfaceSubClass: Device Firmware Upgrade */
+  0x01,   /* bInterfaceProtocol: Runtime protocol */
+  0x00,   /* iInterface: */
+  
+  /*DFU Functional Descriptor*/
+  0x09,   /* bLength */
+  0x21,   /* bDescriptorType: DFU FUNCTIONAL */
+  0x09,   /* bmAttributes: bitWillDetach, bitCanDnload */
+  LOBYTE(DFU_RT_DETACH_TIMEOUT),   /* wDetachTimeOut */
+  HIBYTE(DFU_RT_DETACH_TIMEOUT),
+  LOBYTE(DFU_RT_TRANSFER_SIZE),    /* wTransferSize */
+  HIBYTE(DFU_RT_TRANSFER_SIZE),
+  0x10,   /* bcdDFUVersion: 1.1 */
+  0x01,
+  
+  /*HID control channel interface descriptor*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  HID_CTL_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x02,   /* bNumEndpoints: Two endpoints used */
+  0x03,   /* bInterfaceClass: HID */
+  0x00,   /* bInterfaceSubClass: no boot interface */
+  0x00,   /* bInterfaceProtocol: none */
+  0x00,   /* iInterface: */
+  
+  /*HID Descriptor*/
+  HID_CTL_DESC_SIZE,   /* bLength */
+  HID_CTL_DESCRIPTOR_TYPE,   /* bDescriptorType: HID */
+  0x11,   /* bcdHID: 1.11 */
+  0x01,
+  0x00,   /* bCountryCode: not localized */
+  0x01,   /* bNumDescriptors */
+  HID_CTL_REPORT_DESC_TYPE,   /* bDescriptorType: Report */
+  LOBYTE(HID_CTL_REPORT_DESC_SIZE),   /* wItemLength */
+  HIBYTE(HID_CTL_REPORT_DESC_SIZE),
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  HID_CTL_IN_EP,                      /* bEndpointAddress */
+  0x03,                              /* bmAttributes: Interrupt */
+  LOBYTE(HID_CTL_REPORT_SIZE),        /* wMaxPacketSize: */
+  HIBYTE(HID_CTL_REPORT_SIZE),
+  HID_CTL_POLL_INTERVAL,             /* bInterval: */
+  
+  /*Endpoint OUT Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  HID_CTL_OUT_EP,                     /* bEndpointAddress */
+  0x03,                              /* bmAttributes: Interrupt */
+  LOBYTE(HID_CTL_REPORT_SIZE),        /* wMaxPacketSize: */
+  HIBYTE(HID_CTL_REPORT_SIZE),
+  HID_CTL_POLL_INTERVAL,             /* bInterval: */
+  
+  /*Capture interface descriptor: no endpoint, no bandwidth*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  CAPTURE_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  CAPTURE_ALT_OFF,   /* bAlternateSetting: Alternate setting */
+  0x00,   /* bNumEndpoints: No endpoint used */
+  0xFF,   /* bInterfaceClass: Vendor specific */
+  0x00,   /* bInterfaceSubClass */
+  0x00,   /* bInterfaceProtocol */
+  0x00,   /* iInterface: */
+  
+  /*Capture interface descriptor: port X streaming*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  CAPTURE_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  CAPTURE_ALT_PORT_X,   /* bAlternateSetting: Alternate setting */
+  0x01,   /* bNumEndpoints: One endpoint used */
+  0xFF,   /* bInterfaceClass: Vendor specific */
+  0x00,   /* bInterfaceSubClass */
+  0x00,   /* bInterfaceProtocol */
+  0x00,   /* iInterface: */
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  CAPTURE_IN_EP,                      /* bEndpointAddress */
+  0x05,                              /* bmAttributes: Isochronous, asynchronous */
+  LOBYTE(CAPTURE_PACKET_SIZE),        /* wMaxPacketSize: */
+  HIBYTE(CAPTURE_PACKET_SIZE),
+  CAPTURE_INTERVAL,                  /* bInterval: */
+  
+  /*Capture interface descriptor: port Y streaming*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  CAPTURE_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  CAPTURE_ALT_PORT_Y,   /* bAlternateSetting: Alternate setting */
+  0x01,   /* bNumEndpoints: One endpoint used */
+  0xFF,   /* bInterfaceClass: Vendor specific */
+  0x00,   /* bInterfaceSubClass */
+  0x00,   /* bInterfaceProtocol */
+  0x00,   /* iInterface: */
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  CAPTURE_IN_EP,                      /* bEndpointAddress */
+  0x05,                              /* bmAttributes: Isochronous, asynchronous */
+  LOBYTE(CAPTURE_PACKET_SIZE),        /* wMaxPacketSize: */
+  HIBYTE(CAPTURE_PACKET_SIZE),
+  CAPTURE_INTERVAL,                  /* bInterval: */
+#if (USBD_STATUS_DRIVE == 1)
+  
+  /*Status drive interface descriptor*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
+  MSC_DRIVE_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x02,   /* bNumEndpoints: Two endpoints used */
+  0x08,   /* bInterfaceClass: Mass Storage */
+  0x06,   /* bInterfaceSubClass: SCSI transparent */
+  0x50,   /* bInterfaceProtocol: Bulk-Only Transport */
+  0x00,   /* iInterface: */
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  MSC_EPIN_ADDR,                      /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(MSC_MAX_FS_PACKET),          /* wMaxPacketSize: */
+  HIBYTE(MSC_MAX_FS_PACKET),
+  0x00,                              /* bInterval: ignore for Bulk transfer */
+  
+  /*Endpoint OUT Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  MSC_EPOUT_ADDR,                     /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(MSC_MAX_FS_PACKET),          /* wMaxPacketSize: */
+  HIBYTE(MSC_MAX_FS_PACKET),
+  0x00,                              /* bInterval: ignore for Bulk transfer */
+#endif
 };
 
 /**
@@ -786,76 +1320,53 @@ static uint8_t  USBD_CDC_Init (USBD_HandleTypeDef *pdev,
                                uint8_t cfgidx)
 {
   uint8_t ret = 0;
+  uint8_t port;
   USBD_CDC_HandleTypeDef   *hcdc;
   USBD_CDC_ItfTypeDef   **icdc = (USBD_CDC_ItfTypeDef**) pdev->pUserData;
+  uint16_t packet = (pdev->dev_speed == USBD_SPEED_HIGH) ? CDC_DATA_HS_MAX_PACKET_SIZE : CDC_DATA_FS_MAX_PACKET_SIZE;
   
-  if(pdev->dev_speed == USBD_SPEED_HIGH  ) 
-  {  
-    /* Open EP1 IN */
-    USBD_LL_OpenEP(pdev,
-                   CDC_IN_EP1,
-                   USBD_EP_TYPE_BULK,
-                   CDC_DATA_HS_IN_PACKET_SIZE);
-    
-    /* Open EP1 OUT */
-    USBD_LL_OpenEP(pdev,
-                   CDC_OUT_EP1,
-                   USBD_EP_TYPE_BULK,
-                   CDC_DATA_HS_OUT_PACKET_SIZE);
-    
-    /* Open EP2 IN */
-    USBD_LL_OpenEP(pdev,
-                   CDC_IN_EP2,
-                   USBD_EP_TYPE_BULK,
-                   CDC_DATA_HS_IN_PACKET_SIZE);
-    
-    /* Open EP2 OUT */
-    USBD_LL_OpenEP(pdev,
-                   CDC_OUT_EP2,
-                   USBD_EP_TYPE_BULK,
-                   CDC_DATA_HS_OUT_PACKET_SIZE);
-    
-  }
-  else
+  for (port = 0; port < CDC_PORT_COUNT; port++)
   {
-    /* Open EP1 IN */
-    USBD_LL_OpenEP(pdev,
-                   CDC_IN_EP1,
-                   USBD_EP_TYPE_BULK,
-                   CDC_DATA_FS_IN_PACKET_SIZE);
-    
-    /* Open EP1 OUT */
+    /* Open data IN and OUT endpoints */
     USBD_LL_OpenEP(pdev,
-                   CDC_OUT_EP1,
+                   USBD_CDC_Port[port].InEp,
                    USBD_EP_TYPE_BULK,
-                   CDC_DATA_FS_OUT_PACKET_SIZE);
+                   packet);
     
-    /* Open EP2 IN */
     USBD_LL_OpenEP(pdev,
-                   CDC_IN_EP2,
+                   USBD_CDC_Port[port].OutEp,
                    USBD_EP_TYPE_BULK,
-                   CDC_DATA_FS_IN_PACKET_SIZE);
+                   packet);
     
-    /* Open EP2 OUT */
+    /* Open Command IN endpoint */
     USBD_LL_OpenEP(pdev,
-                   CDC_OUT_EP2,
-                   USBD_EP_TYPE_BULK,
-                   CDC_DATA_FS_OUT_PACKET_SIZE);
-    
+                   USBD_CDC_Port[port].CmdEp,
+                   USBD_EP_TYPE_INTR,
+                   CDC_CMD_PACKET_SIZE);
   }
-  /* Open Command IN EP1 */
+  
+  /* Open the control channel endpoints */
   USBD_LL_OpenEP(pdev,
-                 CDC_CMD_EP1,
+                 HID_CTL_IN_EP,
                  USBD_EP_TYPE_INTR,
-                 CDC_CMD_PACKET_SIZE);
+                 HID_CTL_REPORT_SIZE);
   
-  /* Open Command IN EP2 */
   USBD_LL_OpenEP(pdev,
-                 CDC_CMD_EP2,
+                 HID_CTL_OUT_EP,
                  USBD_EP_TYPE_INTR,
-                 CDC_CMD_PACKET_SIZE);
+                 HID_CTL_REPORT_SIZE);
   
-  pdev->pClassData = USBD_malloc(2 * sizeof (USBD_CDC_HandleTypeDef));
+  /* The capture endpoint opens with its alternate setting */
+  CaptureAlt = CAPTURE_ALT_OFF;
+  CaptureBusy = 0;
+  
+  DfuState = DFU_RT_STATE_APP_IDLE;
+  CtlOwed = CDC_PORT_NONE;
+  HidInBusy = 0;
+  HidIdle = 0;
+  HidProtocol = 1;
+  
+  pdev->pClassData = USBD_malloc(USBD_CDC_CLASS_DATA_SIZE);
   
   if(pdev->pClassData == NULL)
   {
@@ -865,44 +1376,37 @@ static uint8_t  USBD_CDC_Init (USBD_HandleTypeDef *pdev,
   {
     hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
     
-    /* Init  physical Interface components */
-    icdc[0]->Init();
-    icdc[1]->Init();
-    
-    /* Init Xfer states */
-    hcdc[0].TxState =0;
-    hcdc[0].RxState =0;
-    hcdc[1].TxState =0;
-    hcdc[1].RxState =0;
-    
-    if(pdev->dev_speed == USBD_SPEED_HIGH  ) 
+    for (port = 0; port < CDC_PORT_COUNT; port++)
     {
-      /* Prepare Out endpoint1 to receive next packet */
-      USBD_LL_PrepareReceive(pdev,
-                             CDC_OUT_EP1,
-                             hcdc[0].RxBuffer,
-                             CDC_DATA_HS_OUT_PACKET_SIZE);
+      /* Init  physical Interface components */
+      icdc[port]->Init();
+      
+      /* Init Xfer states */
+      hcdc[port].TxState =0;
+      hcdc[port].RxState =0;
+      hcdc[port].NotifyState =0;
       
-      /* Prepare Out endpoint2 to receive next packet */
+      /* Prepare Out endpoint to receive next packet */
       USBD_LL_PrepareReceive(pdev,
-                             CDC_OUT_EP2,
-                             hcdc[1].RxBuffer,
-                             CDC_DATA_HS_OUT_PACKET_SIZE);
+                             USBD_CDC_Port[port].OutEp,
+                             hcdc[port].RxBuffer,
+                             packet);
     }
-    else
+    
+    USBD_LL_PrepareReceive(pdev,
+                           HID_CTL_OUT_EP,
+                           (uint8_t *)HidOutReport,
+                           HID_CTL_REPORT_SIZE);
+    
+#if (USBD_STATUS_DRIVE == 1)
+    /* The BOT handle comes after the CDC handles in the arena */
+    if (MscUserData != NULL)
     {
-      /* Prepare Out endpoint1 to receive next packet */
-      USBD_LL_PrepareReceive(pdev,
-                             CDC_OUT_EP1,
-                             hcdc[0].RxBuffer,
-                             CDC_DATA_FS_OUT_PACKET_SIZE);
-      
-      /* Prepare Out endpoint2 to receive next packet */
-      USBD_LL_PrepareReceive(pdev,
-                             CDC_OUT_EP2,
-                             hcdc[1].RxBuffer,
-                             CDC_DATA_FS_OUT_PACKET_SIZE);
+      USBD_CDC_MscSwap(pdev);
+      ret = USBD_MSC.Init(pdev, cfgidx);
+      USBD_CDC_MscSwap(pdev);
     }
+#endif
   }
   return ret;
 }
@@ -918,37 +1422,56 @@ static uint8_t  USBD_CDC_DeInit (USBD_HandleTypeDef *pdev,
                                  uint8_t cfgidx)
 {
   uint8_t ret = 0;
+  uint8_t port;
   USBD_CDC_ItfTypeDef   **icdc = (USBD_CDC_ItfTypeDef**) pdev->pUserData;
   
-  /* Close EP1 IN */
-  USBD_LL_CloseEP(pdev,
-                  CDC_IN_EP1);
-  
-  /* Close EP1 OUT */
-  USBD_LL_CloseEP(pdev,
-                  CDC_OUT_EP1);
+  /* Close data IN, data OUT and Command IN endpoints */
+  for (port = 0; port < CDC_PORT_COUNT; port++)
+  {
+    USBD_LL_CloseEP(pdev,
+                    USBD_CDC_Port[port].InEp);
+    
+    USBD_LL_CloseEP(pdev,
+                    USBD_CDC_Port[port].OutEp);
+    
+    USBD_LL_CloseEP(pdev,
+                    USBD_CDC_Port[port].CmdEp);
+  }
   
-  /* Close Command IN EP1 */
   USBD_LL_CloseEP(pdev,
-                  CDC_CMD_EP1);
+                  HID_CTL_IN_EP);
   
-  /* Close EP2 IN */
   USBD_LL_CloseEP(pdev,
-                  CDC_IN_EP2);
+                  HID_CTL_OUT_EP);
   
-  /* Close EP2 OUT */
-  USBD_LL_CloseEP(pdev,
-                  CDC_OUT_EP2);
+  if (CaptureAlt != CAPTURE_ALT_OFF)
+  {
+    USBD_LL_CloseEP(pdev,
+                    CAPTURE_IN_EP);
+    CaptureAlt = CAPTURE_ALT_OFF;
+    if (icdc[0]->Capture != NULL)
+    {
+      icdc[0]->Capture(CAPTURE_ALT_OFF);
+    }
+  }
   
-  /* Close Command IN EP2 */
-  USBD_LL_CloseEP(pdev,
-                  CDC_CMD_EP2);
+#if (USBD_STATUS_DRIVE == 1)
+  /* Freed first, the arena releases in reverse order */
+  if (MscClassData != NULL)
+  {
+    USBD_CDC_MscSwap(pdev);
+    USBD_MSC.DeInit(pdev, cfgidx);
+    USBD_CDC_MscSwap(pdev);
+  }
+#endif
   
   /* DeInit  physical Interface components */
   if(pdev->pClassData != NULL)
   {
-    icdc[0]->DeInit();
-    icdc[1]->DeInit();
+    for (port = 0; port < CDC_PORT_COUNT; port++)
+    {
+      icdc[port]->DeInit();
+    }
     USBD_free(pdev->pClassData);
     pdev->pClassData = NULL;
   }
@@ -969,77 +1492,94 @@ static uint8_t  USBD_CDC_Setup (USBD_HandleTypeDef *pdev,
   USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
   USBD_CDC_ItfTypeDef   **icdc = (USBD_CDC_ItfTypeDef**) pdev->pUserData;
   static uint8_t ifalt = 0;
+  uint8_t port;
+  uint8_t status;
   
-  CurrentwIndx = req->wIndex;
+  /* A new request ends the one whose answer is owed */
+  CtlOwed = CDC_PORT_NONE;
   
   switch (req->bmRequest & USB_REQ_TYPE_MASK)
   {
+  /* Vendor requests go through the same port Control callback */
+  case USB_REQ_TYPE_VENDOR :
   case USB_REQ_TYPE_CLASS :
-    if (req->wLength)
+    if (((req->bmRequest & USB_REQ_TYPE_MASK) == USB_REQ_TYPE_CLASS) &&
+        (req->wIndex == DFU_RT_INTERFACE))
     {
-      if (req->bmRequest & 0x80)
-      {
-        if(req->wIndex == CDC_CMD_INTERFACE_1)
-        {
-          icdc[0]->Control(req->bRequest,
-                           (uint8_t *)hcdc[0].data,
-                           req->wLength);
-          USBD_CtlSendData (pdev, 
-                            (uint8_t *)hcdc[0].data,
-                            req->wLength);
-        }
-        else if (req->wIndex == CDC_CMD_INTERFACE_2)
+      return USBD_CDC_DfuSetup(pdev, req);
+    }
+    if (((req->bmRequest & USB_REQ_TYPE_MASK) == USB_REQ_TYPE_CLASS) &&
+        (req->wIndex == HID_CTL_INTERFACE))
+    {
+      return USBD_CDC_HidSetup(pdev, req);
+    }
+#if (USBD_STATUS_DRIVE == 1)
+    if (((req->bmRequest & USB_REQ_TYPE_MASK) == USB_REQ_TYPE_CLASS) &&
+        (req->wIndex == MSC_DRIVE_INTERFACE))
+    {
+      return USBD_CDC_MscSetup(pdev, req);
+    }
+#endif
+    
+    port = CDC_ITF_PORT(req->wIndex);
+    if (port == CDC_PORT_NONE)
+    {
+      USBD_CtlError (pdev, req);
+      return USBD_FAIL;
+    }
+    CurrentPort = port;
+    
+    /* The data stage goes through the command buffer of the port */
+    if (req->wLength > sizeof (hcdc[port].data))
+    {
+      USBD_CtlError (pdev, req);
+      return USBD_FAIL;
+    }
+    
+    if (req->wLength)
+    {
+      if (req->bmRequest & 0x80)
+      {
+        /* wValue where the requests without data have it */
+        ((uint8_t *)hcdc[port].data)[2] = LOBYTE(req->wValue);
+        ((uint8_t *)hcdc[port].data)[3] = HIBYTE(req->wValue);
+        status = icdc[port]->Control(req->bRequest,
+                                     (uint8_t *)hcdc[port].data,
+                                     req->wLength);
+        if (status == USBD_BUSY)
         {
-          icdc[1]->Control(req->bRequest,
-                           (uint8_t *)hcdc[1].data,
-                           req->wLength);
-          USBD_CtlSendData (pdev, 
-                            (uint8_t *)hcdc[1].data,
-                            req->wLength);
+          /* The endpoint NAKs the data stage until USBD_CDC_CtlReply */
+          CtlOwed = port;
+          CtlOwedLength = req->wLength;
+          break;
         }
-        else
+        if (status != USBD_OK)
         {
-          //ERROR//
+          USBD_CtlError (pdev, req);
+          return USBD_FAIL;
         }
+        USBD_CtlSendData (pdev, 
+                          (uint8_t *)hcdc[port].data,
+                          req->wLength);
       }
       else
       {
-        if(req->wIndex == CDC_CMD_INTERFACE_1)
-        {
-          hcdc[0].CmdOpCode = req->bRequest;
-          hcdc[0].CmdLength = req->wLength;
-          USBD_CtlPrepareRx (pdev, 
-                             (uint8_t *)hcdc[0].data,
-                             req->wLength);
-        }
-        else if(req->wIndex == CDC_CMD_INTERFACE_2)
-        {
-          hcdc[1].CmdOpCode = req->bRequest;
-          hcdc[1].CmdLength = req->wLength;
-          USBD_CtlPrepareRx (pdev, 
-                             (uint8_t *)hcdc[1].data,
-                             req->wLength);
-        }
-        else
-        {
-          // ERROR
-        }
+        hcdc[port].CmdOpCode = req->bRequest;
+        hcdc[port].CmdLength = req->wLength;
+        USBD_CtlPrepareRx (pdev, 
+                           (uint8_t *)hcdc[port].data,
+                           req->wLength);
       }
       
     }
     else
     {
-      if(req->wIndex == CDC_CMD_INTERFACE_1)
+      if (icdc[port]->Control(req->bRequest,
+                              (uint8_t*)req,
+                              0) != USBD_OK)
       {
-        icdc[0]->Control(req->bRequest,
-                         (uint8_t*)req,
-                         0);
-      }
-      else
-      {
-        icdc[1]->Control(req->bRequest,
-                         (uint8_t*)req,
-                         0);
+        USBD_CtlError (pdev, req);
+        return USBD_FAIL;
       }
     }
     break;
@@ -1047,14 +1587,55 @@ static uint8_t  USBD_CDC_Setup (USBD_HandleTypeDef *pdev,
   case USB_REQ_TYPE_STANDARD:
     switch (req->bRequest)
     {      
+    case USB_REQ_GET_DESCRIPTOR :
+      if (req->wIndex != HID_CTL_INTERFACE)
+      {
+        USBD_CtlError (pdev, req);
+        return USBD_FAIL;
+      }
+      if ((req->wValue >> 8) == HID_CTL_REPORT_DESC_TYPE)
+      {
+        USBD_CtlSendData (pdev,
+                          (uint8_t *)USBD_CDC_HidReportDesc,
+                          MIN(req->wLength, HID_CTL_REPORT_DESC_SIZE));
+      }
+      else if ((req->wValue >> 8) == HID_CTL_DESCRIPTOR_TYPE)
+      {
+        USBD_CtlSendData (pdev,
+                          &USBD_CDC_CfgFSDesc[HID_CTL_DESC_OFFSET],
+                          MIN(req->wLength, HID_CTL_DESC_SIZE));
+      }
+      else
+      {
+        USBD_CtlError (pdev, req);
+        return USBD_FAIL;
+      }
+      break;
+      
     case USB_REQ_GET_INTERFACE :
       USBD_CtlSendData (pdev,
-                        &ifalt,
+                        (req->wIndex == CAPTURE_INTERFACE) ? &CaptureAlt : &ifalt,
                         1);
       break;
       
     case USB_REQ_SET_INTERFACE :
+      if (req->wIndex == CAPTURE_INTERFACE)
+      {
+        return USBD_CDC_SetCapture(pdev, req);
+      }
+      break;
+      
+#if (USBD_STATUS_DRIVE == 1)
+    /* The halt of a drive endpoint cleared by the host ends the BOT error
+       recovery */
+    case USB_REQ_CLEAR_FEATURE :
+      if (((req->bmRequest & USB_REQ_RECIPIENT_MASK) == USB_REQ_RECIPIENT_ENDPOINT) &&
+          ((req->wIndex & 0x7F) == (MSC_EPIN_ADDR & 0x7F)))
+      {
+        return USBD_CDC_MscSetup(pdev, req);
+      }
       break;
+#endif
     }
     
   default: 
@@ -1063,6 +1644,187 @@ static uint8_t  USBD_CDC_Setup (USBD_HandleTypeDef *pdev,
   return USBD_OK;
 }
 
+/**
+* @brief  USBD_CDC_DfuSetup
+*         Handle the requests of the DFU runtime interface: the application
+*         leaves for the loader on DFU_DETACH.
+* @param  pdev: instance
+* @param  req: usb requests
+* @retval status
+*/
+static uint8_t  USBD_CDC_DfuSetup (USBD_HandleTypeDef *pdev, 
+                                   USBD_SetupReqTypedef *req)
+{
+  USBD_CDC_ItfTypeDef   **icdc = (USBD_CDC_ItfTypeDef**) pdev->pUserData;
+  
+  switch (req->bRequest)
+  {
+  case DFU_RT_DETACH:
+    if ((icdc[0]->Detach == NULL) || (icdc[0]->Detach(req->wValue) != USBD_OK))
+    {
+      USBD_CtlError (pdev, req);
+      return USBD_FAIL;
+    }
+    DfuState = DFU_RT_STATE_APP_DETACH;
+    break;
+    
+  case DFU_RT_GETSTATUS:
+    DfuStatus[0] = 0x00;       /* bStatus: OK */
+    DfuStatus[1] = 0x00;       /* bwPollTimeout */
+    DfuStatus[2] = 0x00;
+    DfuStatus[3] = 0x00;
+    DfuStatus[4] = DfuState;   /* bState */
+    DfuStatus[5] = 0x00;       /* iString */
+    USBD_CtlSendData (pdev,
+                      DfuStatus,
+                      MIN(req->wLength, DFU_RT_STATUS_SIZE));
+    break;
+    
+  case DFU_RT_GETSTATE:
+    USBD_CtlSendData (pdev,
+                      &DfuState,
+                      1);
+    break;
+    
+  default:
+    USBD_CtlError (pdev, req);
+    return USBD_FAIL;
+  }
+  
+  return USBD_OK;
+}
+
+/**
+* @brief  USBD_CDC_HidSetup
+*         Handle the class requests of the HID control channel. The reports
+*         only travel on the interrupt endpoints; idle rate and protocol are
+*         kept for the host to read back.
+* @param  pdev: instance
+* @param  req: usb requests
+* @retval status
+*/
+static uint8_t  USBD_CDC_HidSetup (USBD_HandleTypeDef *pdev, 
+                                   USBD_SetupReqTypedef *req)
+{
+  switch (req->bRequest)
+  {
+  case HID_CTL_REQ_SET_IDLE:
+    HidIdle = (uint8_t)(req->wValue >> 8);
+    break;
+    
+  case HID_CTL_REQ_GET_IDLE:
+    USBD_CtlSendData (pdev,
+                      &HidIdle,
+                      1);
+    break;
+    
+  case HID_CTL_REQ_SET_PROTOCOL:
+    HidProtocol = (uint8_t)(req->wValue);
+    break;
+    
+  case HID_CTL_REQ_GET_PROTOCOL:
+    USBD_CtlSendData (pdev,
+                      &HidProtocol,
+                      1);
+    break;
+    
+  default:
+    USBD_CtlError (pdev, req);
+    return USBD_FAIL;
+  }
+  
+  return USBD_OK;
+}
+
+/**
+* @brief  USBD_CDC_SetCapture
+*         Select an alternate setting of the capture interface: the
+*         isochronous endpoint is only open while a port streams, so that
+*         the bandwidth is only reserved then.
+* @param  pdev: instance
+* @param  req: SET_INTERFACE request, wValue = CAPTURE_ALT_xxx
+* @retval status
+*/
+static uint8_t  USBD_CDC_SetCapture (USBD_HandleTypeDef *pdev, 
+                                     USBD_SetupReqTypedef *req)
+{
+  USBD_CDC_ItfTypeDef   **icdc = (USBD_CDC_ItfTypeDef**) pdev->pUserData;
+  uint8_t alt = (uint8_t)(req->wValue);
+  
+  if ((req->wValue >= CAPTURE_ALT_COUNT) || (icdc[0]->Capture == NULL) ||
+      (icdc[0]->Capture(alt) != USBD_OK))
+  {
+    USBD_CtlError (pdev, req);
+    return USBD_FAIL;
+  }
+  
+  if (CaptureAlt != CAPTURE_ALT_OFF)
+  {
+    USBD_LL_CloseEP(pdev,
+                    CAPTURE_IN_EP);
+  }
+  if (alt != CAPTURE_ALT_OFF)
+  {
+    USBD_LL_OpenEP(pdev,
+                   CAPTURE_IN_EP,
+                   USBD_EP_TYPE_ISOC,
+                   CAPTURE_PACKET_SIZE);
+  }
+  
+  CaptureAlt = alt;
+  CaptureBusy = 0;
+  
+  return USBD_OK;
+}
+
+#if (USBD_STATUS_DRIVE == 1)
+/**
+* @brief  USBD_CDC_MscSetup
+*         Hand a request of the status drive to the MSC class: GET_MAX_LUN,
+*         BOT reset or the clear of an endpoint halt.
+* @param  pdev: instance
+* @param  req: usb requests
+* @retval status
+*/
+static uint8_t  USBD_CDC_MscSetup (USBD_HandleTypeDef *pdev, 
+                                   USBD_SetupReqTypedef *req)
+{
+  uint8_t ret;
+  
+  if (MscClassData == NULL)
+  {
+    USBD_CtlError (pdev, req);
+    return USBD_FAIL;
+  }
+  
+  USBD_CDC_MscSwap(pdev);
+  ret = USBD_MSC.Setup(pdev, req);
+  USBD_CDC_MscSwap(pdev);
+  
+  return ret;
+}
+
+/**
+* @brief  USBD_CDC_MscSwap
+*         Exchange the class and user data of CDC with those of the MSC
+*         class, before a call into it and again after. The class is only
+*         called from the USB interrupt, which nothing else using the
+*         device handle preempts.
+* @param  pdev: instance
+* @retval None
+*/
+static void  USBD_CDC_MscSwap (USBD_HandleTypeDef *pdev)
+{
+  void *data = pdev->pClassData;
+  void *user = pdev->pUserData;
+  
+  pdev->pClassData = MscClassData;
+  pdev->pUserData = MscUserData;
+  MscClassData = data;
+  MscUserData = user;
+}
+#endif
+
 /**
 * @brief  USBD_CDC_DataIn
 *         Data sent on non-control IN endpoint
@@ -1073,31 +1835,59 @@ static uint8_t  USBD_CDC_Setup (USBD_HandleTypeDef *pdev,
 static uint8_t  USBD_CDC_DataIn (USBD_HandleTypeDef *pdev, uint8_t epnum)
 {
   USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
+  USBD_CDC_ItfTypeDef   **icdc = (USBD_CDC_ItfTypeDef**) pdev->pUserData;
+  uint8_t port = CDC_EP_PORT(epnum);
   
-  if(pdev->pClassData != NULL)
+  if ((pdev->pClassData != NULL) && ((epnum | 0x80) == HID_CTL_IN_EP))
   {
-    switch (epnum|0x80)
+    /* The application may send the next report right away */
+    HidInBusy = 0;
+    if (icdc[0]->Report != NULL)
     {
-    case CDC_IN_EP1:
-    case CDC_CMD_EP1:
-      hcdc[0].TxState = 0;
-      break;
-      
-    case CDC_IN_EP2:
-    case CDC_CMD_EP2:
-      hcdc[1].TxState = 0;
-      break;
-      
-    default: 
-      break;
+      icdc[0]->Report(NULL, 0);
     }
-    
     return USBD_OK;
   }
-  else
+  
+  if ((epnum | 0x80) == CAPTURE_IN_EP)
+  {
+    /* The packet of the frame is taken, the next start of frame sends
+       another one */
+    CaptureBusy = 0;
+    return USBD_OK;
+  }
+  
+#if (USBD_STATUS_DRIVE == 1)
+  if ((MscClassData != NULL) && ((epnum | 0x80) == MSC_EPIN_ADDR))
+  {
+    USBD_CDC_MscSwap(pdev);
+    USBD_MSC.DataIn(pdev, epnum);
+    USBD_CDC_MscSwap(pdev);
+    return USBD_OK;
+  }
+#endif
+  
+  if((pdev->pClassData == NULL) || (port == CDC_PORT_NONE))
   {
     return USBD_FAIL;
   }
+  
+  if ((epnum | 0x80) == USBD_CDC_Port[port].CmdEp)
+  {
+    hcdc[port].NotifyState = 0;
+  }
+  else
+  {
+    hcdc[port].TxState = 0;
+    
+    /* The application may start the next transfer right away */
+    if (icdc[port]->TransmitCplt != NULL)
+    {
+      icdc[port]->TransmitCplt(hcdc[port].TxBuffer, &hcdc[port].TxLength, epnum);
+    }
+  }
+  
+  return USBD_OK;
 }
 
 /**
@@ -1111,48 +1901,46 @@ static uint8_t  USBD_CDC_DataOut (USBD_HandleTypeDef *pdev, uint8_t epnum)
 {      
   USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
   USBD_CDC_ItfTypeDef   **icdc = (USBD_CDC_ItfTypeDef**) pdev->pUserData;
+  uint8_t port = CDC_EP_PORT(epnum);
   
-  /* Get the received data length */
-  switch (epnum)
+  if ((pdev->pClassData != NULL) && (epnum == HID_CTL_OUT_EP))
   {
-  case CDC_OUT_EP1:
-    USBD_CDC_SetRxBuffer(pdev, UserRxBuffer[0], epnum);
-    hcdc[0].RxLength = USBD_LL_GetRxDataSize (pdev, epnum);
-    break;
-    
-  case CDC_OUT_EP2:
-    USBD_CDC_SetRxBuffer(pdev, UserRxBuffer[1], epnum);
-    hcdc[1].RxLength = USBD_LL_GetRxDataSize (pdev, epnum);
-    break;
-    
-  default: 
-    break;
+    /* The report is handled at once, the endpoint takes the next one */
+    if (icdc[0]->Report != NULL)
+    {
+      icdc[0]->Report((uint8_t *)HidOutReport, USBD_LL_GetRxDataSize (pdev, epnum));
+    }
+    USBD_LL_PrepareReceive(pdev,
+                           HID_CTL_OUT_EP,
+                           (uint8_t *)HidOutReport,
+                           HID_CTL_REPORT_SIZE);
+    return USBD_OK;
   }
   
-  /* USB data will be immediately processed, this allow next USB traffic being 
-  NAKed till the end of the application Xfer */
-  if(pdev->pClassData != NULL)
+#if (USBD_STATUS_DRIVE == 1)
+  if ((MscClassData != NULL) && (epnum == MSC_EPOUT_ADDR))
   {
-    switch (epnum)
-    {
-    case CDC_OUT_EP1:
-      icdc[0]->Receive(hcdc[0].RxBuffer, &(hcdc[0].RxLength));
-      break;
-      
-    case CDC_OUT_EP2:
-      icdc[1]->Receive(hcdc[1].RxBuffer, &(hcdc[1].RxLength));
-      break;
-      
-    default: 
-      break;
-    }
-    
+    USBD_CDC_MscSwap(pdev);
+    USBD_MSC.DataOut(pdev, epnum);
+    USBD_CDC_MscSwap(pdev);
     return USBD_OK;
   }
-  else
+#endif
+  
+  if((pdev->pClassData == NULL) || (port == CDC_PORT_NONE))
   {
     return USBD_FAIL;
   }
+  
+  /* Get the received data length */
+  hcdc[port].RxBuffer = UserRxBuffer[port];
+  hcdc[port].RxLength = USBD_LL_GetRxDataSize (pdev, epnum);
+  
+  /* USB data will be immediately processed, this allow next USB traffic being 
+  NAKed till the end of the application Xfer */
+  icdc[port]->Receive(hcdc[port].RxBuffer, &(hcdc[port].RxLength));
+  
+  return USBD_OK;
 }
 
 
@@ -1167,30 +1955,67 @@ static uint8_t  USBD_CDC_EP0_RxReady (USBD_HandleTypeDef *pdev)
 { 
   USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
   USBD_CDC_ItfTypeDef   **icdc = (USBD_CDC_ItfTypeDef**) pdev->pUserData;
+  uint8_t port = CurrentPort;
   
-  if (CurrentwIndx == CDC_CMD_INTERFACE_1)
+  if ((port != CDC_PORT_NONE) && (icdc[port] != NULL) && (hcdc[port].CmdOpCode != 0xFF))
   {
-    if((icdc[0] != NULL) && (hcdc[0].CmdOpCode != 0xFF))
-    {
-      icdc[0]->Control(hcdc[0].CmdOpCode,
-                       (uint8_t *)hcdc[0].data,
-                       hcdc[0].CmdLength);
-      hcdc[0].CmdOpCode = 0xFF;
-    }
+    icdc[port]->Control(hcdc[port].CmdOpCode,
+                        (uint8_t *)hcdc[port].data,
+                        hcdc[port].CmdLength);
+    hcdc[port].CmdOpCode = 0xFF;
   }
-  else if (CurrentwIndx == CDC_CMD_INTERFACE_2)
+  
+  return USBD_OK;
+}
+
+/**
+* @brief  USBD_CDC_SOF
+*         Start of frame, every ms: the clock of the HID control channel and
+*         of the capture packets.
+* @param  pdev: device instance
+* @retval status
+*/
+static uint8_t  USBD_CDC_SOF (USBD_HandleTypeDef *pdev)
+{
+  USBD_CDC_ItfTypeDef   **icdc = (USBD_CDC_ItfTypeDef**) pdev->pUserData;
+  
+  /* This device controller has no incomplete isochronous IN interrupt: a
+     capture packet still waiting at the start of frame missed its own */
+  if (CaptureBusy)
   {
-    if((icdc[1] != NULL) && (hcdc[1].CmdOpCode != 0xFF))
-    {
-      icdc[1]->Control(hcdc[1].CmdOpCode,
-                       (uint8_t *)hcdc[1].data,
-                       hcdc[1].CmdLength);
-      hcdc[1].CmdOpCode = 0xFF; 
-    }
+    USBD_CDC_IsoINIncomplete(pdev, CAPTURE_IN_EP & 0x7F);
   }
-  else
+  
+  if ((pdev->pClassData != NULL) && (icdc[0]->Sof != NULL))
+  {
+    icdc[0]->Sof();
+  }
+  
+  return USBD_OK;
+}
+
+/**
+* @brief  USBD_CDC_IsoINIncomplete
+*         A capture packet was not taken in its frame. It is given up: the
+*         next one replaces it in the same buffer, the gap shows in the
+*         frame numbers.
+* @param  pdev: device instance
+* @param  epnum: endpoint number
+* @retval status
+*/
+static uint8_t  USBD_CDC_IsoINIncomplete (USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+  USBD_CDC_ItfTypeDef   **icdc = (USBD_CDC_ItfTypeDef**) pdev->pUserData;
+  
+  if (((epnum | 0x80) != CAPTURE_IN_EP) || !CaptureBusy)
   {
-    //ERROR
+    return USBD_OK;
+  }
+  
+  CaptureBusy = 0;
+  if ((icdc[0]->Capture != NULL) && (CaptureAlt != CAPTURE_ALT_OFF))
+  {
+    icdc[0]->Capture(CAPTURE_MISSED);
   }
   
   return USBD_OK;
@@ -1257,9 +2082,10 @@ uint8_t  USBD_CDC_RegisterInterface  (USBD_HandleTypeDef   *pdev,
                                       USBD_CDC_ItfTypeDef *fops)
 {
   uint8_t  ret = USBD_FAIL;
+  uint8_t  port;
   USBD_CDC_ItfTypeDef **icdc;
   
-  pdev->pUserData = USBD_malloc(2 * sizeof (USBD_CDC_ItfTypeDef*));
+  pdev->pUserData = USBD_malloc(USBD_CDC_USER_DATA_SIZE);
   
   if(pdev->pUserData == NULL)
   {
@@ -1269,14 +2095,36 @@ uint8_t  USBD_CDC_RegisterInterface  (USBD_HandleTypeDef   *pdev,
   {
     icdc = (USBD_CDC_ItfTypeDef**) pdev->pUserData;
     
-    icdc[0] = &fops[0];
-    icdc[1] = &fops[1];
+    for (port = 0; port < CDC_PORT_COUNT; port++)
+    {
+      icdc[port] = &fops[port];
+    }
     ret = USBD_OK;    
   }
   
   return ret;
 }
 
+#if (USBD_STATUS_DRIVE == 1)
+/**
+* @brief  USBD_CDC_RegisterStorage
+*         Give the storage of the status drive, before the device starts
+* @param  pdev: device instance
+* @param  fops: storage callbacks
+* @retval status
+*/
+uint8_t  USBD_CDC_RegisterStorage  (USBD_HandleTypeDef   *pdev, 
+                                    USBD_StorageTypeDef *fops)
+{
+  if (fops == NULL)
+  {
+    return USBD_FAIL;
+  }
+  MscUserData = fops;
+  return USBD_OK;
+}
+#endif
+
 /**
 * @brief  USBD_CDC_SetTxBuffer
 * @param  pdev: device instance
@@ -1291,22 +2139,16 @@ uint8_t  USBD_CDC_SetTxBuffer  (USBD_HandleTypeDef   *pdev,
                                 uint8_t  epnum)
 {
   USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
+  uint8_t port = CDC_EP_PORT(epnum);
   
-  if (epnum == CDC_IN_EP1)
+  if (port == CDC_PORT_NONE)
   {
-    hcdc[0].TxBuffer = pbuff;
-    hcdc[0].TxLength = length;
-  }
-  else if (epnum == CDC_IN_EP2)
-  {
-    hcdc[1].TxBuffer = pbuff;
-    hcdc[1].TxLength = length;
-  }
-  else
-  {
-    //ERROR
+    return USBD_FAIL;
   }
   
+  hcdc[port].TxBuffer = pbuff;
+  hcdc[port].TxLength = length;
+  
   return USBD_OK;  
 }
 
@@ -1323,76 +2165,100 @@ uint8_t  USBD_CDC_SetRxBuffer  (USBD_HandleTypeDef   *pdev,
                                 uint8_t   epnum)
 {
   USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
+  uint8_t port = CDC_EP_PORT(epnum);
   
-  if (epnum == CDC_OUT_EP1)
+  if (port == CDC_PORT_NONE)
   {
-    hcdc[0].RxBuffer = pbuff;
+    return USBD_FAIL;
   }
-  else if (epnum == CDC_OUT_EP2)
+  
+  hcdc[port].RxBuffer = pbuff;
+  
+  return USBD_OK;
+}
+
+/**
+* @brief  USBD_CDC_TransmitPacket
+*         Start sending the Tx buffer on an IN endpoint
+* @param  pdev: device instance
+* @param  epnum: endpoint number
+* @retval status: USBD_BUSY while the previous transfer of the port is pending
+*/
+uint8_t  USBD_CDC_TransmitPacket(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+  USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
+  uint8_t port = CDC_EP_PORT(epnum);
+  
+  if((pdev->pClassData == NULL) || (port == CDC_PORT_NONE))
   {
-    hcdc[1].RxBuffer = pbuff;
+    return USBD_FAIL;
   }
-  else
+  
+  if(hcdc[port].TxState != 0)
   {
-    //ERROR
+    return USBD_BUSY;
   }
   
+  /* Tx Transfer in progress */
+  hcdc[port].TxState = 1;
+  
+  /* Transmit next packet */
+  USBD_LL_Transmit(pdev,
+                   USBD_CDC_Port[port].InEp,
+                   hcdc[port].TxBuffer,
+                   hcdc[port].TxLength);
+  
   return USBD_OK;
 }
 
+
 /**
-* @brief  USBD_CDC_DataOut
-*         Data received on non-control Out endpoint
+* @brief  USBD_CDC_NotifySerialState
+*         Send a SERIAL_STATE notification on the command endpoint of a port
 * @param  pdev: device instance
-* @param  epnum: endpoint number
-* @retval status
+* @param  Port: Port number
+* @param  SerialState: UART state bitmap (CDC_SERIAL_STATE_xxx)
+* @retval status: USBD_BUSY while the previous notification is pending
 */
-uint8_t  USBD_CDC_TransmitPacket(USBD_HandleTypeDef *pdev, uint8_t epnum)
+uint8_t  USBD_CDC_NotifySerialState(USBD_HandleTypeDef *pdev,
+                                    uint32_t Port,
+                                    uint16_t SerialState)
 {
   USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
+  uint8_t *buf;
   
-  if(pdev->pClassData != NULL)
+  if((pdev->pClassData == NULL) || (Port >= CDC_PORT_COUNT))
   {
-    if((hcdc[0].TxState != 0) && (hcdc[1].TxState != 0))
-    {
-      return USBD_BUSY;
-    }
-    else
-    {
-      if((epnum == CDC_IN_EP1) && (hcdc[0].TxState == 0))
-      {
-        /* Tx Transfer in progress */
-        hcdc[0].TxState = 1;
-        
-        /* Transmit next packet */
-        USBD_LL_Transmit(pdev,
-                         CDC_IN_EP1,
-                         hcdc[0].TxBuffer,
-                         hcdc[0].TxLength);
-      }
-      
-      if((epnum == CDC_IN_EP2) && (hcdc[1].TxState == 0))
-      {
-        /* Tx Transfer in progress */
-        hcdc[1].TxState = 1;
-        
-        /* Transmit next packet */      
-        USBD_LL_Transmit(pdev,
-                         CDC_IN_EP2,
-                         hcdc[1].TxBuffer,
-                         hcdc[1].TxLength);
-      }
-      
-      return USBD_OK;
-    }
+    return USBD_FAIL;
   }
-  else
+  
+  if(hcdc[Port].NotifyState != 0)
   {
-    return USBD_FAIL;
+    return USBD_BUSY;
   }
+  
+  buf = hcdc[Port].Notification;
+  buf[0] = 0xA1;                        /* bmRequestType: class, interface, device to host */
+  buf[1] = CDC_NOTIFICATION_SERIAL_STATE;
+  buf[2] = 0x00;                        /* wValue */
+  buf[3] = 0x00;
+  buf[4] = USBD_CDC_Port[Port].CmdItf;  /* wIndex */
+  buf[5] = 0x00;
+  buf[6] = 0x02;                        /* wLength */
+  buf[7] = 0x00;
+  buf[8] = LOBYTE(SerialState);
+  buf[9] = HIBYTE(SerialState);
+  
+  hcdc[Port].NotifyState = 1;
+  
+  USBD_LL_Transmit(pdev,
+                   USBD_CDC_Port[Port].CmdEp,
+                   buf,
+                   CDC_NOTIFICATION_SIZE);
+  
+  return USBD_OK;
 }
 
-
 /**
 * @brief  USBD_CDC_ReceivePacket
 *         prepare OUT Endpoint for reception
@@ -1405,52 +2271,111 @@ uint8_t  USBD_CDC_ReceivePacket(USBD_HandleTypeDef *pdev, uint32_t Port)
   USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
   
   /* Suspend or Resume USB Out process */
-  if(pdev->pClassData != NULL)
+  if((pdev->pClassData == NULL) || (Port >= CDC_PORT_COUNT))
   {
-    if(pdev->dev_speed == USBD_SPEED_HIGH  ) 
-    {      
-      if (Port == 0)
-      {
-        /* Prepare Out endpoint to receive next packet */
-        USBD_LL_PrepareReceive(pdev,
-                               CDC_OUT_EP1,
-                               hcdc[0].RxBuffer,
-                               CDC_DATA_HS_OUT_PACKET_SIZE);
-      }
-      else
-      {
-        USBD_LL_PrepareReceive(pdev,
-                               CDC_OUT_EP2,
-                               hcdc[1].RxBuffer,
-                               CDC_DATA_HS_OUT_PACKET_SIZE);
-      }
-    }
-    else
-    {
-      if (Port == 0)
-      {
-        /* Prepare Out endpoint to receive next packet */
-        USBD_LL_PrepareReceive(pdev,
-                               CDC_OUT_EP1,
-                               hcdc[0].RxBuffer,
-                               CDC_DATA_FS_OUT_PACKET_SIZE);
-      }
-      else
-      {
-        
-        /* Prepare Out endpoint to receive next packet */
-        USBD_LL_PrepareReceive(pdev,
-                               CDC_OUT_EP2,
-                               hcdc[1].RxBuffer,
-                               CDC_DATA_FS_OUT_PACKET_SIZE);
-      }
-    }
-    return USBD_OK;
+    return USBD_FAIL;
   }
-  else
+  
+  /* Prepare Out endpoint to receive next packet */
+  USBD_LL_PrepareReceive(pdev,
+                         USBD_CDC_Port[Port].OutEp,
+                         hcdc[Port].RxBuffer,
+                         (pdev->dev_speed == USBD_SPEED_HIGH) ? CDC_DATA_HS_OUT_PACKET_SIZE : CDC_DATA_FS_OUT_PACKET_SIZE);
+  
+  return USBD_OK;
+}
+
+/**
+* @brief  USBD_CDC_SendReport
+*         Send a report on the HID control channel.
+* @param  pdev: device instance
+* @param  report: report, copied to the endpoint at once
+* @param  len: report length
+* @retval status: USBD_BUSY while the previous report is not taken
+*/
+uint8_t  USBD_CDC_SendReport(USBD_HandleTypeDef *pdev,
+                             uint8_t *report,
+                             uint16_t len)
+{
+  if ((pdev->pClassData == NULL) || (pdev->dev_state != USBD_STATE_CONFIGURED))
+  {
+    return USBD_FAIL;
+  }
+  if (HidInBusy)
+  {
+    return USBD_BUSY;
+  }
+  
+  HidInBusy = 1;
+  USBD_LL_Transmit(pdev,
+                   HID_CTL_IN_EP,
+                   report,
+                   len);
+  
+  return USBD_OK;
+}
+
+/**
+* @brief  USBD_CDC_SendCapture
+*         Send the capture packet of the current frame.
+* @param  pdev: device instance
+* @param  packet: packet, copied to the endpoint at once
+* @param  len: packet length, below CAPTURE_PACKET_SIZE
+* @retval status: USBD_BUSY while the previous packet is not taken
+*/
+uint8_t  USBD_CDC_SendCapture(USBD_HandleTypeDef *pdev,
+                              uint8_t *packet,
+                              uint16_t len)
+{
+  if ((pdev->pClassData == NULL) || (CaptureAlt == CAPTURE_ALT_OFF) ||
+      (len >= CAPTURE_PACKET_SIZE))
   {
     return USBD_FAIL;
   }
+  if (CaptureBusy)
+  {
+    return USBD_BUSY;
+  }
+  
+  CaptureBusy = 1;
+  USBD_LL_Transmit(pdev,
+                   CAPTURE_IN_EP,
+                   packet,
+                   len);
+  
+  return USBD_OK;
+}
+
+/**
+* @brief  USBD_CDC_CtlReply
+*         Send the data stage of an IN request whose Control callback
+*         answered USBD_BUSY, from the command buffer of its port.
+* @param  pdev: device instance
+* @param  status: USBD_OK to send the data, else the request stalls
+* @retval status: USBD_FAIL when no answer is owed any more
+*/
+uint8_t  USBD_CDC_CtlReply(USBD_HandleTypeDef *pdev,
+                           uint8_t status)
+{
+  USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
+  uint8_t port = CtlOwed;
+  
+  if ((hcdc == NULL) || (port == CDC_PORT_NONE))
+  {
+    return USBD_FAIL;
+  }
+  
+  CtlOwed = CDC_PORT_NONE;
+  if (status != USBD_OK)
+  {
+    USBD_CtlError (pdev, NULL);
+    return USBD_OK;
+  }
+  USBD_CtlSendData (pdev,
+                    (uint8_t *)hcdc[port].data,
+                    CtlOwedLength);
+  
+  return USBD_OK;
 }
 
 /**
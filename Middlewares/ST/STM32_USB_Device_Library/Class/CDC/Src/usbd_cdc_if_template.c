@@ -71,13 +71,19 @@ static int8_t TEMPLATE_Init     (void);
 static int8_t TEMPLATE_DeInit   (void);
 static int8_t TEMPLATE_Control  (uint8_t cmd, uint8_t* pbuf, uint16_t length);
 static int8_t TEMPLATE_Receive  (uint8_t* pbuf, uint32_t *Len);
+static int8_t TEMPLATE_TransmitCplt (uint8_t* pbuf, uint32_t *Len, uint8_t epnum);
 
 USBD_CDC_ItfTypeDef USBD_CDC_Template_fops = 
 {
   TEMPLATE_Init,
   TEMPLATE_DeInit,
   TEMPLATE_Control,
-  TEMPLATE_Receive
+  TEMPLATE_Receive,
+  TEMPLATE_TransmitCplt,
+  NULL,                 /* No DFU runtime */
+  NULL,                 /* No HID control channel */
+  NULL,
+  NULL                  /* No capture interface */
 };
 
 USBD_CDC_LineCodingTypeDef linecoding =
@@ -210,6 +216,21 @@ static int8_t TEMPLATE_Receive (uint8_t* Buf, uint32_t *Len)
   return (0);
 }
 
+/**
+  * @brief  TEMPLATE_TransmitCplt
+  *         Data transmitted over the USB IN endpoint, the next transfer can
+  *         be started.
+  * @param  Buf: Buffer of data transmitted
+  * @param  Len: Number of data transmitted (in bytes)
+  * @param  epnum: endpoint number
+  * @retval Result of the operation: USBD_OK if all operations are OK else USBD_FAIL
+  */
+static int8_t TEMPLATE_TransmitCplt (uint8_t* Buf, uint32_t *Len, uint8_t epnum)
+{
+ 
+  return (0);
+}
+
 /**
   * @}
   */ 
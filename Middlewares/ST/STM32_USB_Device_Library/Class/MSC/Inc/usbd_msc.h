@@ -51,7 +51,11 @@
 /** @defgroup USBD_BOT_Exported_Defines
   * @{
   */ 
+/* The packet size and the endpoints may be set in usbd_conf.h, for a
+   composite device */
+#ifndef MSC_MAX_FS_PACKET
 #define MSC_MAX_FS_PACKET            0x40
+#endif
 #define MSC_MAX_HS_PACKET            0x200
 
 #define BOT_GET_MAX_LUN              0xFE
@@ -59,8 +63,10 @@
 #define USB_MSC_CONFIG_DESC_SIZ      32
  
 
+#ifndef MSC_EPIN_ADDR
 #define MSC_EPIN_ADDR                0x81 
 #define MSC_EPOUT_ADDR               0x01 
+#endif
 
 /**
   * @}
@@ -343,6 +343,12 @@ static int8_t SCSI_ModeSense6 (USBD_HandleTypeDef  *pdev, uint8_t lun, uint8_t *
     len--;
     hmsc->bot_data[len] = MSC_Mode_Sense6_data[len];
   }
+  
+  /* WP bit of the device specific parameter: the host mounts read-only */
+  if(((USBD_StorageTypeDef *)pdev->pUserData)->IsWriteProtected(lun) !=0 )
+  {
+    hmsc->bot_data[2] |= 0x80;
+  }
   return 0;
 }
 
@@ -365,6 +371,12 @@ static int8_t SCSI_ModeSense10 (USBD_HandleTypeDef  *pdev, uint8_t lun, uint8_t
     len--;
     hmsc->bot_data[len] = MSC_Mode_Sense10_data[len];
   }
+  
+  /* WP bit of the device specific parameter: the host mounts read-only */
+  if(((USBD_StorageTypeDef *)pdev->pUserData)->IsWriteProtected(lun) !=0 )
+  {
+    hmsc->bot_data[3] |= 0x80;
+  }
   return 0;
 }
 
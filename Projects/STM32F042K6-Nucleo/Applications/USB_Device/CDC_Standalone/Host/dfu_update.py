@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+"""Update the bridge firmware over USB with dfu-util.
+
+The bridge is sent DFU_DETACH on its DFU runtime interface, restarts in the
+DFU loader of its system memory (0483:df11), and the image is written at the
+start of the flash. The download time and rate are printed once it is over.
+
+usage: dfu_update.py firmware.bin [serial]
+"""
+
+import os
+import subprocess
+import sys
+import time
+
+BRIDGE_ID = '2a03:0052'
+LOADER_ID = '0483:df11'
+FLASH_ADDR = 0x08000000
+
+
+def dfu_util(args):
+    return subprocess.call(['dfu-util'] + args)
+
+
+def main(argv):
+    if len(argv) < 2:
+        sys.stderr.write(__doc__)
+        return 1
+
+    image = argv[1]
+    serial = ['-S', argv[2]] if len(argv) > 2 else []
+    size = os.path.getsize(image)
+
+    # dfu-util sends DFU_DETACH and waits for the bridge to leave
+    if dfu_util(['-d', BRIDGE_ID, '-e'] + serial) != 0:
+        return 1
+
+    start = time.time()
+    if dfu_util(['-w', '-d', LOADER_ID, '-a', '0',
+                 '-s', '0x%08X:leave' % FLASH_ADDR, '-D', image]) != 0:
+        return 1
+    elapsed = time.time() - start
+
+    print('%d bytes in %.2f s: %.1f KB/s' % (size, elapsed, size / 1024.0 / elapsed))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""Talk to the bridge over its HID control channel, without any driver.
+
+    hid_ctl.py ping [count]         round trip time of a request
+    hid_ctl.py req port bRequest [wValue] [in_length]
+    hid_ctl.py seq lines,levels,ms [...]
+    hid_ctl.py telemetry [period_ms]
+
+The lines of a step are a mask of 0x01 DTR X, 0x02 RTS X, 0x04 DTR Y,
+0x08 RTS Y and 0x10 SAMD21 reset; the levels set the asserted ones. The
+bRequest values are those of usbd_cdc_interface.h (VCP_REQ_xxx) and of CDC.
+
+needs the hidapi module (pip install hidapi)
+"""
+
+import struct
+import sys
+import time
+
+import hid
+
+BRIDGE_VID = 0x2a03
+BRIDGE_PID = 0x0052
+REPORT_SIZE = 64
+
+HID_REQUEST = 0x01
+HID_SEQUENCE = 0x02
+HID_TELEMETRY = 0x03
+REQ_GET_TX_STATS = 0xA8
+
+
+class Bridge(object):
+    def __init__(self):
+        self.dev = hid.device()
+        self.dev.open(BRIDGE_VID, BRIDGE_PID)
+        self.tag = 0
+
+    def command(self, cmd, args=b'', timeout=1000):
+        self.tag = (self.tag % 255) + 1
+        report = bytes((cmd, self.tag)) + args
+        # Report ID 0 first: the reports have none
+        self.dev.write(b'\x00' + report.ljust(REPORT_SIZE, b'\x00'))
+        while True:
+            answer = bytes(self.dev.read(REPORT_SIZE, timeout))
+            if not answer:
+                raise IOError('no answer')
+            if answer[0] == cmd and answer[1] == self.tag:
+                return answer[2], answer[4:4 + answer[3]]
+
+    def request(self, port, request, value=0, in_length=0, data=b''):
+        length = in_length or len(data)
+        args = struct.pack('<BBHBB', port, request, value, length, 1 if in_length else 0) + data
+        return self.command(HID_REQUEST, args)
+
+
+def main(argv):
+    if len(argv) < 2:
+        sys.stderr.write(__doc__)
+        return 1
+
+    bridge = Bridge()
+    if argv[1] == 'ping':
+        times = []
+        for _ in range(int(argv[2]) if len(argv) > 2 else 100):
+            start = time.perf_counter()
+            bridge.request(0, REQ_GET_TX_STATS, in_length=20)
+            times.append((time.perf_counter() - start) * 1000.0)
+        times.sort()
+        print('round trip: min %.2f ms, median %.2f ms, max %.2f ms' %
+              (times[0], times[len(times) // 2], times[-1]))
+    elif argv[1] == 'req':
+        status, data = bridge.request(int(argv[2]), int(argv[3], 0),
+                                      int(argv[4], 0) if len(argv) > 4 else 0,
+                                      int(argv[5]) if len(argv) > 5 else 0)
+        print('status %d %s' % (status, data.hex()))
+    elif argv[1] == 'seq':
+        steps = [[int(v, 0) for v in step.split(',')] for step in argv[2:]]
+        args = bytes((len(steps), 0)) + b''.join(struct.pack('<BBH', *step) for step in steps)
+        status, _ = bridge.command(HID_SEQUENCE, args, timeout=70000)
+        print('status %d' % status)
+    elif argv[1] == 'telemetry':
+        bridge.command(HID_TELEMETRY, struct.pack('<H', int(argv[2]) if len(argv) > 2 else 100))
+        while True:
+            report = bytes(bridge.dev.read(REPORT_SIZE))
+            if report[0] != HID_TELEMETRY or report[1] != 0:
+                continue
+            values = struct.unpack_from('<I' + 'IIIHH' * 2, report, 4)
+            print('%10d ms  X: rx %d tx %d lost %d state %04x/%04x  '
+                  'Y: rx %d tx %d lost %d state %04x/%04x' % values)
+    else:
+        sys.stderr.write(__doc__)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""Run a batch of I2C operations through the bridge on PA9 (SCL) and PA10 (SDA).
+
+Each argument is one operation, run in turn in a single batch:
+  w:ADDR:BYTES    write the hex bytes to the 7-bit address (w:48 only probes)
+  r:ADDR:COUNT    read COUNT bytes
+  d:MS            wait
+A '+' after the letter keeps the bus for the next operation with a repeated
+start, as for a register read: w+:48:00 r:48:2. The bytes read are printed
+in hex, then the time of the whole round trip.
+
+usage: i2c_batch.py [-f] op [op ...]     -f for 400 kHz, else 100 kHz
+
+needs pyusb (pip install pyusb)
+"""
+
+import struct
+import sys
+import time
+
+import usb.core
+
+BRIDGE_VID = 0x2a03
+BRIDGE_PID = 0x0052
+PORT_X_ITF = 0
+
+REQ_SET_I2C = 0xBB
+REQ_I2C_BATCH = 0xBC
+REQ_GET_I2C = 0xBD
+
+OP_WRITE, OP_READ, OP_DELAY = 0x01, 0x02, 0x03
+NOSTOP = 0x80
+I2C_IDLE, I2C_BUSY, I2C_DONE, I2C_ERROR = range(4)
+I2C_100K, I2C_400K = 1, 2
+ERRORS = {0x01: 'bus error', 0x02: 'arbitration lost', 0x04: 'no acknowledge',
+          0x08: 'overrun', 0x20: 'timeout', 0x40: 'malformed batch'}
+RESULT_SIZE = 64
+
+
+def encode(args):
+    batch = bytearray()
+    for arg in args:
+        fields = arg.split(':')
+        op = fields[0]
+        code = NOSTOP if op.endswith('+') else 0
+        op = op.rstrip('+')
+        if op == 'd':
+            batch += bytes((OP_DELAY, int(fields[1])))
+        elif op == 'w':
+            data = bytes.fromhex(fields[2]) if len(fields) > 2 else b''
+            batch += bytes((OP_WRITE | code, int(fields[1], 16), len(data))) + data
+        elif op == 'r':
+            batch += bytes((OP_READ | code, int(fields[1], 16), int(fields[2])))
+        else:
+            raise ValueError('unknown operation ' + arg)
+    return bytes(batch)
+
+
+def main(argv):
+    args = argv[1:]
+    speed = I2C_100K
+    if args and args[0] == '-f':
+        speed = I2C_400K
+        args = args[1:]
+    if not args:
+        sys.stderr.write(__doc__)
+        return 1
+
+    batch = encode(args)
+    dev = usb.core.find(idVendor=BRIDGE_VID, idProduct=BRIDGE_PID)
+    if dev is None:
+        sys.stderr.write('bridge not found\n')
+        return 1
+
+    dev.ctrl_transfer(0x41, REQ_SET_I2C, speed, PORT_X_ITF)
+    start = time.time()
+    dev.ctrl_transfer(0x41, REQ_I2C_BATCH, 0, PORT_X_ITF, batch)
+    while True:
+        data = bytes(dev.ctrl_transfer(0xC1, REQ_GET_I2C, 0, PORT_X_ITF, RESULT_SIZE))
+        state, done, error, length = struct.unpack_from('<BBBB', data)
+        if state != I2C_BUSY:
+            break
+    elapsed = time.time() - start
+
+    if length:
+        print(data[4:4 + length].hex(' '))
+    if state == I2C_ERROR:
+        sys.stderr.write('operation %d failed: %s\n' % (done + 1, ERRORS.get(error, 'error 0x%02x' % error)))
+    sys.stderr.write('%d operations in %.1f ms\n' % (done, elapsed * 1000))
+    return 0 if state == I2C_DONE else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""Write a firmware to the SAMD21 behind port Y through the SAM-BA engine.
+
+The bridge resets the SAMD21 into its loader, the image goes through the
+virtual COM port of port Y and the bridge writes it in XMODEM blocks,
+checking each chunk with the CRC the loader computes. The vendor requests
+are sent with pyusb to the port Y command interface. The write time and
+rate are printed once it is over, then the SAMD21 starts the new firmware.
+
+usage: samba_flash.py firmware.bin /dev/ttyACM1 [address]
+"""
+
+import struct
+import sys
+import time
+
+import usb.core
+
+BRIDGE_VID = 0x2a03
+BRIDGE_PID = 0x0052
+PORT_Y_ITF = 2
+APP_ADDR = 0x2000               # After the 8 KB of the Arduino loader
+
+REQ_SET_SAMBA = 0xB5
+REQ_SAMBA_WRITE = 0xB6
+REQ_GET_SAMBA = 0xB7
+
+SAMBA_OFF, SAMBA_RESET, SAMBA_SYNC, SAMBA_IDLE, SAMBA_ERROR, SAMBA_BUSY = range(6)
+ERRORS = ('none', 'timeout', 'NAK', 'unexpected reply', 'CRC mismatch')
+
+
+def get_state(dev):
+    data = bytes(dev.ctrl_transfer(0xC1, REQ_GET_SAMBA, 0, PORT_Y_ITF, 24))
+    return struct.unpack('<BBxxIIIII', data)
+
+
+def wait(dev, busy):
+    while True:
+        state = get_state(dev)
+        if state[0] not in busy:
+            return state
+        time.sleep(0.05)
+
+
+def main(argv):
+    if len(argv) < 3:
+        sys.stderr.write(__doc__)
+        return 1
+
+    with open(argv[1], 'rb') as f:
+        image = f.read()
+    address = int(argv[3], 0) if len(argv) > 3 else APP_ADDR
+
+    dev = usb.core.find(idVendor=BRIDGE_VID, idProduct=BRIDGE_PID)
+    if dev is None:
+        sys.stderr.write('bridge not found\n')
+        return 1
+
+    dev.ctrl_transfer(0x41, REQ_SET_SAMBA, 1, PORT_Y_ITF, None)
+    state = wait(dev, (SAMBA_RESET, SAMBA_SYNC))
+    if state[0] != SAMBA_IDLE:
+        sys.stderr.write('no loader: %s\n' % ERRORS[state[1]])
+        return 1
+
+    dev.ctrl_transfer(0x41, REQ_SAMBA_WRITE, 0, PORT_Y_ITF,
+                      struct.pack('<II', address, len(image)))
+    with open(argv[2], 'wb', buffering=0) as port:
+        port.write(image)
+    state = wait(dev, (SAMBA_BUSY,))
+    if state[0] != SAMBA_IDLE:
+        sys.stderr.write('write stopped after %d bytes: %s\n' % (state[2], ERRORS[state[1]]))
+        return 1
+
+    written, elapsed = state[2], state[6] / 1000.0
+    print('%d bytes in %.2f s: %.1f KB/s, %d chunks verified' %
+          (written, elapsed, written / 1024.0 / elapsed, state[4]))
+
+    dev.ctrl_transfer(0x41, REQ_SET_SAMBA, 0, PORT_Y_ITF, None)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
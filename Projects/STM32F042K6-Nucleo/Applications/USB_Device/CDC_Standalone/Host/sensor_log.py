@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+"""Log the board temperature and the gyroscope rates read by the bridge.
+
+The bridge reads an STLM75 and an L3GD20 on the I2C bus (PA9/PA10) at the
+periods given, keeps them in flash, and serves the latest readings; this
+polls them once a second. Periods are in ms, rounded to 10 ms, 0 = off.
+
+usage: sensor_log.py [temperature_ms [gyroscope_ms]]
+
+needs pyusb (pip install pyusb)
+"""
+
+import struct
+import sys
+import time
+
+import usb.core
+
+BRIDGE_VID = 0x2a03
+BRIDGE_PID = 0x0052
+PORT_X_ITF = 0
+
+REQ_SET_SENSOR = 0xC3
+REQ_GET_SENSOR = 0xC4
+
+UNIT_MS = 10
+REPORT_SIZE = 24
+STATES = ('off', 'probe', 'run', 'fail')
+DPS_PER_LSB = 0.00875
+NO_LIMIT = 0xFFFFFFFF
+
+
+def period(ms):
+    return min(255, (ms + UNIT_MS - 1) // UNIT_MS)
+
+
+def main(argv):
+    dev = usb.core.find(idVendor=BRIDGE_VID, idProduct=BRIDGE_PID)
+    if dev is None:
+        sys.stderr.write('bridge not found\n')
+        return 1
+
+    if len(argv) > 1:
+        temp = period(int(argv[1]))
+        gyro = period(int(argv[2])) if len(argv) > 2 else 0
+        dev.ctrl_transfer(0x41, REQ_SET_SENSOR, temp | (gyro << 8), PORT_X_ITF)
+
+    while True:
+        report = bytes(dev.ctrl_transfer(0xC1, REQ_GET_SENSOR, 0, PORT_X_ITF, REPORT_SIZE))
+        (temp_state, gyro_state, temp, x, y, z, temp_age, gyro_age, flags, clamped,
+         limit, temp_errors, gyro_errors) = struct.unpack('<BBhhhhHHBBIHH', report)
+        line = 'temp %-5s %6.1f C (%5d ms)  gyro %-5s %8.2f %8.2f %8.2f dps (%5d ms)' % (
+            STATES[temp_state], temp / 256.0, temp_age,
+            STATES[gyro_state], x * DPS_PER_LSB, y * DPS_PER_LSB, z * DPS_PER_LSB, gyro_age)
+        if limit != NO_LIMIT:
+            line += '  max %d baud' % limit
+        if clamped:
+            line += '  clamped %s' % '/'.join(n for b, n in ((1, 'X'), (2, 'Y')) if clamped & b)
+        if temp_errors or gyro_errors:
+            line += '  errors %d/%d' % (temp_errors, gyro_errors)
+        print(line)
+        time.sleep(1)
+
+
+if __name__ == '__main__':
+    try:
+        sys.exit(main(sys.argv))
+    except KeyboardInterrupt:
+        sys.exit(0)
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""Convert the sniffer records of the CDC ports to a pcap file.
+
+The records are read from the virtual COM ports (or from raw captures of
+them) after VCP_REQ_SET_SNIFF has turned the sniffer on. Each record becomes
+one packet of link type USER0, the data preceded by two bytes:
+    [0] port index (0: USART1, 1: USART2)
+    [1] VCP_SNIFF_xxx flags (0x01: sent by the host on TX, else received)
+
+usage: sniff2pcap.py out.pcap capture0 [capture1]
+"""
+
+import struct
+import sys
+
+SNIFF_SYNC = 0xA5
+SNIFF_HEADER_SIZE = 8
+LINKTYPE_USER0 = 147
+
+
+def records(data):
+    """Yield (flags, stamp, payload) from a record stream, resynchronizing on
+    the sync byte when the stream starts in the middle of a record."""
+    pos = 0
+    while pos + SNIFF_HEADER_SIZE <= len(data):
+        if data[pos] != SNIFF_SYNC:
+            pos += 1
+            continue
+        flags, length, stamp = struct.unpack_from('<BHI', data, pos + 1)
+        end = pos + SNIFF_HEADER_SIZE + length
+        if end > len(data):
+            break
+        yield flags, stamp, data[pos + SNIFF_HEADER_SIZE:end]
+        pos = end
+
+
+def unwrap(stamps):
+    """Extend the 32-bit us timer, wrapping every 71 minutes."""
+    base = 0
+    last = None
+    for stamp in stamps:
+        if last is not None and stamp < last and last - stamp > 0x80000000:
+            base += 1 << 32
+        last = stamp
+        yield base + stamp
+
+
+def main(argv):
+    if len(argv) < 3:
+        sys.stderr.write(__doc__)
+        return 1
+
+    packets = []
+    for port, name in enumerate(argv[2:]):
+        with open(name, 'rb') as f:
+            recs = list(records(f.read()))
+        times = unwrap([stamp for _, stamp, _ in recs])
+        for (flags, _, payload), time in zip(recs, times):
+            packets.append((time, port, flags, payload))
+
+    # Both ports share the same timer, the records merge on time
+    packets.sort(key=lambda p: p[0])
+
+    with open(argv[1], 'wb') as out:
+        out.write(struct.pack('<IHHiIII', 0xA1B2C3D4, 2, 4, 0, 0, 65535, LINKTYPE_USER0))
+        for time, port, flags, payload in packets:
+            body = bytes((port, flags)) + payload
+            out.write(struct.pack('<IIII', time // 1000000, time % 1000000, len(body), len(body)))
+            out.write(body)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""Read or write a SPI NOR flash through the SPI bridge on PA4 to PA7.
+
+Uses the common 25-series commands: 9F read id, 03 read, 06 write enable,
+20 erase 4 KB sector, 02 program page, 05 read status. Reads hold the chip
+select across exchanges, so a whole range streams after a single command,
+60 bytes per request.
+A write erases the sectors it covers, then checks what it wrote.
+
+usage: spi_flash.py id
+       spi_flash.py read address length file
+       spi_flash.py write address file
+
+needs pyusb (pip install pyusb)
+"""
+
+import struct
+import sys
+import time
+
+import usb.core
+
+BRIDGE_VID = 0x2a03
+BRIDGE_PID = 0x0052
+PORT_X_ITF = 0
+
+REQ_SET_SPI = 0xBE
+REQ_SPI_XFER = 0xBF
+REQ_GET_SPI = 0xC0
+REQ_SPI_READ = 0xC5
+
+SPI_CLOCK = 1                   # 12 MHz
+SPI_MODE = 0
+HOLD_CS = 0x01
+SPI_BUSY, SPI_DONE = 1, 2
+CHUNK = 60
+PAGE = 256
+SECTOR = 4096
+
+
+class Bridge(object):
+    def __init__(self, dev):
+        self.dev = dev
+
+    def exchange(self, flags, data):
+        self.dev.ctrl_transfer(0x41, REQ_SPI_XFER, 0, PORT_X_ITF, bytes((flags,)) + data)
+        state = SPI_BUSY
+        while state == SPI_BUSY:
+            result = bytes(self.dev.ctrl_transfer(0xC1, REQ_GET_SPI, 0, PORT_X_ITF, 4 + CHUNK))
+            state, held, error, length = struct.unpack_from('<BBBB', result)
+        if state != SPI_DONE:
+            raise IOError('SPI error 0x%02x' % error)
+        return result[4:4 + length]
+
+    def command(self, data, hold=False):
+        return self.exchange(HOLD_CS if hold else 0, data)
+
+    def read(self, count):
+        """Clock count bytes out of the selected chip, then release it."""
+        out = bytearray()
+        while count:
+            n = min(count, CHUNK)
+            count -= n
+            data = self.dev.ctrl_transfer(0xC1, REQ_SPI_READ, HOLD_CS if count else 0, PORT_X_ITF, n)
+            if len(data) != n:
+                raise IOError('SPI read cut short')
+            out += bytes(data)
+        return bytes(out)
+
+    def wait_ready(self):
+        while self.command(b'\x05\x00')[1] & 0x01:
+            time.sleep(0.001)
+
+
+def address(cmd, addr):
+    return bytes((cmd, (addr >> 16) & 0xFF, (addr >> 8) & 0xFF, addr & 0xFF))
+
+
+def flash_read(spi, addr, length):
+    spi.command(address(0x03, addr), hold=True)
+    return spi.read(length)
+
+
+def flash_write(spi, addr, image):
+    for sector in range(addr - addr % SECTOR, addr + len(image), SECTOR):
+        spi.command(b'\x06')
+        spi.command(address(0x20, sector))
+        spi.wait_ready()
+    pos = 0
+    while pos < len(image):
+        # A program never crosses a page, nor the length of one exchange
+        n = min(PAGE - (addr + pos) % PAGE, CHUNK - 4, len(image) - pos)
+        spi.command(b'\x06')
+        spi.command(address(0x02, addr + pos) + image[pos:pos + n])
+        spi.wait_ready()
+        pos += n
+    if flash_read(spi, addr, len(image)) != image:
+        raise IOError('verify failed')
+
+
+def main(argv):
+    if len(argv) < 2 or argv[1] not in ('id', 'read', 'write'):
+        sys.stderr.write(__doc__)
+        return 1
+
+    dev = usb.core.find(idVendor=BRIDGE_VID, idProduct=BRIDGE_PID)
+    if dev is None:
+        sys.stderr.write('bridge not found\n')
+        return 1
+    dev.ctrl_transfer(0x41, REQ_SET_SPI, SPI_CLOCK | (SPI_MODE << 8), PORT_X_ITF)
+    spi = Bridge(dev)
+
+    start = time.time()
+    try:
+        if argv[1] == 'id':
+            print(spi.command(b'\x9f\x00\x00\x00')[1:].hex(' '))
+        elif argv[1] == 'read':
+            data = flash_read(spi, int(argv[2], 0), int(argv[3], 0))
+            with open(argv[4], 'wb') as f:
+                f.write(data)
+        else:
+            with open(argv[3], 'rb') as f:
+                data = f.read()
+            flash_write(spi, int(argv[2], 0), data)
+    finally:
+        dev.ctrl_transfer(0x41, REQ_SET_SPI, 0, PORT_X_ITF)
+
+    if argv[1] != 'id':
+        elapsed = time.time() - start
+        print('%d bytes in %.2f s: %.1f KB/s' % (len(data), elapsed, len(data) / 1024.0 / elapsed))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
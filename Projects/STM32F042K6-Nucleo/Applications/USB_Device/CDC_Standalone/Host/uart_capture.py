@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+"""Log the data received by a port through the isochronous capture interface.
+
+The capture interface is set to the alternate setting of the port, whose
+endpoint brings one packet in every frame. The data go to the output file,
+or to stdout; the frames missed and the bytes lost by the bridge are told
+on stderr. Ctrl-C stops the capture and prints the counters of the bridge.
+
+usage: uart_capture.py x|y [output]
+
+needs the libusb1 module (pip install libusb1)
+"""
+
+import struct
+import sys
+
+import usb1
+
+BRIDGE_VID = 0x2a03
+BRIDGE_PID = 0x0052
+PORT_ITF = {'x': 0, 'y': 2}
+CAPTURE_ITF = 6
+CAPTURE_ALT = {'x': 1, 'y': 2}
+CAPTURE_EP = 0x86
+PACKET_SIZE = 176
+HEADER_SIZE = 4
+CAPTURE_LOST = 0x01
+PACKETS = 32                    # Frames per transfer
+TRANSFERS = 4
+
+REQ_GET_CAPTURE = 0xB8
+
+
+class Capture(object):
+    def __init__(self, out):
+        self.out = out
+        self.last = None
+        self.missed = 0
+
+    def packet(self, data):
+        if len(data) < HEADER_SIZE:
+            return
+        frame, flags, _ = struct.unpack_from('<HBB', data)
+        if self.last is not None:
+            ahead = (frame - self.last) & 0xFFFF
+            # A late copy of an older packet
+            if ahead == 0 or ahead >= 0x8000:
+                return
+            if ahead > 1:
+                self.missed += ahead - 1
+                sys.stderr.write('frames %d to %d missed\n' % ((self.last + 1) & 0xFFFF, (frame - 1) & 0xFFFF))
+        self.last = frame
+        if flags & CAPTURE_LOST:
+            sys.stderr.write('bytes lost before frame %d\n' % frame)
+        self.out.write(data[HEADER_SIZE:])
+
+    def done(self, transfer):
+        if transfer.getStatus() != usb1.TRANSFER_COMPLETED:
+            return
+        for status, data in transfer.iterISO():
+            if status == usb1.TRANSFER_COMPLETED:
+                self.packet(bytes(data))
+        self.out.flush()
+        transfer.submit()
+
+
+def main(argv):
+    if len(argv) < 2 or argv[1] not in CAPTURE_ALT:
+        sys.stderr.write(__doc__)
+        return 1
+
+    port = argv[1]
+    out = open(argv[2], 'wb') if len(argv) > 2 else sys.stdout.buffer
+    capture = Capture(out)
+
+    with usb1.USBContext() as context:
+        handle = context.openByVendorIDAndProductID(BRIDGE_VID, BRIDGE_PID)
+        if handle is None:
+            sys.stderr.write('bridge not found\n')
+            return 1
+        handle.claimInterface(CAPTURE_ITF)
+        handle.setInterfaceAltSetting(CAPTURE_ITF, CAPTURE_ALT[port])
+
+        transfers = []
+        for _ in range(TRANSFERS):
+            transfer = handle.getTransfer(iso_packets=PACKETS)
+            transfer.setIsochronous(CAPTURE_EP, PACKETS * PACKET_SIZE, callback=capture.done)
+            transfer.submit()
+            transfers.append(transfer)
+
+        try:
+            while True:
+                context.handleEvents()
+        except KeyboardInterrupt:
+            pass
+
+        for transfer in transfers:
+            if transfer.isSubmitted():
+                transfer.cancel()
+        while any(transfer.isSubmitted() for transfer in transfers):
+            context.handleEvents()
+
+        handle.setInterfaceAltSetting(CAPTURE_ITF, 0)
+        data = handle.controlRead(0xC1, REQ_GET_CAPTURE, 0, PORT_ITF[port], 16)
+        _, _, _, packets, sent, late = struct.unpack('<BBHIII', data)
+        sys.stderr.write('%d packets, %d bytes, %d not taken in their frame, %d frames missed here\n' %
+                         (packets, sent, late, capture.missed))
+        handle.releaseInterface(CAPTURE_ITF)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -55,6 +55,12 @@
 #include "usbd_desc.h"
 #include "usbd_cdc.h"
 #include "usbd_cdc_interface.h"
+#include "vcp_config.h"
+#include "vcp_drive.h"
+#include "vcp_i2c.h"
+#include "vcp_spi.h"
+#include "vcp_screen.h"
+#include "vcp_sensor.h"
 
 /* Exported types ------------------------------------------------------------*/
 /* Exported constants --------------------------------------------------------*/
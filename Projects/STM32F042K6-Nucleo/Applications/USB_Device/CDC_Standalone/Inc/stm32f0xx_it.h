@@ -60,6 +60,13 @@ void USB_IRQHandler(void);
 void USARTx_IRQHandler(void);
 void USARTy_IRQHandler(void);
 void TIMx_IRQHandler(void);
+void TIMx_BRK_IRQHandler(void);
+void TIMy_BRK_IRQHandler(void);
+void TIMy_GAP_IRQHandler(void);
+void USARTx_DMA_TX_RX_IRQHandler(void);
+void USARTy_DMA_TX_RX_IRQHandler(void);
+void I2Cx_IRQHandler(void);
+void SPIx_IRQHandler(void);
 #ifdef __cplusplus
 }
 #endif
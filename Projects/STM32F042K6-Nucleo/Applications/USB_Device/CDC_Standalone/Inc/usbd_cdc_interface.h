@@ -51,6 +51,8 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "usbd_cdc.h"
+#include "stm32f0xx_ll_dma.h"
+#include "stm32f0xx_ll_usart.h"
 
 /* Exported types ------------------------------------------------------------*/
 /* Exported constants --------------------------------------------------------*/
@@ -98,6 +100,7 @@
 /* Definition for USARTx's DMA */
 #define USARTx_TX_DMA_STREAM              DMA1_Channel2
 #define USARTx_RX_DMA_STREAM              DMA1_Channel3
+#define USARTx_TX_DMA_CHANNEL             LL_DMA_CHANNEL_2
 
 /* Definition for USARTx's NVIC */
 #define USARTx_DMA_TX_RX_IRQn             DMA1_Channel2_3_IRQn
@@ -122,6 +125,12 @@
 #define USARTy_RX_GPIO_PORT              GPIOA
 #define USARTy_RX_AF                     GPIO_AF1_USART2
 
+/* Driver enable output of the RS-485 mode. USART1 has its DE output on PA12
+   only, which is the USB D+ line, so port X has no RS-485 mode */
+#define USARTy_DE_PIN                    GPIO_PIN_1
+#define USARTy_DE_GPIO_PORT              GPIOA
+#define USARTy_DE_AF                     GPIO_AF1_USART2
+
 /* Definition for USARTx's NVIC: used for receiving data over Rx pin */
 #define USARTy_IRQn                      USART2_IRQn
 #define USARTy_IRQHandler                USART2_IRQHandler
@@ -129,6 +138,7 @@
 /* Definition for USARTx's DMA */
 #define USARTy_TX_DMA_STREAM              DMA1_Channel4
 #define USARTy_RX_DMA_STREAM              DMA1_Channel5
+#define USARTy_TX_DMA_CHANNEL             LL_DMA_CHANNEL_4
 
 /* Definition for USARTx's NVIC */
 #define USARTy_DMA_TX_RX_IRQn             DMA1_Channel4_5_6_7_IRQn
@@ -143,14 +153,393 @@
 #define TIMx_IRQn                        TIM3_IRQn
 #define TIMx_IRQHandler                  TIM3_IRQHandler
 
+/* Definition for the break timers: a one pulse timer per port ends a break */
+#define TIMx_BRK                         TIM16
+#define TIMx_BRK_CLK_ENABLE              __HAL_RCC_TIM16_CLK_ENABLE
+#define TIMx_BRK_IRQn                    TIM16_IRQn
+#define TIMx_BRK_IRQHandler              TIM16_IRQHandler
+
+#define TIMy_BRK                         TIM17
+#define TIMy_BRK_CLK_ENABLE              __HAL_RCC_TIM17_CLK_ENABLE
+#define TIMy_BRK_IRQn                    TIM17_IRQn
+#define TIMy_BRK_IRQHandler              TIM17_IRQHandler
+
+/* Definition for the inter-frame gap timer of port Y: USART2 has no receiver
+   timeout, the gap left after an idle line is timed by TIM14 */
+#define TIMy_GAP                         TIM14
+#define TIMy_GAP_CLK_ENABLE              __HAL_RCC_TIM14_CLK_ENABLE
+#define TIMy_GAP_IRQn                    TIM14_IRQn
+#define TIMy_GAP_IRQHandler              TIM14_IRQHandler
+
+/* Definition for the sniffer time base: TIM2 counts microseconds over 32 bits */
+#define SNIFF_TIM                        TIM2
+#define SNIFF_TIM_CLK_ENABLE             __HAL_RCC_TIM2_CLK_ENABLE
+
 /* Periodically, the state of the buffer "UserTxBuffer" is checked.
    The period depends on CDC_POLLING_INTERVAL */
 #define CDC_POLLING_INTERVAL             5 /* in ms. The max is 65 and the min is 1 */
 
+/* Modem control lines are identified by a one byte pin code:
+   bit 7 = active low, bit 6 = not connected, bits 5:4 = GPIO port (0: GPIOA, 1: GPIOB),
+   bits 3:0 = pin number */
+#define VCP_PIN(gpio, pin)               ((uint8_t)(((gpio) << 4) | (pin)))
+#define VCP_PIN_ACTIVE_LOW               0x80
+#define VCP_PIN_NC                       0x40
+
+/* Default DTR/RTS outputs, driven from SET_CONTROL_LINE_STATE.
+   Like the DTR#/RTS# pins of a discrete USB-UART the outputs are active low */
+#define VCPx_DTR_PIN_DEFAULT             (VCP_PIN(1, 4)  | VCP_PIN_ACTIVE_LOW) /* PB4 */
+#define VCPx_RTS_PIN_DEFAULT             (VCP_PIN(1, 5)  | VCP_PIN_ACTIVE_LOW) /* PB5 */
+#define VCPy_DTR_PIN_DEFAULT             (VCP_PIN(0, 8)  | VCP_PIN_ACTIVE_LOW) /* PA8 */
+#define VCPy_RTS_PIN_DEFAULT             (VCP_PIN(0, 15) | VCP_PIN_ACTIVE_LOW) /* PA15 */
+
+/* Default DCD/DSR/RI inputs, reported with SERIAL_STATE notifications.
+   An input is pulled to its deasserted level while nothing drives it */
+#define VCPx_DCD_PIN_DEFAULT             VCP_PIN_NC
+#define VCPx_DSR_PIN_DEFAULT             VCP_PIN_NC
+#define VCPx_RI_PIN_DEFAULT              VCP_PIN_NC
+#define VCPy_DCD_PIN_DEFAULT             VCP_PIN_NC
+#define VCPy_DSR_PIN_DEFAULT             VCP_PIN_NC
+#define VCPy_RI_PIN_DEFAULT              VCP_PIN_NC
+
+/* Modem lines of a port */
+#define VCP_LINE_DTR                     0
+#define VCP_LINE_RTS                     1
+#define VCP_LINE_DCD                     2
+#define VCP_LINE_DSR                     3
+#define VCP_LINE_RI                      4
+#define VCP_LINE_COUNT                   5
+
+/* Frame mode: received data goes to the host one frame per transfer, a frame
+   ending on an idle gap of the configured length (Modbus RTU: 3.5 characters) */
+#define VCP_FRAME_QUEUE                  8 /* Frame ends waiting for the host, power of 2 */
+#define VCP_FRAME_GAP_MAX                4095 /* in bit times, keeps the gap timer in range down to 300 baud */
+
+/* Input lines and UART errors are sampled every CDC_POLLING_INTERVAL; changes
+   seen within VCP_NOTIFY_INTERVAL of the last notification are merged into the next one */
+#define VCP_NOTIFY_INTERVAL              20 /* in ms, multiple of CDC_POLLING_INTERVAL */
+
+/* Pins the host is allowed to claim for modem control lines: the USART, USB,
+   HSE, SWD and SAMD21 control pins are never handed out */
+#define VCP_MODEM_PINS_GPIOA             (GPIO_PIN_0 | GPIO_PIN_1 | GPIO_PIN_4 | GPIO_PIN_5 | \
+                                          GPIO_PIN_6 | GPIO_PIN_7 | GPIO_PIN_8 | GPIO_PIN_9 | \
+                                          GPIO_PIN_10 | GPIO_PIN_15)
+#define VCP_MODEM_PINS_GPIOB             (GPIO_PIN_3 | GPIO_PIN_4 | GPIO_PIN_5)
+
+/* Vendor specific requests, addressed to the CDC command interface of the port
+   (bmRequestType 0x41 host to device, 0xC1 device to host, wIndex = interface) */
+#define VCP_REQ_GET_MODEM_MAP            0xA0 /* IN, 12 bytes:
+                                                  [0] DTR pin code   [1] RTS pin code
+                                                  [2] control line state (bit 0 DTR, bit 1 RTS)
+                                                  [3] last SERIAL_STATE sent
+                                                  [4..5] last apply time in ns
+                                                  [6..7] worst apply time in ns
+                                                  [8] DCD pin code   [9] DSR pin code
+                                                  [10] RI pin code   [11] reserved */
+#define VCP_REQ_SET_MODEM_MAP            0xA1 /* wValue = DTR pin code | (RTS pin code << 8) */
+#define VCP_REQ_SET_INPUT_MAP            0xA2 /* wValue = pin code | (VCP_LINE_DCD/DSR/RI << 8) */
+#define VCP_REQ_SEND_BREAK_US            0xA3 /* wValue = break duration in us, 0 ends the break */
+#define VCP_REQ_SET_RS485                0xA4 /* wValue = RS-485 configuration, see below */
+#define VCP_REQ_GET_RS485                0xA5 /* IN, 2 bytes: RS-485 configuration */
+#define VCP_REQ_SET_FRAME_GAP            0xA6 /* wValue = inter-frame gap in bit times, 0 = stream */
+#define VCP_REQ_GET_FRAME_GAP            0xA7 /* IN, 2 bytes: inter-frame gap in bit times */
+#define VCP_REQ_GET_TX_STATS             0xA8 /* IN, 20 bytes, little endian:
+                                                  [0..3] current tick in ms
+                                                  [4..7] bytes sent to the host
+                                                  [8..11] IN transfers
+                                                  [12..15] deferred rounds
+                                                  [16..17] last latency in ms
+                                                  [18..19] worst latency in ms */
+#define VCP_REQ_SET_RX_POLICY            0xA9 /* wValue = VCP_RX_DROP_OLDEST/DROP_NEWEST/FLOW_CONTROL */
+#define VCP_REQ_GET_RX_STATS             0xAA /* IN, 16 bytes, little endian:
+                                                  [0] overflow policy
+                                                  [1] bit 0 reception paused, bit 1 RTS throttled
+                                                  [2..3] line errors, modulo 65536
+                                                  [4..7] overflows
+                                                  [8..11] bytes lost
+                                                  [12..15] stream offset of the last loss */
+#define VCP_REQ_SET_PASSTHROUGH          0xAB /* wValue = 1 to join USART1 and USART2, 0 to end, kept in flash */
+#define VCP_REQ_GET_PASSTHROUGH          0xAC /* IN, 20 bytes, little endian:
+                                                  [0] passthrough on   [1..3] reserved
+                                                  [4..7] bytes sent from port X to port Y
+                                                  [8..11] bytes of port X dropped
+                                                  [12..15] bytes sent from port Y to port X
+                                                  [16..19] bytes of port Y dropped */
+#define VCP_REQ_SET_SNIFF                0xAD /* wValue = 1 to send the data of the port as sniffer records */
+#define VCP_REQ_GET_SNIFF                0xAE /* IN, 8 bytes, little endian:
+                                                  [0] sniffer on   [1..3] reserved
+                                                  [4..7] current time in us */
+#define VCP_REQ_SET_TEST                 0xAF /* wValue = VCP_TEST_xxx pattern | VCP_TEST_LOOPBACK, VCP_TEST_OFF ends it */
+#define VCP_REQ_GET_TEST                 0xB0 /* IN, 32 bytes, little endian:
+                                                  [0] pattern   [1] bit 0 loopback, bit 1 locked
+                                                  [2..3] smallest room left in the reception ring
+                                                  [4..7] test time in ms
+                                                  [8..11] bytes sent   [12..15] bytes received
+                                                  [16..19] bit errors   [20..23] byte errors
+                                                  [24..27] bytes lost by the reception ring
+                                                  [28..29] transmission stalls   [30..31] resyncs */
+#define VCP_REQ_SET_AUTOBAUD             0xB1 /* wValue = VCP_AUTOBAUD_xxx, port X only; the mode in use again detects again */
+#define VCP_REQ_GET_AUTOBAUD             0xB2 /* IN, 8 bytes, little endian:
+                                                  [0] mode   [1] VCP_AUTOBAUD_IDLE/WAITING/LOCKED
+                                                  [2..3] characters rejected
+                                                  [4..7] rate detected, 0 before the first */
+#define VCP_REQ_SET_COBS                 0xB3 /* wValue = 1 to frame the data of the port, see below */
+#define VCP_REQ_GET_COBS                 0xB4 /* IN, 24 bytes, little endian:
+                                                  [0] framing on   [1..3] reserved
+                                                  [4..7] frames sent to the host
+                                                  [8..11] of them with a line error
+                                                  [12..15] frames of the host sent on TX
+                                                  [16..19] frames of the host with a bad COBS code or CRC
+                                                  [20..23] frames of the host too long */
+#define VCP_REQ_SET_SAMBA                0xB5 /* Port Y only, wValue = 1 to reset the SAMD21 into its loader and
+                                                  take it over, 0 to reset it into the new firmware */
+#define VCP_REQ_SAMBA_WRITE              0xB6 /* OUT, 8 bytes, little endian: [0..3] flash address, page aligned
+                                                  [4..7] length; the next bytes the host sends on port Y are
+                                                  written there. The first write erases from its address on */
+#define VCP_REQ_GET_SAMBA                0xB7 /* IN, 24 bytes, little endian:
+                                                  [0] VCP_SAMBA_xxx state   [1] VCP_SAMBA_ERR_xxx   [2..3] reserved
+                                                  [4..7] bytes written and verified
+                                                  [8..11] bytes of the write still expected
+                                                  [12..15] chunks verified   [16..19] CRC mismatches
+                                                  [20..23] ms spent on the write */
+#define VCP_REQ_GET_CAPTURE              0xB8 /* IN, 16 bytes, little endian:
+                                                  [0] CAPTURE_ALT_xxx in use   [1] 1 once streaming
+                                                  [2..3] frame number of the last packet
+                                                  [4..7] packets sent   [8..11] bytes sent
+                                                  [12..15] packets not taken in their frame */
+#define VCP_REQ_SET_PROFILE              0xB9 /* wValue = VCP_PROFILE_xxx action on the power up profile, see below */
+#define VCP_REQ_GET_PROFILE              0xBA /* IN, 20 bytes, little endian:
+                                                  [0..3] rate   [4] stop bits   [5] parity   [6] data bits
+                                                  [7] VCP_PROFILE_SAVED/LOCKED flags   [8] overflow policy
+                                                  [9] passthrough on   [10..11] RS-485 configuration
+                                                  [12..13] frame gap   [14..15] records left before the next erase
+                                                  [16..19] erases of the settings flash */
+#define VCP_REQ_SET_I2C                  0xBB /* wValue = VCP_I2C_OFF/100K/400K, I2C bridge on PA9 SCL and PA10 SDA */
+#define VCP_REQ_I2C_BATCH                0xBC /* OUT, up to 64 bytes: operations run in turn, see vcp_i2c.h */
+#define VCP_REQ_GET_I2C                  0xBD /* IN, up to 64 bytes: state of the batch and the bytes read */
+#define VCP_REQ_SET_SPI                  0xBE /* wValue = clock | (mode << 8), SPI bridge on PA4 CS, PA5 SCK,
+                                                  PA6 MISO and PA7 MOSI, see vcp_spi.h; clock 0 turns it off */
+#define VCP_REQ_SPI_XFER                 0xBF /* OUT, up to 61 bytes: one exchange, see vcp_spi.h; stalls
+                                                  while the previous one runs */
+#define VCP_REQ_GET_SPI                  0xC0 /* IN, up to 64 bytes: state of the exchange and the bytes received */
+#define VCP_REQ_SET_SCREEN               0xC1 /* wValue = 1 to show the status on an ST7735 panel on the SPI
+                                                  pins, 0 to give them back, kept in flash */
+#define VCP_REQ_GET_SCREEN               0xC2 /* IN, 16 bytes, little endian:
+                                                  [0] screen on   [1] state, 4 once running   [2..3] reserved
+                                                  [4..7] refreshes   [8..11] pixels sent
+                                                  [12..15] us spent by the main loop on the screen */
+#define VCP_REQ_SET_SENSOR               0xC3 /* wValue = temperature period | gyroscope period << 8, in
+                                                  VCP_SENSOR_UNIT, 0 = off; turns the I2C bridge on at
+                                                  100 kHz if needed, kept in flash */
+#define VCP_REQ_GET_SENSOR               0xC4 /* IN, VCP_SENSOR_REPORT_SIZE bytes: the latest readings and
+                                                  the bitrate limit of the thermal derating, applied
+                                                  when the host sets a line coding */
+#define VCP_REQ_SPI_READ                 0xC5 /* IN, up to 60 bytes: wValue = VCP_SPI_HOLD_CS or 0, wLength
+                                                  bytes of 0xFF clocked on the SPI bridge and the bytes
+                                                  received, once the exchange in progress is done */
+
+/* Sniffer: each chunk of data delimited by an idle line goes to the host as
+   a record, an 8 bytes header followed by the data, little endian:
+   [0] VCP_SNIFF_SYNC   [1] VCP_SNIFF_xxx flags   [2..3] data length
+   [4..7] time in us of the end of the last character */
+#define VCP_SNIFF_SYNC                   0xA5
+#define VCP_SNIFF_HEADER_SIZE            8
+#define VCP_SNIFF_GAP                    10   /* Idle bit times ending a chunk */
+#define VCP_SNIFF_HOST                   0x01 /* Sent by the host on TX, else received on RX */
+#define VCP_SNIFF_CUT                    0x02 /* Cut at a half ring, the next chunk follows without gap */
+#define VCP_SNIFF_BREAK                  CDC_SERIAL_STATE_BREAK
+#define VCP_SNIFF_FRAMING                CDC_SERIAL_STATE_FRAMING
+#define VCP_SNIFF_PARITY                 CDC_SERIAL_STATE_PARITY
+#define VCP_SNIFF_OVERRUN                CDC_SERIAL_STATE_OVERRUN /* Characters lost by the USART or the ring */
+
+/* Self-test: the port sends a PRBS on TX at the line coding rate, most
+   significant bit first, and checks what comes back on RX, through a jumper
+   or the single wire mode that joins RX to TX inside the USART. The data of
+   the port stay off the USB while it runs */
+#define VCP_TEST_OFF                     0
+#define VCP_TEST_PRBS7                   1 /* x^7 + x^6 + 1 */
+#define VCP_TEST_PRBS15                  2 /* x^15 + x^14 + 1 */
+#define VCP_TEST_PRBS31                  3 /* x^31 + x^28 + 1 */
+#define VCP_TEST_LOOPBACK                0x0100 /* Single wire mode, no jumper needed */
+
+/* Auto-baud: USART1 measures the rate of the peer on the first character it
+   receives, the line coding of the host being only the starting point. The
+   rate found replaces it in GET_LINE_CODING. USART2 has no such hardware */
+#define VCP_AUTOBAUD_OFF                 0
+#define VCP_AUTOBAUD_START_BIT           1 /* Any character starting with a 1 bit */
+#define VCP_AUTOBAUD_FALLING_EDGE        2 /* Any character starting with 10 */
+#define VCP_AUTOBAUD_0X7F                3
+#define VCP_AUTOBAUD_0X55                4
+#define VCP_AUTOBAUD_IDLE                0
+#define VCP_AUTOBAUD_WAITING             1
+#define VCP_AUTOBAUD_LOCKED              2
+
+/* Framing: each chunk delimited by an idle line goes to the host COBS
+   encoded, the data followed by their CRC-32 (little endian) and ended by a
+   0x00. A chunk received with a framing, parity or overrun error goes with
+   its CRC inverted. The host sends its data in the same frames, one with a
+   bad CRC is dropped before reaching TX */
+#define VCP_COBS_DELIMITER               0x00
+#define VCP_COBS_CRC_SIZE                4
+#define VCP_COBS_OUT_MAX                 (APP_RX_DATA_SIZE - CDC_DATA_FS_OUT_PACKET_SIZE) /* Longest frame of the host, encoded */
+
+/* SAM-BA engine: the bridge flashes the SAMD21 behind port Y on its own.
+   Each chunk goes to the RAM of the loader by XMODEM, is written by the
+   loader, then read back as a CRC16 compared with the one of the data */
+#define VCP_SAMBA_BUFFER                 0x20004000 /* Loader RAM holding a chunk */
+#define VCP_SAMBA_CHUNK                  4096
+#define VCP_SAMBA_PAGE                   64 /* A chunk is padded with 0xFF to a whole page */
+#define VCP_SAMBA_OFF                    0
+#define VCP_SAMBA_RESET                  1 /* Reset line held */
+#define VCP_SAMBA_SYNC                   2 /* Waiting for the loader */
+#define VCP_SAMBA_IDLE                   3 /* Ready for a write */
+#define VCP_SAMBA_ERROR                  4 /* Write stopped, the loader still runs */
+#define VCP_SAMBA_BUSY                   5 /* Writing */
+#define VCP_SAMBA_ERR_NONE               0
+#define VCP_SAMBA_ERR_TIMEOUT            1 /* The loader did not answer */
+#define VCP_SAMBA_ERR_NAK                2 /* A block was refused again and again */
+#define VCP_SAMBA_ERR_REPLY              3 /* Unexpected answer */
+#define VCP_SAMBA_ERR_CRC                4 /* The flash does not hold the data */
+
+/* Control channel: the HID interface takes a command in each OUT report and
+   answers it in an IN report, the endpoints being polled every ms. It needs
+   no driver and leaves both CDC ports alone. One command at a time:
+   OUT [0] VCP_HID_xxx   [1] tag   [2..63] arguments
+   IN  [0] VCP_HID_xxx   [1] tag   [2] USBD_OK or USBD_FAIL   [3] data length   [4..63] data
+   Telemetry reports come unasked, with tag 0 */
+#define VCP_HID_REPORT_SIZE              HID_CTL_REPORT_SIZE
+#define VCP_HID_REQUEST                  0x01 /* A request of a port as on EP0: [2] port [3] bRequest, VCP_REQ_xxx
+                                                  or CDC_xxx [4..5] wValue [6] wLength [7] 1 for data IN;
+                                                  OUT data from [8], up to 56 bytes, IN data from [4] */
+#define VCP_HID_SEQUENCE                 0x02 /* Drive output lines in steps on the USB frames: [2] steps, then
+                                                  4 bytes per step from [4]: [0] VCP_HID_LINE_xxx driven
+                                                  [1] VCP_HID_LINE_xxx asserted [2..3] ms to the next step.
+                                                  Answered once the last step is applied */
+#define VCP_HID_TELEMETRY                0x03 /* [2..3] period in ms, 0 to stop. Telemetry data, little endian:
+                                                  [4..7] ms tick, then 16 bytes per port from [8]:
+                                                  [0..3] bytes received   [4..7] bytes sent to the host
+                                                  [8..11] bytes lost      [12..13] SERIAL_STATE
+                                                  [14..15] control line state of the host */
+#define VCP_HID_STEPS                    15
+#define VCP_HID_LINE_DTR_X               0x01
+#define VCP_HID_LINE_RTS_X               0x02
+#define VCP_HID_LINE_DTR_Y               0x04
+#define VCP_HID_LINE_RTS_Y               0x08
+#define VCP_HID_LINE_SAMD21_RESET        0x10 /* PB1, asserted holds the SAMD21 in reset */
+
+/* Capture: an alternate setting of the capture interface streams the data
+   received by a port on the isochronous endpoint instead of its bulk one,
+   one packet in every frame, with or without data. Each packet starts with
+   a header, little endian:
+   [0..1] frame number, counted from the start of the stream
+   [2] VCP_CAPTURE_xxx flags   [3] port
+   A frame number not following the last one tells a packet the host did
+   not get; a repeated one is a late copy and is dropped */
+#define VCP_CAPTURE_HEADER_SIZE          4
+#define VCP_CAPTURE_DATA_MAX             (CAPTURE_PACKET_SIZE - VCP_CAPTURE_HEADER_SIZE - 1) /* Never a full packet, which the PCD driver would end with a zero length one */
+#define VCP_CAPTURE_LOST                 0x01 /* Bytes were lost before the data of the packet */
+
+/* Overflow policy of the reception ring, used when the host does not read the
+   data fast enough. Every byte lost is counted and reported as an overrun */
+#define VCP_RX_DROP_OLDEST               0 /* Overwrite the unread data, keep the newest */
+#define VCP_RX_DROP_NEWEST               1 /* Keep the unread data, discard new bytes */
+#define VCP_RX_FLOW_CONTROL              2 /* Deassert the mapped RTS line while the ring is half full */
+
+/* RS-485 configuration: bits 4:0 flags, bits 10:6 DE assertion time and
+   bits 15:11 DE deassertion time, both in sample times (1/16 bit, 0 to 31) */
+#define VCP_RS485_ENABLE                 0x0001
+#define VCP_RS485_RX_BLANKING            0x0002 /* Receiver off while transmitting */
+#define VCP_RS485_DE_ACTIVE_LOW          0x0004
+#define VCP_RS485_DEAT_POS               6
+#define VCP_RS485_DEDT_POS               11
+
+/* Power up profile of a port, kept in flash and applied before the USB
+   device starts. It holds the line coding, the overflow policy, the RS-485
+   configuration and the frame gap; a locked profile also ignores the line
+   coding the host sets when it opens the port */
+#define VCP_PROFILE_CLEAR                0 /* Back to 115200 baud 8N1 and the defaults */
+#define VCP_PROFILE_SAVE                 1 /* Keep the current settings of the port */
+#define VCP_PROFILE_LOCK                 2 /* Keep them, and the line coding whatever the host sets */
+
+/* Set to 1 to time the USART interrupt handlers with SysTick (VcpIsrProfile) */
+#define VCP_ISR_PROFILE                  0
+
+/* SEND_BREAK duration (wValue, in ms) held until the host ends the break */
+#define CDC_BREAK_INFINITE               0xFFFF
+
+/* SET_CONTROL_LINE_STATE bits */
+#define CDC_CTRL_LINE_DTR                0x0001
+#define CDC_CTRL_LINE_RTS                0x0002
+
 extern USBD_CDC_ItfTypeDef  USBD_CDC_fops[2];
 
+/* Statistics of the data sent to the host on a port (VCP_REQ_GET_TX_STATS).
+   The latency runs from the first poll that saw data waiting to the start of
+   the IN transfer carrying them */
+typedef struct
+{
+    uint32_t Bytes;
+    uint32_t Transfers;
+    uint32_t Deferred;               /* Rounds with data held back by a busy endpoint or the scheduler */
+    uint16_t LatencyLast;
+    uint16_t LatencyMax;
+}
+VCP_TxStatsTypeDef;
+
+extern VCP_TxStatsTypeDef VcpTxStats[2];
+
+/* Line coding and counters of a port, for the status screen */
+typedef struct
+{
+    uint32_t Bitrate;
+    uint8_t  StopBits;               /* As in the line coding */
+    uint8_t  Parity;
+    uint8_t  DataBits;
+    uint8_t  Reserved;
+    uint32_t Received;               /* Bytes received by the USART */
+    uint32_t Sent;                   /* Bytes handed to the USART transmission */
+    uint32_t Lost;                   /* Bytes lost by the reception ring */
+    uint32_t LineErrors;             /* Parity, framing, noise and overrun errors, and breaks */
+}
+VCP_PortStatusTypeDef;
+
+#if VCP_ISR_PROFILE
+typedef struct
+{
+    uint32_t Count;                  /* Interrupts taken */
+    uint32_t Cycles;                 /* Total SysTick cycles spent in the handler */
+    uint32_t CyclesMax;
+}
+VCP_IsrProfileTypeDef;
+
+extern VCP_IsrProfileTypeDef VcpIsrProfile[2];
+#endif
+
 /* Exported macro ------------------------------------------------------------*/
 /* Exported functions ------------------------------------------------------- */
+void VCP_SerialState_Process(void);
+uint32_t VCP_Frame_Head(uint8_t port, uint32_t in, uint32_t out);
+void VCP_Frame_Release(uint8_t port);
+uint8_t VCP_Frame_Mode(uint8_t port);
+void VCP_UART_IRQHandler(uint8_t port);
+uint32_t VCP_Rx_Pending(uint8_t port, uint32_t *out);
+uint8_t VCP_Rx_Intact(uint8_t port);
+uint8_t VCP_Rx_Consume(uint8_t port, uint32_t length);
+uint32_t VCP_Rx_Recent(uint8_t port, uint8_t *pbuf);
+void VCP_RxDma_IRQHandler(uint8_t port);
+void VCP_Profile_Init(void);
+void VCP_Port_Status(uint8_t port, VCP_PortStatusTypeDef *status);
+uint32_t VCP_Sniff_Header(uint8_t port, uint8_t *pbuf, uint32_t length);
+uint32_t VCP_Sniff_HostRecord(uint8_t port, uint8_t *pbuf);
+uint8_t VCP_Test_Process(uint8_t port);
+void VCP_Autobaud_Process(void);
+uint32_t VCP_Cobs_Header(uint8_t port);
+uint32_t VCP_Cobs_Encode(uint8_t port, uint8_t *pbuf, uint32_t size);
+void VCP_Cobs_Process(void);
+void VCP_Dfu_Process(void);
+uint8_t VCP_Samba_Process(uint8_t port);
+uint8_t VCP_Capture_Process(uint8_t port, uint8_t idle);
+
 #endif /* __USBD_CDC_IF_H */
 
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
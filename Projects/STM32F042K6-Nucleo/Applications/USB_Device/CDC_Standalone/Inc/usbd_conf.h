@@ -57,31 +57,41 @@
 
 /* Exported types ------------------------------------------------------------*/
 /* Exported constants --------------------------------------------------------*/
+/* Status drive: a read-only mass storage interface showing the counters
+   and the last received bytes as files, set to 0 to leave it out */
+#define USBD_STATUS_DRIVE                     1
+
 /* Common Config */
-#define USBD_MAX_NUM_INTERFACES               4
+#if (USBD_STATUS_DRIVE == 1)
+#define USBD_MAX_NUM_INTERFACES               8
+#else
+#define USBD_MAX_NUM_INTERFACES               7
+#endif
 #define USBD_MAX_NUM_CONFIGURATION            1
 #define USBD_MAX_STR_DESC_SIZ                 0x100
 #define USBD_SUPPORT_USER_STRING              0
 #define USBD_SELF_POWERED                     1
 #define USBD_DEBUG_LEVEL                      0
 
+/* MSC Class Config: EP7, small packets to fit in the packet memory */
+#define MSC_MEDIA_PACKET                      512   /* One sector */
+#define MSC_MAX_FS_PACKET                     0x20
+#define MSC_EPIN_ADDR                         0x87
+#define MSC_EPOUT_ADDR                        0x07
+
 /* Exported macro ------------------------------------------------------------*/
 /* Memory management macros */
 
-/* For footprint reasons and since only one allocation is handled in the CDC class
-   driver, the malloc/free is changed into a static allocation method */
+/* For footprint reasons the malloc/free is changed into a static allocation
+   method: an arena sized at compile time in usbd_conf.c, allocated upwards and
+   freed in reverse order, so that a DeInit/Init cycle gets the same memory back */
 
 void *USBD_static_malloc(uint32_t size);
 void USBD_static_free(void *p);
 
-#define MAX_STATIC_ALLOC_SIZE     140 /*CDC Class Driver Structure size*/
-#if 0
+#define MAX_STATIC_ALLOC_SIZE     1024 /* Budget of the arena in bytes, checked at build time */
 #define USBD_malloc               (uint32_t *)USBD_static_malloc
 #define USBD_free                 USBD_static_free
-#else
-#define USBD_malloc               malloc
-#define USBD_free                 free
-#endif
 #define USBD_memset               /* Not used */
 #define USBD_memcpy               /* Not used */
 
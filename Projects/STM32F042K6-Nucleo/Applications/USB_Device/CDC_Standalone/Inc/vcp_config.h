@@ -0,0 +1,67 @@
+/**
+  ******************************************************************************
+  * @file    USB_Device/CDC_Standalone/Inc/vcp_config.h
+  * @brief   Header for vcp_config.c file.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __VCP_CONFIG_H
+#define __VCP_CONFIG_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f0xx_hal.h"
+
+/* Exported types ------------------------------------------------------------*/
+/* Power up profile of a port */
+typedef struct
+{
+    uint32_t Bitrate;
+    uint8_t  Format;             /* Line coding as in SET_LINE_CODING */
+    uint8_t  Parity;
+    uint8_t  DataBits;
+    uint8_t  Flags;              /* VCP_PROFILE_xxx */
+    uint8_t  RxPolicy;           /* VCP_RX_xxx */
+    uint8_t  Reserved;
+    uint16_t Rs485;              /* VCP_REQ_SET_RS485 configuration */
+    uint16_t FrameGap;           /* In bit times, 0 = stream */
+    uint16_t Reserved2;
+} VCP_PortConfigTypeDef;
+
+/* Settings kept across reboots. Each word is a key of the store: a record
+   holds the index of the word and its new value */
+typedef struct
+{
+    uint8_t  Passthrough;        /* 1: USART1 and USART2 joined, the host only watches */
+    uint8_t  Screen;             /* 1: status screen on the SPI pins */
+    uint8_t  TempPeriod;         /* Sensor periods in VCP_SENSOR_UNIT, 0 = off */
+    uint8_t  GyroPeriod;
+    VCP_PortConfigTypeDef Port[2];
+} VCP_ConfigTypeDef;
+
+/* Exported constants --------------------------------------------------------*/
+/* The settings live in the last flash pages, left out of the code area. More
+   pages spread the erases further, each one is taken from the code */
+#define VCP_CONFIG_PAGES                 1
+#define VCP_CONFIG_SIZE                  (VCP_CONFIG_PAGES * FLASH_PAGE_SIZE)
+#define VCP_CONFIG_ADDR                  (FLASH_BANK1_END + 1 - VCP_CONFIG_SIZE)
+#define VCP_CONFIG_MAGIC                 0x56435002 /* "VCP" and layout version */
+#define VCP_CONFIG_MAGIC_V1              0x56435001 /* Whole structure, passthrough only */
+
+/* VCP_PortConfigTypeDef Flags */
+#define VCP_PROFILE_SAVED                0x01 /* Saved by the host, else built-in defaults */
+#define VCP_PROFILE_LOCKED               0x02 /* SET_LINE_CODING of the host is ignored */
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported variables --------------------------------------------------------*/
+extern VCP_ConfigTypeDef VcpConfig;
+
+/* Exported functions ------------------------------------------------------- */
+void VCP_Config_Load(void);
+void VCP_Config_Defaults(uint8_t port);
+void VCP_Config_Changed(void);
+void VCP_Config_Process(void);
+uint32_t VCP_Config_Erases(void);
+uint16_t VCP_Config_Free(void);
+
+#endif /* __VCP_CONFIG_H */
@@ -0,0 +1,37 @@
+/**
+  ******************************************************************************
+  * @file    USB_Device/CDC_Standalone/Inc/vcp_drive.h
+  * @brief   Header for vcp_drive.c file.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __VCP_DRIVE_H
+#define __VCP_DRIVE_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_cdc.h"
+
+#if (USBD_STATUS_DRIVE == 1)
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+/* Volume layout, one cluster per sector */
+#define VCP_DRIVE_SECTOR_SIZE            512
+#define VCP_DRIVE_SECTORS                64   /* Declared size; the sectors past the files read as zeros */
+#define VCP_DRIVE_FAT_SECTOR             1    /* Two copies of the FAT, one sector each */
+#define VCP_DRIVE_FAT_COUNT              2
+#define VCP_DRIVE_ROOT_SECTOR            3
+#define VCP_DRIVE_ROOT_ENTRIES           16   /* One sector */
+#define VCP_DRIVE_STATUS_SECTOR          4    /* STATUS.TXT, cluster 2 */
+#define VCP_DRIVE_CAPTURE_SECTOR         5    /* CAPTURE.BIN, cluster 3 */
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported variables --------------------------------------------------------*/
+extern USBD_StorageTypeDef VCP_Drive_fops;
+
+/* Exported functions ------------------------------------------------------- */
+
+#endif /* USBD_STATUS_DRIVE */
+
+#endif /* __VCP_DRIVE_H */
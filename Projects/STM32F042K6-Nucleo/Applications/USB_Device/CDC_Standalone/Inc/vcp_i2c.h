@@ -0,0 +1,91 @@
+/**
+  ******************************************************************************
+  * @file    USB_Device/CDC_Standalone/Inc/vcp_i2c.h
+  * @brief   Header for vcp_i2c.c file.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __VCP_I2C_H
+#define __VCP_I2C_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f0xx_hal.h"
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+/* Definition for I2Cx resources: I2C1 remapped on PA9/PA10, as its default
+   pins PB6/PB7 carry USART1 */
+#define I2Cx                             I2C1
+#define I2Cx_CLK_ENABLE()                __HAL_RCC_I2C1_CLK_ENABLE()
+#define I2Cx_FORCE_RESET()               __HAL_RCC_I2C1_FORCE_RESET()
+#define I2Cx_RELEASE_RESET()             __HAL_RCC_I2C1_RELEASE_RESET()
+#define I2Cx_GPIO_CLK_ENABLE()           __HAL_RCC_GPIOA_CLK_ENABLE()
+
+#define I2Cx_SCL_PIN                     GPIO_PIN_9
+#define I2Cx_SDA_PIN                     GPIO_PIN_10
+#define I2Cx_GPIO_PORT                   GPIOA
+#define I2Cx_AF                          GPIO_AF4_I2C1
+
+#define I2Cx_IRQn                        I2C1_IRQn
+#define I2Cx_IRQHandler                  I2C1_IRQHandler
+
+/* Timings for the 8 MHz HSI clock of I2C1 */
+#define I2Cx_TIMING_100K                 0x10420F13
+#define I2Cx_TIMING_400K                 0x00310309
+
+/* Batch of operations, run one after the other (VCP_REQ_I2C_BATCH). Each one
+   starts with a code, VCP_I2C_OP_xxx | VCP_I2C_NOSTOP:
+   VCP_I2C_OP_WRITE  [1] 7-bit address [2] length, then the bytes; a length
+                     of 0 only checks that the address is acknowledged
+   VCP_I2C_OP_READ   [1] 7-bit address [2] length, 1 at least
+   VCP_I2C_OP_DELAY  [1] ms, rounded up to the polling period
+   VCP_I2C_NOSTOP leaves the bus to the next operation with a repeated start,
+   as for a register read: write the register number, then read. The last
+   write or read of a batch cannot carry it */
+#define VCP_I2C_BATCH_SIZE               64
+#define VCP_I2C_OP_WRITE                 0x01
+#define VCP_I2C_OP_READ                  0x02
+#define VCP_I2C_OP_DELAY                 0x03
+#define VCP_I2C_OP_MASK                  0x0F
+#define VCP_I2C_NOSTOP                   0x80
+
+/* Result of the batch (VCP_REQ_GET_I2C), up to 64 bytes:
+   [0] VCP_I2C_xxx state   [1] operations done   [2] HAL_I2C_ERROR_xxx of
+   the operation that failed   [3] bytes read, then the bytes read by all
+   the operations, in order */
+#define VCP_I2C_RESULT_HEADER            4
+#define VCP_I2C_DATA_SIZE                (VCP_I2C_BATCH_SIZE - VCP_I2C_RESULT_HEADER)
+#define VCP_I2C_IDLE                     0
+#define VCP_I2C_BUSY                     1
+#define VCP_I2C_DONE                     2
+#define VCP_I2C_ERROR                    3
+
+/* Bus speed (VCP_REQ_SET_I2C wValue) */
+#define VCP_I2C_OFF                      0 /* PA9/PA10 back to inputs */
+#define VCP_I2C_100K                     1
+#define VCP_I2C_400K                     2
+
+/* An operation longer than this, a slave stretching the clock for ever, ends
+   the batch with HAL_I2C_ERROR_TIMEOUT */
+#define VCP_I2C_TIMEOUT                  25 /* in ms */
+
+/* Register access for the firmware itself (the sensors): the register number,
+   then up to this many bytes written, or a repeated start and the bytes read.
+   A batch of the host arriving meanwhile waits for the end of the access */
+#define VCP_I2C_REG_SIZE                 8
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+int8_t VCP_I2C_Config(uint8_t speed);
+uint8_t VCP_I2C_PinInUse(GPIO_TypeDef *GPIOx, uint32_t pin);
+int8_t VCP_I2C_Batch(const uint8_t *pbuf, uint16_t length);
+void VCP_I2C_GetResult(uint8_t *pbuf, uint16_t length);
+int8_t VCP_I2C_RegRead(uint8_t addr, uint8_t reg, uint8_t *pbuf, uint8_t length);
+int8_t VCP_I2C_RegWrite(uint8_t addr, uint8_t reg, const uint8_t *pbuf, uint8_t length);
+uint8_t VCP_I2C_RegState(void);
+void VCP_I2C_Process(void);
+void VCP_I2C_IRQHandler(void);
+
+#endif /* __VCP_I2C_H */
@@ -0,0 +1,43 @@
+/**
+  ******************************************************************************
+  * @file    USB_Device/CDC_Standalone/Inc/vcp_screen.h
+  * @brief   Header for vcp_screen.c file.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __VCP_SCREEN_H
+#define __VCP_SCREEN_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f0xx_hal.h"
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+/* ST7735 panel, 128x160, on the pins of the SPI bridge: SPI1 transmit only,
+   PA6 (MISO of the bridge) selects command or data. The panel reset line is
+   left to the board, the panel gets a software reset */
+#define SCREEN_SPI                       SPI1
+#define SCREEN_CS_PIN                    GPIO_PIN_4
+#define SCREEN_SCK_PIN                   GPIO_PIN_5
+#define SCREEN_DC_PIN                    GPIO_PIN_6
+#define SCREEN_SDA_PIN                   GPIO_PIN_7
+#define SCREEN_GPIO_PORT                 GPIOA
+#define SCREEN_AF                        GPIO_AF0_SPI1
+#define SCREEN_PINS                      (SCREEN_CS_PIN | SCREEN_SCK_PIN | SCREEN_DC_PIN | SCREEN_SDA_PIN)
+
+/* The counters are sampled and the changed parts of the screen drawn again
+   every period; a main loop pass sends at most the budget, about 0.7 ms of
+   the bus at 12 MHz, and goes on with the next pass */
+#define VCP_SCREEN_PERIOD                100 /* in ms, multiple of CDC_POLLING_INTERVAL */
+#define VCP_SCREEN_BUDGET                512 /* in pixels */
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+void VCP_Screen_Config(uint8_t on);
+uint8_t VCP_Screen_PinInUse(GPIO_TypeDef *GPIOx, uint32_t pin);
+void VCP_Screen_Process(void);
+void VCP_Screen_GetStats(uint8_t *pbuf);
+
+#endif /* __VCP_SCREEN_H */
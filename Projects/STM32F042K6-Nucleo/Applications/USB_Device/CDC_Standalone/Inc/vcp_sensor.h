@@ -0,0 +1,66 @@
+/**
+  ******************************************************************************
+  * @file    USB_Device/CDC_Standalone/Inc/vcp_sensor.h
+  * @brief   Header for vcp_sensor.c file.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __VCP_SENSOR_H
+#define __VCP_SENSOR_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f0xx_hal.h"
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+/* Sensors on the I2C bridge bus, PA9/PA10: an STLM75 with A2..A0 low, and an
+   L3GD20 in I2C mode, CS high and SDO high. The SPI pins stay with the SPI
+   bridge and the screen */
+#define VCP_SENSOR_TEMP                  0
+#define VCP_SENSOR_GYRO                  1
+#define VCP_SENSOR_TEMP_ADDR             0x48
+#define VCP_SENSOR_GYRO_ADDR             0x6B
+
+/* Periods (VCP_REQ_SET_SENSOR wValue: temperature low byte, gyroscope high
+   byte), in units of 10 ms, 0 = off */
+#define VCP_SENSOR_UNIT                  10 /* in ms */
+
+/* State of a sensor (VCP_REQ_GET_SENSOR [0] and [1]) */
+#define VCP_SENSOR_OFF                   0
+#define VCP_SENSOR_PROBE                 1 /* Not read yet */
+#define VCP_SENSOR_RUN                   2
+#define VCP_SENSOR_FAIL                  3 /* The last access failed, tried again every period */
+
+/* Thermal derating: from each temperature on, a line coding the host sets
+   runs at the given bitrate at most, until the board is cooler by the
+   hysteresis. A port already running keeps its rate */
+#define VCP_SENSOR_HOT                   70 /* in degrees C */
+#define VCP_SENSOR_HOT_BITRATE           1000000
+#define VCP_SENSOR_CRITICAL              85 /* in degrees C */
+#define VCP_SENSOR_CRITICAL_BITRATE      115200
+#define VCP_SENSOR_HYSTERESIS            5 /* in degrees C */
+#define VCP_SENSOR_NO_LIMIT              0xFFFFFFFF
+
+/* Readings (VCP_REQ_GET_SENSOR), 24 bytes, little endian:
+   [0] temperature state   [1] gyroscope state
+   [2..3] temperature, degrees C x 256
+   [4..9] X, Y and Z rates, 8.75 mdps each at 250 dps full scale
+   [10..11] ms since the temperature was read   [12..13] the same for the
+   rates, 65535 at most or when never read
+   [14] VCP_SENSOR_DERATED   [15] ports whose last line coding was clamped,
+   bit 0 port X, bit 1 port Y   [16..19] bitrate limit, or
+   VCP_SENSOR_NO_LIMIT   [20..21] temperature errors   [22..23] gyroscope
+   errors */
+#define VCP_SENSOR_REPORT_SIZE           24
+#define VCP_SENSOR_DERATED               0x01
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+void VCP_Sensor_Config(uint8_t temp, uint8_t gyro);
+void VCP_Sensor_Process(void);
+uint32_t VCP_Sensor_MaxBitrate(void);
+void VCP_Sensor_GetReadings(uint8_t *pbuf);
+
+#endif /* __VCP_SENSOR_H */
@@ -0,0 +1,80 @@
+/**
+  ******************************************************************************
+  * @file    USB_Device/CDC_Standalone/Inc/vcp_spi.h
+  * @brief   Header for vcp_spi.c file.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __VCP_SPI_H
+#define __VCP_SPI_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f0xx_hal.h"
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+/* Definition for SPIx resources: SPI1 on PA5/PA6/PA7, the chip select on PA4
+   is driven by software so that it can stay low across several exchanges */
+#define SPIx                             SPI1
+#define SPIx_CLK_ENABLE()                __HAL_RCC_SPI1_CLK_ENABLE()
+#define SPIx_FORCE_RESET()               __HAL_RCC_SPI1_FORCE_RESET()
+#define SPIx_RELEASE_RESET()             __HAL_RCC_SPI1_RELEASE_RESET()
+#define SPIx_GPIO_CLK_ENABLE()           __HAL_RCC_GPIOA_CLK_ENABLE()
+#define SPIx_IRQn                        SPI1_IRQn
+#define SPIx_IRQHandler                  SPI1_IRQHandler
+
+#define SPIx_CS_PIN                      GPIO_PIN_4
+#define SPIx_SCK_PIN                     GPIO_PIN_5
+#define SPIx_MISO_PIN                    GPIO_PIN_6
+#define SPIx_MOSI_PIN                    GPIO_PIN_7
+#define SPIx_GPIO_PORT                   GPIOA
+#define SPIx_AF                          GPIO_AF0_SPI1
+#define SPIx_PINS                        (SPIx_CS_PIN | SPIx_SCK_PIN | SPIx_MISO_PIN | SPIx_MOSI_PIN)
+
+/* Clock (VCP_REQ_SET_SPI wValue low byte): 48 MHz >> (n + 1), from 1 = 12 MHz,
+   the fastest the pins are specified for, down to 7 = 187.5 kHz */
+#define VCP_SPI_OFF                      0 /* PA4 to PA7 back to inputs */
+#define VCP_SPI_CLOCK_MAX                7
+
+/* Mode (VCP_REQ_SET_SPI wValue high byte): bit 1 CPOL, bit 0 CPHA as usual */
+#define VCP_SPI_MODE_MASK                0x03
+#define VCP_SPI_LSB_FIRST                0x04
+
+/* Exchange (VCP_REQ_SPI_XFER), up to 61 bytes: [0] VCP_SPI_xxx flags, then
+   the bytes to send, or with VCP_SPI_FILL the number of 0xFF bytes to send.
+   The chip select goes low before the first byte, and high after the last
+   one unless VCP_SPI_HOLD_CS. The bytes are clocked from the SPI interrupt
+   once the request is over; a new exchange stalls until the previous one is
+   done. A flash read sends its command in one exchange with VCP_SPI_HOLD_CS,
+   then reads with VCP_REQ_SPI_READ: wValue VCP_SPI_HOLD_CS or 0, wLength
+   bytes of 0xFF clocked, up to 60, and the bytes received in its data
+   stage, which waits for the exchange in progress and then its own */
+#define VCP_SPI_HOLD_CS                  0x01
+#define VCP_SPI_FILL                     0x02
+
+/* Result of the exchange (VCP_REQ_GET_SPI), up to 64 bytes:
+   [0] VCP_SPI_xxx state   [1] 1 while the chip select is held low
+   [2] HAL_SPI_ERROR_xxx, or VCP_SPI_MALFORMED   [3] bytes received, then
+   the bytes received */
+#define VCP_SPI_RESULT_HEADER            4
+#define VCP_SPI_DATA_SIZE                60
+#define VCP_SPI_IDLE                     0
+#define VCP_SPI_BUSY                     1
+#define VCP_SPI_DONE                     2
+#define VCP_SPI_ERROR                    3
+#define VCP_SPI_MALFORMED                0x80
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+int8_t VCP_SPI_Config(uint8_t clock, uint8_t mode);
+uint8_t VCP_SPI_PinInUse(GPIO_TypeDef *GPIOx, uint32_t pin);
+int8_t VCP_SPI_Transfer(const uint8_t *pbuf, uint16_t length);
+uint8_t VCP_SPI_State(void);
+void VCP_SPI_GetResult(uint8_t *pbuf, uint16_t length);
+void VCP_SPI_GetData(uint8_t *pbuf, uint16_t length);
+void VCP_SPI_IRQHandler(void);
+void VCP_SPI_DoneCallback(void);
+
+#endif /* __VCP_SPI_H */
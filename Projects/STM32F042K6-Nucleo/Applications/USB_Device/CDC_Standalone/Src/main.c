@@ -49,19 +49,30 @@
 #include "main.h"
 
 /* Private typedef -----------------------------------------------------------*/
+/* IN side of a port: data received over USART wait in the reception ring
+   between Out and In until they are sent over USB */
+typedef struct
+{
+    uint32_t In;          /* Ring position up to which data can be sent */
+    uint32_t Out;         /* Ring position of the first byte not sent yet */
+    uint32_t Deficit;     /* Bytes the port may still send in this round */
+    uint32_t WaitSince;   /* Tick of the first poll that saw data waiting */
+    uint8_t  Waiting;
+    uint8_t  Busy;        /* IN transfer in progress */
+} TxPortTypeDef;
+
 /* Private define ------------------------------------------------------------*/
+/* Bytes a port may send per round while both ports have data waiting */
+#define TX_QUANTUM          (2 * CDC_DATA_FS_MAX_PACKET_SIZE)
+
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
 USBD_HandleTypeDef USBD_Device;
 volatile uint8_t timer_expired = 0;
-uint32_t UserTxBufPtrInX = 0;/* Increment this pointer or roll it back to
-start address when data are received over USART */
-uint32_t UserTxBufPtrOutX = 0; /* Increment this pointer or roll it back to
-start address when data are sent over USB */
-uint32_t UserTxBufPtrInY = 0;/* Increment this pointer or roll it back to
-start address when data are received over USART */
-uint32_t UserTxBufPtrOutY = 0; /* Increment this pointer or roll it back to
-start address when data are sent over USB */
+volatile uint8_t frame_ready = 0; /* A frame ended, or a sniffer or self-test needs the main loop */
+volatile uint8_t tx_complete[2];  /* The IN endpoint of a port is free again */
+VCP_TxStatsTypeDef VcpTxStats[2];
+static TxPortTypeDef TxPort[2];
 
 extern DMA_HandleTypeDef hdma_rx;
 extern DMA_HandleTypeDef hdmaY_rx;
@@ -71,6 +82,10 @@ extern uint8_t UART_RxBuffer[2][APP_TX_DATA_SIZE];
 
 /* Private function prototypes -----------------------------------------------*/
 static void SystemClock_Config(void);
+static void Tx_Schedule(void);
+static uint32_t Tx_Pending(uint8_t port);
+static void Tx_Send(uint8_t port, uint32_t length, uint8_t contended);
+static uint8_t Tx_Start(uint8_t port, uint32_t length);
 
 /* Private functions ---------------------------------------------------------*/
 
@@ -95,6 +110,13 @@ int main(void)
     /* Configure the system clock to get correspondent USB clock source */
     SystemClock_Config();
 
+    /* Saved settings, before the host can see the ports: the line coding of
+       the profiles, a passthrough started right away, host or not, and the
+       status screen */
+    VCP_Config_Load();
+    VCP_Profile_Init();
+    VCP_Screen_Config(VcpConfig.Screen);
+
     /* Init Device Library */
     USBD_Init(&USBD_Device, &VCP_Desc, 0);
 
@@ -104,6 +126,11 @@ int main(void)
     /* Add CDC Interface Class */
     USBD_CDC_RegisterInterface(&USBD_Device, &USBD_CDC_fops[0]);
 
+#if (USBD_STATUS_DRIVE == 1)
+    /* Add the storage behind the status drive */
+    USBD_CDC_RegisterStorage(&USBD_Device, &VCP_Drive_fops);
+#endif
+
     /* Start Device Process */
     USBD_Start(&USBD_Device);
 		
@@ -146,77 +173,263 @@ int main(void)
 
     while (1)
     {
-        uint8_t status;
-
-        if(timer_expired)
+        if(timer_expired || frame_ready || tx_complete[0] || tx_complete[1])
         {
-            uint16_t DmaCounter, length;
+            uint8_t tick = timer_expired;
 
             timer_expired = 0;
+            frame_ready = 0;
 
-            if(__HAL_DMA_GET_FLAG(&hdma_rx, __HAL_DMA_GET_TE_FLAG_INDEX(&hdma_rx)) == RESET)
+            Tx_Schedule();
+
+            /* Frames of the host waiting for TX */
+            VCP_Cobs_Process();
+
+            /* Modem inputs and line errors go out on the interrupt endpoints */
+            if (tick)
             {
-                DmaCounter = APP_TX_DATA_SIZE - __HAL_DMA_GET_COUNTER(&hdma_rx);
-                UserTxBufPtrInX = DmaCounter;
-
-                if(UserTxBufPtrOutX != UserTxBufPtrInX)
-                {
-                    if (UserTxBufPtrOutX > UserTxBufPtrInX)
-                    {
-                        memcpy(&UserTxBuffer[0][0], &UART_RxBuffer[0][UserTxBufPtrOutX], (APP_TX_DATA_SIZE - UserTxBufPtrOutX));
-                        memcpy(&UserTxBuffer[0][(APP_TX_DATA_SIZE - UserTxBufPtrOutX)], &UART_RxBuffer[0][0], UserTxBufPtrInX);
-                        length = APP_TX_DATA_SIZE + UserTxBufPtrInX - UserTxBufPtrOutX;
-                    }
-                    else
-                    {
-                        length = UserTxBufPtrInX - UserTxBufPtrOutX;
-                        memcpy(&UserTxBuffer[0][0], &UART_RxBuffer[0][UserTxBufPtrOutX], length);
-                    }
-
-                    USBD_CDC_SetTxBuffer(&USBD_Device, (uint8_t*)&UserTxBuffer[0][0], length, CDC_IN_EP1);
-
-                    status = USBD_CDC_TransmitPacket(&USBD_Device, CDC_IN_EP1);
-
-                    if(status == USBD_OK)
-                    {
-                        UserTxBufPtrOutX = UserTxBufPtrInX;
-                    }
-                }
+                VCP_SerialState_Process();
+                VCP_Autobaud_Process();
+                VCP_Config_Process();
+                VCP_I2C_Process();
+                VCP_Screen_Process();
+                VCP_Sensor_Process();
+                VCP_Dfu_Process();
             }
+        }
+
+        __WFI();
+    }
+}
+
+/**
+  * @brief  Send the data received over USART to the host. The ports are
+  *         served in turn, starting with the other port each round, and a
+  *         deficit round robin shares the rounds while both have data waiting.
+  *         A round runs on every polling tick, frame end and IN transfer end.
+  * @param  None
+  * @retval None
+  */
+static void Tx_Schedule(void)
+{
+    static uint8_t first = 0;
+    uint32_t length[2];
+    uint8_t contended;
+    uint8_t port;
+    uint8_t i;
+
+    /* Until the host configures the device the data stay in the rings, where
+       the overflow policy of each port applies */
+    if (USBD_Device.dev_state != USBD_STATE_CONFIGURED)
+    {
+        return;
+    }
+
+    length[0] = Tx_Pending(0);
+    length[1] = Tx_Pending(1);
+    contended = (length[0] != 0) && (length[1] != 0);
+
+    for (i = 0; i < 2; i++)
+    {
+        port = (first + i) & 1;
+        if (length[port] != 0)
+        {
+            Tx_Send(port, length[port], contended);
+        }
+    }
+
+    first ^= 1;
+}
+
+/**
+  * @brief  Find the data of a port waiting to be sent over USB.
+  * @param  port: CDC port index
+  * @retval Number of bytes that can be sent now, 0 when there are none or
+  *         while the IN endpoint is busy
+  */
+static uint32_t Tx_Pending(uint8_t port)
+{
+    TxPortTypeDef *tx = &TxPort[port];
+    DMA_HandleTypeDef *hdma = (port == 0) ? &hdma_rx : &hdmaY_rx;
+    uint32_t pending;
+    uint32_t record;
+
+    if (tx_complete[port])
+    {
+        tx_complete[port] = 0;
+        tx->Busy = 0;
+    }
+
+    /* A port under self-test checks its own data, none go to the host */
+    if (VCP_Test_Process(port))
+    {
+        return 0;
+    }
+
+    /* The SAM-BA engine owns port Y, the answers of the loader are its own */
+    if (VCP_Samba_Process(port))
+    {
+        return 0;
+    }
+
+    /* A captured port streams its ring on the isochronous endpoint */
+    if (VCP_Capture_Process(port, !tx->Busy))
+    {
+        return 0;
+    }
+
+    if(__HAL_DMA_GET_FLAG(hdma, __HAL_DMA_GET_TE_FLAG_INDEX(hdma)) != RESET)
+    {
+        return 0;
+    }
+
+    /* Sniffer: a packet the host sent on TX goes back first, as a record */
+    if (!tx->Busy)
+    {
+        record = VCP_Sniff_HostRecord(port, &UserTxBuffer[port][0]);
+        if (record != 0)
+        {
+            Tx_Start(port, record);
+            return 0;
+        }
+    }
+
+    pending = VCP_Rx_Pending(port, &tx->Out);
+    tx->In = VCP_Frame_Head(port, (tx->Out + pending) % APP_TX_DATA_SIZE, tx->Out);
+
+    if (tx->In == tx->Out)
+    {
+        tx->Deficit = 0;
+        tx->Waiting = 0;
+        return 0;
+    }
+
+    if (!tx->Waiting)
+    {
+        tx->Waiting = 1;
+        tx->WaitSince = HAL_GetTick();
+    }
+
+    if (tx->Busy)
+    {
+        VcpTxStats[port].Deferred++;
+        return 0;
+    }
 
-            if(__HAL_DMA_GET_FLAG(&hdmaY_rx, __HAL_DMA_GET_TE_FLAG_INDEX(&hdmaY_rx)) == RESET)
+    return (APP_TX_DATA_SIZE + tx->In - tx->Out) % APP_TX_DATA_SIZE;
+}
+
+/**
+  * @brief  Start an IN transfer with the data waiting on a port.
+  * @param  port: CDC port index
+  * @param  length: number of bytes waiting
+  * @param  contended: both ports have data waiting in this round
+  * @retval None
+  */
+static void Tx_Send(uint8_t port, uint32_t length, uint8_t contended)
+{
+    TxPortTypeDef *tx = &TxPort[port];
+    VCP_TxStatsTypeDef *stats = &VcpTxStats[port];
+    uint32_t latency;
+    uint32_t first;
+    uint32_t header;
+    uint32_t size;
+
+    if (contended)
+    {
+        tx->Deficit += TX_QUANTUM;
+        if (length > tx->Deficit)
+        {
+            /* A frame goes out whole: it waits until the port has saved
+               enough deficit, while a stream is cut to the deficit */
+            if (VCP_Frame_Mode(port))
             {
-                DmaCounter = APP_TX_DATA_SIZE - __HAL_DMA_GET_COUNTER(&hdmaY_rx);
-                UserTxBufPtrInY = DmaCounter;
-
-                if(UserTxBufPtrOutY != UserTxBufPtrInY)
-                {
-                    if (UserTxBufPtrOutY > UserTxBufPtrInY)
-                    {
-                        memcpy(&UserTxBuffer[1][0], &UART_RxBuffer[1][UserTxBufPtrOutY], (APP_TX_DATA_SIZE - UserTxBufPtrOutY));
-                        memcpy(&UserTxBuffer[1][(APP_TX_DATA_SIZE - UserTxBufPtrOutY)], &UART_RxBuffer[1][0], UserTxBufPtrInY);
-                        length = APP_TX_DATA_SIZE + UserTxBufPtrInY - UserTxBufPtrOutY;
-                    }
-                    else
-                    {
-                        length = UserTxBufPtrInY - UserTxBufPtrOutY;
-                        memcpy(&UserTxBuffer[1][0], &UART_RxBuffer[1][UserTxBufPtrOutY], length);
-                    }
-
-                    USBD_CDC_SetTxBuffer(&USBD_Device, (uint8_t*)&UserTxBuffer[1][0], length, CDC_IN_EP2);
-
-                    status = USBD_CDC_TransmitPacket(&USBD_Device, CDC_IN_EP2);
-
-                    if(status == USBD_OK)
-                    {
-                        UserTxBufPtrOutY = UserTxBufPtrInY;
-                    }
-                }
+                stats->Deferred++;
+                return;
             }
+            length = tx->Deficit;
         }
+        tx->Deficit -= length;
+    }
+    else
+    {
+        tx->Deficit = 0;
+    }
 
-        __WFI();
+    /* Sniffer: the chunk goes out as a record, framing: as a COBS frame.
+       Either fits as a chunk never exceeds APP_TX_DATA_SIZE - RX_MARGIN bytes */
+    header = VCP_Sniff_Header(port, &UserTxBuffer[port][0], length) + VCP_Cobs_Header(port);
+
+    first = APP_TX_DATA_SIZE - tx->Out;
+    if (length > first)
+    {
+        memcpy(&UserTxBuffer[port][header], &UART_RxBuffer[port][tx->Out], first);
+        memcpy(&UserTxBuffer[port][header + first], &UART_RxBuffer[port][0], length - first);
+    }
+    else
+    {
+        memcpy(&UserTxBuffer[port][header], &UART_RxBuffer[port][tx->Out], length);
     }
+
+    /* The frame uses the line errors of the chunk, still queued */
+    size = VCP_Cobs_Encode(port, &UserTxBuffer[port][0], header + length);
+
+    /* A chunk the endpoint refuses stays in the ring for the next round,
+       with the deficit it would have used */
+    if ((VCP_Rx_Intact(port) == USBD_OK) && (Tx_Start(port, size) != USBD_OK))
+    {
+        if (contended)
+        {
+            tx->Deficit += length;
+        }
+        return;
+    }
+
+    /* The bytes are out of the ring: a chunk the DMA overran during the copy
+       is dropped, the loss is accounted by the reception side */
+    tx->Out = (tx->Out + length) % APP_TX_DATA_SIZE;
+    if (tx->Out == tx->In)
+    {
+        VCP_Frame_Release(port);
+    }
+    if (VCP_Rx_Consume(port, length) != USBD_OK)
+    {
+        return;
+    }
+
+    latency = HAL_GetTick() - tx->WaitSince;
+    tx->Waiting = 0;
+
+    stats->LatencyLast = (latency > 0xFFFF) ? 0xFFFF : (uint16_t)latency;
+    if (stats->LatencyLast > stats->LatencyMax)
+    {
+        stats->LatencyMax = stats->LatencyLast;
+    }
+}
+
+/**
+  * @brief  Hand the IN buffer of a port to the endpoint.
+  * @param  port: CDC port index
+  * @param  length: number of bytes in UserTxBuffer
+  * @retval USBD_OK, or USBD_FAIL when the endpoint refused the transfer
+  */
+static uint8_t Tx_Start(uint8_t port, uint32_t length)
+{
+    VCP_TxStatsTypeDef *stats = &VcpTxStats[port];
+
+    USBD_CDC_SetTxBuffer(&USBD_Device, &UserTxBuffer[port][0], length, (port == 0) ? CDC_IN_EP1 : CDC_IN_EP2);
+
+    if (USBD_CDC_TransmitPacket(&USBD_Device, (port == 0) ? CDC_IN_EP1 : CDC_IN_EP2) != USBD_OK)
+    {
+        stats->Deferred++;
+        return USBD_FAIL;
+    }
+
+    TxPort[port].Busy = 1;
+
+    stats->Bytes += length;
+    stats->Transfers++;
+    return USBD_OK;
 }
 
 /**
@@ -99,6 +99,9 @@ void HAL_UART_MspInit(UART_HandleTypeDef *huart)
         /* Associate the initialized DMA handle to the the UART handle */
         __HAL_LINKDMA(huart, hdmarx, hdma_rx);
 
+        /*##-4- Configure the NVIC for DMA: counts the halves of the reception ring */
+        HAL_NVIC_SetPriority(USARTx_DMA_TX_RX_IRQn, 0, 1);
+        HAL_NVIC_EnableIRQ(USARTx_DMA_TX_RX_IRQn);
     }
     else if (huart->Instance == USARTy)
     {
@@ -146,6 +149,10 @@ void HAL_UART_MspInit(UART_HandleTypeDef *huart)
 
         /* Associate the initialized DMA handle to the the UART handle */
         __HAL_LINKDMA(huart, hdmarx, hdmaY_rx);
+
+        /*##-4- Configure the NVIC for DMA: counts the halves of the reception ring */
+        HAL_NVIC_SetPriority(USARTy_DMA_TX_RX_IRQn, 0, 1);
+        HAL_NVIC_EnableIRQ(USARTy_DMA_TX_RX_IRQn);
     }
     else
     {
@@ -163,6 +170,118 @@ void HAL_UART_MspInit(UART_HandleTypeDef *huart)
     HAL_NVIC_EnableIRQ(TIMx_IRQn);
 }
 
+/**
+* @brief TIM MSP Initialization
+*        This function configures the hardware resources of the break,
+*        inter-frame gap and sniffer timers:
+*           - Peripheral's clock enable
+*           - NVIC configuration: the break timers run at the USB priority since
+*             both reconfigure the USART TX pin, the gap timer at the USART one
+* @param htim: TIM handle pointer
+* @retval None
+*/
+void HAL_TIM_Base_MspInit(TIM_HandleTypeDef *htim)
+{
+    if (htim->Instance == TIMx_BRK)
+    {
+        TIMx_BRK_CLK_ENABLE();
+        HAL_NVIC_SetPriority(TIMx_BRK_IRQn, 6, 0);
+        HAL_NVIC_EnableIRQ(TIMx_BRK_IRQn);
+    }
+    else if (htim->Instance == TIMy_BRK)
+    {
+        TIMy_BRK_CLK_ENABLE();
+        HAL_NVIC_SetPriority(TIMy_BRK_IRQn, 6, 0);
+        HAL_NVIC_EnableIRQ(TIMy_BRK_IRQn);
+    }
+    else if (htim->Instance == TIMy_GAP)
+    {
+        TIMy_GAP_CLK_ENABLE();
+        HAL_NVIC_SetPriority(TIMy_GAP_IRQn, 0, 1);
+        HAL_NVIC_EnableIRQ(TIMy_GAP_IRQn);
+    }
+    else if (htim->Instance == SNIFF_TIM)
+    {
+        /* Read by the interrupt handlers, raises no interrupt itself */
+        SNIFF_TIM_CLK_ENABLE();
+    }
+}
+
+/**
+* @brief CRC MSP Initialization
+*        This function enables the clock of the CRC unit used by the framing.
+* @param hcrc: CRC handle pointer
+* @retval None
+*/
+void HAL_CRC_MspInit(CRC_HandleTypeDef *hcrc)
+{
+    __HAL_RCC_CRC_CLK_ENABLE();
+}
+
+/**
+* @brief I2C MSP Initialization
+*        This function configures the hardware resources of the I2C bridge:
+*           - Peripheral's clock enable
+*           - Peripheral's GPIO Configuration: open drain with the internal
+*             pull-ups, enough for short wires at 100 kHz
+*           - NVIC configuration at the USB priority, the requests and the
+*             bus interrupt never preempt each other
+* @param hi2c: I2C handle pointer
+* @retval None
+*/
+void HAL_I2C_MspInit(I2C_HandleTypeDef *hi2c)
+{
+    GPIO_InitTypeDef  GPIO_InitStruct;
+
+    I2Cx_GPIO_CLK_ENABLE();
+    I2Cx_CLK_ENABLE();
+
+    GPIO_InitStruct.Pin       = I2Cx_SCL_PIN | I2Cx_SDA_PIN;
+    GPIO_InitStruct.Mode      = GPIO_MODE_AF_OD;
+    GPIO_InitStruct.Pull      = GPIO_PULLUP;
+    GPIO_InitStruct.Speed     = GPIO_SPEED_FREQ_HIGH;
+    GPIO_InitStruct.Alternate = I2Cx_AF;
+    HAL_GPIO_Init(I2Cx_GPIO_PORT, &GPIO_InitStruct);
+
+    HAL_NVIC_SetPriority(I2Cx_IRQn, 6, 0);
+    HAL_NVIC_EnableIRQ(I2Cx_IRQn);
+}
+
+/**
+* @brief SPI MSP Initialization
+*        This function configures the hardware resources of the SPI bridge:
+*           - Peripheral's clock enable
+*           - Peripheral's GPIO Configuration: SCK, MISO and MOSI in
+*             alternate function, the chip select a push-pull output, high
+*           - NVIC configuration for the exchanges run by interrupt
+* @param hspi: SPI handle pointer
+* @retval None
+*/
+void HAL_SPI_MspInit(SPI_HandleTypeDef *hspi)
+{
+    GPIO_InitTypeDef  GPIO_InitStruct;
+
+    SPIx_GPIO_CLK_ENABLE();
+    SPIx_CLK_ENABLE();
+
+    GPIO_InitStruct.Pin       = SPIx_SCK_PIN | SPIx_MISO_PIN | SPIx_MOSI_PIN;
+    GPIO_InitStruct.Mode      = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull      = GPIO_PULLDOWN;
+    GPIO_InitStruct.Speed     = GPIO_SPEED_FREQ_HIGH;
+    GPIO_InitStruct.Alternate = SPIx_AF;
+    HAL_GPIO_Init(SPIx_GPIO_PORT, &GPIO_InitStruct);
+
+    HAL_GPIO_WritePin(SPIx_GPIO_PORT, SPIx_CS_PIN, GPIO_PIN_SET);
+    GPIO_InitStruct.Pin       = SPIx_CS_PIN;
+    GPIO_InitStruct.Mode      = GPIO_MODE_OUTPUT_PP;
+    GPIO_InitStruct.Pull      = GPIO_NOPULL;
+    GPIO_InitStruct.Alternate = 0;
+    HAL_GPIO_Init(SPIx_GPIO_PORT, &GPIO_InitStruct);
+
+    HAL_NVIC_SetPriority(SPIx_IRQn, 6, 0);
+    HAL_NVIC_EnableIRQ(SPIx_IRQn);
+}
+
 /**
 * @brief UART MSP De-Initialization
 *        This function frees the hardware resources used in this example:
@@ -187,6 +306,7 @@ void HAL_UART_MspDeInit(UART_HandleTypeDef *huart)
 
         /*##-4- Disable the NVIC for DMA ###########################################*/
         HAL_NVIC_DisableIRQ(USARTx_IRQn);
+        HAL_NVIC_DisableIRQ(USARTx_DMA_TX_RX_IRQn);
     }
     else if (huart->Instance == USARTy)
     {
@@ -202,6 +322,7 @@ void HAL_UART_MspDeInit(UART_HandleTypeDef *huart)
 
         /*##-4- Disable the NVIC for DMA ###########################################*/
         HAL_NVIC_DisableIRQ(USARTy_IRQn);
+        HAL_NVIC_DisableIRQ(USARTy_DMA_TX_RX_IRQn);
     }
     else
     {
@@ -209,6 +330,36 @@ void HAL_UART_MspDeInit(UART_HandleTypeDef *huart)
     }
 }
 
+/**
+* @brief I2C MSP De-Initialization
+*        This function gives back the pins of the I2C bridge.
+* @param hi2c: I2C handle pointer
+* @retval None
+*/
+void HAL_I2C_MspDeInit(I2C_HandleTypeDef *hi2c)
+{
+    I2Cx_FORCE_RESET();
+    I2Cx_RELEASE_RESET();
+
+    HAL_GPIO_DeInit(I2Cx_GPIO_PORT, I2Cx_SCL_PIN | I2Cx_SDA_PIN);
+    HAL_NVIC_DisableIRQ(I2Cx_IRQn);
+}
+
+/**
+* @brief SPI MSP De-Initialization
+*        This function gives back the pins of the SPI bridge.
+* @param hspi: SPI handle pointer
+* @retval None
+*/
+void HAL_SPI_MspDeInit(SPI_HandleTypeDef *hspi)
+{
+    SPIx_FORCE_RESET();
+    SPIx_RELEASE_RESET();
+
+    HAL_GPIO_DeInit(SPIx_GPIO_PORT, SPIx_PINS);
+    HAL_NVIC_DisableIRQ(SPIx_IRQn);
+}
+
 /**
 * @}
 */
@@ -50,12 +50,10 @@
 
 extern PCD_HandleTypeDef hpcd;
 extern USBD_HandleTypeDef USBD_Device;
-/* UART handler declared in "usbd_cdc_interface.c" file */
-extern UART_HandleTypeDef UartHandleX;
-extern UART_HandleTypeDef UartHandleY;
-
 /* TIM handler declared in "usbd_cdc_interface.c" file */
 extern TIM_HandleTypeDef TimHandle;
+extern TIM_HandleTypeDef BreakTimHandle[2];
+extern TIM_HandleTypeDef GapTimHandle;
 /* Private function prototypes -----------------------------------------------*/
 /* Private functions ---------------------------------------------------------*/
 
@@ -140,7 +138,7 @@ void USB_IRQHandler(void)
 */
 void USARTx_IRQHandler(void)
 {
-    HAL_UART_IRQHandler(&UartHandleX);
+    VCP_UART_IRQHandler(0);
 }
 
 /**
@@ -150,7 +148,7 @@ void USARTx_IRQHandler(void)
 */
 void USARTy_IRQHandler(void)
 {
-    HAL_UART_IRQHandler(&UartHandleY);
+    VCP_UART_IRQHandler(1);
 }
 
 
@@ -164,6 +162,77 @@ void TIMx_IRQHandler(void)
     HAL_TIM_IRQHandler(&TimHandle);
 }
 
+/**
+* @brief  This function handles the break timer interrupt of port X.
+* @param  None
+* @retval None
+*/
+void TIMx_BRK_IRQHandler(void)
+{
+    HAL_TIM_IRQHandler(&BreakTimHandle[0]);
+}
+
+/**
+* @brief  This function handles the break timer interrupt of port Y.
+* @param  None
+* @retval None
+*/
+void TIMy_BRK_IRQHandler(void)
+{
+    HAL_TIM_IRQHandler(&BreakTimHandle[1]);
+}
+
+/**
+* @brief  This function handles the inter-frame gap timer interrupt of port Y.
+* @param  None
+* @retval None
+*/
+void TIMy_GAP_IRQHandler(void)
+{
+    HAL_TIM_IRQHandler(&GapTimHandle);
+}
+
+/**
+* @brief  This function handles the DMA interrupt of port X: a half of the
+*         reception ring has been filled.
+* @param  None
+* @retval None
+*/
+void USARTx_DMA_TX_RX_IRQHandler(void)
+{
+    VCP_RxDma_IRQHandler(0);
+}
+
+/**
+* @brief  This function handles the DMA interrupt of port Y.
+* @param  None
+* @retval None
+*/
+void USARTy_DMA_TX_RX_IRQHandler(void)
+{
+    VCP_RxDma_IRQHandler(1);
+}
+
+/**
+* @brief  This function handles the I2C bridge interrupt.
+* @param  None
+* @retval None
+*/
+void I2Cx_IRQHandler(void)
+{
+    VCP_I2C_IRQHandler();
+}
+
+/**
+* @brief  This function handles the SPI bridge interrupt.
+* @param  None
+* @retval None
+*/
+void SPIx_IRQHandler(void)
+{
+    VCP_SPI_IRQHandler();
+}
+
 /**
 * @brief  This function handles PPP interrupt request.
 * @param  None
@@ -58,45 +58,486 @@
 */
 
 /* Private typedef -----------------------------------------------------------*/
+/* Modem line: for an output the BSRR words are computed once when the pin is
+   mapped so that applying a new line state is a single store per line */
+typedef struct
+{
+    GPIO_TypeDef *GPIOx;
+    uint32_t      AssertBSRR;
+    uint32_t      DeassertBSRR;
+    uint16_t      Pin;
+    uint8_t       Code;
+} VCP_ModemLineTypeDef;
+
+typedef struct
+{
+    VCP_ModemLineTypeDef Line[VCP_LINE_COUNT];
+    uint16_t             LineState;
+    uint16_t             ApplyCycles;    /* SysTick cycles spent in the last apply */
+    uint16_t             ApplyCyclesMax; /* Worst case since the port was configured */
+    uint16_t             SerialState;    /* Last SERIAL_STATE sent to the host */
+    uint16_t             Events;         /* Event bits waiting for the next notification */
+    __IO uint16_t        Errors;         /* UART errors latched by the interrupt handler */
+    uint8_t              RingLevel;
+    uint8_t              Holdoff;        /* Polling ticks before the next notification */
+} VCP_ModemTypeDef;
+
+/* Break generator: the TX pin is taken from the USART and driven low for the
+   duration of the break */
+typedef struct
+{
+    GPIO_TypeDef *GPIOx;
+    uint32_t      Pin;
+    uint32_t      ModerMask;
+    uint32_t      ModerOutput;
+    uint32_t      ModerAf;
+    __IO uint8_t  Active;
+    __IO uint32_t Pending;       /* Duration of a break waiting for the end of a packet, 0 = none */
+} VCP_BreakTypeDef;
+
+/* Frame mode: ring positions where frames end, queued by the interrupt
+   handlers and consumed by the main loop */
+typedef struct
+{
+    uint16_t      GapBits;       /* Gap in force, 0: stream mode */
+    uint16_t      UserBits;      /* Gap set by the host or the profile */
+    uint16_t      IdlePos;       /* Ring position at the last idle line (port Y) */
+    uint16_t      End[VCP_FRAME_QUEUE];
+    __IO uint8_t  Head;
+    __IO uint8_t  Tail;
+} VCP_FrameTypeDef;
+
+/* Reception ring: the DMA writes it in circular mode and interrupts at every
+   half, the main loop reads it. The positions are counted in bytes since the
+   reception started so that a lap of the writer over the reader shows */
+typedef struct
+{
+    __IO uint32_t Halves;        /* Half rings written by the DMA */
+    uint32_t      Read;          /* Bytes taken by the main loop */
+    __IO uint32_t Lost;          /* Bytes lost to overflows */
+    __IO uint32_t LostAt;        /* Value of Read where the last loss happened */
+    __IO uint32_t Overflows;
+    __IO uint32_t LineErrors;    /* Characters received with a line error, and breaks */
+    uint8_t       Policy;        /* VCP_RX_xxx */
+    __IO uint8_t  Paused;        /* Drop newest: bytes discarded by the USART interrupt */
+    __IO uint8_t  Throttled;     /* Flow control: RTS withdrawn */
+    __IO uint16_t Pos;           /* Passthrough: ring position written by the USART interrupt */
+} VCP_RxRingTypeDef;
+
+/* Passthrough: each USART sends what the other one received, straight from
+   its reception ring, while the host only reads the rings */
+typedef struct
+{
+    __IO uint32_t Sent[2];       /* Bytes of the ring of a port sent by the other port */
+    __IO uint32_t Dropped[2];    /* Bytes of the ring of a port overwritten before being sent */
+} VCP_PassTypeDef;
+
+/* Sniffer: a time and flags for each frame end queued, plus the packet of
+   the host being sent on TX, whose OUT endpoint stays NAKed until its record
+   is out */
+typedef struct
+{
+    uint8_t       On;
+    __IO uint8_t  Errors;        /* VCP_SNIFF_xxx flags of the chunk being received */
+    __IO uint8_t  Hold;          /* SNIFF_HOLD_xxx: what the host packet waits for */
+    uint8_t       HostLength;
+    __IO uint32_t HostStamp;     /* End of the host packet on TX */
+    uint32_t      GapUs;         /* Length of the gap ending a chunk */
+    uint32_t      Stamp[VCP_FRAME_QUEUE];
+    uint8_t       Flags[VCP_FRAME_QUEUE];
+} VCP_SniffTypeDef;
+
+/* Self-test: the pattern goes out by DMA from the two halves of the IN
+   buffer, the main loop generating one while the other is sent, and is
+   checked from the reception ring */
+typedef struct
+{
+    __IO uint8_t  Pattern;       /* VCP_TEST_xxx, VCP_TEST_OFF when stopped */
+    uint8_t       Loopback;
+    uint8_t       Locked;        /* The checker follows the pattern */
+    uint8_t       Run;           /* Matching bytes while locking, errored bytes while locked */
+    uint32_t      TxState;       /* Last 32 bits generated */
+    uint32_t      RxState;       /* Last 32 bits checked */
+    __IO uint32_t Filled;        /* Halves generated */
+    __IO uint32_t Started;       /* Halves handed to the DMA */
+    __IO uint8_t  Busy;          /* The DMA is sending a half */
+    uint16_t      RoomMin;
+    __IO uint16_t Stalls;        /* Halves sent late, the next one not being ready */
+    uint16_t      Resyncs;
+    __IO uint32_t Sent;
+    uint32_t      Received;
+    uint32_t      BitErrors;
+    uint32_t      ByteErrors;
+    uint32_t      LostBase;      /* Ring losses before the test */
+    uint32_t      StartTick;
+    uint32_t      EndTick;
+} VCP_TestTypeDef;
+
+/* Auto-baud of port X: the USART locks on its own, the main loop reads the
+   rate it found */
+typedef struct
+{
+    uint8_t       Mode;          /* VCP_AUTOBAUD_xxx */
+    __IO uint8_t  State;         /* VCP_AUTOBAUD_IDLE/WAITING/LOCKED */
+    uint16_t      Failures;      /* Characters the USART could not measure */
+    uint32_t      Rate;
+} VCP_AutobaudTypeDef;
+
+/* Framing: the OUT packets land at the start of the OUT buffer and gather
+   behind it until a frame is complete, the main loop decodes it in place */
+typedef struct
+{
+    uint8_t       On;
+    uint8_t       Skip;          /* Drop the rest of a frame too long */
+    __IO uint8_t  Pending;       /* OUT data or a transmission end for the main loop */
+    __IO uint8_t  Sending;       /* A frame of the host is going out on TX */
+    __IO uint16_t Fill;          /* Encoded bytes gathered */
+    uint16_t      Sent;          /* Encoded bytes of the frame on TX */
+    uint32_t      FramesIn;
+    uint32_t      Poisoned;      /* Frames to the host with their CRC inverted */
+    uint32_t      FramesOut;
+    uint32_t      BadFrames;
+    uint32_t      Overflows;
+} VCP_CobsTypeDef;
+
+/* SAM-BA engine of port Y: the main loop talks to the loader of the SAMD21,
+   the data of the host goes out in XMODEM blocks */
+typedef struct
+{
+    uint8_t       State;         /* VCP_SAMBA_xxx or SAMBA_xxx */
+    uint8_t       Error;         /* VCP_SAMBA_ERR_xxx */
+    uint8_t       Leave;         /* Reset to start the firmware, not the loader */
+    uint8_t       Sourced;       /* The RAM buffer has been sent to the loader */
+    uint8_t       Erased;
+    uint8_t       Retries;
+    uint8_t       BlockNum;
+    uint8_t       Line;          /* The answer is a line, not a single byte */
+    uint8_t       Waiting;       /* For an answer of the loader */
+    uint8_t       ReplyLength;
+    __IO uint8_t  TxBusy;
+    __IO uint8_t  PacketLength;  /* Bytes of the OUT packet held, 0 when none */
+    uint8_t       PacketOffset;
+    uint16_t      BlockFill;
+    uint16_t      ChunkCrc;
+    uint32_t      Address;
+    __IO uint32_t Remaining;     /* Bytes of the host still to write */
+    uint32_t      ChunkHost;     /* Bytes of the host in the chunk */
+    uint32_t      ChunkLength;   /* The same padded to a page */
+    uint32_t      ChunkSent;
+    uint32_t      Deadline;
+    uint32_t      Written;
+    uint32_t      Chunks;
+    uint32_t      CrcErrors;
+    uint32_t      StartTick;
+    uint32_t      EndTick;
+    char          Reply[16];
+    char          Cmd[20];
+} VCP_SambaTypeDef;
+
+/* Control channel: run from the USB interrupt, on the reports and the start
+   of each frame */
+typedef struct
+{
+    uint8_t       Pending;       /* HID_xxx report waiting for the IN endpoint */
+    uint8_t       Steps;         /* Steps of the sequence still to apply */
+    uint8_t       Step;
+    uint8_t       Tag;           /* Of the sequence, answered at its end */
+    uint8_t       Owed;          /* The sequence is over, its answer not sent yet */
+    uint16_t      Wait;          /* ms to the next step */
+    uint16_t      Period;        /* Telemetry, in ms, 0 when off */
+    uint16_t      Elapsed;
+    uint8_t       Sequence[VCP_HID_STEPS * 4];
+    uint32_t      Report[VCP_HID_REPORT_SIZE / 4];
+} VCP_HidTypeDef;
+
+/* Capture: the packets are made from the USB interrupt at each start of
+   frame, in the IN buffer of the port the bulk endpoint leaves unused */
+typedef struct
+{
+    __IO uint8_t  Port;          /* Captured port, CDC_PORT_NONE when off */
+    __IO uint8_t  Streaming;     /* The main loop has let go of the ring */
+    uint16_t      Frame;
+    uint16_t      Length;        /* Data in the packet of the frame */
+    uint32_t      Lost;          /* Bytes lost by the ring when the packet was made */
+    uint32_t      Packets;
+    uint32_t      Bytes;
+    uint32_t      Missed;
+} VCP_CaptureTypeDef;
+
+/* Read of the SPI bridge whose answer is owed: its exchange waits for the
+   one in progress, then its bytes go to the data stage of the request or to
+   the answer of the control channel */
+typedef struct
+{
+    uint8_t       Channel;       /* SPI_READ_xxx */
+    uint8_t       Started;       /* Its exchange is on the bus */
+    uint8_t       Flags;         /* VCP_SPI_HOLD_CS */
+    uint8_t       Length;
+    uint8_t       Tag;           /* Of the control channel command */
+    uint8_t      *Data;          /* Command buffer of the request */
+} VCP_SpiReadTypeDef;
+
 /* Private define ------------------------------------------------------------*/
+#define BREAK_HOLD                       0xFFFFFFFF /* Break held until ended by the host */
+#define RX_HALF                          (APP_TX_DATA_SIZE / 2)
+#define RX_MARGIN                        16 /* Unread bytes kept clear of the DMA when it laps */
+#define SNIFF_HOLD_UART                  0x01 /* The host packet is being sent on TX */
+#define SNIFF_HOLD_RECORD                0x02 /* Its record has not gone to the host yet */
+#define TEST_HALF                        (APP_TX_DATA_SIZE / 2)
+#define TEST_LOCK                        4 /* Matching bytes to lock: more than the 31 bits of state */
+#define TEST_UNLOCK                      8 /* Errored bytes in a row taken as a slip */
+#define AUTOBAUD_SNAP                    33 /* A rate within 1/33 (3 %) of a standard one is taken as it */
+#define COBS_OUT_OFFSET                  CDC_DATA_FS_OUT_PACKET_SIZE /* Frames of the host gather behind the packet */
+#define COBS_LINE_ERRORS                 (VCP_SNIFF_FRAMING | VCP_SNIFF_PARITY | VCP_SNIFF_OVERRUN)
+#define DFU_SYSTEM_MEMORY                0x1FFFC400 /* ROM loader of the STM32F04x, DFU on USB */
+#define DFU_DETACH_TICKS                 2 /* Polling ticks left to the status stage of DFU_DETACH */
+#define DFU_DISCONNECT_MS                20 /* Pull-up off long enough for the host to see the detach */
+
+/* SAM-BA engine */
+#define SAMBA_RESET_PORT                 GPIOB
+#define SAMBA_RESET_PIN                  GPIO_PIN_1 /* High holds the SAMD21 in reset */
+#define SAMBA_RESET_MS                   100
+#define SAMBA_REPLY_MS                   500
+#define SAMBA_ERASE_MS                   10000 /* Whole flash of a SAMD21G18 */
+#define SAMBA_SYNC_RETRIES               4
+#define SAMBA_RETRIES                    4
+/* Private states of a write, from VCP_SAMBA_BUSY */
+#define SAMBA_BEGIN                      5
+#define SAMBA_ERASE                      6
+#define SAMBA_START                      7
+#define SAMBA_BLOCK                      8
+#define SAMBA_ACK                        9
+#define SAMBA_EOT                        10
+#define SAMBA_WRITE                      11
+#define SAMBA_VERIFY                     12
+#define SAMBA_XMODEM_SOH                 0x01
+#define SAMBA_XMODEM_EOT                 0x04
+#define SAMBA_XMODEM_ACK                 0x06
+#define SAMBA_XMODEM_NAK                 0x15
+#define SAMBA_XMODEM_C                   'C'
+#define SAMBA_XMODEM_HEADER              3
+#define SAMBA_XMODEM_DATA                128
+#define SAMBA_BLOCK_SIZE                 (SAMBA_XMODEM_HEADER + SAMBA_XMODEM_DATA + 2)
+/* The block is built behind the OUT packet, the host cannot send anything
+   else while the engine owns port Y */
+#define SAMBA_BLOCK_BUF                  (&UserRxBuffer[1][CDC_DATA_FS_OUT_PACKET_SIZE])
+
+/* Report waiting in the control channel buffer; an answer is never replaced */
+#define HID_NONE                         0
+#define HID_TELEMETRY                    1
+#define HID_ANSWER                       2
+
+/* Who waits for a read of the SPI bridge */
+#define SPI_READ_NONE                    0
+#define SPI_READ_EP0                     1
+#define SPI_READ_HID                     2
 
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
-USBD_CDC_LineCodingTypeDef LineCoding =
+USBD_CDC_LineCodingTypeDef LineCoding[2] =
 {
-    115200, /* baud rate*/
-    0x00,   /* stop bits-1*/
-    0x00,   /* parity - none*/
-    0x08    /* nb. of bits 8*/
+    {
+        115200, /* baud rate*/
+        0x00,   /* stop bits-1*/
+        0x00,   /* parity - none*/
+        0x08    /* nb. of bits 8*/
+    },
+    {
+        115200, /* baud rate*/
+        0x00,   /* stop bits-1*/
+        0x00,   /* parity - none*/
+        0x08    /* nb. of bits 8*/
+    }
 };
 
 extern uint8_t UserRxBuffer[2][APP_RX_DATA_SIZE];/* Received Data over USB are stored in this buffer */
 extern uint8_t UserTxBuffer[2][APP_TX_DATA_SIZE];/* Received Data over UART (CDC interface) are stored in this buffer */
 uint8_t UART_RxBuffer[2][APP_TX_DATA_SIZE];
 extern volatile uint8_t timer_expired;
+extern volatile uint8_t frame_ready;
+extern volatile uint8_t tx_complete[2];
 
 /* UART handler declaration */
 UART_HandleTypeDef UartHandleX;
 UART_HandleTypeDef UartHandleY;
 /* TIM handler declaration */
 TIM_HandleTypeDef    TimHandle;
+TIM_HandleTypeDef    BreakTimHandle[2];
+TIM_HandleTypeDef    GapTimHandle;
+#if VCP_ISR_PROFILE
+VCP_IsrProfileTypeDef VcpIsrProfile[2];
+#endif
 /* USB handler declaration */
 extern USBD_HandleTypeDef  USBD_Device;
+/* Modem lines, timing and serial state of each port */
+static VCP_ModemTypeDef Modem[2];
+/* Break state of each port */
+static VCP_BreakTypeDef Break[2];
+/* RS-485 configuration of each port */
+static uint16_t Rs485Config[2];
+/* Frame mode state of each port */
+static VCP_FrameTypeDef Frame[2];
+static VCP_RxRingTypeDef Rx[2];
+static VCP_PassTypeDef Pass;
+static VCP_SniffTypeDef Sniff[2];
+static TIM_HandleTypeDef SniffTimHandle;
+static VCP_TestTypeDef Test[2];
+static const uint8_t NibbleBits[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+static VCP_AutobaudTypeDef Autobaud;
+static const uint32_t AutobaudModes[4] =
+{
+    UART_ADVFEATURE_AUTOBAUDRATE_ONSTARTBIT,
+    UART_ADVFEATURE_AUTOBAUDRATE_ONFALLINGEDGE,
+    UART_ADVFEATURE_AUTOBAUDRATE_ON0X7FFRAME,
+    UART_ADVFEATURE_AUTOBAUDRATE_ON0X55FRAME
+};
+static VCP_CobsTypeDef Cobs[2];
+static __IO uint8_t DfuDetach;
+static CRC_HandleTypeDef CrcHandle;
+static VCP_SambaTypeDef Samba;
+static VCP_HidTypeDef Hid;
+static VCP_CaptureTypeDef Capture;
+static VCP_SpiReadTypeDef SpiRead;
+/* Ports whose last line coding was clamped by the thermal derating, bit 0
+   port X, bit 1 port Y */
+static uint8_t Derated;
+static uint32_t TxSent[2];       /* Bytes handed to the USART transmission */
+/* CRC16 of XMODEM, 4 bits at a time */
+static const uint16_t Crc16Nibble[16] =
+{
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+static const uint32_t AutobaudRates[] =
+{
+    1200, 2400, 4800, 9600, 14400, 19200, 28800, 38400, 57600, 76800, 115200,
+    230400, 250000, 460800, 500000, 921600, 1000000, 1500000, 2000000, 3000000
+};
+static const uint8_t ModemDefaults[2][VCP_LINE_COUNT] =
+{
+    { VCPx_DTR_PIN_DEFAULT, VCPx_RTS_PIN_DEFAULT, VCPx_DCD_PIN_DEFAULT, VCPx_DSR_PIN_DEFAULT, VCPx_RI_PIN_DEFAULT },
+    { VCPy_DTR_PIN_DEFAULT, VCPy_RTS_PIN_DEFAULT, VCPy_DCD_PIN_DEFAULT, VCPy_DSR_PIN_DEFAULT, VCPy_RI_PIN_DEFAULT }
+};
 
 /* Private function prototypes -----------------------------------------------*/
 static int8_t CDC_Itf_Init_UARTx     (void);
 static int8_t CDC_Itf_DeInit_UARTx   (void);
 static int8_t CDC_Itf_Control_UARTx  (uint8_t cmd, uint8_t* pbuf, uint16_t length);
 static int8_t CDC_Itf_Receive_UARTx  (uint8_t* pbuf, uint32_t *Len);
+static int8_t CDC_Itf_TransmitCplt_UARTx (uint8_t* pbuf, uint32_t *Len, uint8_t epnum);
+static int8_t CDC_Itf_Detach         (uint16_t timeout);
+static int8_t CDC_Itf_Report         (uint8_t* pbuf, uint32_t len);
+static int8_t CDC_Itf_Sof            (void);
+static int8_t CDC_Itf_Capture        (uint8_t alt);
 
 static int8_t CDC_Itf_Init_UARTy     (void);
 static int8_t CDC_Itf_DeInit_UARTy   (void);
 static int8_t CDC_Itf_Control_UARTy  (uint8_t cmd, uint8_t* pbuf, uint16_t length);
 static int8_t CDC_Itf_Receive_UARTy  (uint8_t* pbuf, uint32_t *Len);
+static int8_t CDC_Itf_TransmitCplt_UARTy (uint8_t* pbuf, uint32_t *Len, uint8_t epnum);
 
 static void Error_Handler(void);
 static void ComPort_Config(UART_HandleTypeDef *UartHandle);
+static void Uart_SetCoding(UART_HandleTypeDef *UartHandle, USBD_CDC_LineCodingTypeDef *coding);
 static void TIM_Config(void);
+static void Modem_Init(uint8_t port);
+static int8_t Modem_SetLine(uint8_t port, uint8_t line, uint8_t code);
+static int8_t Modem_CheckLine(uint8_t port, uint8_t line, uint8_t code, GPIO_TypeDef **GPIOx);
+static int8_t Modem_Map(uint8_t port, uint8_t dtr, uint8_t rts);
+static void Modem_Apply(uint8_t port, uint16_t state);
+static void Modem_GetMap(uint8_t port, uint8_t *pbuf);
+static uint8_t Modem_ReadLine(VCP_ModemLineTypeDef *line);
+static void Modem_Notify(uint8_t port);
+static void Break_Init(uint8_t port, GPIO_TypeDef *GPIOx, uint32_t pin, TIM_TypeDef *tim);
+static void Break_Start(uint8_t port, uint32_t us);
+static void Break_End(uint8_t port);
+static void Break_Resume(uint8_t port);
+static void Derate_Clamp(uint8_t port);
+static uint8_t Modem_PinInUse(GPIO_TypeDef *GPIOx, uint32_t pin, VCP_ModemLineTypeDef *self);
+static int8_t RS485_Config(uint8_t port, uint16_t config);
+static void RS485_Apply(UART_HandleTypeDef *UartHandle, uint16_t config);
+static void OnePulse_Init(TIM_HandleTypeDef *htim, TIM_TypeDef *tim);
+static void OnePulse_Start(TIM_HandleTypeDef *htim, uint32_t cycles);
+static void Frame_Config(uint8_t port, uint16_t gap);
+static void Frame_Restart(uint8_t port);
+static void Frame_Apply(UART_HandleTypeDef *UartHandle, uint16_t gap);
+static void Frame_Push(uint8_t port, UART_HandleTypeDef *UartHandle);
+static void Uart_TxInit(uint8_t port);
+static void Tx_GetStats(uint8_t port, uint8_t *pbuf);
+static void Rx_Start(uint8_t port);
+static uint32_t Rx_Written(uint8_t port);
+static void Rx_Loss(uint8_t port, uint32_t count);
+static void Rx_Check(uint8_t port);
+static void Rx_Throttle(uint8_t port, uint8_t on);
+static void Rx_GetStats(uint8_t port, uint8_t *pbuf);
+static void Uart_Transmit(uint8_t port, uint8_t *pbuf, uint32_t len);
+static uint8_t Uart_TxStop(uint8_t port);
+static void Uart_LineError(uint8_t port, UART_HandleTypeDef *UartHandle, uint32_t isr);
+static void Uart_Open(uint8_t port);
+static uint16_t Rx_Pos(uint8_t port);
+static int8_t Pass_Config(uint8_t mode);
+static void Pass_Receive(uint8_t port, uint8_t data);
+static void Pass_Forward(uint8_t port);
+static void Pass_GetStats(uint8_t *pbuf);
+static int8_t Profile_Config(uint8_t port, uint16_t action);
+static void Profile_Get(uint8_t port, uint8_t *pbuf);
+static int8_t I2c_Config(uint8_t speed);
+static int8_t Spi_Config(uint8_t clock, uint8_t mode);
+static int8_t Spi_Transfer(uint8_t *pbuf, uint16_t length);
+static int8_t Spi_Read(uint8_t *pbuf, uint16_t length);
+static void Spi_Reply(int8_t status);
+static int8_t Screen_Config(uint8_t on);
+static int8_t Sensor_Config(uint8_t temp, uint8_t gyro);
+static int8_t Sniff_Config(uint8_t port, uint8_t on);
+static void Sniff_Host(uint8_t port, uint32_t len);
+static void Sniff_Release(uint8_t port, uint8_t hold);
+static void Sniff_Cut(uint8_t port);
+static void Sniff_Encode(uint8_t *pbuf, uint8_t flags, uint32_t length, uint32_t stamp);
+static void Sniff_GetState(uint8_t port, uint8_t *pbuf);
+static int8_t Test_Config(uint8_t port, uint16_t value);
+static void Test_Apply(UART_HandleTypeDef *UartHandle, uint8_t port);
+static void Test_Start(uint8_t port);
+static void Test_End(uint8_t port);
+static void Test_Send(uint8_t port);
+static void Test_TxDone(uint8_t port);
+static void Test_Check(VCP_TestTypeDef *test, const uint8_t *pbuf, uint32_t len);
+static uint8_t Prbs_Next(uint32_t *state, uint8_t pattern);
+static void Test_GetStats(uint8_t port, uint8_t *pbuf);
+static int8_t Autobaud_Config(uint8_t port, uint8_t mode);
+static void Autobaud_GetState(uint8_t port, uint8_t *pbuf);
+static int8_t Cobs_Config(uint8_t port, uint8_t on);
+static void Cobs_Receive(uint8_t port, uint8_t *pbuf, uint32_t len);
+static void Cobs_Sent(uint8_t port);
+static void Cobs_Out(uint8_t port);
+static uint32_t Cobs_Decode(uint8_t *pbuf, uint32_t len);
+static uint32_t Cobs_Crc(uint8_t *pbuf, uint32_t len);
+static void Cobs_GetStats(uint8_t port, uint8_t *pbuf);
+static void Dfu_Jump(void);
+static int8_t Samba_Config(uint8_t port, uint8_t on);
+static void Samba_Close(void);
+static int8_t Samba_Write(uint8_t *pbuf);
+static void Samba_Receive(uint8_t *pbuf, uint32_t len);
+static void Samba_Sent(void);
+static void Samba_Expect(char c);
+static void Samba_Ignore(void);
+static void Samba_Chunk(void);
+static void Samba_Block(void);
+static void Samba_Verify(void);
+static void Samba_Command(char c, uint32_t a, uint32_t b, uint8_t args);
+static void Samba_Send(uint8_t *pbuf, uint32_t len, uint8_t line);
+static uint8_t Samba_Reply(void);
+static void Samba_Fail(uint8_t error);
+static uint16_t Samba_Crc16(uint16_t crc, const uint8_t *pbuf, uint32_t len);
+static void Samba_GetState(uint8_t *pbuf);
+static int8_t Hid_Request(uint8_t *pbuf, uint8_t *report);
+static int8_t Hid_Sequence(uint8_t *pbuf);
+static void Hid_Step(void);
+static void Hid_Drive(uint8_t lines, uint8_t levels);
+static void Hid_Answer(uint8_t cmd, uint8_t tag, int8_t status);
+static void Hid_Telemetry(void);
+static void Hid_Flush(void);
+static void Capture_Send(void);
+static void Capture_GetState(uint8_t *pbuf);
 
 USBD_CDC_ItfTypeDef USBD_CDC_fops[2] =
 {
@@ -104,13 +545,23 @@ USBD_CDC_ItfTypeDef USBD_CDC_fops[2] =
         CDC_Itf_Init_UARTx,
         CDC_Itf_DeInit_UARTx,
         CDC_Itf_Control_UARTx,
-        CDC_Itf_Receive_UARTx
+        CDC_Itf_Receive_UARTx,
+        CDC_Itf_TransmitCplt_UARTx,
+        CDC_Itf_Detach,
+        CDC_Itf_Report,
+        CDC_Itf_Sof,
+        CDC_Itf_Capture
     },
     {
         CDC_Itf_Init_UARTy,
         CDC_Itf_DeInit_UARTy,
         CDC_Itf_Control_UARTy,
-        CDC_Itf_Receive_UARTy
+        CDC_Itf_Receive_UARTy,
+        CDC_Itf_TransmitCplt_UARTy,
+        NULL,                   /* The DFU runtime, the control channel and */
+        NULL,                   /* the capture are served by the first port */
+        NULL,
+        NULL
     }
 };
 
@@ -124,40 +575,50 @@ USBD_CDC_ItfTypeDef USBD_CDC_fops[2] =
 */
 static int8_t CDC_Itf_Init_UARTx()
 {
-    /*##-1- Configure the UART peripheral ######################################*/
-    /* Put the USART peripheral in the Asynchronous mode (UART Mode) */
-    /* USART configured as follow:
-    - Word Length = 8 Bits
-    - Stop Bit    = One Stop bit
-    - Parity      = No parity
-    - BaudRate    = 115200 baud
-    - Hardware flow control disabled (RTS and CTS signals) */
-    UartHandleX.Instance        = USARTx;
-    UartHandleX.Init.BaudRate   = 115200;
-    UartHandleX.Init.WordLength = UART_WORDLENGTH_8B;
-    UartHandleX.Init.StopBits   = UART_STOPBITS_1;
-    UartHandleX.Init.Parity     = UART_PARITY_NONE;
-    UartHandleX.Init.HwFlowCtl  = UART_HWCONTROL_NONE;
-    UartHandleX.Init.Mode       = UART_MODE_TX_RX;
-
-    if(HAL_UART_Init(&UartHandleX) != HAL_OK)
+    /*##-8- Start with the sniffer and the framing off #########################*/
+    /* Before the USART opens, so that it takes the frame gap of the profile;
+       the USART of a passthrough keeps running as it is */
+    Sniff[0].Hold = 0;
+    Sniff[0].On = 0;
+    Sniff[0].Errors = 0;
+    memset(&Cobs[0], 0, sizeof (Cobs[0]));
+
+    /*##-1- Configure the UART peripheral and start the reception ##############*/
+    /* A passthrough keeps its ports running whatever the host does */
+    if (!VcpConfig.Passthrough)
     {
-        /* Initialization Error */
-        Error_Handler();
+        Uart_Open(0);
     }
 
-    /*##-2- Put UART peripheral in IT reception process ########################*/
-    /* Any data received will stored in "UserTxBuffer" buffer  */
-    UartHandleX.pRxBuffPtr = (uint8_t*)&UART_RxBuffer[0][0];
-    UartHandleX.RxXferSize = APP_TX_DATA_SIZE;
-    UartHandleX.ErrorCode = HAL_UART_ERROR_NONE;
-
-    HAL_UART_Receive_DMA(&UartHandleX, (uint8_t*)&UART_RxBuffer[0][0], APP_TX_DATA_SIZE);
-
     /*##-5- Set Application Buffers ############################################*/
     USBD_CDC_SetTxBuffer(&USBD_Device, UserTxBuffer[0], 0, CDC_IN_EP1);
     USBD_CDC_SetRxBuffer(&USBD_Device, UserRxBuffer[0], CDC_OUT_EP1);
 
+    /*##-6- Map the modem control lines ########################################*/
+    Modem_Init(0);
+
+    /*##-7- Prepare the break generator ########################################*/
+    Break_Init(0, USARTx_TX_GPIO_PORT, USARTx_TX_PIN, TIMx_BRK);
+
+    /*##-9- Trust the line coding of the host until told otherwise #############*/
+    Autobaud.Mode = VCP_AUTOBAUD_OFF;
+    Autobaud.State = VCP_AUTOBAUD_IDLE;
+
+    /*##-11- No IN transfer survives a new configuration #######################*/
+    memset(&VcpTxStats[0], 0, sizeof (VcpTxStats[0]));
+    tx_complete[0] = 1;
+
+    /*##-12- The control channel starts idle ###################################*/
+    Hid.Pending = HID_NONE;
+    Hid.Steps = 0;
+    Hid.Owed = 0;
+    Hid.Wait = 0;
+    Hid.Period = 0;
+
+    /*##-13- The capture interface starts on its alternate setting 0 ##########*/
+    Capture.Port = CDC_PORT_NONE;
+    Capture.Streaming = 0;
+
     /*##-3- Configure the TIM Base generation  #################################*/
     TIM_Config();
 
@@ -180,40 +641,42 @@ static int8_t CDC_Itf_Init_UARTx()
 */
 static int8_t CDC_Itf_Init_UARTy()
 {
-    /*##-1- Configure the UART peripheral ######################################*/
-    /* Put the USART peripheral in the Asynchronous mode (UART Mode) */
-    /* USART configured as follow:
-    - Word Length = 8 Bits
-    - Stop Bit    = One Stop bit
-    - Parity      = No parity
-    - BaudRate    = 115200 baud
-    - Hardware flow control disabled (RTS and CTS signals) */
-    UartHandleY.Instance        = USARTy;
-    UartHandleY.Init.BaudRate   = 115200;
-    UartHandleY.Init.WordLength = UART_WORDLENGTH_8B;
-    UartHandleY.Init.StopBits   = UART_STOPBITS_1;
-    UartHandleY.Init.Parity     = UART_PARITY_NONE;
-    UartHandleY.Init.HwFlowCtl  = UART_HWCONTROL_NONE;
-    UartHandleY.Init.Mode       = UART_MODE_TX_RX;
-
-    if(HAL_UART_Init(&UartHandleY) != HAL_OK)
+    /*##-8- Start with the sniffer, the framing and the SAM-BA engine off ######*/
+    /* Before the USART opens, so that it takes the frame gap of the profile;
+       the USART of a passthrough keeps running as it is */
+    Sniff[1].Hold = 0;
+    Sniff[1].On = 0;
+    Sniff[1].Errors = 0;
+    memset(&Cobs[1], 0, sizeof (Cobs[1]));
+    if (Samba.State != VCP_SAMBA_OFF)
     {
-        /* Initialization Error */
-        Error_Handler();
+        HAL_GPIO_WritePin(SAMBA_RESET_PORT, SAMBA_RESET_PIN, GPIO_PIN_RESET);
     }
+    Samba.State = VCP_SAMBA_OFF;
+    Samba.TxBusy = 0;
+    Samba.PacketLength = 0;
 
-    /*##-2- Put UART peripheral in IT reception process ########################*/
-    /* Any data received will stored in "UserTxBuffer" buffer  */
-    UartHandleY.pRxBuffPtr = (uint8_t*)&UART_RxBuffer[1][0];
-    UartHandleY.RxXferSize = APP_TX_DATA_SIZE;
-    UartHandleY.ErrorCode = HAL_UART_ERROR_NONE;
-
-    HAL_UART_Receive_DMA(&UartHandleY, (uint8_t*)&UART_RxBuffer[1][0], APP_TX_DATA_SIZE);
+    /*##-1- Configure the UART peripheral and start the reception ##############*/
+    /* A passthrough keeps its ports running whatever the host does */
+    if (!VcpConfig.Passthrough)
+    {
+        Uart_Open(1);
+    }
 
     /*##-5- Set Application Buffers ############################################*/
     USBD_CDC_SetTxBuffer(&USBD_Device, UserTxBuffer[1], 0, CDC_IN_EP2);
     USBD_CDC_SetRxBuffer(&USBD_Device, UserRxBuffer[1], CDC_OUT_EP2);
 
+    /*##-6- Map the modem control lines ########################################*/
+    Modem_Init(1);
+
+    /*##-7- Prepare the break generator ########################################*/
+    Break_Init(1, USARTy_TX_GPIO_PORT, USARTy_TX_PIN, TIMy_BRK);
+
+    /*##-11- No IN transfer survives a new configuration #######################*/
+    memset(&VcpTxStats[1], 0, sizeof (VcpTxStats[1]));
+    tx_complete[1] = 1;
+
     /*##-3- Configure the TIM Base generation  #################################*/
     TIM_Config();
 
@@ -236,6 +699,14 @@ static int8_t CDC_Itf_Init_UARTy()
 */
 static int8_t CDC_Itf_DeInit_UARTx(void)
 {
+    Break_End(0);
+    if (VcpConfig.Passthrough)
+    {
+        return (USBD_OK);
+    }
+    Test_End(0);
+    Uart_TxStop(0);
+
     /* DeInitialize the UART peripheral */
     if(HAL_UART_DeInit(&UartHandleX) != HAL_OK)
     {
@@ -253,6 +724,14 @@ static int8_t CDC_Itf_DeInit_UARTx(void)
 */
 static int8_t CDC_Itf_DeInit_UARTy(void)
 {
+    Break_End(1);
+    if (VcpConfig.Passthrough)
+    {
+        return (USBD_OK);
+    }
+    Test_End(1);
+    Uart_TxStop(1);
+
     /* DeInitialize the UART peripheral */
     if(HAL_UART_DeInit(&UartHandleY) != HAL_OK)
     {
@@ -295,11 +774,17 @@ static int8_t CDC_Itf_Control_UARTx (uint8_t cmd, uint8_t* pbuf, uint16_t length
         break;
 
     case CDC_SET_LINE_CODING:
-        LineCoding.bitrate    = (uint32_t)(pbuf[0] | (pbuf[1] << 8) |\
-                                           (pbuf[2] << 16) | (pbuf[3] << 24));
-        LineCoding.format     = pbuf[4];
-        LineCoding.paritytype = pbuf[5];
-        LineCoding.datatype   = pbuf[6];
+        /* A locked profile keeps its line coding whatever the host opens it with */
+        if (VcpConfig.Port[0].Flags & VCP_PROFILE_LOCKED)
+        {
+            break;
+        }
+        LineCoding[0].bitrate    = (uint32_t)(pbuf[0] | (pbuf[1] << 8) |\
+                                              (pbuf[2] << 16) | (pbuf[3] << 24));
+        LineCoding[0].format     = pbuf[4];
+        LineCoding[0].paritytype = pbuf[5];
+        LineCoding[0].datatype   = pbuf[6];
+        Derate_Clamp(0);
 
         /* Set the new configuration */
         ComPort_Config(&UartHandleX);
@@ -307,23 +792,193 @@ static int8_t CDC_Itf_Control_UARTx (uint8_t cmd, uint8_t* pbuf, uint16_t length
         break;
 
     case CDC_GET_LINE_CODING:
-        pbuf[0] = (uint8_t)(LineCoding.bitrate);
-        pbuf[1] = (uint8_t)(LineCoding.bitrate >> 8);
-        pbuf[2] = (uint8_t)(LineCoding.bitrate >> 16);
-        pbuf[3] = (uint8_t)(LineCoding.bitrate >> 24);
-        pbuf[4] = LineCoding.format;
-        pbuf[5] = LineCoding.paritytype;
-        pbuf[6] = LineCoding.datatype;
+        pbuf[0] = (uint8_t)(LineCoding[0].bitrate);
+        pbuf[1] = (uint8_t)(LineCoding[0].bitrate >> 8);
+        pbuf[2] = (uint8_t)(LineCoding[0].bitrate >> 16);
+        pbuf[3] = (uint8_t)(LineCoding[0].bitrate >> 24);
+        pbuf[4] = LineCoding[0].format;
+        pbuf[5] = LineCoding[0].paritytype;
+        pbuf[6] = LineCoding[0].datatype;
 
         /* Add your code here */
         break;
 
     case CDC_SET_CONTROL_LINE_STATE:
-        /* Add your code here */
+        /* wValue of the setup request carries the DTR/RTS bits */
+        Modem_Apply(0, (uint16_t)(pbuf[2] | (pbuf[3] << 8)));
         break;
 
     case CDC_SEND_BREAK:
-        /* Add your code here */
+        /* wValue of the setup request carries the duration in ms */
+        if ((pbuf[2] | (pbuf[3] << 8)) == CDC_BREAK_INFINITE)
+        {
+            Break_Start(0, BREAK_HOLD);
+        }
+        else
+        {
+            Break_Start(0, (uint32_t)(pbuf[2] | (pbuf[3] << 8)) * 1000);
+        }
+        break;
+
+    case VCP_REQ_SEND_BREAK_US:
+        Break_Start(0, (uint32_t)(pbuf[2] | (pbuf[3] << 8)));
+        break;
+
+    case VCP_REQ_SET_RS485:
+        if (RS485_Config(0, (uint16_t)(pbuf[2] | (pbuf[3] << 8))) != USBD_OK)
+        {
+            return (USBD_FAIL);
+        }
+        break;
+
+    case VCP_REQ_GET_RS485:
+        pbuf[0] = (uint8_t)(Rs485Config[0]);
+        pbuf[1] = (uint8_t)(Rs485Config[0] >> 8);
+        break;
+
+    case VCP_REQ_SET_FRAME_GAP:
+        Frame_Config(0, (uint16_t)(pbuf[2] | (pbuf[3] << 8)));
+        break;
+
+    case VCP_REQ_GET_FRAME_GAP:
+        pbuf[0] = (uint8_t)(Frame[0].GapBits);
+        pbuf[1] = (uint8_t)(Frame[0].GapBits >> 8);
+        break;
+
+    case VCP_REQ_GET_TX_STATS:
+        Tx_GetStats(0, pbuf);
+        break;
+
+    case VCP_REQ_SET_RX_POLICY:
+        if ((pbuf[2] | (pbuf[3] << 8)) > VCP_RX_FLOW_CONTROL)
+        {
+            return (USBD_FAIL);
+        }
+        Rx[0].Policy = pbuf[2];
+        __disable_irq();
+        Rx_Check(0);
+        __enable_irq();
+        break;
+
+    case VCP_REQ_GET_RX_STATS:
+        Rx_GetStats(0, pbuf);
+        break;
+
+    case VCP_REQ_SET_SNIFF:
+        return Sniff_Config(0, pbuf[2]);
+
+    case VCP_REQ_GET_SNIFF:
+        Sniff_GetState(0, pbuf);
+        break;
+
+    case VCP_REQ_SET_TEST:
+        return Test_Config(0, (uint16_t)(pbuf[2] | (pbuf[3] << 8)));
+
+    case VCP_REQ_GET_TEST:
+        Test_GetStats(0, pbuf);
+        break;
+
+    case VCP_REQ_SET_AUTOBAUD:
+        return Autobaud_Config(0, pbuf[2]);
+
+    case VCP_REQ_GET_AUTOBAUD:
+        Autobaud_GetState(0, pbuf);
+        break;
+
+    case VCP_REQ_SET_COBS:
+        return Cobs_Config(0, pbuf[2]);
+
+    case VCP_REQ_GET_COBS:
+        Cobs_GetStats(0, pbuf);
+        break;
+
+    case VCP_REQ_SET_SAMBA:
+        return Samba_Config(0, pbuf[2]);
+
+    case VCP_REQ_SAMBA_WRITE:
+        return (USBD_FAIL);
+
+    case VCP_REQ_GET_SAMBA:
+        Samba_GetState(pbuf);
+        break;
+
+    case VCP_REQ_GET_CAPTURE:
+        Capture_GetState(pbuf);
+        break;
+
+    case VCP_REQ_SET_PASSTHROUGH:
+        if (Pass_Config(pbuf[2]) != USBD_OK)
+        {
+            return (USBD_FAIL);
+        }
+        break;
+
+    case VCP_REQ_GET_PASSTHROUGH:
+        Pass_GetStats(pbuf);
+        break;
+
+    case VCP_REQ_SET_PROFILE:
+        return Profile_Config(0, (uint16_t)(pbuf[2] | (pbuf[3] << 8)));
+
+    case VCP_REQ_GET_PROFILE:
+        Profile_Get(0, pbuf);
+        break;
+
+    case VCP_REQ_SET_I2C:
+        return I2c_Config(pbuf[2]);
+
+    case VCP_REQ_I2C_BATCH:
+        return VCP_I2C_Batch(pbuf, length);
+
+    case VCP_REQ_GET_I2C:
+        VCP_I2C_GetResult(pbuf, length);
+        break;
+
+    case VCP_REQ_SET_SPI:
+        return Spi_Config(pbuf[2], pbuf[3]);
+
+    case VCP_REQ_SPI_XFER:
+        return Spi_Transfer(pbuf, length);
+
+    case VCP_REQ_SPI_READ:
+        return Spi_Read(pbuf, length);
+
+    case VCP_REQ_GET_SPI:
+        VCP_SPI_GetResult(pbuf, length);
+        break;
+
+    case VCP_REQ_SET_SCREEN:
+        return Screen_Config(pbuf[2]);
+
+    case VCP_REQ_GET_SCREEN:
+        VCP_Screen_GetStats(pbuf);
+        break;
+
+    case VCP_REQ_SET_SENSOR:
+        return Sensor_Config(pbuf[2], pbuf[3]);
+
+    case VCP_REQ_GET_SENSOR:
+        VCP_Sensor_GetReadings(pbuf);
+        pbuf[15] = Derated;
+        break;
+
+    case VCP_REQ_GET_MODEM_MAP:
+        Modem_GetMap(0, pbuf);
+        break;
+
+    case VCP_REQ_SET_MODEM_MAP:
+        if (Modem_Map(0, pbuf[2], pbuf[3]) != USBD_OK)
+        {
+            return (USBD_FAIL);
+        }
+        break;
+
+    case VCP_REQ_SET_INPUT_MAP:
+        if ((pbuf[3] < VCP_LINE_DCD) || (pbuf[3] >= VCP_LINE_COUNT) ||
+            (Modem_SetLine(0, pbuf[3], pbuf[2]) != USBD_OK))
+        {
+            return (USBD_FAIL);
+        }
         break;
 
     default:
@@ -366,17 +1021,23 @@ static int8_t CDC_Itf_Control_UARTy (uint8_t cmd, uint8_t* pbuf, uint16_t length
         break;
 
     case CDC_SET_LINE_CODING:
-        LineCoding.bitrate    = (uint32_t)(pbuf[0] | (pbuf[1] << 8) |\
-                                           (pbuf[2] << 16) | (pbuf[3] << 24));
-        LineCoding.format     = pbuf[4];
-        LineCoding.paritytype = pbuf[5];
-        LineCoding.datatype   = pbuf[6];
+        /* A locked profile keeps its line coding whatever the host opens it with */
+        if (VcpConfig.Port[1].Flags & VCP_PROFILE_LOCKED)
+        {
+            break;
+        }
+        LineCoding[1].bitrate    = (uint32_t)(pbuf[0] | (pbuf[1] << 8) |\
+                                              (pbuf[2] << 16) | (pbuf[3] << 24));
+        LineCoding[1].format     = pbuf[4];
+        LineCoding[1].paritytype = pbuf[5];
+        LineCoding[1].datatype   = pbuf[6];
+        Derate_Clamp(1);
 
         /* Set the new configuration */
         ComPort_Config(&UartHandleY);
 		
 				// ----- alfran ----- begin -----
-				if (LineCoding.bitrate == 1200) 
+				if (LineCoding[1].bitrate == 1200) 
 					{
 								// Reset SAMD21
 								HAL_GPIO_WritePin(GPIOB, GPIO_PIN_1, GPIO_PIN_SET);
@@ -388,23 +1049,193 @@ static int8_t CDC_Itf_Control_UARTy (uint8_t cmd, uint8_t* pbuf, uint16_t length
         break;
 
     case CDC_GET_LINE_CODING:
-        pbuf[0] = (uint8_t)(LineCoding.bitrate);
-        pbuf[1] = (uint8_t)(LineCoding.bitrate >> 8);
-        pbuf[2] = (uint8_t)(LineCoding.bitrate >> 16);
-        pbuf[3] = (uint8_t)(LineCoding.bitrate >> 24);
-        pbuf[4] = LineCoding.format;
-        pbuf[5] = LineCoding.paritytype;
-        pbuf[6] = LineCoding.datatype;
+        pbuf[0] = (uint8_t)(LineCoding[1].bitrate);
+        pbuf[1] = (uint8_t)(LineCoding[1].bitrate >> 8);
+        pbuf[2] = (uint8_t)(LineCoding[1].bitrate >> 16);
+        pbuf[3] = (uint8_t)(LineCoding[1].bitrate >> 24);
+        pbuf[4] = LineCoding[1].format;
+        pbuf[5] = LineCoding[1].paritytype;
+        pbuf[6] = LineCoding[1].datatype;
 
         /* Add your code here */
         break;
 
     case CDC_SET_CONTROL_LINE_STATE:
-        /* Add your code here */
+        /* wValue of the setup request carries the DTR/RTS bits */
+        Modem_Apply(1, (uint16_t)(pbuf[2] | (pbuf[3] << 8)));
         break;
 
     case CDC_SEND_BREAK:
-        /* Add your code here */
+        /* wValue of the setup request carries the duration in ms */
+        if ((pbuf[2] | (pbuf[3] << 8)) == CDC_BREAK_INFINITE)
+        {
+            Break_Start(1, BREAK_HOLD);
+        }
+        else
+        {
+            Break_Start(1, (uint32_t)(pbuf[2] | (pbuf[3] << 8)) * 1000);
+        }
+        break;
+
+    case VCP_REQ_SEND_BREAK_US:
+        Break_Start(1, (uint32_t)(pbuf[2] | (pbuf[3] << 8)));
+        break;
+
+    case VCP_REQ_SET_RS485:
+        if (RS485_Config(1, (uint16_t)(pbuf[2] | (pbuf[3] << 8))) != USBD_OK)
+        {
+            return (USBD_FAIL);
+        }
+        break;
+
+    case VCP_REQ_GET_RS485:
+        pbuf[0] = (uint8_t)(Rs485Config[1]);
+        pbuf[1] = (uint8_t)(Rs485Config[1] >> 8);
+        break;
+
+    case VCP_REQ_SET_FRAME_GAP:
+        Frame_Config(1, (uint16_t)(pbuf[2] | (pbuf[3] << 8)));
+        break;
+
+    case VCP_REQ_GET_FRAME_GAP:
+        pbuf[0] = (uint8_t)(Frame[1].GapBits);
+        pbuf[1] = (uint8_t)(Frame[1].GapBits >> 8);
+        break;
+
+    case VCP_REQ_GET_TX_STATS:
+        Tx_GetStats(1, pbuf);
+        break;
+
+    case VCP_REQ_SET_RX_POLICY:
+        if ((pbuf[2] | (pbuf[3] << 8)) > VCP_RX_FLOW_CONTROL)
+        {
+            return (USBD_FAIL);
+        }
+        Rx[1].Policy = pbuf[2];
+        __disable_irq();
+        Rx_Check(1);
+        __enable_irq();
+        break;
+
+    case VCP_REQ_GET_RX_STATS:
+        Rx_GetStats(1, pbuf);
+        break;
+
+    case VCP_REQ_SET_SNIFF:
+        return Sniff_Config(1, pbuf[2]);
+
+    case VCP_REQ_GET_SNIFF:
+        Sniff_GetState(1, pbuf);
+        break;
+
+    case VCP_REQ_SET_TEST:
+        return Test_Config(1, (uint16_t)(pbuf[2] | (pbuf[3] << 8)));
+
+    case VCP_REQ_GET_TEST:
+        Test_GetStats(1, pbuf);
+        break;
+
+    case VCP_REQ_SET_AUTOBAUD:
+        return Autobaud_Config(1, pbuf[2]);
+
+    case VCP_REQ_GET_AUTOBAUD:
+        Autobaud_GetState(1, pbuf);
+        break;
+
+    case VCP_REQ_SET_COBS:
+        return Cobs_Config(1, pbuf[2]);
+
+    case VCP_REQ_GET_COBS:
+        Cobs_GetStats(1, pbuf);
+        break;
+
+    case VCP_REQ_SET_SAMBA:
+        return Samba_Config(1, pbuf[2]);
+
+    case VCP_REQ_SAMBA_WRITE:
+        return Samba_Write(pbuf);
+
+    case VCP_REQ_GET_SAMBA:
+        Samba_GetState(pbuf);
+        break;
+
+    case VCP_REQ_GET_CAPTURE:
+        Capture_GetState(pbuf);
+        break;
+
+    case VCP_REQ_SET_PASSTHROUGH:
+        if (Pass_Config(pbuf[2]) != USBD_OK)
+        {
+            return (USBD_FAIL);
+        }
+        break;
+
+    case VCP_REQ_GET_PASSTHROUGH:
+        Pass_GetStats(pbuf);
+        break;
+
+    case VCP_REQ_SET_PROFILE:
+        return Profile_Config(1, (uint16_t)(pbuf[2] | (pbuf[3] << 8)));
+
+    case VCP_REQ_GET_PROFILE:
+        Profile_Get(1, pbuf);
+        break;
+
+    case VCP_REQ_SET_I2C:
+        return I2c_Config(pbuf[2]);
+
+    case VCP_REQ_I2C_BATCH:
+        return VCP_I2C_Batch(pbuf, length);
+
+    case VCP_REQ_GET_I2C:
+        VCP_I2C_GetResult(pbuf, length);
+        break;
+
+    case VCP_REQ_SET_SPI:
+        return Spi_Config(pbuf[2], pbuf[3]);
+
+    case VCP_REQ_SPI_XFER:
+        return Spi_Transfer(pbuf, length);
+
+    case VCP_REQ_SPI_READ:
+        return Spi_Read(pbuf, length);
+
+    case VCP_REQ_GET_SPI:
+        VCP_SPI_GetResult(pbuf, length);
+        break;
+
+    case VCP_REQ_SET_SCREEN:
+        return Screen_Config(pbuf[2]);
+
+    case VCP_REQ_GET_SCREEN:
+        VCP_Screen_GetStats(pbuf);
+        break;
+
+    case VCP_REQ_SET_SENSOR:
+        return Sensor_Config(pbuf[2], pbuf[3]);
+
+    case VCP_REQ_GET_SENSOR:
+        VCP_Sensor_GetReadings(pbuf);
+        pbuf[15] = Derated;
+        break;
+
+    case VCP_REQ_GET_MODEM_MAP:
+        Modem_GetMap(1, pbuf);
+        break;
+
+    case VCP_REQ_SET_MODEM_MAP:
+        if (Modem_Map(1, pbuf[2], pbuf[3]) != USBD_OK)
+        {
+            return (USBD_FAIL);
+        }
+        break;
+
+    case VCP_REQ_SET_INPUT_MAP:
+        if ((pbuf[3] < VCP_LINE_DCD) || (pbuf[3] >= VCP_LINE_COUNT) ||
+            (Modem_SetLine(1, pbuf[3], pbuf[2]) != USBD_OK))
+        {
+            return (USBD_FAIL);
+        }
         break;
 
     default:
@@ -421,7 +1252,26 @@ static int8_t CDC_Itf_Control_UARTy (uint8_t cmd, uint8_t* pbuf, uint16_t length
 */
 void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
 {
-    timer_expired = 1;
+    if (htim->Instance == TIMx)
+    {
+        timer_expired = 1;
+    }
+    else if (htim->Instance == TIMx_BRK)
+    {
+        Break_End(0);
+    }
+    else if (htim->Instance == TIMy_BRK)
+    {
+        Break_End(1);
+    }
+    else if (htim->Instance == TIMy_GAP)
+    {
+        /* No character since the idle line: the frame is over */
+        if (Rx_Pos(1) == Frame[1].IdlePos)
+        {
+            Frame_Push(1, &UartHandleY);
+        }
+    }
 }
 
 
@@ -435,7 +1285,20 @@ void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
 */
 static int8_t CDC_Itf_Receive_UARTx(uint8_t* Buf, uint32_t *Len)
 {
-    HAL_UART_Transmit_IT(&UartHandleX, Buf, *Len);
+    /* In passthrough the host only watches and the self-test owns TX: its
+       data are dropped */
+    if (VcpConfig.Passthrough || Test[0].Pattern)
+    {
+        Uart_Transmit(0, Buf, 0);
+        return (USBD_OK);
+    }
+    if (Cobs[0].On)
+    {
+        Cobs_Receive(0, Buf, *Len);
+        return (USBD_OK);
+    }
+    Sniff_Host(0, *Len);
+    Uart_Transmit(0, Buf, *Len);
     return (USBD_OK);
 }
 
@@ -449,46 +1312,335 @@ static int8_t CDC_Itf_Receive_UARTx(uint8_t* Buf, uint32_t *Len)
 */
 static int8_t CDC_Itf_Receive_UARTy(uint8_t* Buf, uint32_t *Len)
 {
-    HAL_UART_Transmit_IT(&UartHandleY, Buf, *Len);
+    /* In passthrough the host only watches and the self-test owns TX: its
+       data are dropped */
+    if (VcpConfig.Passthrough || Test[1].Pattern)
+    {
+        Uart_Transmit(1, Buf, 0);
+        return (USBD_OK);
+    }
+    if (Samba.State != VCP_SAMBA_OFF)
+    {
+        Samba_Receive(Buf, *Len);
+        return (USBD_OK);
+    }
+    if (Cobs[1].On)
+    {
+        Cobs_Receive(1, Buf, *Len);
+        return (USBD_OK);
+    }
+    Sniff_Host(1, *Len);
+    Uart_Transmit(1, Buf, *Len);
     return (USBD_OK);
 }
 
 /**
-* @brief  Tx Transfer completed callback
-* @param  huart: UART handle
-* @retval None
+* @brief  CDC_Itf_TransmitCplt
+*         An IN transfer is over: wake the main loop to send the next data.
+* @param  Buf: Buffer of data sent
+* @param  Len: Number of data sent (in bytes)
+* @param  epnum: endpoint number
+* @retval Result of the opeartion: USBD_OK if all operations are OK else USBD_FAIL
 */
-void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+static int8_t CDC_Itf_TransmitCplt_UARTx(uint8_t* Buf, uint32_t *Len, uint8_t epnum)
 {
-    /* Initiate next USB packet transfer once UART completes transfer (transmitting data over Tx line) */
-    if (huart->Instance == USARTx)
-    {
-        USBD_CDC_ReceivePacket(&USBD_Device, 0);
-    }
-    else
+    tx_complete[0] = 1;
+    return (USBD_OK);
+}
+
+/**
+* @brief  CDC_Itf_TransmitCplt
+*         An IN transfer is over: wake the main loop to send the next data.
+* @param  Buf: Buffer of data sent
+* @param  Len: Number of data sent (in bytes)
+* @param  epnum: endpoint number
+* @retval Result of the opeartion: USBD_OK if all operations are OK else USBD_FAIL
+*/
+static int8_t CDC_Itf_TransmitCplt_UARTy(uint8_t* Buf, uint32_t *Len, uint8_t epnum)
+{
+    tx_complete[1] = 1;
+    return (USBD_OK);
+}
+
+/**
+* @brief  CDC_Itf_Detach
+*         The host asks for the loader (DFU_DETACH): leave once the request
+*         is over, as the descriptor announces bitWillDetach.
+* @param  timeout: wTimeout of the request, in ms
+* @retval Result of the opeartion: USBD_OK if all operations are OK else USBD_FAIL
+*/
+static int8_t CDC_Itf_Detach(uint16_t timeout)
+{
+    DfuDetach = DFU_DETACH_TICKS;
+    return (USBD_OK);
+}
+
+/**
+* @brief  CDC_Itf_Report
+*         A command of the control channel, answered as soon as the IN
+*         endpoint is free; or, with pbuf NULL, the last IN report is taken.
+* @param  pbuf: OUT report, or NULL
+* @param  len: report length
+* @retval Result of the opeartion: USBD_OK if all operations are OK else USBD_FAIL
+*/
+static int8_t CDC_Itf_Report(uint8_t* pbuf, uint32_t len)
+{
+    uint8_t *report = (uint8_t *)Hid.Report;
+    int8_t status;
+
+    if (pbuf == NULL)
     {
-        USBD_CDC_ReceivePacket(&USBD_Device, 1);
+        Hid_Flush();
+        return (USBD_OK);
+    }
+
+    /* The host waits for an answer before the next command: one sent
+       meanwhile is dropped */
+    if ((Hid.Pending == HID_ANSWER) || (len < 2))
+    {
+        return (USBD_OK);
+    }
+
+    memset(report, 0, VCP_HID_REPORT_SIZE);
+    switch (pbuf[0])
+    {
+    case VCP_HID_REQUEST:
+        status = Hid_Request(pbuf, report);
+        if (status == USBD_BUSY)
+        {
+            /* Answered by Spi_Reply */
+            SpiRead.Channel = SPI_READ_HID;
+            SpiRead.Tag = pbuf[1];
+            return (USBD_OK);
+        }
+        break;
+
+    case VCP_HID_SEQUENCE:
+        status = Hid_Sequence(pbuf);
+        if (status == USBD_OK)
+        {
+            /* Answered by the last step, maybe right now */
+            Hid_Step();
+            return (USBD_OK);
+        }
+        break;
+
+    case VCP_HID_TELEMETRY:
+        Hid.Period = (uint16_t)(pbuf[2] | (pbuf[3] << 8));
+        Hid.Elapsed = 0;
+        status = USBD_OK;
+        break;
+
+    default:
+        status = USBD_FAIL;
+        break;
     }
+
+    Hid_Answer(pbuf[0], pbuf[1], status);
+    return (USBD_OK);
 }
 
+/**
+* @brief  CDC_Itf_Sof
+*         Start of frame: the ms clock of the sequences, the telemetry and
+*         the capture packets.
+* @param  None
+* @retval Result of the opeartion: USBD_OK if all operations are OK else USBD_FAIL
+*/
+static int8_t CDC_Itf_Sof(void)
+{
+    VCP_HidTypeDef *hid = &Hid;
+
+    Capture_Send();
+
+    if ((hid->Wait != 0) && (--hid->Wait == 0))
+    {
+        Hid_Step();
+    }
+
+    if ((hid->Period != 0) && (++hid->Elapsed >= hid->Period))
+    {
+        hid->Elapsed = 0;
+        Hid_Telemetry();
+    }
+    return (USBD_OK);
+}
 
 /**
-* @brief  ComPort_Config
-*         Configure the COM Port with the parameters received from host.
-* @param  None.
+* @brief  CDC_Itf_Capture
+*         The host selects an alternate setting of the capture interface.
+*         A port streams once the main loop has let go of its ring.
+* @param  alt: CAPTURE_ALT_xxx, or CAPTURE_MISSED when the packet of the
+*         last frame was not taken
+* @retval USBD_OK, or USBD_FAIL while another mode owns the data of the port
+*/
+static int8_t CDC_Itf_Capture(uint8_t alt)
+{
+    VCP_CaptureTypeDef *capture = &Capture;
+    uint8_t port;
+
+    if (alt == CAPTURE_MISSED)
+    {
+        /* The data of the packet given up are lost */
+        capture->Missed++;
+        if (capture->Port != CDC_PORT_NONE)
+        {
+            Rx_Loss(capture->Port, capture->Length);
+        }
+        capture->Length = 0;
+        return (USBD_OK);
+    }
+
+    port = (alt == CAPTURE_ALT_OFF) ? CDC_PORT_NONE : (alt - CAPTURE_ALT_PORT_X);
+    if ((port != CDC_PORT_NONE) &&
+        (VcpConfig.Passthrough || Test[port].Pattern || Cobs[port].On || Sniff[port].On ||
+         VCP_Frame_Mode(port) || ((port == 1) && (Samba.State != VCP_SAMBA_OFF))))
+    {
+        return (USBD_FAIL);
+    }
+
+    capture->Streaming = 0;
+    capture->Port = port;
+    capture->Frame = 0;
+    capture->Length = 0;
+    if (port != CDC_PORT_NONE)
+    {
+        capture->Packets = 0;
+        capture->Bytes = 0;
+        capture->Missed = 0;
+    }
+    return (USBD_OK);
+}
+
+/**
+* @brief  Tx_GetStats
+*         Report the statistics of the data sent to the host (VCP_REQ_GET_TX_STATS).
+* @param  port: CDC port index
+* @param  pbuf: response buffer
 * @retval None.
-* @note   When a configuration is not supported, a default value is used.
 */
-static void ComPort_Config(UART_HandleTypeDef *UartHandle)
+static void Tx_GetStats(uint8_t port, uint8_t *pbuf)
 {
-    if(HAL_UART_DeInit(UartHandle) != HAL_OK)
+    VCP_TxStatsTypeDef *stats = &VcpTxStats[port];
+    uint32_t words[4];
+    uint8_t i;
+
+    words[0] = HAL_GetTick();
+    words[1] = stats->Bytes;
+    words[2] = stats->Transfers;
+    words[3] = stats->Deferred;
+
+    for (i = 0; i < 16; i++)
     {
-        /* Initialization Error */
-        Error_Handler();
+        pbuf[i] = (uint8_t)(words[i / 4] >> (8 * (i % 4)));
+    }
+    pbuf[16] = (uint8_t)(stats->LatencyLast);
+    pbuf[17] = (uint8_t)(stats->LatencyLast >> 8);
+    pbuf[18] = (uint8_t)(stats->LatencyMax);
+    pbuf[19] = (uint8_t)(stats->LatencyMax >> 8);
+}
+
+/**
+* @brief  Uart_TxInit
+*         Set up the transmission DMA channel of a port once: only the
+*         addresses and the length change from one packet to the next.
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Uart_TxInit(uint8_t port)
+{
+    uint32_t channel = (port == 0) ? USARTx_TX_DMA_CHANNEL : USARTy_TX_DMA_CHANNEL;
+
+    LL_DMA_DisableChannel(DMA1, channel);
+    LL_DMA_ConfigTransfer(DMA1, channel, LL_DMA_DIRECTION_MEMORY_TO_PERIPH |
+                                         LL_DMA_MODE_NORMAL |
+                                         LL_DMA_PERIPH_NOINCREMENT |
+                                         LL_DMA_MEMORY_INCREMENT |
+                                         LL_DMA_PDATAALIGN_BYTE |
+                                         LL_DMA_MDATAALIGN_BYTE |
+                                         LL_DMA_PRIORITY_LOW);
+}
+
+/**
+* @brief  Uart_Transmit
+*         Send a packet received over USB. A single character is written to
+*         the data register, a longer packet goes out by DMA: either way the
+*         only interrupt is the transmission complete after the last stop bit.
+* @param  port: CDC port index
+* @param  pbuf: data to send
+* @param  len: number of bytes
+* @retval None.
+* @note   A 9 bits word always carries a parity bit here (see ComPort_Config),
+*         so the data are bytes whatever the word length.
+*/
+static void Uart_Transmit(uint8_t port, uint8_t *pbuf, uint32_t len)
+{
+    USART_TypeDef *usart = (port == 0) ? USARTx : USARTy;
+    uint32_t channel = (port == 0) ? USARTx_TX_DMA_CHANNEL : USARTy_TX_DMA_CHANNEL;
+
+    if (len == 0)
+    {
+        USBD_CDC_ReceivePacket(&USBD_Device, port);
+        return;
+    }
+    TxSent[port] += len;
+
+    /* Do not receive our own frame back from the bus */
+    if ((port == 1) && (Rs485Config[1] & VCP_RS485_RX_BLANKING))
+    {
+        CLEAR_BIT(usart->CR1, USART_CR1_RE);
     }
 
+    LL_USART_ClearFlag_TC(usart);
+    if (len == 1)
+    {
+        LL_USART_TransmitData8(usart, pbuf[0]);
+    }
+    else
+    {
+        LL_DMA_ConfigAddresses(DMA1, channel, (uint32_t)pbuf,
+                               LL_USART_DMA_GetRegAddr(usart, LL_USART_DMA_REG_DATA_TRANSMIT),
+                               LL_DMA_DIRECTION_MEMORY_TO_PERIPH);
+        LL_DMA_SetDataLength(DMA1, channel, len);
+        LL_USART_EnableDMAReq_TX(usart);
+        LL_DMA_EnableChannel(DMA1, channel);
+    }
+    LL_USART_EnableIT_TC(usart);
+}
+
+/**
+* @brief  Uart_TxStop
+*         Stop the transmission of a port.
+* @param  port: CDC port index
+* @retval 1 if a packet was being sent, else 0
+*/
+static uint8_t Uart_TxStop(uint8_t port)
+{
+    USART_TypeDef *usart = (port == 0) ? USARTx : USARTy;
+    uint32_t channel = (port == 0) ? USARTx_TX_DMA_CHANNEL : USARTy_TX_DMA_CHANNEL;
+    uint8_t pending = (uint8_t)LL_USART_IsEnabledIT_TC(usart);
+
+    LL_USART_DisableIT_TC(usart);
+    LL_USART_DisableDMAReq_TX(usart);
+    LL_DMA_DisableChannel(DMA1, channel);
+    LL_DMA_DisableIT_TC(DMA1, channel);
+
+    return pending;
+}
+
+
+/**
+* @brief  Uart_SetCoding
+*         Translate a CDC line coding into the UART init structure.
+* @param  UartHandle: UART handle
+* @param  coding: line coding
+* @retval None.
+* @note   When a configuration is not supported, a default value is used.
+*/
+static void Uart_SetCoding(UART_HandleTypeDef *UartHandle, USBD_CDC_LineCodingTypeDef *coding)
+{
     /* set the Stop bit */
-    switch (LineCoding.format)
+    switch (coding->format)
     {
     case 0:
         UartHandle->Init.StopBits = UART_STOPBITS_1;
@@ -502,7 +1654,7 @@ static void ComPort_Config(UART_HandleTypeDef *UartHandle)
     }
 
     /* set the parity bit*/
-    switch (LineCoding.paritytype)
+    switch (coding->paritytype)
     {
     case 0:
         UartHandle->Init.Parity = UART_PARITY_NONE;
@@ -519,7 +1671,7 @@ static void ComPort_Config(UART_HandleTypeDef *UartHandle)
     }
 
     /*set the data type : only 8bits and 9bits is supported */
-    switch (LineCoding.datatype)
+    switch (coding->datatype)
     {
     case 0x07:
         /* With this configuration a parity (Even or Odd) must be set */
@@ -541,32 +1693,96 @@ static void ComPort_Config(UART_HandleTypeDef *UartHandle)
         break;
     }
 
-    UartHandle->Init.BaudRate = LineCoding.bitrate;
+    UartHandle->Init.BaudRate = coding->bitrate;
+}
+
+/**
+* @brief  ComPort_Config
+*         Configure the COM Port with the parameters received from host.
+* @param  None.
+* @retval None.
+* @note   When a configuration is not supported, a default value is used.
+*/
+static void ComPort_Config(UART_HandleTypeDef *UartHandle)
+{
+    uint8_t port = (UartHandle->Instance == USARTx) ? 0 : 1;
+    USBD_CDC_LineCodingTypeDef *coding = &LineCoding[port];
+    uint8_t pending = Uart_TxStop(port);
+
+    if(HAL_UART_DeInit(UartHandle) != HAL_OK)
+    {
+        /* Initialization Error */
+        Error_Handler();
+    }
+
+    Uart_SetCoding(UartHandle, coding);
     UartHandle->Init.HwFlowCtl  = UART_HWCONTROL_NONE;
     UartHandle->Init.Mode       = UART_MODE_TX_RX;
 
+    /* Auto-baud: the rate above only holds until the first character */
+    if ((port == 0) && (Autobaud.Mode != VCP_AUTOBAUD_OFF))
+    {
+        UartHandle->AdvancedInit.AdvFeatureInit = UART_ADVFEATURE_AUTOBAUDRATE_INIT;
+        UartHandle->AdvancedInit.AutoBaudRateEnable = UART_ADVFEATURE_AUTOBAUDRATE_ENABLE;
+        UartHandle->AdvancedInit.AutoBaudRateMode = AutobaudModes[Autobaud.Mode - 1];
+        Autobaud.State = VCP_AUTOBAUD_WAITING;
+    }
+    else
+    {
+        UartHandle->AdvancedInit.AdvFeatureInit = UART_ADVFEATURE_NO_INIT;
+    }
+
     if(HAL_UART_Init(UartHandle) != HAL_OK)
     {
         /* Initialization Error */
         Error_Handler();
     }
 
-    /* Start reception: provide the buffer pointer with offset and the buffer size */
-    if (UartHandle->Instance == USARTx)
+    if (UartHandle->Instance == USARTy)
     {
-        UartHandleX.pRxBuffPtr = (uint8_t*)&UserTxBuffer[0][0];
-        UartHandleX.RxXferSize = APP_TX_DATA_SIZE;
-        UartHandleX.ErrorCode = HAL_UART_ERROR_NONE;
-
-        HAL_UART_Receive_DMA(&UartHandleX, (uint8_t*)&UserTxBuffer[0][0], APP_TX_DATA_SIZE);
+        RS485_Apply(UartHandle, Rs485Config[1]);
+        Frame_Apply(UartHandle, Frame[1].GapBits);
     }
     else
     {
-        UartHandleY.pRxBuffPtr = (uint8_t*)&UserTxBuffer[1][0];
-        UartHandleY.RxXferSize = APP_TX_DATA_SIZE;
-        UartHandleY.ErrorCode = HAL_UART_ERROR_NONE;
+        Frame_Apply(UartHandle, Frame[0].GapBits);
+    }
+    Test_Apply(UartHandle, port);
+
+    /* The transmission is stopped: a break waiting for it starts now */
+    Break_Resume(port);
+
+    /* Restart reception at the start of the ring */
+    Rx_Start(port);
+
+    if (VcpConfig.Passthrough)
+    {
+        /* Go on sending what the other port received */
+        __disable_irq();
+        Pass_Forward(port);
+        __enable_irq();
+    }
+    else if (pending)
+    {
+        /* The packet cut short by the new configuration is dropped */
+        if ((port == 1) && (Samba.State != VCP_SAMBA_OFF))
+        {
+            Samba_Sent();
+        }
+        else if (Cobs[port].On)
+        {
+            Cobs_Sent(port);
+        }
+        else
+        {
+            Sniff_Release(port, SNIFF_HOLD_UART);
+        }
+    }
 
-        HAL_UART_Receive_DMA(&UartHandleY, (uint8_t*)&UserTxBuffer[1][0], APP_TX_DATA_SIZE);
+    /* The self-test starts over at the new line coding */
+    if (Test[port].Pattern)
+    {
+        Test_Start(port);
     }
 }
 
@@ -600,14 +1816,3877 @@ static void TIM_Config(void)
 }
 
 /**
-* @brief  UART error callbacks
-* @param  UartHandle: UART handle
-* @retval None
+* @brief  Modem_Init
+*         Map the modem lines of a port and drive the outputs deasserted.
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Modem_Init(uint8_t port)
+{
+    uint8_t line;
+
+    __HAL_RCC_GPIOA_CLK_ENABLE();
+    __HAL_RCC_GPIOB_CLK_ENABLE();
+
+    /* Each configuration starts again from the default mapping; a line that
+       was never mapped has no pin to release */
+    for (line = 0; line < VCP_LINE_COUNT; line++)
+    {
+        if (Modem[port].Line[line].GPIOx == NULL)
+        {
+            Modem[port].Line[line].Code = VCP_PIN_NC;
+        }
+        Modem_SetLine(port, line, ModemDefaults[port][line]);
+    }
+
+    Modem[port].ApplyCyclesMax = 0;
+    Modem_Apply(port, 0);
+
+    Modem[port].SerialState = 0;
+    Modem[port].Events = 0;
+    Modem[port].Errors = 0;
+    Modem[port].RingLevel = 0;
+    Modem[port].Holdoff = 0;
+}
+
+/**
+* @brief  Modem_SetLine
+*         Move a modem line to another pin. DTR/RTS become push-pull outputs,
+*         DCD/DSR/RI inputs pulled to their deasserted level.
+* @param  port: CDC port index
+* @param  line: VCP_LINE_xxx
+* @param  code: pin code, see VCP_PIN()
+* @retval USBD_OK if the pin can be used, USBD_FAIL otherwise
+*/
+static int8_t Modem_SetLine(uint8_t port, uint8_t line, uint8_t code)
+{
+    VCP_ModemLineTypeDef *ml = &Modem[port].Line[line];
+    GPIO_InitTypeDef GPIO_InitStruct;
+    GPIO_TypeDef *GPIOx;
+    uint32_t pin = 1U << (code & 0x0F);
+
+    if (code == ml->Code)
+    {
+        return (USBD_OK);
+    }
+    if (Modem_CheckLine(port, line, code, &GPIOx) != USBD_OK)
+    {
+        return (USBD_FAIL);
+    }
+
+    /* Release the previous pin */
+    if (ml->GPIOx != NULL)
+    {
+        HAL_GPIO_DeInit(ml->GPIOx, ml->Pin);
+    }
+
+    ml->GPIOx = GPIOx;
+    ml->Pin = (uint16_t)pin;
+    ml->Code = code;
+    ml->AssertBSRR = 0;
+    ml->DeassertBSRR = 0;
+
+    if (GPIOx == NULL)
+    {
+        return (USBD_OK);
+    }
+
+    GPIO_InitStruct.Pin = pin;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
+
+    if (line >= VCP_LINE_DCD)
+    {
+        GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+        GPIO_InitStruct.Pull = (code & VCP_PIN_ACTIVE_LOW) ? GPIO_PULLUP : GPIO_PULLDOWN;
+        HAL_GPIO_Init(GPIOx, &GPIO_InitStruct);
+        return (USBD_OK);
+    }
+
+    if (code & VCP_PIN_ACTIVE_LOW)
+    {
+        ml->AssertBSRR = pin << 16;
+        ml->DeassertBSRR = pin;
+    }
+    else
+    {
+        ml->AssertBSRR = pin;
+        ml->DeassertBSRR = pin << 16;
+    }
+
+    /* Start deasserted, then hand the pin to the output driver */
+    GPIOx->BSRR = ml->DeassertBSRR;
+
+    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    HAL_GPIO_Init(GPIOx, &GPIO_InitStruct);
+
+    return (USBD_OK);
+}
+
+/**
+* @brief  Modem_CheckLine
+*         Check that a modem line can move to a pin, without moving it.
+* @param  port: CDC port index
+* @param  line: VCP_LINE_xxx
+* @param  code: pin code, see VCP_PIN()
+* @param  GPIOx: set to the GPIO port of the pin, NULL when not connected
+* @retval USBD_OK if the pin can be used, USBD_FAIL otherwise
+*/
+static int8_t Modem_CheckLine(uint8_t port, uint8_t line, uint8_t code, GPIO_TypeDef **GPIOx)
+{
+    VCP_ModemLineTypeDef *ml = &Modem[port].Line[line];
+    uint32_t pin = 1U << (code & 0x0F);
+
+    if (code == ml->Code)
+    {
+        *GPIOx = ml->GPIOx;
+        return (USBD_OK);
+    }
+
+    if (code & VCP_PIN_NC)
+    {
+        *GPIOx = NULL;
+        return (USBD_OK);
+    }
+    if (((code & 0x30) == 0x00) && (pin & VCP_MODEM_PINS_GPIOA))
+    {
+        *GPIOx = GPIOA;
+    }
+    else if (((code & 0x30) == 0x10) && (pin & VCP_MODEM_PINS_GPIOB))
+    {
+        *GPIOx = GPIOB;
+    }
+    else
+    {
+        return (USBD_FAIL);
+    }
+
+    /* A pin drives or feeds a single line, and the RS-485 DE output, the
+       I2C and SPI bridges and the screen own their pins */
+    if (Modem_PinInUse(*GPIOx, pin, ml) || VCP_I2C_PinInUse(*GPIOx, pin) || VCP_SPI_PinInUse(*GPIOx, pin) ||
+        VCP_Screen_PinInUse(*GPIOx, pin))
+    {
+        return (USBD_FAIL);
+    }
+    if ((*GPIOx == USARTy_DE_GPIO_PORT) && (pin == USARTy_DE_PIN) && (Rs485Config[1] & VCP_RS485_ENABLE))
+    {
+        return (USBD_FAIL);
+    }
+
+    return (USBD_OK);
+}
+
+/**
+* @brief  Modem_Map
+*         Move DTR and RTS of a port (VCP_REQ_SET_MODEM_MAP). Both pins are
+*         checked before either line moves, so that a request refused leaves
+*         the mapping and the lines as they were.
+* @param  port: CDC port index
+* @param  dtr: pin code of DTR
+* @param  rts: pin code of RTS
+* @retval USBD_OK, or USBD_FAIL if a pin cannot be used
+*/
+static int8_t Modem_Map(uint8_t port, uint8_t dtr, uint8_t rts)
+{
+    GPIO_TypeDef *GPIOx;
+
+    if ((Modem_CheckLine(port, VCP_LINE_DTR, dtr, &GPIOx) != USBD_OK) ||
+        (Modem_CheckLine(port, VCP_LINE_RTS, rts, &GPIOx) != USBD_OK))
+    {
+        return (USBD_FAIL);
+    }
+    /* Nor can the two lines share a pin */
+    if (!(dtr & VCP_PIN_NC) && !(rts & VCP_PIN_NC) && ((dtr & 0x3F) == (rts & 0x3F)))
+    {
+        return (USBD_FAIL);
+    }
+
+    Modem_SetLine(port, VCP_LINE_DTR, dtr);
+    Modem_SetLine(port, VCP_LINE_RTS, rts);
+    Modem_Apply(port, Modem[port].LineState);
+    return (USBD_OK);
+}
+
+/**
+* @brief  Modem_PinInUse
+*         Check whether a pin is mapped to a modem line of either port.
+* @param  GPIOx: GPIO port
+* @param  pin: GPIO pin
+* @param  self: line to leave out of the check, or NULL
+* @retval 1 if the pin is in use, 0 otherwise
 */
-void HAL_UART_ErrorCallback(UART_HandleTypeDef *UartHandle)
+static uint8_t Modem_PinInUse(GPIO_TypeDef *GPIOx, uint32_t pin, VCP_ModemLineTypeDef *self)
 {
-    /* Transfer error occured in reception and/or transmission process */
-    Error_Handler();
+    uint8_t p, l;
+
+    for (p = 0; p < 2; p++)
+    {
+        for (l = 0; l < VCP_LINE_COUNT; l++)
+        {
+            if ((&Modem[p].Line[l] != self) && (Modem[p].Line[l].GPIOx == GPIOx) &&
+                (Modem[p].Line[l].Pin == pin))
+            {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+* @brief  Modem_Apply
+*         Drive DTR/RTS from a SET_CONTROL_LINE_STATE value. Runs in the EP0
+*         setup path: one BSRR store per mapped line, timed with SysTick.
+* @param  port: CDC port index
+* @param  state: control line state (CDC_CTRL_LINE_xxx)
+* @retval None.
+*/
+static void Modem_Apply(uint8_t port, uint16_t state)
+{
+    VCP_ModemTypeDef *modem = &Modem[port];
+    VCP_ModemLineTypeDef *dtr = &modem->Line[VCP_LINE_DTR];
+    VCP_ModemLineTypeDef *rts = &modem->Line[VCP_LINE_RTS];
+    uint32_t start = SysTick->VAL;
+    uint32_t end;
+
+    if (dtr->GPIOx != NULL)
+    {
+        dtr->GPIOx->BSRR = (state & CDC_CTRL_LINE_DTR) ? dtr->AssertBSRR : dtr->DeassertBSRR;
+    }
+    if (rts->GPIOx != NULL)
+    {
+        rts->GPIOx->BSRR = ((state & CDC_CTRL_LINE_RTS) && !Rx[port].Throttled) ? rts->AssertBSRR : rts->DeassertBSRR;
+    }
+
+    end = SysTick->VAL;
+
+    /* SysTick counts down and reloads every millisecond */
+    if (end > start)
+    {
+        start += SysTick->LOAD + 1;
+    }
+
+    modem->LineState = state;
+    modem->ApplyCycles = (uint16_t)(start - end);
+    if (modem->ApplyCycles > modem->ApplyCyclesMax)
+    {
+        modem->ApplyCyclesMax = modem->ApplyCycles;
+    }
+}
+
+/**
+* @brief  Modem_GetMap
+*         Report the modem line mapping and apply timing (VCP_REQ_GET_MODEM_MAP).
+* @param  port: CDC port index
+* @param  pbuf: response buffer
+* @retval None.
+*/
+static void Modem_GetMap(uint8_t port, uint8_t *pbuf)
+{
+    uint32_t mhz = SystemCoreClock / 1000000;
+    uint32_t last = (Modem[port].ApplyCycles * 1000) / mhz;
+    uint32_t max = (Modem[port].ApplyCyclesMax * 1000) / mhz;
+
+    pbuf[0] = Modem[port].Line[VCP_LINE_DTR].Code;
+    pbuf[1] = Modem[port].Line[VCP_LINE_RTS].Code;
+    pbuf[2] = (uint8_t)Modem[port].LineState;
+    pbuf[3] = (uint8_t)Modem[port].SerialState;
+    pbuf[4] = (uint8_t)(last);
+    pbuf[5] = (uint8_t)(last >> 8);
+    pbuf[6] = (uint8_t)(max);
+    pbuf[7] = (uint8_t)(max >> 8);
+    pbuf[8] = Modem[port].Line[VCP_LINE_DCD].Code;
+    pbuf[9] = Modem[port].Line[VCP_LINE_DSR].Code;
+    pbuf[10] = Modem[port].Line[VCP_LINE_RI].Code;
+    pbuf[11] = 0;
+}
+
+/**
+* @brief  Modem_ReadLine
+*         Sample a modem input.
+* @param  line: modem line
+* @retval 1 if the line is mapped and asserted, 0 otherwise
+*/
+static uint8_t Modem_ReadLine(VCP_ModemLineTypeDef *line)
+{
+    uint8_t level;
+
+    if (line->GPIOx == NULL)
+    {
+        return 0;
+    }
+
+    level = ((line->GPIOx->IDR & line->Pin) != 0) ? 1 : 0;
+
+    return (line->Code & VCP_PIN_ACTIVE_LOW) ? !level : level;
+}
+
+/**
+* @brief  Modem_Notify
+*         Sample the inputs of a port and send a SERIAL_STATE notification
+*         when DCD/DSR changed or an event (ring, UART error) is pending.
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Modem_Notify(uint8_t port)
+{
+    VCP_ModemTypeDef *modem = &Modem[port];
+    uint16_t state = 0;
+    uint8_t ring;
+
+    if (modem->Holdoff != 0)
+    {
+        modem->Holdoff--;
+    }
+
+    if (Modem_ReadLine(&modem->Line[VCP_LINE_DCD]))
+    {
+        state |= CDC_SERIAL_STATE_DCD;
+    }
+    if (Modem_ReadLine(&modem->Line[VCP_LINE_DSR]))
+    {
+        state |= CDC_SERIAL_STATE_DSR;
+    }
+
+    /* bRingSignal reports the start of a ring */
+    ring = Modem_ReadLine(&modem->Line[VCP_LINE_RI]);
+    if (ring && !modem->RingLevel)
+    {
+        modem->Events |= CDC_SERIAL_STATE_RING;
+    }
+    modem->RingLevel = ring;
+
+    __disable_irq();
+    modem->Events |= modem->Errors;
+    modem->Errors = 0;
+    __enable_irq();
+
+    if (((state == modem->SerialState) && (modem->Events == 0)) || (modem->Holdoff != 0))
+    {
+        return;
+    }
+
+    if (USBD_CDC_NotifySerialState(&USBD_Device, port, state | modem->Events) == USBD_OK)
+    {
+        modem->SerialState = state;
+        modem->Events = 0;
+        modem->Holdoff = VCP_NOTIFY_INTERVAL / CDC_POLLING_INTERVAL;
+    }
+}
+
+/**
+* @brief  VCP_SerialState_Process
+*         Report the serial state of both ports. Called from the main loop on
+*         every polling tick, outside of the USB interrupt.
+* @param  None.
+* @retval None.
+*/
+void VCP_SerialState_Process(void)
+{
+    Modem_Notify(0);
+    Modem_Notify(1);
+}
+
+/**
+* @brief  OnePulse_Init
+*         Bind a timer handle used to time a single delay.
+* @param  htim: TIM handle
+* @param  tim: TIM instance
+* @retval None.
+*/
+static void OnePulse_Init(TIM_HandleTypeDef *htim, TIM_TypeDef *tim)
+{
+    htim->Instance = tim;
+    htim->Init.Prescaler = 0;
+    htim->Init.Period = 0xFFFF;
+    htim->Init.ClockDivision = 0;
+    htim->Init.CounterMode = TIM_COUNTERMODE_UP;
+    htim->Init.RepetitionCounter = 0;
+    if(HAL_TIM_Base_Init(htim) != HAL_OK)
+    {
+        /* Initialization Error */
+        Error_Handler();
+    }
+}
+
+/**
+* @brief  OnePulse_Start
+*         (Re)start a delay, the period elapsed callback runs once at its end.
+* @param  htim: TIM handle
+* @param  cycles: delay in core clock cycles, at least 2
+* @retval None.
+*/
+static void OnePulse_Start(TIM_HandleTypeDef *htim, uint32_t cycles)
+{
+    /* Smallest prescaler keeping the delay within the 16-bit counter */
+    uint32_t div = (cycles >> 16) + 1;
+
+    HAL_TIM_Base_Stop_IT(htim);
+
+    htim->Init.Prescaler = div - 1;
+    htim->Init.Period = (cycles / div) - 1;
+    if(HAL_TIM_Base_Init(htim) != HAL_OK)
+    {
+        /* Initialization Error */
+        Error_Handler();
+    }
+
+    /* The init loads the prescaler with an update event: drop it so that it
+       does not end the delay at once */
+    __HAL_TIM_CLEAR_FLAG(htim, TIM_FLAG_UPDATE);
+    htim->Instance->CR1 |= TIM_CR1_OPM;
+    HAL_TIM_Base_Start_IT(htim);
+}
+
+/**
+* @brief  Break_Init
+*         Prepare the break generator of a port.
+* @param  port: CDC port index
+* @param  GPIOx: GPIO port of the USART TX pin
+* @param  pin: USART TX pin
+* @param  tim: one pulse timer ending the break
+* @retval None.
+*/
+static void Break_Init(uint8_t port, GPIO_TypeDef *GPIOx, uint32_t pin, TIM_TypeDef *tim)
+{
+    VCP_BreakTypeDef *brk = &Break[port];
+    uint32_t pos = 0;
+
+    while ((pin >> pos) != 1)
+    {
+        pos++;
+    }
+
+    brk->GPIOx = GPIOx;
+    brk->Pin = pin;
+    brk->ModerMask = GPIO_MODER_MODER0 << (pos * 2);
+    brk->ModerOutput = GPIO_MODER_MODER0_0 << (pos * 2);
+    brk->ModerAf = GPIO_MODER_MODER0_1 << (pos * 2);
+    brk->Active = 0;
+    brk->Pending = 0;
+
+    OnePulse_Init(&BreakTimHandle[port], tim);
+}
+
+/**
+* @brief  Break_Start
+*         Start a break, or end the current one. The TX pin is driven low at
+*         once and a one pulse timer gives it back to the USART. While a
+*         packet is going out, the break waits for its last stop bit.
+* @param  port: CDC port index
+* @param  us: duration in us, 0 ends the break, BREAK_HOLD keeps it until ended
+* @retval None.
+*/
+static void Break_Start(uint8_t port, uint32_t us)
+{
+    VCP_BreakTypeDef *brk = &Break[port];
+    TIM_HandleTypeDef *htim = &BreakTimHandle[port];
+    USART_TypeDef *usart = (port == 0) ? USARTx : USARTy;
+
+    if (us == 0)
+    {
+        Break_End(port);
+        return;
+    }
+
+    __disable_irq();
+    if (LL_USART_IsEnabledIT_TC(usart))
+    {
+        /* The end of the transmission calls Break_Resume */
+        brk->Pending = us;
+        __enable_irq();
+        return;
+    }
+    brk->Pending = 0;
+    __enable_irq();
+
+    /* A new request restarts the break from now */
+    HAL_TIM_Base_Stop_IT(htim);
+
+    brk->GPIOx->BRR = brk->Pin;
+    brk->GPIOx->MODER = (brk->GPIOx->MODER & ~brk->ModerMask) | brk->ModerOutput;
+    brk->Active = 1;
+
+    if (us == BREAK_HOLD)
+    {
+        return;
+    }
+
+    OnePulse_Start(htim, us * (SystemCoreClock / 1000000));
+}
+
+/**
+* @brief  Break_End
+*         Give the TX pin back to the USART.
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Break_End(uint8_t port)
+{
+    VCP_BreakTypeDef *brk = &Break[port];
+
+    brk->Pending = 0;
+    HAL_TIM_Base_Stop_IT(&BreakTimHandle[port]);
+
+    if (brk->Active)
+    {
+        brk->GPIOx->MODER = (brk->GPIOx->MODER & ~brk->ModerMask) | brk->ModerAf;
+        brk->Active = 0;
+    }
+}
+
+/**
+* @brief  Break_Resume
+*         Start the break that waited for the transmission to stop.
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Break_Resume(uint8_t port)
+{
+    uint32_t us = Break[port].Pending;
+
+    if (us != 0)
+    {
+        Break[port].Pending = 0;
+        Break_Start(port, us);
+    }
+}
+
+/**
+* @brief  RS485_Config
+*         Switch a port between point to point and RS-485 half duplex mode.
+* @param  port: CDC port index
+* @param  config: RS-485 configuration (VCP_RS485_xxx)
+* @retval USBD_OK if the configuration is applied, USBD_FAIL otherwise, or
+*         while the port transmits
+*/
+static int8_t RS485_Config(uint8_t port, uint16_t config)
+{
+    GPIO_InitTypeDef GPIO_InitStruct;
+
+    if (!(config & VCP_RS485_ENABLE))
+    {
+        config = 0;
+    }
+
+    if (port == 0)
+    {
+        /* No DE output available on USART1 */
+        return (config == 0) ? USBD_OK : USBD_FAIL;
+    }
+
+    if ((config & VCP_RS485_ENABLE) && Modem_PinInUse(USARTy_DE_GPIO_PORT, USARTy_DE_PIN, NULL))
+    {
+        return (USBD_FAIL);
+    }
+
+    /* The USART is disabled to be set up: the frame being sent, or the
+       pattern of a self-test, would be cut and DE dropped mid-byte */
+    __disable_irq();
+    if (LL_USART_IsEnabledIT_TC(USARTy) || Test[1].Pattern)
+    {
+        __enable_irq();
+        return (USBD_FAIL);
+    }
+
+    if (config & VCP_RS485_ENABLE)
+    {
+        /* Keep the driver off while the USART does not drive DE */
+        GPIO_InitStruct.Pin       = USARTy_DE_PIN;
+        GPIO_InitStruct.Mode      = GPIO_MODE_AF_PP;
+        GPIO_InitStruct.Pull      = (config & VCP_RS485_DE_ACTIVE_LOW) ? GPIO_PULLUP : GPIO_PULLDOWN;
+        GPIO_InitStruct.Speed     = GPIO_SPEED_FREQ_HIGH;
+        GPIO_InitStruct.Alternate = USARTy_DE_AF;
+        HAL_GPIO_Init(USARTy_DE_GPIO_PORT, &GPIO_InitStruct);
+    }
+    else if (Rs485Config[1] & VCP_RS485_ENABLE)
+    {
+        HAL_GPIO_DeInit(USARTy_DE_GPIO_PORT, USARTy_DE_PIN);
+    }
+
+    Rs485Config[1] = config;
+    RS485_Apply(&UartHandleY, config);
+    __enable_irq();
+
+    return (USBD_OK);
+}
+
+/**
+* @brief  RS485_Apply
+*         Program the hardware driver enable of the USART.
+* @param  UartHandle: UART handle
+* @param  config: RS-485 configuration (VCP_RS485_xxx)
+* @retval None.
+*/
+static void RS485_Apply(UART_HandleTypeDef *UartHandle, uint16_t config)
+{
+    uint32_t deat = (config >> VCP_RS485_DEAT_POS) & 0x1F;
+    uint32_t dedt = (config >> VCP_RS485_DEDT_POS) & 0x1F;
+
+    /* DEM, DEP and the DE times can only be written while the USART is disabled */
+    __HAL_UART_DISABLE(UartHandle);
+
+    if (config & VCP_RS485_ENABLE)
+    {
+        MODIFY_REG(UartHandle->Instance->CR1, USART_CR1_DEAT | USART_CR1_DEDT,
+                   (deat << USART_CR1_DEAT_Pos) | (dedt << USART_CR1_DEDT_Pos));
+        MODIFY_REG(UartHandle->Instance->CR3, USART_CR3_DEM | USART_CR3_DEP,
+                   USART_CR3_DEM | ((config & VCP_RS485_DE_ACTIVE_LOW) ? USART_CR3_DEP : 0));
+    }
+    else
+    {
+        CLEAR_BIT(UartHandle->Instance->CR3, USART_CR3_DEM | USART_CR3_DEP);
+    }
+    SET_BIT(UartHandle->Instance->CR1, USART_CR1_RE);
+
+    __HAL_UART_ENABLE(UartHandle);
+}
+
+/**
+* @brief  Frame_Config
+*         Switch a port between stream and frame mode.
+* @param  port: CDC port index
+* @param  gap: inter-frame gap in bit times, 0 for stream mode
+* @retval None.
+*/
+static void Frame_Config(uint8_t port, uint16_t gap)
+{
+    Frame[port].UserBits = (gap > VCP_FRAME_GAP_MAX) ? VCP_FRAME_GAP_MAX : gap;
+    Frame_Restart(port);
+}
+
+/**
+* @brief  Frame_Restart
+*         Restart the end of frame detection of a port with the gap of the
+*         host, or the gap of the sniffer while a mode needs the chunks
+*         delimited and the host set none.
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Frame_Restart(uint8_t port)
+{
+    UART_HandleTypeDef *UartHandle = (port == 0) ? &UartHandleX : &UartHandleY;
+    uint16_t gap = Frame[port].UserBits;
+
+    Frame_Apply(UartHandle, 0);
+    if (port == 1)
+    {
+        HAL_TIM_Base_Stop_IT(&GapTimHandle);
+    }
+
+    Frame[port].Head = 0;
+    Frame[port].Tail = 0;
+    Frame[port].IdlePos = Rx_Pos(port);
+    if ((gap == 0) && (Sniff[port].On || Cobs[port].On || ((port == 1) && (Samba.State != VCP_SAMBA_OFF))))
+    {
+        /* The sniffer, the framing and the SAM-BA engine need the chunks
+           delimited */
+        gap = VCP_SNIFF_GAP;
+    }
+    Frame[port].GapBits = gap;
+
+    Frame_Apply(UartHandle, Frame[port].GapBits);
+}
+
+/**
+* @brief  Frame_Apply
+*         Program the end of frame detection of the USART: receiver timeout
+*         on USART1, idle line on USART2.
+* @param  UartHandle: UART handle
+* @param  gap: inter-frame gap in bit times, 0 for stream mode
+* @retval None.
+*/
+static void Frame_Apply(UART_HandleTypeDef *UartHandle, uint16_t gap)
+{
+    Sniff[(UartHandle->Instance == USARTx) ? 0 : 1].GapUs = (gap * 1000000U) / UartHandle->Init.BaudRate;
+
+    if (UartHandle->Instance == USARTx)
+    {
+        if (gap != 0)
+        {
+            WRITE_REG(UartHandle->Instance->RTOR, gap);
+            __HAL_UART_CLEAR_FLAG(UartHandle, UART_CLEAR_RTOF);
+            SET_BIT(UartHandle->Instance->CR2, USART_CR2_RTOEN);
+            SET_BIT(UartHandle->Instance->CR1, USART_CR1_RTOIE);
+        }
+        else
+        {
+            CLEAR_BIT(UartHandle->Instance->CR1, USART_CR1_RTOIE);
+            CLEAR_BIT(UartHandle->Instance->CR2, USART_CR2_RTOEN);
+        }
+    }
+    else
+    {
+        if (gap != 0)
+        {
+            __HAL_UART_CLEAR_IDLEFLAG(UartHandle);
+            SET_BIT(UartHandle->Instance->CR1, USART_CR1_IDLEIE);
+        }
+        else
+        {
+            CLEAR_BIT(UartHandle->Instance->CR1, USART_CR1_IDLEIE);
+        }
+    }
+}
+
+/**
+* @brief  Frame_Push
+*         Queue the end of a frame at the current reception position.
+* @param  port: CDC port index
+* @param  UartHandle: UART handle
+* @retval None.
+*/
+static void Frame_Push(uint8_t port, UART_HandleTypeDef *UartHandle)
+{
+    VCP_FrameTypeDef *frame = &Frame[port];
+    VCP_SniffTypeDef *sniff = &Sniff[port];
+    uint16_t pos = Rx_Pos(port);
+    uint8_t head = frame->Head;
+    uint8_t flags = 0;
+    uint32_t stamp;
+
+    /* When the host lags behind, the last two frames are merged */
+    if ((uint8_t)(head - frame->Tail) == VCP_FRAME_QUEUE)
+    {
+        head--;
+        flags = sniff->Flags[head & (VCP_FRAME_QUEUE - 1)] & ~VCP_SNIFF_CUT;
+    }
+
+    if (sniff->On)
+    {
+        /* A gap is seen some time after the last stop bit, a cut at once */
+        stamp = SNIFF_TIM->CNT;
+        if (!(sniff->Errors & VCP_SNIFF_CUT))
+        {
+            stamp -= sniff->GapUs;
+        }
+        sniff->Stamp[head & (VCP_FRAME_QUEUE - 1)] = stamp;
+    }
+    if (sniff->On || Cobs[port].On)
+    {
+        /* The framing uses the error flags of the chunk too */
+        sniff->Flags[head & (VCP_FRAME_QUEUE - 1)] = flags | sniff->Errors;
+        sniff->Errors = 0;
+    }
+
+    frame->End[head & (VCP_FRAME_QUEUE - 1)] = pos;
+    frame->Head = head + 1;
+    frame_ready = 1;
+}
+
+/**
+* @brief  VCP_UART_IRQHandler
+*         USART interrupt handler of a port. The HAL handler is not used: the
+*         reception runs by DMA and the transmission only interrupts at its
+*         end, what is left are the line errors and the frame delimiters.
+* @param  port: CDC port index
+* @retval None.
+*/
+void VCP_UART_IRQHandler(uint8_t port)
+{
+    UART_HandleTypeDef *UartHandle = (port == 0) ? &UartHandleX : &UartHandleY;
+    USART_TypeDef *usart = UartHandle->Instance;
+    uint32_t isr = usart->ISR;
+    uint32_t cr1 = usart->CR1;
+    uint32_t bits;
+#if VCP_ISR_PROFILE
+    uint32_t start = SysTick->VAL;
+    uint32_t end;
+#endif
+
+    /* The last stop bit is out: listen to the bus again and take the next packet */
+    if ((cr1 & USART_CR1_TCIE) && (isr & USART_ISR_TC))
+    {
+        Uart_TxStop(port);
+        if (port == 1)
+        {
+            SET_BIT(usart->CR1, USART_CR1_RE);
+        }
+        Break_Resume(port);
+        if (VcpConfig.Passthrough)
+        {
+            Pass_Forward(port);
+        }
+        else if ((port == 1) && (Samba.State != VCP_SAMBA_OFF))
+        {
+            Samba_Sent();
+        }
+        else if (Cobs[port].On)
+        {
+            Cobs_Sent(port);
+        }
+        else
+        {
+            Sniff_Release(port, SNIFF_HOLD_UART);
+        }
+    }
+
+    if ((cr1 & USART_CR1_RXNEIE) && (isr & (USART_ISR_RXNE | USART_ISR_ORE)))
+    {
+        if (!VcpConfig.Passthrough)
+        {
+            /* Drop newest: the ring is full, the characters are counted and discarded */
+            (void)usart->RDR;
+            Rx_Loss(port, 1);
+        }
+        else if (isr & USART_ISR_RXNE)
+        {
+            /* Passthrough: the character goes to the ring and on to the other port */
+            Pass_Receive(port, (uint8_t)usart->RDR);
+        }
+    }
+
+    /* After the reception: a break shows as the last character in the ring */
+    if (isr & (USART_ISR_PE | USART_ISR_FE | USART_ISR_NE | USART_ISR_ORE))
+    {
+        usart->ICR = USART_ICR_PECF | USART_ICR_FECF | USART_ICR_NCF | USART_ICR_ORECF;
+        Uart_LineError(port, UartHandle, isr);
+    }
+
+    if ((cr1 & USART_CR1_RTOIE) && (isr & USART_ISR_RTOF))
+    {
+        usart->ICR = USART_ICR_RTOCF;
+        Frame_Push(port, UartHandle);
+    }
+
+    if ((cr1 & USART_CR1_IDLEIE) && (isr & USART_ISR_IDLE))
+    {
+        usart->ICR = USART_ICR_IDLECF;
+
+        /* The idle line already covers one character: time the rest of the gap */
+        bits = 2 + ((UartHandle->Init.WordLength == UART_WORDLENGTH_9B) ? 9 : 8) +
+               ((UartHandle->Init.StopBits == UART_STOPBITS_2) ? 1 : 0);
+        Frame[port].IdlePos = Rx_Pos(port);
+        if (Frame[port].GapBits > bits)
+        {
+            OnePulse_Start(&GapTimHandle, (Frame[port].GapBits - bits) * (SystemCoreClock / UartHandle->Init.BaudRate));
+        }
+        else
+        {
+            Frame_Push(port, UartHandle);
+        }
+    }
+
+#if VCP_ISR_PROFILE
+    end = SysTick->VAL;
+    if (end > start)
+    {
+        start += SysTick->LOAD + 1;
+    }
+    VcpIsrProfile[port].Count++;
+    VcpIsrProfile[port].Cycles += start - end;
+    if ((start - end) > VcpIsrProfile[port].CyclesMax)
+    {
+        VcpIsrProfile[port].CyclesMax = start - end;
+    }
+#endif
+}
+
+/**
+* @brief  VCP_Frame_Head
+*         Give the reception position up to which data can go to the host.
+* @param  port: CDC port index
+* @param  in: current reception position of the DMA
+* @param  out: position of the first byte not sent yet
+* @retval in for a port in stream mode, else the end of the oldest complete
+*         frame, or out when there is none
+*/
+uint32_t VCP_Frame_Head(uint8_t port, uint32_t in, uint32_t out)
+{
+    VCP_FrameTypeDef *frame = &Frame[port];
+
+    if (frame->GapBits == 0)
+    {
+        return in;
+    }
+
+    /* Skip empty frames, such as a gap timed out again without new data */
+    while ((frame->Head != frame->Tail) &&
+           (frame->End[frame->Tail & (VCP_FRAME_QUEUE - 1)] == out))
+    {
+        frame->Tail++;
+    }
+
+    if (frame->Head == frame->Tail)
+    {
+        return out;
+    }
+
+    return frame->End[frame->Tail & (VCP_FRAME_QUEUE - 1)];
+}
+
+/**
+* @brief  VCP_Frame_Mode
+*         Tell whether a port delimits its data in frames.
+* @param  port: CDC port index
+* @retval 1 in frame mode, 0 in stream mode
+*/
+uint8_t VCP_Frame_Mode(uint8_t port)
+{
+    return (Frame[port].GapBits != 0);
+}
+
+/**
+* @brief  VCP_Frame_Release
+*         The frame returned by VCP_Frame_Head() has been handed to USB.
+* @param  port: CDC port index
+* @retval None.
+*/
+void VCP_Frame_Release(uint8_t port)
+{
+    if ((Frame[port].GapBits != 0) && (Frame[port].Head != Frame[port].Tail))
+    {
+        Frame[port].Tail++;
+    }
+}
+
+/**
+* @brief  Rx_Start
+*         Start the DMA reception of a port at the start of its ring.
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Rx_Start(uint8_t port)
+{
+    UART_HandleTypeDef *UartHandle = (port == 0) ? &UartHandleX : &UartHandleY;
+    VCP_RxRingTypeDef *rx = &Rx[port];
+
+    /* Whatever ran before, the DMA or the passthrough interrupt, is stopped */
+    HAL_UART_DMAStop(UartHandle);
+    CLEAR_BIT(UartHandle->Instance->CR1, USART_CR1_RXNEIE);
+
+    rx->Halves = 0;
+    rx->Read = 0;
+    rx->Paused = 0;
+    rx->Pos = 0;
+    Pass.Sent[port] = 0;
+    Rx_Throttle(port, 0);
+    Frame[port].Tail = Frame[port].Head;
+
+    UartHandle->pRxBuffPtr = (uint8_t*)&UART_RxBuffer[port][0];
+    UartHandle->RxXferSize = APP_TX_DATA_SIZE;
+    UartHandle->ErrorCode = HAL_UART_ERROR_NONE;
+
+    /* Passthrough: every character interrupts so that it is passed on at once */
+    if (VcpConfig.Passthrough)
+    {
+        SET_BIT(UartHandle->Instance->CR1, USART_CR1_RXNEIE);
+    }
+    else
+    {
+        HAL_UART_Receive_DMA(UartHandle, (uint8_t*)&UART_RxBuffer[port][0], APP_TX_DATA_SIZE);
+    }
+
+    /* Line errors are reported to the host, the DMA reception does not enable them */
+    __HAL_UART_ENABLE_IT(UartHandle, UART_IT_ERR);
+    __HAL_UART_ENABLE_IT(UartHandle, UART_IT_PE);
+}
+
+/**
+* @brief  Rx_Pos
+*         Give the ring position where the next received character goes.
+* @param  port: CDC port index
+* @retval Position in the ring
+*/
+static uint16_t Rx_Pos(uint8_t port)
+{
+    UART_HandleTypeDef *UartHandle = (port == 0) ? &UartHandleX : &UartHandleY;
+
+    if (VcpConfig.Passthrough)
+    {
+        return Rx[port].Pos;
+    }
+    return (uint16_t)((APP_TX_DATA_SIZE - UartHandle->hdmarx->Instance->CNDTR) % APP_TX_DATA_SIZE);
+}
+
+/**
+* @brief  Rx_Written
+*         Count the bytes written to the ring since the reception started.
+* @param  port: CDC port index
+* @retval Number of bytes
+*/
+static uint32_t Rx_Written(uint8_t port)
+{
+    uint32_t halves;
+    uint32_t pos;
+
+    /* A half ring may end between the two reads */
+    do
+    {
+        halves = Rx[port].Halves;
+        pos = Rx_Pos(port);
+    }
+    while (halves != Rx[port].Halves);
+
+    /* The writer may have crossed into the next half before its interrupt
+       counted the one it filled: the half it writes tells */
+    if ((pos / RX_HALF) != (halves % 2))
+    {
+        halves++;
+    }
+
+    return (halves * RX_HALF) + (pos % RX_HALF);
+}
+
+/**
+* @brief  Rx_Loss
+*         Account for bytes received over USART that never reach the host.
+* @param  port: CDC port index
+* @param  count: number of bytes lost
+* @retval None.
+*/
+static void Rx_Loss(uint8_t port, uint32_t count)
+{
+    VCP_RxRingTypeDef *rx = &Rx[port];
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    rx->Lost += count;
+    rx->LostAt = rx->Read;
+    rx->Overflows++;
+    Modem[port].Errors |= CDC_SERIAL_STATE_OVERRUN;
+    Sniff[port].Errors |= VCP_SNIFF_OVERRUN;
+}
+
+/**
+* @brief  Rx_Check
+*         Apply the overflow policy of a port from the ring fill level. Called
+*         at every half ring and whenever the main loop frees some room.
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Rx_Check(uint8_t port)
+{
+    VCP_RxRingTypeDef *rx = &Rx[port];
+    USART_TypeDef *usart = (port == 0) ? USARTx : USARTy;
+    uint32_t unread = Rx_Written(port) - rx->Read;
+
+    /* The host never holds up a passthrough: its data are dropped oldest first */
+    if (VcpConfig.Passthrough)
+    {
+        return;
+    }
+
+    if (rx->Policy == VCP_RX_DROP_NEWEST)
+    {
+        /* The DMA must be able to write the next half without reaching the
+           oldest unread byte, else the newest characters are discarded */
+        if (!rx->Paused && ((APP_TX_DATA_SIZE - unread) <= RX_HALF))
+        {
+            rx->Paused = 1;
+            CLEAR_BIT(usart->CR3, USART_CR3_DMAR);
+            SET_BIT(usart->CR1, USART_CR1_RXNEIE);
+        }
+        else if (rx->Paused && ((APP_TX_DATA_SIZE - unread) > RX_HALF))
+        {
+            CLEAR_BIT(usart->CR1, USART_CR1_RXNEIE);
+            SET_BIT(usart->CR3, USART_CR3_DMAR);
+            rx->Paused = 0;
+        }
+    }
+    else if (rx->Paused)
+    {
+        CLEAR_BIT(usart->CR1, USART_CR1_RXNEIE);
+        SET_BIT(usart->CR3, USART_CR3_DMAR);
+        rx->Paused = 0;
+    }
+
+    if (rx->Policy == VCP_RX_FLOW_CONTROL)
+    {
+        if (unread >= RX_HALF)
+        {
+            Rx_Throttle(port, 1);
+        }
+        else if (rx->Throttled && (unread <= (APP_TX_DATA_SIZE / 4)))
+        {
+            Rx_Throttle(port, 0);
+        }
+    }
+    else if (rx->Throttled)
+    {
+        Rx_Throttle(port, 0);
+    }
+}
+
+/**
+* @brief  Rx_Throttle
+*         Withdraw RTS while the ring is filling up, give back the state the
+*         host asked for once it has drained.
+* @param  port: CDC port index
+* @param  on: 1 to withdraw RTS
+* @retval None.
+*/
+static void Rx_Throttle(uint8_t port, uint8_t on)
+{
+    VCP_ModemLineTypeDef *rts = &Modem[port].Line[VCP_LINE_RTS];
+
+    Rx[port].Throttled = on;
+    if (rts->GPIOx != NULL)
+    {
+        rts->GPIOx->BSRR = ((Modem[port].LineState & CDC_CTRL_LINE_RTS) && !on) ? rts->AssertBSRR : rts->DeassertBSRR;
+    }
+}
+
+/**
+* @brief  VCP_Rx_Pending
+*         Find the data received over USART not read yet. When the DMA has
+*         come too close to the oldest of them, all but the last half ring are
+*         given up and the loss is accounted.
+* @param  port: CDC port index
+* @param  out: ring position of the first byte not read yet
+* @retval Number of bytes waiting in the ring
+*/
+uint32_t VCP_Rx_Pending(uint8_t port, uint32_t *out)
+{
+    VCP_RxRingTypeDef *rx = &Rx[port];
+    uint32_t unread = Rx_Written(port) - rx->Read;
+
+    if (unread > (APP_TX_DATA_SIZE - RX_MARGIN))
+    {
+        Rx_Loss(port, unread - RX_HALF);
+        rx->Read += unread - RX_HALF;
+        unread = RX_HALF;
+
+        /* The frame ends queued refer to data that are gone */
+        Frame[port].Tail = Frame[port].Head;
+    }
+
+    *out = rx->Read % APP_TX_DATA_SIZE;
+    return unread;
+}
+
+/**
+* @brief  VCP_Rx_Recent
+*         Copy the last ring of bytes received over USART, read or not, the
+*         oldest first. The bytes coming in during the copy may show at
+*         either end.
+* @param  port: CDC port index
+* @param  pbuf: APP_TX_DATA_SIZE bytes
+* @retval Bytes received since the reception started
+*/
+uint32_t VCP_Rx_Recent(uint8_t port, uint8_t *pbuf)
+{
+    uint32_t written = Rx_Written(port);
+    uint32_t pos = written % APP_TX_DATA_SIZE;
+
+    memcpy(pbuf, &UART_RxBuffer[port][pos], APP_TX_DATA_SIZE - pos);
+    memcpy(&pbuf[APP_TX_DATA_SIZE - pos], &UART_RxBuffer[port][0], pos);
+    return written;
+}
+
+/**
+* @brief  VCP_Rx_Intact
+*         Check the bytes being copied out of the ring before they are
+*         handed on.
+* @param  port: CDC port index
+* @retval USBD_OK, or USBD_FAIL when the DMA overwrote them during the copy
+*/
+uint8_t VCP_Rx_Intact(uint8_t port)
+{
+    return ((Rx_Written(port) - Rx[port].Read) > APP_TX_DATA_SIZE) ? USBD_FAIL : USBD_OK;
+}
+
+/**
+* @brief  VCP_Rx_Consume
+*         The main loop has copied bytes out of the ring.
+* @param  port: CDC port index
+* @param  length: number of bytes copied
+* @retval USBD_OK, or USBD_FAIL when the DMA overwrote them during the copy:
+*         they are then accounted as lost and must not be sent
+*/
+uint8_t VCP_Rx_Consume(uint8_t port, uint32_t length)
+{
+    VCP_RxRingTypeDef *rx = &Rx[port];
+    uint8_t ret = USBD_OK;
+
+    if (VCP_Rx_Intact(port) != USBD_OK)
+    {
+        Rx_Loss(port, length);
+        ret = USBD_FAIL;
+    }
+
+    rx->Read += length;
+
+    __disable_irq();
+    Rx_Check(port);
+    __enable_irq();
+
+    return ret;
+}
+
+/**
+* @brief  VCP_RxDma_IRQHandler
+*         Count the half rings written by the reception DMA of a port. The
+*         interrupt is shared with the transmission DMA, which only enables
+*         it for the self-test.
+* @param  port: CDC port index
+* @retval None.
+*/
+void VCP_RxDma_IRQHandler(uint8_t port)
+{
+    UART_HandleTypeDef *UartHandle = (port == 0) ? &UartHandleX : &UartHandleY;
+    DMA_HandleTypeDef *hdma = UartHandle->hdmarx;
+    uint32_t channel = (port == 0) ? USARTx_TX_DMA_CHANNEL : USARTy_TX_DMA_CHANNEL;
+    uint32_t tc = DMA_ISR_TCIF1 << (4 * (channel - LL_DMA_CHANNEL_1));
+    uint8_t halves = 0;
+
+    /* Self-test: a half of the pattern is out */
+    if (LL_DMA_IsEnabledIT_TC(DMA1, channel) && (DMA1->ISR & tc))
+    {
+        DMA1->IFCR = tc;
+        Test_TxDone(port);
+    }
+
+    /* Each half of the ring filled is counted, even when both flags are seen at once */
+    if (__HAL_DMA_GET_FLAG(hdma, __HAL_DMA_GET_HT_FLAG_INDEX(hdma)))
+    {
+        __HAL_DMA_CLEAR_FLAG(hdma, __HAL_DMA_GET_HT_FLAG_INDEX(hdma));
+        halves++;
+    }
+    if (__HAL_DMA_GET_FLAG(hdma, __HAL_DMA_GET_TC_FLAG_INDEX(hdma)))
+    {
+        __HAL_DMA_CLEAR_FLAG(hdma, __HAL_DMA_GET_TC_FLAG_INDEX(hdma));
+        halves++;
+    }
+    if (halves != 0)
+    {
+        Rx[port].Halves += halves;
+        Rx_Check(port);
+        Sniff_Cut(port);
+        if (Test[port].Pattern)
+        {
+            frame_ready = 1;
+        }
+    }
+
+    /* A transfer error stops the channel, the main loop sees the flag */
+    if (__HAL_DMA_GET_FLAG(hdma, __HAL_DMA_GET_TE_FLAG_INDEX(hdma)))
+    {
+        __HAL_DMA_DISABLE_IT(hdma, DMA_IT_TE);
+    }
+}
+
+/**
+* @brief  Rx_GetStats
+*         Report the overflow policy and losses of a port (VCP_REQ_GET_RX_STATS).
+* @param  port: CDC port index
+* @param  pbuf: response buffer
+* @retval None.
+*/
+static void Rx_GetStats(uint8_t port, uint8_t *pbuf)
+{
+    VCP_RxRingTypeDef *rx = &Rx[port];
+    uint32_t words[3];
+    uint8_t i;
+
+    pbuf[0] = rx->Policy;
+    pbuf[1] = (rx->Paused ? 0x01 : 0) | (rx->Throttled ? 0x02 : 0);
+    pbuf[2] = (uint8_t)(rx->LineErrors);
+    pbuf[3] = (uint8_t)(rx->LineErrors >> 8);
+
+    words[0] = rx->Overflows;
+    words[1] = rx->Lost;
+    words[2] = rx->LostAt;
+    for (i = 0; i < 12; i++)
+    {
+        pbuf[4 + i] = (uint8_t)(words[i / 4] >> (8 * (i % 4)));
+    }
+}
+
+/**
+* @brief  Uart_Open
+*         Bring up the USART of a port with the saved profile and start its
+*         reception.
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Uart_Open(uint8_t port)
+{
+    UART_HandleTypeDef *UartHandle = (port == 0) ? &UartHandleX : &UartHandleY;
+    VCP_PortConfigTypeDef *profile = &VcpConfig.Port[port];
+
+    /* Put the USART peripheral in the Asynchronous mode (UART Mode) */
+    /* USART configured with the line coding of the profile, 115200 baud 8N1
+       unless saved otherwise, hardware flow control disabled */
+    UartHandle->Instance        = (port == 0) ? USARTx : USARTy;
+    Derate_Clamp(port);
+    Uart_SetCoding(UartHandle, &LineCoding[port]);
+    UartHandle->Init.HwFlowCtl  = UART_HWCONTROL_NONE;
+    UartHandle->Init.Mode       = UART_MODE_TX_RX;
+    UartHandle->AdvancedInit.AdvFeatureInit = UART_ADVFEATURE_NO_INIT;
+
+    if(HAL_UART_Init(UartHandle) != HAL_OK)
+    {
+        /* Initialization Error */
+        Error_Handler();
+    }
+
+    /* Any data received will stored in the "UART_RxBuffer" ring */
+    Rx[port].Policy = profile->RxPolicy;
+    Rx_Start(port);
+
+    if (port == 1)
+    {
+        /* Point to point mode unless saved otherwise, or the DE pin is taken */
+        if (RS485_Config(1, profile->Rs485) != USBD_OK)
+        {
+            RS485_Config(1, 0);
+        }
+        OnePulse_Init(&GapTimHandle, TIMy_GAP);
+    }
+
+    /* Stream mode unless saved otherwise */
+    Frame_Config(port, profile->FrameGap);
+
+    /* Prepare the transmission DMA channel */
+    Uart_TxInit(port);
+}
+
+/**
+* @brief  VCP_Port_Status
+*         Give the line coding and the counters of a port to the status
+*         screen.
+* @param  port: CDC port index
+* @param  status: filled with the line coding and counters
+* @retval None.
+*/
+void VCP_Port_Status(uint8_t port, VCP_PortStatusTypeDef *status)
+{
+    status->Bitrate    = LineCoding[port].bitrate;
+    status->StopBits   = LineCoding[port].format;
+    status->Parity     = LineCoding[port].paritytype;
+    status->DataBits   = LineCoding[port].datatype;
+    status->Reserved   = 0;
+    status->Received   = Rx_Written(port);
+    status->Sent       = TxSent[port];
+    status->Lost       = Rx[port].Lost;
+    status->LineErrors = Rx[port].LineErrors;
+}
+
+/**
+* @brief  Derate_Clamp
+*         Bring the rate of a line coding being set under the limit of the
+*         thermal derating. The clamped rate is kept, so GET_LINE_CODING
+*         gives the rate the line runs at; a running port is never changed
+*         behind its peer.
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Derate_Clamp(uint8_t port)
+{
+    uint32_t limit = VCP_Sensor_MaxBitrate();
+
+    if (LineCoding[port].bitrate > limit)
+    {
+        LineCoding[port].bitrate = limit;
+        Derated |= (uint8_t)(1 << port);
+    }
+    else
+    {
+        Derated &= (uint8_t)~(1 << port);
+    }
+}
+
+/**
+* @brief  VCP_Profile_Init
+*         Apply the saved profiles at power up: the line coding of each port,
+*         the two USARTs joined without waiting for a host when the
+*         passthrough was left enabled, and the sensor periods.
+* @param  None
+* @retval None.
+*/
+void VCP_Profile_Init(void)
+{
+    uint8_t port;
+
+    /* No capture until the host selects the alternate setting */
+    Capture.Port = CDC_PORT_NONE;
+
+    for (port = 0; port < 2; port++)
+    {
+        LineCoding[port].bitrate    = VcpConfig.Port[port].Bitrate;
+        LineCoding[port].format     = VcpConfig.Port[port].Format;
+        LineCoding[port].paritytype = VcpConfig.Port[port].Parity;
+        LineCoding[port].datatype   = VcpConfig.Port[port].DataBits;
+    }
+
+    if (VcpConfig.Passthrough)
+    {
+        Uart_Open(0);
+        Uart_Open(1);
+    }
+
+    /* The sensors, with the I2C bridge they need */
+    Sensor_Config(VcpConfig.TempPeriod, VcpConfig.GyroPeriod);
+}
+
+/**
+* @brief  Pass_Config
+*         Switch the passthrough on or off and keep the choice in flash.
+* @param  mode: 1 to join the two USARTs, 0 to bridge each one to the host
+* @retval USBD_OK, or USBD_FAIL during a self-test, SAM-BA or a capture
+*/
+static int8_t Pass_Config(uint8_t mode)
+{
+    uint8_t port;
+    uint8_t pending;
+
+    mode = (mode != 0) ? 1 : 0;
+    if (mode == VcpConfig.Passthrough)
+    {
+        return (USBD_OK);
+    }
+    if (Test[0].Pattern || Test[1].Pattern || (Samba.State != VCP_SAMBA_OFF) || (Capture.Port != CDC_PORT_NONE))
+    {
+        return (USBD_FAIL);
+    }
+
+    __disable_irq();
+    for (port = 0; port < 2; port++)
+    {
+        /* A packet from the host cut short is dropped */
+        pending = Uart_TxStop(port);
+        if (pending && !VcpConfig.Passthrough)
+        {
+            Sniff_Release(port, SNIFF_HOLD_UART);
+        }
+        if (port == 1)
+        {
+            SET_BIT(USARTy->CR1, USART_CR1_RE);
+        }
+    }
+
+    VcpConfig.Passthrough = mode;
+    Pass.Dropped[0] = 0;
+    Pass.Dropped[1] = 0;
+    Rx_Start(0);
+    Rx_Start(1);
+    __enable_irq();
+
+    VCP_Config_Changed();
+
+    return (USBD_OK);
+}
+
+/**
+* @brief  Pass_Receive
+*         Store a character received in passthrough and pass it on.
+* @param  port: CDC port index of the USART that received it
+* @param  data: character
+* @retval None.
+*/
+static void Pass_Receive(uint8_t port, uint8_t data)
+{
+    VCP_RxRingTypeDef *rx = &Rx[port];
+    uint16_t pos = rx->Pos;
+
+    UART_RxBuffer[port][pos] = data;
+    pos = (pos + 1) % APP_TX_DATA_SIZE;
+    rx->Pos = pos;
+    if ((pos % RX_HALF) == 0)
+    {
+        rx->Halves++;
+        Sniff_Cut(port);
+    }
+
+    Pass_Forward(port ^ 1);
+}
+
+/**
+* @brief  Pass_Forward
+*         Send on a port the characters received by the other port, unless
+*         a transmission is already running: its end calls back here. A lone
+*         character goes straight to the data register, a backlog by DMA.
+* @param  port: CDC port index of the USART that transmits
+* @retval None.
+* @note   Called from the USART interrupts, else with the interrupts disabled.
+*/
+static void Pass_Forward(uint8_t port)
+{
+    USART_TypeDef *usart = (port == 0) ? USARTx : USARTy;
+    uint8_t src = port ^ 1;
+    uint32_t written;
+    uint32_t pending;
+    uint32_t out;
+
+    if (LL_USART_IsEnabledIT_TC(usart) || Break[port].Active)
+    {
+        return;
+    }
+
+    written = Rx_Written(src);
+    pending = written - Pass.Sent[src];
+    if (pending == 0)
+    {
+        return;
+    }
+
+    /* The receiver is faster: skip what it is about to overwrite */
+    if (pending > (APP_TX_DATA_SIZE - RX_MARGIN))
+    {
+        Pass.Dropped[src] += pending - RX_HALF;
+        Pass.Sent[src] = written - RX_HALF;
+        pending = RX_HALF;
+    }
+
+    out = Pass.Sent[src] % APP_TX_DATA_SIZE;
+    if (pending > (APP_TX_DATA_SIZE - out))
+    {
+        pending = APP_TX_DATA_SIZE - out;
+    }
+    Pass.Sent[src] += pending;
+
+    Uart_Transmit(port, &UART_RxBuffer[src][out], pending);
+}
+
+/**
+* @brief  Pass_GetStats
+*         Report the passthrough state (VCP_REQ_GET_PASSTHROUGH).
+* @param  pbuf: response buffer
+* @retval None.
+*/
+static void Pass_GetStats(uint8_t *pbuf)
+{
+    uint32_t words[4];
+    uint8_t i;
+
+    pbuf[0] = VcpConfig.Passthrough;
+    pbuf[1] = 0;
+    pbuf[2] = 0;
+    pbuf[3] = 0;
+
+    words[0] = Pass.Sent[0];
+    words[1] = Pass.Dropped[0];
+    words[2] = Pass.Sent[1];
+    words[3] = Pass.Dropped[1];
+
+    for (i = 0; i < 16; i++)
+    {
+        pbuf[4 + i] = (uint8_t)(words[i / 4] >> (8 * (i % 4)));
+    }
+}
+
+/**
+* @brief  Profile_Config
+*         Keep the current settings of a port as its power up profile, or go
+*         back to the built-in one. The flash is written by the main loop.
+* @param  port: CDC port index
+* @param  action: VCP_PROFILE_CLEAR/SAVE/LOCK
+* @retval USBD_OK, or USBD_FAIL for an unknown action
+*/
+static int8_t Profile_Config(uint8_t port, uint16_t action)
+{
+    VCP_PortConfigTypeDef *profile = &VcpConfig.Port[port];
+
+    switch (action)
+    {
+    case VCP_PROFILE_CLEAR:
+        VCP_Config_Defaults(port);
+        break;
+
+    case VCP_PROFILE_SAVE:
+    case VCP_PROFILE_LOCK:
+        profile->Bitrate  = LineCoding[port].bitrate;
+        profile->Format   = LineCoding[port].format;
+        profile->Parity   = LineCoding[port].paritytype;
+        profile->DataBits = LineCoding[port].datatype;
+        profile->RxPolicy = Rx[port].Policy;
+        profile->Rs485    = Rs485Config[port];
+        profile->FrameGap = Frame[port].UserBits;
+        profile->Flags    = VCP_PROFILE_SAVED;
+        if (action == VCP_PROFILE_LOCK)
+        {
+            profile->Flags |= VCP_PROFILE_LOCKED;
+        }
+        break;
+
+    default:
+        return (USBD_FAIL);
+    }
+
+    VCP_Config_Changed();
+    return (USBD_OK);
+}
+
+/**
+* @brief  Profile_Get
+*         Report the power up profile of a port (VCP_REQ_GET_PROFILE).
+* @param  port: CDC port index
+* @param  pbuf: response buffer
+* @retval None.
+*/
+static void Profile_Get(uint8_t port, uint8_t *pbuf)
+{
+    VCP_PortConfigTypeDef *profile = &VcpConfig.Port[port];
+    uint32_t erases = VCP_Config_Erases();
+    uint16_t free = VCP_Config_Free();
+    uint8_t i;
+
+    for (i = 0; i < 4; i++)
+    {
+        pbuf[i] = (uint8_t)(profile->Bitrate >> (8 * i));
+        pbuf[16 + i] = (uint8_t)(erases >> (8 * i));
+    }
+    pbuf[4]  = profile->Format;
+    pbuf[5]  = profile->Parity;
+    pbuf[6]  = profile->DataBits;
+    pbuf[7]  = profile->Flags;
+    pbuf[8]  = profile->RxPolicy;
+    pbuf[9]  = VcpConfig.Passthrough;
+    pbuf[10] = (uint8_t)(profile->Rs485);
+    pbuf[11] = (uint8_t)(profile->Rs485 >> 8);
+    pbuf[12] = (uint8_t)(profile->FrameGap);
+    pbuf[13] = (uint8_t)(profile->FrameGap >> 8);
+    pbuf[14] = (uint8_t)(free);
+    pbuf[15] = (uint8_t)(free >> 8);
+}
+
+/**
+* @brief  I2c_Config
+*         Turn the I2C bridge on or off, unless a modem line holds its pins.
+* @param  speed: VCP_I2C_OFF/100K/400K
+* @retval USBD_OK, or USBD_FAIL when the pins are taken or the bridge busy
+*/
+static int8_t I2c_Config(uint8_t speed)
+{
+    if ((speed != VCP_I2C_OFF) &&
+        (Modem_PinInUse(I2Cx_GPIO_PORT, I2Cx_SCL_PIN, NULL) || Modem_PinInUse(I2Cx_GPIO_PORT, I2Cx_SDA_PIN, NULL)))
+    {
+        return (USBD_FAIL);
+    }
+    return VCP_I2C_Config(speed);
+}
+
+/**
+* @brief  Spi_Config
+*         Turn the SPI bridge on or off, unless a modem line or the screen
+*         holds its pins.
+* @param  clock: VCP_SPI_OFF, or 1 to VCP_SPI_CLOCK_MAX
+* @param  mode: SPI mode | VCP_SPI_LSB_FIRST
+* @retval USBD_OK, or USBD_FAIL when the pins are taken or a read is owed
+*/
+static int8_t Spi_Config(uint8_t clock, uint8_t mode)
+{
+    uint32_t pin;
+
+    if (SpiRead.Channel != SPI_READ_NONE)
+    {
+        return (USBD_FAIL);
+    }
+    for (pin = SPIx_CS_PIN; (clock != VCP_SPI_OFF) && (pin <= SPIx_MOSI_PIN); pin <<= 1)
+    {
+        if ((pin & SPIx_PINS) &&
+            (Modem_PinInUse(SPIx_GPIO_PORT, pin, NULL) || VCP_Screen_PinInUse(SPIx_GPIO_PORT, pin)))
+        {
+            return (USBD_FAIL);
+        }
+    }
+    return VCP_SPI_Config(clock, mode);
+}
+
+/**
+* @brief  Spi_Transfer
+*         Start an exchange of the SPI bridge (VCP_REQ_SPI_XFER).
+* @param  pbuf: exchange, see vcp_spi.h
+* @param  length: bytes of pbuf
+* @retval USBD_OK, or USBD_FAIL while an exchange runs or a read is owed
+*/
+static int8_t Spi_Transfer(uint8_t *pbuf, uint16_t length)
+{
+    if (SpiRead.Channel != SPI_READ_NONE)
+    {
+        return (USBD_FAIL);
+    }
+    return (VCP_SPI_Transfer(pbuf, length) == USBD_OK) ? USBD_OK : USBD_FAIL;
+}
+
+/**
+* @brief  Spi_Read
+*         Clock bytes of 0xFF on the SPI bridge and answer with the bytes
+*         received (VCP_REQ_SPI_READ), once the exchange in progress and
+*         this one are done.
+* @param  pbuf: command buffer, [2] wValue: VCP_SPI_HOLD_CS or 0
+* @param  length: bytes to read, up to VCP_SPI_DATA_SIZE
+* @retval USBD_BUSY, the answer follows; USBD_FAIL when the bus is off, the
+*         length wrong or a read already owed
+*/
+static int8_t Spi_Read(uint8_t *pbuf, uint16_t length)
+{
+    uint8_t xfer[2];
+    int8_t status;
+
+    if ((SpiRead.Channel != SPI_READ_NONE) || (length == 0) || (length > VCP_SPI_DATA_SIZE))
+    {
+        return (USBD_FAIL);
+    }
+
+    SpiRead.Flags = pbuf[2] & VCP_SPI_HOLD_CS;
+    SpiRead.Length = (uint8_t)length;
+    SpiRead.Data = pbuf;
+    xfer[0] = SpiRead.Flags | VCP_SPI_FILL;
+    xfer[1] = SpiRead.Length;
+    status = VCP_SPI_Transfer(xfer, sizeof (xfer));
+    if (status == USBD_FAIL)
+    {
+        return (USBD_FAIL);
+    }
+    SpiRead.Started = (status == USBD_OK) ? 1 : 0;
+    SpiRead.Channel = SPI_READ_EP0;  /* The control channel takes it over */
+    return (USBD_BUSY);
+}
+
+/**
+* @brief  VCP_SPI_DoneCallback
+*         An exchange of the SPI bridge is over: start the owed read it held
+*         back, or answer it.
+* @param  None
+* @retval None.
+* @note   Called from the SPI interrupt, of the same priority as the USB one.
+*/
+void VCP_SPI_DoneCallback(void)
+{
+    uint8_t xfer[2];
+
+    if (SpiRead.Channel == SPI_READ_NONE)
+    {
+        return;
+    }
+    if (!SpiRead.Started)
+    {
+        xfer[0] = SpiRead.Flags | VCP_SPI_FILL;
+        xfer[1] = SpiRead.Length;
+        if (VCP_SPI_Transfer(xfer, sizeof (xfer)) == USBD_OK)
+        {
+            SpiRead.Started = 1;
+            return;
+        }
+        Spi_Reply(USBD_FAIL);
+        return;
+    }
+    Spi_Reply((VCP_SPI_State() == VCP_SPI_DONE) ? USBD_OK : USBD_FAIL);
+}
+
+/**
+* @brief  Spi_Reply
+*         Answer the owed read with the bytes received, or refuse it.
+* @param  status: USBD_OK or USBD_FAIL
+* @retval None.
+*/
+static void Spi_Reply(int8_t status)
+{
+    uint8_t *report = (uint8_t *)Hid.Report;
+
+    if (SpiRead.Channel == SPI_READ_HID)
+    {
+        memset(report, 0, VCP_HID_REPORT_SIZE);
+        if (status == USBD_OK)
+        {
+            VCP_SPI_GetData(&report[4], SpiRead.Length);
+            report[3] = SpiRead.Length;
+        }
+        Hid_Answer(VCP_HID_REQUEST, SpiRead.Tag, status);
+    }
+    else
+    {
+        if (status == USBD_OK)
+        {
+            VCP_SPI_GetData(SpiRead.Data, SpiRead.Length);
+        }
+        /* Fails when the host gave up the request meanwhile */
+        USBD_CDC_CtlReply(&USBD_Device, (uint8_t)status);
+    }
+    SpiRead.Channel = SPI_READ_NONE;
+}
+
+/**
+* @brief  Screen_Config
+*         Turn the status screen on or off and keep the choice in flash,
+*         unless a modem line or the SPI bridge holds its pins.
+* @param  on: 1 to show the status
+* @retval USBD_OK, or USBD_FAIL when the pins are taken
+*/
+static int8_t Screen_Config(uint8_t on)
+{
+    uint32_t pin;
+
+    on = (on != 0) ? 1 : 0;
+    for (pin = SCREEN_CS_PIN; on && (pin <= SCREEN_SDA_PIN); pin <<= 1)
+    {
+        if ((pin & SCREEN_PINS) &&
+            (Modem_PinInUse(SCREEN_GPIO_PORT, pin, NULL) || VCP_SPI_PinInUse(SCREEN_GPIO_PORT, pin)))
+        {
+            return (USBD_FAIL);
+        }
+    }
+
+    VCP_Screen_Config(on);
+    if (on != VcpConfig.Screen)
+    {
+        VcpConfig.Screen = on;
+        VCP_Config_Changed();
+    }
+    return (USBD_OK);
+}
+
+/**
+* @brief  Sensor_Config
+*         Set the sensor periods and keep them in flash. The sensors sit on
+*         the I2C bridge bus, turned on at 100 kHz unless already on.
+* @param  temp: temperature period in VCP_SENSOR_UNIT, 0 = off
+* @param  gyro: gyroscope period in VCP_SENSOR_UNIT, 0 = off
+* @retval USBD_OK, or USBD_FAIL when the I2C pins are taken
+*/
+static int8_t Sensor_Config(uint8_t temp, uint8_t gyro)
+{
+    if ((temp || gyro) && !VCP_I2C_PinInUse(I2Cx_GPIO_PORT, I2Cx_SCL_PIN) &&
+        (I2c_Config(VCP_I2C_100K) != USBD_OK))
+    {
+        return (USBD_FAIL);
+    }
+
+    VCP_Sensor_Config(temp, gyro);
+    if ((temp != VcpConfig.TempPeriod) || (gyro != VcpConfig.GyroPeriod))
+    {
+        VcpConfig.TempPeriod = temp;
+        VcpConfig.GyroPeriod = gyro;
+        VCP_Config_Changed();
+    }
+    return (USBD_OK);
+}
+
+/**
+* @brief  Sniff_Config
+*         Switch the IN stream of a port between raw data and sniffer records.
+* @param  port: CDC port index
+* @param  on: 1 to send sniffer records
+* @retval USBD_OK, or USBD_FAIL while the port frames its data
+*/
+static int8_t Sniff_Config(uint8_t port, uint8_t on)
+{
+    on = (on != 0) ? 1 : 0;
+    if (on && (Cobs[port].On || (Capture.Port == port) || ((port == 1) && (Samba.State != VCP_SAMBA_OFF))))
+    {
+        return (USBD_FAIL);
+    }
+
+    /* The time base runs free from the first use on */
+    if (on && (SniffTimHandle.Instance == NULL))
+    {
+        SniffTimHandle.Instance = SNIFF_TIM;
+        SniffTimHandle.Init.Prescaler = (SystemCoreClock / 1000000) - 1;
+        SniffTimHandle.Init.Period = 0xFFFFFFFF;
+        SniffTimHandle.Init.ClockDivision = 0;
+        SniffTimHandle.Init.CounterMode = TIM_COUNTERMODE_UP;
+        SniffTimHandle.Init.RepetitionCounter = 0;
+        if(HAL_TIM_Base_Init(&SniffTimHandle) != HAL_OK)
+        {
+            /* Initialization Error */
+            Error_Handler();
+        }
+        HAL_TIM_Base_Start(&SniffTimHandle);
+    }
+
+    __disable_irq();
+    Sniff[port].On = on;
+    Sniff[port].Errors = 0;
+    if (!on)
+    {
+        Sniff_Release(port, SNIFF_HOLD_RECORD);
+    }
+    __enable_irq();
+
+    /* Chunks are frames ending on a short idle gap */
+    Frame_Restart(port);
+    return (USBD_OK);
+}
+
+/**
+* @brief  Sniff_Host
+*         A packet from the host is about to be sent on TX: keep it for its
+*         record.
+* @param  port: CDC port index
+* @param  len: number of bytes
+* @retval None.
+*/
+static void Sniff_Host(uint8_t port, uint32_t len)
+{
+    if (Sniff[port].On && (len != 0))
+    {
+        Sniff[port].HostLength = (uint8_t)len;
+        Sniff[port].Hold = SNIFF_HOLD_UART | SNIFF_HOLD_RECORD;
+    }
+}
+
+/**
+* @brief  Sniff_Release
+*         Clear what the host packet of a port waits for, and take the next
+*         packet once nothing is left.
+* @param  port: CDC port index
+* @param  hold: SNIFF_HOLD_xxx
+* @retval None.
+* @note   Called from the interrupts, else with the interrupts disabled.
+*/
+static void Sniff_Release(uint8_t port, uint8_t hold)
+{
+    VCP_SniffTypeDef *sniff = &Sniff[port];
+
+    if ((hold == SNIFF_HOLD_RECORD) && !(sniff->Hold & SNIFF_HOLD_RECORD))
+    {
+        return;
+    }
+
+    /* The last stop bit is out: time the record and have it sent */
+    if ((hold & SNIFF_HOLD_UART) && (sniff->Hold & SNIFF_HOLD_RECORD))
+    {
+        sniff->HostStamp = SNIFF_TIM->CNT;
+        frame_ready = 1;
+    }
+
+    sniff->Hold &= ~hold;
+    if (sniff->Hold == 0)
+    {
+        USBD_CDC_ReceivePacket(&USBD_Device, port);
+    }
+}
+
+/**
+* @brief  Sniff_Cut
+*         A half ring has been filled: end the chunk there so that a stream
+*         without gaps still goes to the host.
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Sniff_Cut(uint8_t port)
+{
+    UART_HandleTypeDef *UartHandle = (port == 0) ? &UartHandleX : &UartHandleY;
+
+    if (Sniff[port].On)
+    {
+        Sniff[port].Errors |= VCP_SNIFF_CUT;
+        Frame_Push(port, UartHandle);
+    }
+}
+
+/**
+* @brief  Sniff_Encode
+*         Write the header of a sniffer record.
+* @param  pbuf: record buffer
+* @param  flags: VCP_SNIFF_xxx
+* @param  length: number of data bytes following the header
+* @param  stamp: time in us
+* @retval None.
+*/
+static void Sniff_Encode(uint8_t *pbuf, uint8_t flags, uint32_t length, uint32_t stamp)
+{
+    pbuf[0] = VCP_SNIFF_SYNC;
+    pbuf[1] = flags;
+    pbuf[2] = (uint8_t)(length);
+    pbuf[3] = (uint8_t)(length >> 8);
+    pbuf[4] = (uint8_t)(stamp);
+    pbuf[5] = (uint8_t)(stamp >> 8);
+    pbuf[6] = (uint8_t)(stamp >> 16);
+    pbuf[7] = (uint8_t)(stamp >> 24);
+}
+
+/**
+* @brief  VCP_Sniff_Header
+*         Write the record header of the chunk about to be sent to the host,
+*         the one returned by VCP_Frame_Head().
+* @param  port: CDC port index
+* @param  pbuf: IN buffer, the data follow the header
+* @param  length: number of data bytes
+* @retval Size of the header, 0 when the port does not sniff
+*/
+uint32_t VCP_Sniff_Header(uint8_t port, uint8_t *pbuf, uint32_t length)
+{
+    uint8_t tail = Frame[port].Tail & (VCP_FRAME_QUEUE - 1);
+
+    if (!Sniff[port].On)
+    {
+        return 0;
+    }
+
+    Sniff_Encode(pbuf, Sniff[port].Flags[tail], length, Sniff[port].Stamp[tail]);
+    return VCP_SNIFF_HEADER_SIZE;
+}
+
+/**
+* @brief  VCP_Sniff_HostRecord
+*         Build the record of the last packet the host sent on TX, once it
+*         is out, and take the next packet.
+* @param  port: CDC port index
+* @param  pbuf: IN buffer
+* @retval Size of the record, 0 when there is none
+*/
+uint32_t VCP_Sniff_HostRecord(uint8_t port, uint8_t *pbuf)
+{
+    VCP_SniffTypeDef *sniff = &Sniff[port];
+    uint32_t length = sniff->HostLength;
+
+    if (sniff->Hold != SNIFF_HOLD_RECORD)
+    {
+        return 0;
+    }
+
+    Sniff_Encode(pbuf, VCP_SNIFF_HOST, length, sniff->HostStamp);
+    memcpy(&pbuf[VCP_SNIFF_HEADER_SIZE], &UserRxBuffer[port][0], length);
+
+    __disable_irq();
+    Sniff_Release(port, SNIFF_HOLD_RECORD);
+    __enable_irq();
+
+    return VCP_SNIFF_HEADER_SIZE + length;
+}
+
+/**
+* @brief  Sniff_GetState
+*         Report the sniffer state of a port and the current time, to line
+*         the records up with the host clock (VCP_REQ_GET_SNIFF).
+* @param  port: CDC port index
+* @param  pbuf: response buffer
+* @retval None.
+*/
+static void Sniff_GetState(uint8_t port, uint8_t *pbuf)
+{
+    uint32_t now = (SniffTimHandle.Instance != NULL) ? SNIFF_TIM->CNT : 0;
+
+    pbuf[0] = Sniff[port].On;
+    pbuf[1] = 0;
+    pbuf[2] = 0;
+    pbuf[3] = 0;
+    pbuf[4] = (uint8_t)(now);
+    pbuf[5] = (uint8_t)(now >> 8);
+    pbuf[6] = (uint8_t)(now >> 16);
+    pbuf[7] = (uint8_t)(now >> 24);
+}
+
+/**
+* @brief  Test_Config
+*         Start or end the self-test of a port (VCP_REQ_SET_TEST).
+* @param  port: CDC port index
+* @param  value: VCP_TEST_xxx pattern, with VCP_TEST_LOOPBACK for the single
+*         wire mode
+* @retval USBD_OK, or USBD_FAIL for an unknown pattern or in passthrough
+*/
+static int8_t Test_Config(uint8_t port, uint16_t value)
+{
+    UART_HandleTypeDef *UartHandle = (port == 0) ? &UartHandleX : &UartHandleY;
+    uint8_t pattern = (uint8_t)value;
+
+    if ((pattern > VCP_TEST_PRBS31) || VcpConfig.Passthrough ||
+        (pattern && (Capture.Port == port)) ||
+        (pattern && (port == 1) && (Samba.State != VCP_SAMBA_OFF)))
+    {
+        return (USBD_FAIL);
+    }
+
+    Test_End(port);
+    Test[port].Pattern = pattern;
+    Test[port].Loopback = (value & VCP_TEST_LOOPBACK) ? 1 : 0;
+
+    /* Either way the USART is set up again: for the test, or back to the bridge */
+    ComPort_Config(UartHandle);
+    return (USBD_OK);
+}
+
+/**
+* @brief  Test_Apply
+*         Set the USART of a port under self-test: pattern most significant
+*         bit first, and RX joined to TX in loopback.
+* @param  UartHandle: UART handle, just initialized
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Test_Apply(UART_HandleTypeDef *UartHandle, uint8_t port)
+{
+    if (!Test[port].Pattern)
+    {
+        return;
+    }
+
+    __HAL_UART_DISABLE(UartHandle);
+    SET_BIT(UartHandle->Instance->CR2, USART_CR2_MSBFIRST);
+    if (Test[port].Loopback)
+    {
+        SET_BIT(UartHandle->Instance->CR3, USART_CR3_HDSEL);
+    }
+    __HAL_UART_ENABLE(UartHandle);
+}
+
+/**
+* @brief  Test_Start
+*         Clear the results and have the main loop send the first halves.
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Test_Start(uint8_t port)
+{
+    VCP_TestTypeDef *test = &Test[port];
+    uint32_t channel = (port == 0) ? USARTx_TX_DMA_CHANNEL : USARTy_TX_DMA_CHANNEL;
+
+    test->Locked = 0;
+    test->Run = 0;
+    test->TxState = 0xFFFFFFFF;
+    test->RxState = 0;
+    test->Filled = 0;
+    test->Started = 0;
+    test->Busy = 0;
+    test->RoomMin = APP_TX_DATA_SIZE;
+    test->Stalls = 0;
+    test->Resyncs = 0;
+    test->Sent = 0;
+    test->Received = 0;
+    test->BitErrors = 0;
+    test->ByteErrors = 0;
+    test->LostBase = Rx[port].Lost;
+    test->StartTick = HAL_GetTick();
+
+    /* The end of each half interrupts, a flag left by the bridge does not */
+    DMA1->IFCR = DMA_IFCR_CTCIF1 << (4 * (channel - LL_DMA_CHANNEL_1));
+    LL_DMA_EnableIT_TC(DMA1, channel);
+
+    frame_ready = 1;
+}
+
+/**
+* @brief  Test_End
+*         Stop the self-test of a port, its results stay readable.
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Test_End(uint8_t port)
+{
+    if (Test[port].Pattern)
+    {
+        Test[port].Pattern = VCP_TEST_OFF;
+        Test[port].EndTick = HAL_GetTick();
+        Uart_TxStop(port);
+    }
+}
+
+/**
+* @brief  Test_Send
+*         Hand the next half of the pattern to the transmission DMA. Called
+*         with the DMA interrupt masked or from it.
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Test_Send(uint8_t port)
+{
+    VCP_TestTypeDef *test = &Test[port];
+    USART_TypeDef *usart = (port == 0) ? USARTx : USARTy;
+    uint32_t channel = (port == 0) ? USARTx_TX_DMA_CHANNEL : USARTy_TX_DMA_CHANNEL;
+
+    LL_DMA_DisableChannel(DMA1, channel);
+    LL_DMA_ConfigAddresses(DMA1, channel, (uint32_t)&UserTxBuffer[port][(test->Started & 1) * TEST_HALF],
+                           LL_USART_DMA_GetRegAddr(usart, LL_USART_DMA_REG_DATA_TRANSMIT),
+                           LL_DMA_DIRECTION_MEMORY_TO_PERIPH);
+    LL_DMA_SetDataLength(DMA1, channel, TEST_HALF);
+    LL_USART_EnableDMAReq_TX(usart);
+    LL_DMA_EnableChannel(DMA1, channel);
+
+    test->Started++;
+    test->Busy = 1;
+}
+
+/**
+* @brief  Test_TxDone
+*         The DMA has moved a half to the USART, which still holds two
+*         characters: the next half follows without a gap when it is ready.
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Test_TxDone(uint8_t port)
+{
+    VCP_TestTypeDef *test = &Test[port];
+
+    test->Sent += TEST_HALF;
+    if (test->Filled != test->Started)
+    {
+        Test_Send(port);
+    }
+    else
+    {
+        test->Busy = 0;
+        test->Stalls++;
+    }
+
+    /* The half just sent can be generated again */
+    frame_ready = 1;
+}
+
+/**
+* @brief  VCP_Test_Process
+*         Run the self-test of a port from the main loop: generate the next
+*         half of the pattern and check what was received.
+* @param  port: CDC port index
+* @retval 1 when the port is under self-test, else 0
+*/
+uint8_t VCP_Test_Process(uint8_t port)
+{
+    VCP_TestTypeDef *test = &Test[port];
+    uint8_t *pbuf;
+    uint32_t pending;
+    uint32_t first;
+    uint32_t out;
+    uint32_t i;
+
+    if (!test->Pattern)
+    {
+        return 0;
+    }
+
+    /* One half is being sent, the other one is generated ahead */
+    while (test->Filled == test->Started)
+    {
+        pbuf = &UserTxBuffer[port][(test->Filled & 1) * TEST_HALF];
+        for (i = 0; i < TEST_HALF; i++)
+        {
+            pbuf[i] = Prbs_Next(&test->TxState, test->Pattern);
+        }
+
+        __disable_irq();
+        test->Filled++;
+        if (test->Pattern && !test->Busy)
+        {
+            Test_Send(port);
+        }
+        __enable_irq();
+    }
+
+    pending = VCP_Rx_Pending(port, &out);
+    if ((APP_TX_DATA_SIZE - pending) < test->RoomMin)
+    {
+        test->RoomMin = (uint16_t)(APP_TX_DATA_SIZE - pending);
+    }
+
+    first = APP_TX_DATA_SIZE - out;
+    if (pending > first)
+    {
+        Test_Check(test, &UART_RxBuffer[port][out], first);
+        Test_Check(test, &UART_RxBuffer[port][0], pending - first);
+    }
+    else
+    {
+        Test_Check(test, &UART_RxBuffer[port][out], pending);
+    }
+    test->Received += pending;
+
+    /* Bytes overwritten during the check are lost, the checker slips */
+    VCP_Rx_Consume(port, pending);
+    return 1;
+}
+
+/**
+* @brief  Test_Check
+*         Check received bytes against the pattern. Unlocked, each byte is
+*         predicted from the bytes before it, so that the checker locks on
+*         whatever the phase; locked, it runs its own generator and counts
+*         the differences.
+* @param  test: self-test state of the port
+* @param  pbuf: received bytes
+* @param  len: number of bytes
+* @retval None.
+*/
+static void Test_Check(VCP_TestTypeDef *test, const uint8_t *pbuf, uint32_t len)
+{
+    uint32_t state;
+    uint8_t diff;
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        if (test->Locked)
+        {
+            diff = Prbs_Next(&test->RxState, test->Pattern) ^ pbuf[i];
+            if (diff == 0)
+            {
+                test->Run = 0;
+                continue;
+            }
+
+            test->ByteErrors++;
+            test->BitErrors += NibbleBits[diff & 0x0F] + NibbleBits[diff >> 4];
+            if (++test->Run >= TEST_UNLOCK)
+            {
+                test->Locked = 0;
+                test->Run = 0;
+                test->Resyncs++;
+            }
+        }
+        else
+        {
+            state = test->RxState;
+            diff = Prbs_Next(&state, test->Pattern) ^ pbuf[i];
+            test->RxState = (test->RxState << 8) | pbuf[i];
+
+            test->Run = (diff == 0) ? (test->Run + 1) : 0;
+            if (test->Run >= TEST_LOCK)
+            {
+                test->Locked = 1;
+                test->Run = 0;
+            }
+        }
+    }
+}
+
+/**
+* @brief  Prbs_Next
+*         Generate the next 8 bits of a pattern. The taps being at least 8
+*         bits back, a byte is computed at once from the last bits (two
+*         nibbles for PRBS-7, whose taps are 6 bits back).
+* @param  state: last bits of the sequence, the newest in bit 0
+* @param  pattern: VCP_TEST_PRBSxx
+* @retval Next 8 bits, the first one in bit 7
+*/
+static uint8_t Prbs_Next(uint32_t *state, uint8_t pattern)
+{
+    uint32_t s = *state;
+
+    switch (pattern)
+    {
+    case VCP_TEST_PRBS7:
+        s = (s << 4) | (((s >> 2) ^ (s >> 3)) & 0x0F);
+        s = (s << 4) | (((s >> 2) ^ (s >> 3)) & 0x0F);
+        break;
+    case VCP_TEST_PRBS15:
+        s = (s << 8) | (((s >> 6) ^ (s >> 7)) & 0xFF);
+        break;
+    default:
+        s = (s << 8) | (((s >> 20) ^ (s >> 23)) & 0xFF);
+        break;
+    }
+
+    *state = s;
+    return (uint8_t)s;
+}
+
+/**
+* @brief  Test_GetStats
+*         Report the results of the self-test of a port (VCP_REQ_GET_TEST).
+*         The throughput is the bytes sent over the test time, the bit error
+*         rate the bit errors over 8 times the bytes received.
+* @param  port: CDC port index
+* @param  pbuf: response buffer
+* @retval None.
+*/
+static void Test_GetStats(uint8_t port, uint8_t *pbuf)
+{
+    VCP_TestTypeDef *test = &Test[port];
+    uint32_t words[6];
+    uint8_t i;
+
+    words[0] = (test->Pattern ? HAL_GetTick() : test->EndTick) - test->StartTick;
+    words[1] = test->Sent;
+    words[2] = test->Received;
+    words[3] = test->BitErrors;
+    words[4] = test->ByteErrors;
+    words[5] = Rx[port].Lost - test->LostBase;
+
+    pbuf[0] = test->Pattern;
+    pbuf[1] = test->Loopback | (test->Locked << 1);
+    pbuf[2] = (uint8_t)(test->RoomMin);
+    pbuf[3] = (uint8_t)(test->RoomMin >> 8);
+    for (i = 0; i < 24; i++)
+    {
+        pbuf[4 + i] = (uint8_t)(words[i / 4] >> (8 * (i % 4)));
+    }
+    pbuf[28] = (uint8_t)(test->Stalls);
+    pbuf[29] = (uint8_t)(test->Stalls >> 8);
+    pbuf[30] = (uint8_t)(test->Resyncs);
+    pbuf[31] = (uint8_t)(test->Resyncs >> 8);
+}
+
+/**
+* @brief  Autobaud_Config
+*         Set the auto-baud mode of a port, or detect the rate again when the
+*         mode is the one in use (VCP_REQ_SET_AUTOBAUD).
+* @param  port: CDC port index, only port X has the hardware
+* @param  mode: VCP_AUTOBAUD_xxx
+* @retval USBD_OK, or USBD_FAIL on port Y or for an unknown mode
+*/
+static int8_t Autobaud_Config(uint8_t port, uint8_t mode)
+{
+    if ((port != 0) || (mode > VCP_AUTOBAUD_0X55))
+    {
+        return (USBD_FAIL);
+    }
+
+    if ((mode == Autobaud.Mode) && (mode != VCP_AUTOBAUD_OFF))
+    {
+        /* The USART measures the next character, the data keep flowing */
+        Autobaud.State = VCP_AUTOBAUD_WAITING;
+        __HAL_UART_SEND_REQ(&UartHandleX, UART_AUTOBAUD_REQUEST);
+        return (USBD_OK);
+    }
+
+    Autobaud.Mode = mode;
+    Autobaud.State = VCP_AUTOBAUD_IDLE;
+    ComPort_Config(&UartHandleX);
+    return (USBD_OK);
+}
+
+/**
+* @brief  VCP_Autobaud_Process
+*         Take the rate the USART has found. Called from the main loop on
+*         every polling tick.
+* @param  None.
+* @retval None.
+*/
+void VCP_Autobaud_Process(void)
+{
+    uint32_t isr = UartHandleX.Instance->ISR;
+    uint32_t rate;
+    uint32_t i;
+
+    if ((Autobaud.State != VCP_AUTOBAUD_WAITING) || !(isr & USART_ISR_ABRF))
+    {
+        return;
+    }
+
+    /* Out of range, or not the character expected: wait for the next one */
+    if (isr & USART_ISR_ABRE)
+    {
+        Autobaud.Failures++;
+        __HAL_UART_SEND_REQ(&UartHandleX, UART_AUTOBAUD_REQUEST);
+        return;
+    }
+
+    /* The divider is measured to a clock cycle: report the standard rate it stands for */
+    rate = HAL_RCC_GetPCLK1Freq() / UartHandleX.Instance->BRR;
+    for (i = 0; i < (sizeof (AutobaudRates) / sizeof (AutobaudRates[0])); i++)
+    {
+        if ((rate > (AutobaudRates[i] - (AutobaudRates[i] / AUTOBAUD_SNAP))) &&
+            (rate < (AutobaudRates[i] + (AutobaudRates[i] / AUTOBAUD_SNAP))))
+        {
+            rate = AutobaudRates[i];
+            break;
+        }
+    }
+
+    __disable_irq();
+    if (Autobaud.State == VCP_AUTOBAUD_WAITING)
+    {
+        Autobaud.Rate = rate;
+        Autobaud.State = VCP_AUTOBAUD_LOCKED;
+        LineCoding[0].bitrate = rate;
+        UartHandleX.Init.BaudRate = rate;
+
+        /* The gaps are counted in bits, their length in time changes */
+        Frame_Apply(&UartHandleX, Frame[0].GapBits);
+    }
+    __enable_irq();
+}
+
+/**
+* @brief  Autobaud_GetState
+*         Report the auto-baud mode and result of a port (VCP_REQ_GET_AUTOBAUD).
+* @param  port: CDC port index
+* @param  pbuf: response buffer
+* @retval None.
+*/
+static void Autobaud_GetState(uint8_t port, uint8_t *pbuf)
+{
+    if (port != 0)
+    {
+        memset(pbuf, 0, 8);
+        return;
+    }
+
+    pbuf[0] = Autobaud.Mode;
+    pbuf[1] = Autobaud.State;
+    pbuf[2] = (uint8_t)(Autobaud.Failures);
+    pbuf[3] = (uint8_t)(Autobaud.Failures >> 8);
+    pbuf[4] = (uint8_t)(Autobaud.Rate);
+    pbuf[5] = (uint8_t)(Autobaud.Rate >> 8);
+    pbuf[6] = (uint8_t)(Autobaud.Rate >> 16);
+    pbuf[7] = (uint8_t)(Autobaud.Rate >> 24);
+}
+
+/**
+* @brief  Cobs_Config
+*         Switch the data of a port between a raw stream and COBS frames
+*         checked by a CRC-32, in both directions.
+* @param  port: CDC port index
+* @param  on: 1 to frame the data
+* @retval USBD_OK, or USBD_FAIL while the port sniffs
+*/
+static int8_t Cobs_Config(uint8_t port, uint8_t on)
+{
+    VCP_CobsTypeDef *cobs = &Cobs[port];
+
+    on = (on != 0) ? 1 : 0;
+    if (on && (Sniff[port].On || (Capture.Port == port) || ((port == 1) && (Samba.State != VCP_SAMBA_OFF))))
+    {
+        return (USBD_FAIL);
+    }
+
+    /* The CRC unit is set up on the first use: CRC-32 of Ethernet, reflected */
+    if (on && (CrcHandle.Instance == NULL))
+    {
+        CrcHandle.Instance = CRC;
+        CrcHandle.Init.DefaultPolynomialUse = DEFAULT_POLYNOMIAL_ENABLE;
+        CrcHandle.Init.DefaultInitValueUse = DEFAULT_INIT_VALUE_ENABLE;
+        CrcHandle.Init.InputDataInversionMode = CRC_INPUTDATA_INVERSION_BYTE;
+        CrcHandle.Init.OutputDataInversionMode = CRC_OUTPUTDATA_INVERSION_ENABLE;
+        CrcHandle.InputDataFormat = CRC_INPUTDATA_FORMAT_BYTES;
+        if (HAL_CRC_Init(&CrcHandle) != HAL_OK)
+        {
+            /* Initialization Error */
+            Error_Handler();
+        }
+    }
+
+    __disable_irq();
+    /* A host packet held for the main loop is taken back, one on TX is
+       released by its transmission end */
+    if (cobs->On && !on && cobs->Pending && !cobs->Sending)
+    {
+        USBD_CDC_ReceivePacket(&USBD_Device, port);
+    }
+    memset(cobs, 0, sizeof (*cobs));
+    cobs->On = on;
+    Sniff[port].Errors = 0;
+    __enable_irq();
+
+    /* Chunks are frames ending on a short idle gap */
+    Frame_Restart(port);
+    return (USBD_OK);
+}
+
+/**
+* @brief  Cobs_Receive
+*         Gather a packet of the host behind the ones already received, for
+*         the main loop to look for complete frames.
+* @param  port: CDC port index
+* @param  pbuf: packet received
+* @param  len: number of bytes
+* @retval None.
+*/
+static void Cobs_Receive(uint8_t port, uint8_t *pbuf, uint32_t len)
+{
+    VCP_CobsTypeDef *cobs = &Cobs[port];
+
+    if ((cobs->Fill + len) > VCP_COBS_OUT_MAX)
+    {
+        /* The frame cannot fit: drop it up to its delimiter */
+        if (!cobs->Skip)
+        {
+            cobs->Overflows++;
+        }
+        cobs->Fill = 0;
+        cobs->Skip = 1;
+    }
+
+    memcpy(&UserRxBuffer[port][COBS_OUT_OFFSET + cobs->Fill], pbuf, len);
+    cobs->Fill += len;
+
+    /* The OUT endpoint stays NAKed until the main loop is done */
+    cobs->Pending = 1;
+    frame_ready = 1;
+}
+
+/**
+* @brief  Cobs_Sent
+*         A frame of the host is out on TX: have the main loop go on.
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Cobs_Sent(uint8_t port)
+{
+    Cobs[port].Sending = 0;
+    Cobs[port].Pending = 1;
+    frame_ready = 1;
+}
+
+/**
+* @brief  VCP_Cobs_Header
+*         Room to leave in front of the chunk about to be sent to the host.
+* @param  port: CDC port index
+* @retval 1 for the first COBS code, 0 when the port does not frame its data
+*/
+uint32_t VCP_Cobs_Header(uint8_t port)
+{
+    return Cobs[port].On ? 1 : 0;
+}
+
+/**
+* @brief  VCP_Cobs_Encode
+*         Turn the chunk about to be sent to the host into a frame: append
+*         its CRC-32, then COBS encode it in place and end it.
+* @param  port: CDC port index
+* @param  pbuf: IN buffer, the data follow the room of VCP_Cobs_Header()
+* @param  size: number of bytes in the buffer
+* @retval Size of the frame, size when the port does not frame its data
+* @note   A chunk is shorter than 254 bytes, so the frame is a single COBS
+*         block and the encoding only replaces the zeros.
+*/
+uint32_t VCP_Cobs_Encode(uint8_t port, uint8_t *pbuf, uint32_t size)
+{
+    uint8_t tail = Frame[port].Tail & (VCP_FRAME_QUEUE - 1);
+    uint32_t crc;
+    uint32_t code = 0;
+    uint32_t i;
+
+    if (!Cobs[port].On)
+    {
+        return size;
+    }
+
+    /* A chunk received damaged goes with a CRC the host will reject */
+    crc = Cobs_Crc(&pbuf[1], size - 1);
+    if (Sniff[port].Flags[tail] & COBS_LINE_ERRORS)
+    {
+        crc = ~crc;
+        Cobs[port].Poisoned++;
+    }
+    pbuf[size++] = (uint8_t)(crc);
+    pbuf[size++] = (uint8_t)(crc >> 8);
+    pbuf[size++] = (uint8_t)(crc >> 16);
+    pbuf[size++] = (uint8_t)(crc >> 24);
+
+    /* Each code is the distance to the next zero, the last one to the end */
+    for (i = 1; i < size; i++)
+    {
+        if (pbuf[i] == VCP_COBS_DELIMITER)
+        {
+            pbuf[code] = (uint8_t)(i - code);
+            code = i;
+        }
+    }
+    pbuf[code] = (uint8_t)(size - code);
+    pbuf[size++] = VCP_COBS_DELIMITER;
+
+    Cobs[port].FramesIn++;
+    return size;
+}
+
+/**
+* @brief  VCP_Cobs_Process
+*         Send the frames of the host gathered by the ports, called from the
+*         main loop.
+* @param  None
+* @retval None
+*/
+void VCP_Cobs_Process(void)
+{
+    uint8_t port;
+
+    for (port = 0; port < 2; port++)
+    {
+        if (Cobs[port].On && Cobs[port].Pending && !Cobs[port].Sending)
+        {
+            Cobs[port].Pending = 0;
+            Cobs_Out(port);
+        }
+    }
+}
+
+/**
+* @brief  Cobs_Out
+*         Drop the frame just sent on TX, then send the next good frame of
+*         the host, or take the next packet when none is complete.
+* @param  port: CDC port index
+* @retval None.
+*/
+static void Cobs_Out(uint8_t port)
+{
+    VCP_CobsTypeDef *cobs = &Cobs[port];
+    uint8_t *pbuf = &UserRxBuffer[port][COBS_OUT_OFFSET];
+    uint8_t *end;
+    uint32_t used;
+    uint32_t size;
+
+    used = cobs->Sent;
+    cobs->Sent = 0;
+    while (1)
+    {
+        cobs->Fill -= used;
+        memmove(pbuf, &pbuf[used], cobs->Fill);
+
+        end = memchr(pbuf, VCP_COBS_DELIMITER, cobs->Fill);
+        if (end == NULL)
+        {
+            break;
+        }
+        used = (uint32_t)(end - pbuf) + 1;
+
+        size = Cobs_Decode(pbuf, used - 1);
+        if (cobs->Skip)
+        {
+            /* Tail of a frame too long */
+            cobs->Skip = 0;
+        }
+        else if ((size > VCP_COBS_CRC_SIZE) && (Cobs_Crc(pbuf, size) == 0x2144DF1C))
+        {
+            /* The data alone go out, the frame is dropped at its end */
+            cobs->FramesOut++;
+            cobs->Sent = (uint16_t)used;
+            cobs->Sending = 1;
+            Uart_Transmit(port, pbuf, size - VCP_COBS_CRC_SIZE);
+            return;
+        }
+        else if (used > 1)
+        {
+            cobs->BadFrames++;
+        }
+    }
+
+    USBD_CDC_ReceivePacket(&USBD_Device, port);
+}
+
+/**
+* @brief  Cobs_Decode
+*         Decode a COBS frame in place, its delimiter excluded.
+* @param  pbuf: frame
+* @param  len: number of encoded bytes
+* @retval Number of decoded bytes, 0 when a code runs past the end
+*/
+static uint32_t Cobs_Decode(uint8_t *pbuf, uint32_t len)
+{
+    uint32_t in = 0;
+    uint32_t out = 0;
+    uint8_t code;
+    uint8_t i;
+
+    while (in < len)
+    {
+        code = pbuf[in++];
+        if ((in + code - 1) > len)
+        {
+            return 0;
+        }
+        for (i = 1; i < code; i++)
+        {
+            pbuf[out++] = pbuf[in++];
+        }
+        /* A zero follows the block, unless it is full or the last one */
+        if ((code != 0xFF) && (in < len))
+        {
+            pbuf[out++] = 0;
+        }
+    }
+    return out;
+}
+
+/**
+* @brief  Cobs_Crc
+*         CRC-32 of a buffer, as Ethernet and zlib compute it.
+* @param  pbuf: data
+* @param  len: number of bytes
+* @retval CRC
+* @note   Over the data followed by their CRC (little endian) the result is
+*         the constant 0x2144DF1C.
+*/
+static uint32_t Cobs_Crc(uint8_t *pbuf, uint32_t len)
+{
+    return HAL_CRC_Calculate(&CrcHandle, (uint32_t *)pbuf, len) ^ 0xFFFFFFFF;
+}
+
+/**
+* @brief  Cobs_GetStats
+*         Fill the VCP_REQ_GET_COBS answer of a port.
+* @param  port: CDC port index
+* @param  pbuf: 24 bytes, see usbd_cdc_interface.h
+* @retval None.
+*/
+static void Cobs_GetStats(uint8_t port, uint8_t *pbuf)
+{
+    VCP_CobsTypeDef *cobs = &Cobs[port];
+    uint32_t values[5];
+    uint8_t i;
+
+    values[0] = cobs->FramesIn;
+    values[1] = cobs->Poisoned;
+    values[2] = cobs->FramesOut;
+    values[3] = cobs->BadFrames;
+    values[4] = cobs->Overflows;
+
+    memset(pbuf, 0, 24);
+    pbuf[0] = cobs->On;
+    for (i = 0; i < 5; i++)
+    {
+        pbuf[4 + (4 * i)]     = (uint8_t)(values[i]);
+        pbuf[4 + (4 * i) + 1] = (uint8_t)(values[i] >> 8);
+        pbuf[4 + (4 * i) + 2] = (uint8_t)(values[i] >> 16);
+        pbuf[4 + (4 * i) + 3] = (uint8_t)(values[i] >> 24);
+    }
+}
+
+/**
+* @brief  VCP_Dfu_Process
+*         Leave for the loader a few ticks after DFU_DETACH. Called from the
+*         main loop on every polling tick.
+* @param  None.
+* @retval None.
+*/
+void VCP_Dfu_Process(void)
+{
+    if ((DfuDetach == 0) || (--DfuDetach != 0))
+    {
+        return;
+    }
+
+    /* Pending settings are written first, the loader may erase their page */
+    VCP_Config_Process();
+
+    USBD_Stop(&USBD_Device);
+    HAL_Delay(DFU_DISCONNECT_MS);
+    Dfu_Jump();
+}
+
+/**
+* @brief  Dfu_Jump
+*         Start the DFU loader of the system memory as after a reset with
+*         BOOT0 high: peripherals, clocks and interrupts back to their reset
+*         state, system memory mapped at 0.
+* @param  None.
+* @retval None.
+*/
+static void Dfu_Jump(void)
+{
+    const uint32_t *vectors = (const uint32_t *)DFU_SYSTEM_MEMORY;
+
+    __disable_irq();
+    SysTick->CTRL = 0;
+    HAL_RCC_DeInit();
+    HAL_DeInit();
+    NVIC->ICER[0] = 0xFFFFFFFF;
+    NVIC->ICPR[0] = 0xFFFFFFFF;
+
+    __HAL_RCC_SYSCFG_CLK_ENABLE();
+    __HAL_SYSCFG_REMAPMEMORY_SYSTEMFLASH();
+
+    __set_MSP(vectors[0]);
+    __enable_irq();
+    ((void (*)(void))vectors[1])();
+
+    while (1)
+    {
+    }
+}
+
+/**
+* @brief  Samba_Config
+*         Take the SAMD21 behind port Y over through its SAM-BA loader, or
+*         give it back. Either way it is reset through its reset line, the
+*         same as on the 1200 bps touch.
+* @param  port: CDC port index
+* @param  on: 1 to enter the loader, 0 to start the new firmware
+* @retval USBD_OK, or USBD_FAIL on port X or while another mode owns port Y
+*/
+static int8_t Samba_Config(uint8_t port, uint8_t on)
+{
+    VCP_SambaTypeDef *samba = &Samba;
+
+    if ((port != 1) || VcpConfig.Passthrough || Test[1].Pattern || Cobs[1].On || Sniff[1].On ||
+        (Capture.Port == 1))
+    {
+        return (USBD_FAIL);
+    }
+    if (!on && (samba->State == VCP_SAMBA_OFF))
+    {
+        return (USBD_OK);
+    }
+
+    __disable_irq();
+    if (samba->TxBusy)
+    {
+        Uart_TxStop(1);
+    }
+    if (samba->State == VCP_SAMBA_OFF)
+    {
+        memset(samba, 0, sizeof (*samba));
+    }
+    samba->TxBusy = 0;
+    samba->Waiting = 0;
+    samba->Erased = 0;
+    samba->Leave = on ? 0 : 1;
+    samba->State = VCP_SAMBA_RESET;
+    samba->Deadline = HAL_GetTick() + SAMBA_RESET_MS;
+    HAL_GPIO_WritePin(SAMBA_RESET_PORT, SAMBA_RESET_PIN, GPIO_PIN_SET);
+    __enable_irq();
+
+    /* The replies of the loader wake the main loop at their end */
+    Frame_Restart(1);
+    return (USBD_OK);
+}
+
+/**
+* @brief  Samba_Close
+*         The SAMD21 runs on its own again: port Y goes back to the bridge.
+* @param  None.
+* @retval None.
+*/
+static void Samba_Close(void)
+{
+    __disable_irq();
+    Samba.State = VCP_SAMBA_OFF;
+    if (Samba.PacketLength != 0)
+    {
+        Samba.PacketLength = 0;
+        USBD_CDC_ReceivePacket(&USBD_Device, 1);
+    }
+    __enable_irq();
+
+    Frame_Restart(1);
+}
+
+/**
+* @brief  Samba_Write
+*         Start writing the next bytes of the host at a flash address.
+* @param  pbuf: VCP_REQ_SAMBA_WRITE data
+* @retval USBD_OK, or USBD_FAIL when the engine is not ready or the address
+*         is not page aligned
+*/
+static int8_t Samba_Write(uint8_t *pbuf)
+{
+    uint32_t address = (uint32_t)(pbuf[0] | (pbuf[1] << 8) | (pbuf[2] << 16) | (pbuf[3] << 24));
+    uint32_t length = (uint32_t)(pbuf[4] | (pbuf[5] << 8) | (pbuf[6] << 16) | (pbuf[7] << 24));
+
+    if ((Samba.State != VCP_SAMBA_IDLE) || (length == 0) || (address % VCP_SAMBA_PAGE))
+    {
+        return (USBD_FAIL);
+    }
+
+    Samba.Address = address;
+    Samba.Remaining = length;
+    Samba.Written = 0;
+    Samba.StartTick = HAL_GetTick();
+    Samba.EndTick = Samba.StartTick;
+    Samba.State = SAMBA_BEGIN;
+    frame_ready = 1;
+    return (USBD_OK);
+}
+
+/**
+* @brief  Samba_Receive
+*         Keep a packet of the host for the engine: the OUT endpoint stays
+*         NAKed until all its bytes are in a block.
+* @param  pbuf: packet received
+* @param  len: number of bytes
+* @retval None.
+*/
+static void Samba_Receive(uint8_t *pbuf, uint32_t len)
+{
+    if (len == 0)
+    {
+        USBD_CDC_ReceivePacket(&USBD_Device, 1);
+        return;
+    }
+    Samba.PacketOffset = 0;
+    Samba.PacketLength = (uint8_t)len;
+    frame_ready = 1;
+}
+
+/**
+* @brief  Samba_Sent
+*         A command or block is out on TX: have the main loop go on.
+* @param  None.
+* @retval None.
+*/
+static void Samba_Sent(void)
+{
+    Samba.TxBusy = 0;
+    frame_ready = 1;
+}
+
+/**
+* @brief  VCP_Samba_Process
+*         Run the SAM-BA engine from the main loop: take the answer of the
+*         loader, then send the next command or block.
+* @param  port: CDC port index
+* @retval 1 when the engine owns the port, else 0
+*/
+uint8_t VCP_Samba_Process(uint8_t port)
+{
+    VCP_SambaTypeDef *samba = &Samba;
+    uint8_t reply;
+
+    if ((port != 1) || (samba->State == VCP_SAMBA_OFF))
+    {
+        return 0;
+    }
+    if (samba->TxBusy)
+    {
+        return 1;
+    }
+
+    reply = Samba_Reply();
+    if (!reply && samba->Waiting && ((int32_t)(HAL_GetTick() - samba->Deadline) > 0))
+    {
+        /* The loader may still be starting: knock again */
+        if ((samba->State == VCP_SAMBA_SYNC) && !samba->Sourced && (++samba->Retries < SAMBA_SYNC_RETRIES))
+        {
+            Samba_Command('N', 0, 0, 0);
+        }
+        else
+        {
+            Samba_Fail(VCP_SAMBA_ERR_TIMEOUT);
+        }
+        return 1;
+    }
+
+    switch (samba->State)
+    {
+    case VCP_SAMBA_RESET:
+        if ((int32_t)(HAL_GetTick() - samba->Deadline) >= 0)
+        {
+            HAL_GPIO_WritePin(SAMBA_RESET_PORT, SAMBA_RESET_PIN, GPIO_PIN_RESET);
+            if (samba->Leave)
+            {
+                Samba_Close();
+                return 0;
+            }
+            /* Binary mode first, then the RAM the chunks are copied from */
+            samba->State = VCP_SAMBA_SYNC;
+            samba->Retries = 0;
+            samba->Sourced = 0;
+            Samba_Command('N', 0, 0, 0);
+        }
+        break;
+
+    case VCP_SAMBA_SYNC:
+        if (!reply)
+        {
+            break;
+        }
+        if (!samba->Sourced)
+        {
+            samba->Sourced = 1;
+            Samba_Command('Y', VCP_SAMBA_BUFFER, 0, 2);
+        }
+        else if (samba->Reply[0] == 'Y')
+        {
+            samba->State = VCP_SAMBA_IDLE;
+        }
+        else
+        {
+            Samba_Fail(VCP_SAMBA_ERR_REPLY);
+        }
+        break;
+
+    case SAMBA_BEGIN:
+        if (!samba->Erased)
+        {
+            samba->Erased = 1;
+            samba->State = SAMBA_ERASE;
+            Samba_Command('X', samba->Address, 0, 1);
+            samba->Deadline += SAMBA_ERASE_MS - SAMBA_REPLY_MS;
+        }
+        else
+        {
+            Samba_Chunk();
+        }
+        break;
+
+    case SAMBA_ERASE:
+        if (reply)
+        {
+            Samba_Expect('X');
+        }
+        break;
+
+    case SAMBA_START:
+        if (reply && (samba->Reply[0] == SAMBA_XMODEM_C))
+        {
+            samba->State = SAMBA_BLOCK;
+            Samba_Block();
+        }
+        else if (reply)
+        {
+            Samba_Ignore();
+        }
+        break;
+
+    case SAMBA_BLOCK:
+        Samba_Block();
+        break;
+
+    case SAMBA_ACK:
+        if (!reply)
+        {
+            break;
+        }
+        if (samba->Reply[0] == SAMBA_XMODEM_ACK)
+        {
+            samba->Retries = 0;
+            samba->BlockNum++;
+            samba->BlockFill = 0;
+            if (samba->ChunkSent == samba->ChunkLength)
+            {
+                samba->State = SAMBA_EOT;
+                samba->Cmd[0] = SAMBA_XMODEM_EOT;
+                Samba_Send((uint8_t *)samba->Cmd, 1, 0);
+            }
+            else
+            {
+                samba->State = SAMBA_BLOCK;
+                Samba_Block();
+            }
+        }
+        else if ((samba->Reply[0] == SAMBA_XMODEM_NAK) && (++samba->Retries < SAMBA_RETRIES))
+        {
+            Samba_Send(SAMBA_BLOCK_BUF, SAMBA_BLOCK_SIZE, 0);
+        }
+        else if (samba->Reply[0] == SAMBA_XMODEM_NAK)
+        {
+            Samba_Fail(VCP_SAMBA_ERR_NAK);
+        }
+        else
+        {
+            Samba_Ignore();
+        }
+        break;
+
+    case SAMBA_EOT:
+        if (reply && (samba->Reply[0] == SAMBA_XMODEM_ACK))
+        {
+            samba->State = SAMBA_WRITE;
+            Samba_Command('Y', samba->Address, samba->ChunkLength, 2);
+        }
+        else if (reply)
+        {
+            Samba_Ignore();
+        }
+        break;
+
+    case SAMBA_WRITE:
+        if (reply)
+        {
+            Samba_Expect('Y');
+        }
+        break;
+
+    case SAMBA_VERIFY:
+        if (reply)
+        {
+            Samba_Verify();
+        }
+        break;
+
+    default:
+        break;
+    }
+    return 1;
+}
+
+/**
+* @brief  Samba_Expect
+*         Go on once the loader has answered a command: erase, write.
+* @param  c: first character of the expected answer
+* @retval None.
+*/
+static void Samba_Expect(char c)
+{
+    if (Samba.Reply[0] != c)
+    {
+        Samba_Fail(VCP_SAMBA_ERR_REPLY);
+    }
+    else if (Samba.State == SAMBA_ERASE)
+    {
+        Samba_Chunk();
+    }
+    else
+    {
+        /* Written: read the chunk back as a CRC */
+        Samba.State = SAMBA_VERIFY;
+        Samba_Command('Z', Samba.Address, Samba.ChunkLength, 2);
+    }
+}
+
+/**
+* @brief  Samba_Ignore
+*         Drop a byte the XMODEM transfer does not expect, such as a late
+*         'C', and keep waiting.
+* @param  None.
+* @retval None.
+*/
+static void Samba_Ignore(void)
+{
+    Samba.ReplyLength = 0;
+    Samba.Waiting = 1;
+}
+
+/**
+* @brief  Samba_Chunk
+*         Open the next chunk of the write in the RAM of the loader.
+* @param  None.
+* @retval None.
+*/
+static void Samba_Chunk(void)
+{
+    VCP_SambaTypeDef *samba = &Samba;
+
+    samba->ChunkHost = (samba->Remaining > VCP_SAMBA_CHUNK) ? VCP_SAMBA_CHUNK : samba->Remaining;
+    samba->ChunkLength = (samba->ChunkHost + VCP_SAMBA_PAGE - 1) & ~(VCP_SAMBA_PAGE - 1);
+    samba->ChunkSent = 0;
+    samba->ChunkCrc = 0;
+    samba->BlockNum = 1;
+    samba->BlockFill = 0;
+    samba->Retries = 0;
+    samba->State = SAMBA_START;
+    Samba_Command('S', VCP_SAMBA_BUFFER, samba->ChunkLength, 2);
+}
+
+/**
+* @brief  Samba_Block
+*         Fill the XMODEM block with the data of the host, the OUT endpoint
+*         taking the next packet as soon as one is used up, and send it
+*         once full. The tail of the chunk is padded to a page.
+* @param  None.
+* @retval None.
+*/
+static void Samba_Block(void)
+{
+    VCP_SambaTypeDef *samba = &Samba;
+    uint8_t *block = SAMBA_BLOCK_BUF;
+    uint8_t *data = &block[SAMBA_XMODEM_HEADER];
+    uint32_t n;
+    uint16_t crc;
+
+    while ((samba->BlockFill < SAMBA_XMODEM_DATA) && (samba->ChunkSent < samba->ChunkLength))
+    {
+        n = SAMBA_XMODEM_DATA - samba->BlockFill;
+        if (n > (samba->ChunkLength - samba->ChunkSent))
+        {
+            n = samba->ChunkLength - samba->ChunkSent;
+        }
+
+        if (samba->ChunkSent < samba->ChunkHost)
+        {
+            if (samba->PacketLength == 0)
+            {
+                return;
+            }
+            if (n > (uint32_t)(samba->PacketLength - samba->PacketOffset))
+            {
+                n = samba->PacketLength - samba->PacketOffset;
+            }
+            if (n > (samba->ChunkHost - samba->ChunkSent))
+            {
+                n = samba->ChunkHost - samba->ChunkSent;
+            }
+            memcpy(&data[samba->BlockFill], &UserRxBuffer[1][samba->PacketOffset], n);
+            samba->PacketOffset += n;
+            samba->Remaining -= n;
+            if (samba->PacketOffset == samba->PacketLength)
+            {
+                samba->PacketLength = 0;
+                USBD_CDC_ReceivePacket(&USBD_Device, 1);
+            }
+        }
+        else
+        {
+            memset(&data[samba->BlockFill], 0xFF, n);
+        }
+
+        samba->ChunkCrc = Samba_Crc16(samba->ChunkCrc, &data[samba->BlockFill], n);
+        samba->BlockFill += n;
+        samba->ChunkSent += n;
+    }
+
+    /* The loader only keeps the bytes of the chunk, the rest is padding */
+    memset(&data[samba->BlockFill], 0xFF, SAMBA_XMODEM_DATA - samba->BlockFill);
+    crc = Samba_Crc16(0, data, SAMBA_XMODEM_DATA);
+    block[0] = SAMBA_XMODEM_SOH;
+    block[1] = samba->BlockNum;
+    block[2] = (uint8_t)~samba->BlockNum;
+    block[SAMBA_XMODEM_HEADER + SAMBA_XMODEM_DATA] = (uint8_t)(crc >> 8);
+    block[SAMBA_XMODEM_HEADER + SAMBA_XMODEM_DATA + 1] = (uint8_t)(crc);
+
+    samba->State = SAMBA_ACK;
+    Samba_Send(block, SAMBA_BLOCK_SIZE, 0);
+}
+
+/**
+* @brief  Samba_Verify
+*         Compare the CRC the loader computed over the chunk in flash with
+*         the one of the data, then go on with the next chunk.
+* @param  None.
+* @retval None.
+*/
+static void Samba_Verify(void)
+{
+    VCP_SambaTypeDef *samba = &Samba;
+    uint16_t crc = 0;
+    uint8_t c;
+    uint8_t i;
+
+    /* "Z" and 8 hex digits */
+    for (i = 1; i <= 8; i++)
+    {
+        c = (uint8_t)samba->Reply[i];
+        crc = (uint16_t)((crc << 4) | ((c <= '9') ? (c - '0') : ((c | 0x20) - 'a' + 10)));
+    }
+    if ((samba->Reply[0] != 'Z') || (crc != samba->ChunkCrc))
+    {
+        samba->CrcErrors++;
+        Samba_Fail(VCP_SAMBA_ERR_CRC);
+        return;
+    }
+
+    samba->Chunks++;
+    samba->Written += samba->ChunkHost;
+    samba->Address += samba->ChunkLength;
+    samba->EndTick = HAL_GetTick();
+    if (samba->Remaining != 0)
+    {
+        Samba_Chunk();
+    }
+    else
+    {
+        samba->State = VCP_SAMBA_IDLE;
+    }
+}
+
+/**
+* @brief  Samba_Command
+*         Send a SAM-BA command, "c" followed by its arguments in hex and
+*         "#", and wait for the answer line.
+* @param  c: command letter
+* @param  a: first argument
+* @param  b: second argument
+* @param  args: number of arguments
+* @retval None.
+*/
+static void Samba_Command(char c, uint32_t a, uint32_t b, uint8_t args)
+{
+    char *cmd = Samba.Cmd;
+    uint32_t value;
+    uint8_t i;
+    uint8_t j;
+
+    *cmd++ = c;
+    for (i = 0; i < args; i++)
+    {
+        if (i != 0)
+        {
+            *cmd++ = ',';
+        }
+        value = (i == 0) ? a : b;
+        for (j = 0; j < 8; j++)
+        {
+            *cmd++ = "0123456789ABCDEF"[(value >> (28 - (4 * j))) & 0x0F];
+        }
+    }
+    *cmd++ = '#';
+
+    Samba_Send((uint8_t *)Samba.Cmd, (uint32_t)(cmd - Samba.Cmd), 1);
+}
+
+/**
+* @brief  Samba_Send
+*         Send bytes to the loader once what it sent before is dropped.
+* @param  pbuf: bytes to send, kept until the transmission is over
+* @param  len: number of bytes
+* @param  line: 1 when the answer is a line, 0 for a single byte
+* @retval None.
+*/
+static void Samba_Send(uint8_t *pbuf, uint32_t len, uint8_t line)
+{
+    uint32_t out;
+
+    VCP_Rx_Consume(1, VCP_Rx_Pending(1, &out));
+    Samba.ReplyLength = 0;
+    Samba.Line = line;
+    Samba.Waiting = 1;
+    Samba.Deadline = HAL_GetTick() + SAMBA_REPLY_MS;
+    Samba.TxBusy = 1;
+    Uart_Transmit(1, pbuf, len);
+}
+
+/**
+* @brief  Samba_Reply
+*         Gather the answer of the loader from the reception ring.
+* @param  None.
+* @retval 1 once the answer is complete: a line ended by "\n\r" or a single
+*         byte, else 0
+*/
+static uint8_t Samba_Reply(void)
+{
+    VCP_SambaTypeDef *samba = &Samba;
+    uint32_t pending;
+    uint32_t out;
+    uint32_t used = 0;
+    uint8_t c;
+
+    if (!samba->Waiting)
+    {
+        return 0;
+    }
+
+    pending = VCP_Rx_Pending(1, &out);
+    while (used < pending)
+    {
+        c = UART_RxBuffer[1][(out + used) % APP_TX_DATA_SIZE];
+        used++;
+        if (samba->ReplyLength < sizeof (samba->Reply))
+        {
+            samba->Reply[samba->ReplyLength++] = (char)c;
+        }
+        if (!samba->Line ||
+            ((c == '\r') && (samba->ReplyLength >= 2) && (samba->Reply[samba->ReplyLength - 2] == '\n')))
+        {
+            samba->Waiting = 0;
+            break;
+        }
+    }
+    VCP_Rx_Consume(1, used);
+
+    return !samba->Waiting;
+}
+
+/**
+* @brief  Samba_Fail
+*         Stop the write on an error, the SAMD21 staying in its loader.
+* @param  error: VCP_SAMBA_ERR_xxx
+* @retval None.
+*/
+static void Samba_Fail(uint8_t error)
+{
+    Samba.Error = error;
+    Samba.Waiting = 0;
+    Samba.State = VCP_SAMBA_ERROR;
+    Samba.EndTick = HAL_GetTick();
+}
+
+/**
+* @brief  Samba_Crc16
+*         CRC16 of XMODEM (CCITT polynomial, initial value 0), the one the
+*         loader computes for the Z command too.
+* @param  crc: CRC of the bytes before
+* @param  pbuf: data
+* @param  len: number of bytes
+* @retval CRC
+*/
+static uint16_t Samba_Crc16(uint16_t crc, const uint8_t *pbuf, uint32_t len)
+{
+    while (len--)
+    {
+        crc = (uint16_t)((crc << 4) ^ Crc16Nibble[(crc >> 12) ^ (*pbuf >> 4)]);
+        crc = (uint16_t)((crc << 4) ^ Crc16Nibble[(crc >> 12) ^ (*pbuf & 0x0F)]);
+        pbuf++;
+    }
+    return crc;
+}
+
+/**
+* @brief  Samba_GetState
+*         Fill the VCP_REQ_GET_SAMBA answer.
+* @param  pbuf: 24 bytes, see usbd_cdc_interface.h
+* @retval None.
+*/
+static void Samba_GetState(uint8_t *pbuf)
+{
+    VCP_SambaTypeDef *samba = &Samba;
+    uint32_t values[5];
+    uint8_t i;
+
+    values[0] = samba->Written;
+    values[1] = samba->Remaining;
+    values[2] = samba->Chunks;
+    values[3] = samba->CrcErrors;
+    values[4] = (samba->State >= VCP_SAMBA_BUSY) ? (HAL_GetTick() - samba->StartTick) :
+                                                   (samba->EndTick - samba->StartTick);
+
+    memset(pbuf, 0, 24);
+    pbuf[0] = (samba->State >= VCP_SAMBA_BUSY) ? VCP_SAMBA_BUSY : samba->State;
+    pbuf[1] = samba->Error;
+    for (i = 0; i < 5; i++)
+    {
+        pbuf[4 + (4 * i)]     = (uint8_t)(values[i]);
+        pbuf[4 + (4 * i) + 1] = (uint8_t)(values[i] >> 8);
+        pbuf[4 + (4 * i) + 2] = (uint8_t)(values[i] >> 16);
+        pbuf[4 + (4 * i) + 3] = (uint8_t)(values[i] >> 24);
+    }
+}
+
+/**
+* @brief  Hid_Request
+*         Run a request of a port carried by the control channel, the same
+*         way as when it comes on EP0.
+* @param  pbuf: VCP_HID_REQUEST report
+* @param  report: answer, the IN data from [4]
+* @retval Result of the request
+*/
+static int8_t Hid_Request(uint8_t *pbuf, uint8_t *report)
+{
+    uint8_t port = pbuf[2];
+    uint8_t length = pbuf[6];
+    uint8_t setup[8];
+    int8_t status;
+
+    if ((port >= 2) || (length > (pbuf[7] ? (VCP_HID_REPORT_SIZE - 4) : (VCP_HID_REPORT_SIZE - 8))))
+    {
+        return (USBD_FAIL);
+    }
+
+    if (length == 0)
+    {
+        /* Without data the request itself holds wValue */
+        memset(setup, 0, sizeof (setup));
+        setup[1] = pbuf[3];
+        setup[2] = pbuf[4];
+        setup[3] = pbuf[5];
+        setup[4] = (port == 0) ? CDC_CMD_INTERFACE_1 : CDC_CMD_INTERFACE_2;
+        return USBD_CDC_fops[port].Control(pbuf[3], setup, 0);
+    }
+    if (pbuf[7])
+    {
+        /* wValue where the requests without data have it, as on EP0 */
+        report[6] = pbuf[4];
+        report[7] = pbuf[5];
+        status = USBD_CDC_fops[port].Control(pbuf[3], &report[4], length);
+        if (status == USBD_OK)
+        {
+            report[3] = length;
+        }
+        return status;
+    }
+    return USBD_CDC_fops[port].Control(pbuf[3], &pbuf[8], length);
+}
+
+/**
+* @brief  Hid_Sequence
+*         Take a sequence of output line steps, applied from now on.
+* @param  pbuf: VCP_HID_SEQUENCE report
+* @retval USBD_OK, or USBD_FAIL while another sequence runs or when a step
+*         drives the SAMD21 reset line the SAM-BA engine owns
+*/
+static int8_t Hid_Sequence(uint8_t *pbuf)
+{
+    uint8_t steps = pbuf[2];
+    uint8_t i;
+
+    if ((steps == 0) || (steps > VCP_HID_STEPS) || (Hid.Steps != 0) || Hid.Owed)
+    {
+        return (USBD_FAIL);
+    }
+    for (i = 0; i < steps; i++)
+    {
+        if ((pbuf[4 + (4 * i)] & VCP_HID_LINE_SAMD21_RESET) && (Samba.State != VCP_SAMBA_OFF))
+        {
+            return (USBD_FAIL);
+        }
+    }
+
+    memcpy(Hid.Sequence, &pbuf[4], 4 * steps);
+    Hid.Tag = pbuf[1];
+    Hid.Step = 0;
+    Hid.Steps = steps;
+    Hid.Wait = 0;
+    return (USBD_OK);
+}
+
+/**
+* @brief  Hid_Step
+*         Apply the steps of the sequence due now, and answer after the
+*         last one.
+* @param  None.
+* @retval None.
+*/
+static void Hid_Step(void)
+{
+    VCP_HidTypeDef *hid = &Hid;
+    uint8_t *step;
+
+    while (hid->Steps != 0)
+    {
+        step = &hid->Sequence[4 * hid->Step];
+        Hid_Drive(step[0], step[1]);
+        hid->Step++;
+        hid->Steps--;
+        hid->Wait = (uint16_t)(step[2] | (step[3] << 8));
+        if ((hid->Wait != 0) && (hid->Steps != 0))
+        {
+            return;
+        }
+    }
+
+    hid->Wait = 0;
+    hid->Owed = 1;
+    Hid_Flush();
+}
+
+/**
+* @brief  Hid_Drive
+*         Set output lines, through the BSRR words of the modem line mapping
+*         so that the polarity of each pin holds.
+* @param  lines: VCP_HID_LINE_xxx driven
+* @param  levels: VCP_HID_LINE_xxx asserted
+* @retval None.
+*/
+static void Hid_Drive(uint8_t lines, uint8_t levels)
+{
+    VCP_ModemLineTypeDef *ml;
+    uint8_t i;
+
+    for (i = 0; i < 4; i++)
+    {
+        ml = &Modem[i >> 1].Line[(i & 1) ? VCP_LINE_RTS : VCP_LINE_DTR];
+        if ((lines & (1 << i)) && (ml->GPIOx != NULL))
+        {
+            ml->GPIOx->BSRR = (levels & (1 << i)) ? ml->AssertBSRR : ml->DeassertBSRR;
+        }
+    }
+    if (lines & VCP_HID_LINE_SAMD21_RESET)
+    {
+        HAL_GPIO_WritePin(SAMBA_RESET_PORT, SAMBA_RESET_PIN,
+                          (levels & VCP_HID_LINE_SAMD21_RESET) ? GPIO_PIN_SET : GPIO_PIN_RESET);
+    }
+}
+
+/**
+* @brief  Hid_Answer
+*         Complete the answer built in the report buffer and send it.
+* @param  cmd: VCP_HID_xxx
+* @param  tag: tag of the command
+* @param  status: USBD_OK or USBD_FAIL
+* @retval None.
+*/
+static void Hid_Answer(uint8_t cmd, uint8_t tag, int8_t status)
+{
+    uint8_t *report = (uint8_t *)Hid.Report;
+
+    report[0] = cmd;
+    report[1] = tag;
+    report[2] = (uint8_t)status;
+    Hid.Pending = HID_ANSWER;
+    Hid_Flush();
+}
+
+/**
+* @brief  Hid_Telemetry
+*         Send the counters of both ports, unless an answer is waiting: the
+*         next period brings them anyway.
+* @param  None.
+* @retval None.
+*/
+static void Hid_Telemetry(void)
+{
+    uint8_t *report = (uint8_t *)Hid.Report;
+    uint32_t words[9];
+    uint8_t port;
+    uint8_t i;
+
+    if (Hid.Pending == HID_ANSWER)
+    {
+        return;
+    }
+
+    words[0] = HAL_GetTick();
+    for (port = 0; port < 2; port++)
+    {
+        words[1 + (4 * port)] = Rx_Written(port);
+        words[2 + (4 * port)] = VcpTxStats[port].Bytes;
+        words[3 + (4 * port)] = Rx[port].Lost;
+        words[4 + (4 * port)] = Modem[port].SerialState | ((uint32_t)Modem[port].LineState << 16);
+    }
+
+    memset(report, 0, VCP_HID_REPORT_SIZE);
+    report[0] = VCP_HID_TELEMETRY;
+    report[3] = sizeof (words);
+    for (i = 0; i < sizeof (words); i++)
+    {
+        report[4 + i] = (uint8_t)(words[i / 4] >> (8 * (i % 4)));
+    }
+    Hid.Pending = HID_TELEMETRY;
+    Hid_Flush();
+}
+
+/**
+* @brief  Hid_Flush
+*         Give the waiting report to the IN endpoint when it is free, then
+*         build the answer of a finished sequence.
+* @param  None.
+* @retval None.
+*/
+static void Hid_Flush(void)
+{
+    if ((Hid.Pending != HID_NONE) &&
+        (USBD_CDC_SendReport(&USBD_Device, (uint8_t *)Hid.Report, VCP_HID_REPORT_SIZE) == USBD_OK))
+    {
+        Hid.Pending = HID_NONE;
+    }
+
+    if (Hid.Owed && (Hid.Pending != HID_ANSWER))
+    {
+        Hid.Owed = 0;
+        memset(Hid.Report, 0, VCP_HID_REPORT_SIZE);
+        Hid_Answer(VCP_HID_SEQUENCE, Hid.Tag, USBD_OK);
+    }
+}
+
+/**
+* @brief  VCP_Capture_Process
+*         Keep the bulk IN endpoint of a captured port quiet: the ring goes
+*         to the capture packets once its last transfer is over.
+* @param  port: CDC port index
+* @param  idle: no bulk IN transfer of the port is pending
+* @retval 1 while the capture owns the port, else 0
+*/
+uint8_t VCP_Capture_Process(uint8_t port, uint8_t idle)
+{
+    VCP_CaptureTypeDef *capture = &Capture;
+
+    if (capture->Port != port)
+    {
+        return 0;
+    }
+    if (idle && !capture->Streaming)
+    {
+        capture->Lost = Rx[port].Lost;
+        capture->Streaming = 1;
+    }
+    return 1;
+}
+
+/**
+* @brief  Capture_Send
+*         Make the packet of the frame from the data waiting in the ring of
+*         the captured port. One goes in every frame, with or without data,
+*         so that the endpoint never repeats an older one.
+* @param  None.
+* @retval None.
+*/
+static void Capture_Send(void)
+{
+    VCP_CaptureTypeDef *capture = &Capture;
+    uint8_t port = capture->Port;
+    uint8_t *packet;
+    uint32_t length;
+    uint32_t out;
+    uint32_t first;
+
+    if ((port == CDC_PORT_NONE) || !capture->Streaming)
+    {
+        return;
+    }
+
+    packet = &UserTxBuffer[port][0];
+    length = VCP_Rx_Pending(port, &out);
+    if (length > VCP_CAPTURE_DATA_MAX)
+    {
+        length = VCP_CAPTURE_DATA_MAX;
+    }
+
+    first = APP_TX_DATA_SIZE - out;
+    if (length > first)
+    {
+        memcpy(&packet[VCP_CAPTURE_HEADER_SIZE], &UART_RxBuffer[port][out], first);
+        memcpy(&packet[VCP_CAPTURE_HEADER_SIZE + first], &UART_RxBuffer[port][0], length - first);
+    }
+    else
+    {
+        memcpy(&packet[VCP_CAPTURE_HEADER_SIZE], &UART_RxBuffer[port][out], length);
+    }
+
+    /* Data the DMA overran during the copy are already accounted as lost */
+    if (VCP_Rx_Consume(port, length) != USBD_OK)
+    {
+        length = 0;
+    }
+
+    capture->Frame++;
+    packet[0] = (uint8_t)(capture->Frame);
+    packet[1] = (uint8_t)(capture->Frame >> 8);
+    packet[2] = (Rx[port].Lost != capture->Lost) ? VCP_CAPTURE_LOST : 0;
+    packet[3] = port;
+    capture->Lost = Rx[port].Lost;
+
+    if (USBD_CDC_SendCapture(&USBD_Device, packet, VCP_CAPTURE_HEADER_SIZE + length) != USBD_OK)
+    {
+        Rx_Loss(port, length);
+        return;
+    }
+
+    capture->Length = (uint16_t)length;
+    capture->Packets++;
+    capture->Bytes += length;
+}
+
+/**
+* @brief  Capture_GetState
+*         Fill the VCP_REQ_GET_CAPTURE answer.
+* @param  pbuf: 16 bytes, see usbd_cdc_interface.h
+* @retval None.
+*/
+static void Capture_GetState(uint8_t *pbuf)
+{
+    VCP_CaptureTypeDef *capture = &Capture;
+    uint32_t values[3];
+    uint8_t i;
+
+    values[0] = capture->Packets;
+    values[1] = capture->Bytes;
+    values[2] = capture->Missed;
+
+    pbuf[0] = (capture->Port == CDC_PORT_NONE) ? CAPTURE_ALT_OFF : (capture->Port + CAPTURE_ALT_PORT_X);
+    pbuf[1] = capture->Streaming;
+    pbuf[2] = (uint8_t)(capture->Frame);
+    pbuf[3] = (uint8_t)(capture->Frame >> 8);
+    for (i = 0; i < 3; i++)
+    {
+        pbuf[4 + (4 * i)]     = (uint8_t)(values[i]);
+        pbuf[4 + (4 * i) + 1] = (uint8_t)(values[i] >> 8);
+        pbuf[4 + (4 * i) + 2] = (uint8_t)(values[i] >> 16);
+        pbuf[4 + (4 * i) + 3] = (uint8_t)(values[i] >> 24);
+    }
+}
+
+/**
+* @brief  Uart_LineError
+*         Latch the line errors of a port for the next SERIAL_STATE.
+* @param  port: CDC port index
+* @param  UartHandle: UART handle
+* @param  isr: USART status register read by the interrupt handler
+* @retval None
+*/
+static void Uart_LineError(uint8_t port, UART_HandleTypeDef *UartHandle, uint32_t isr)
+{
+    VCP_ModemTypeDef *modem = &Modem[port];
+    uint16_t errors = 0;
+    uint32_t last;
+
+    if (isr & USART_ISR_PE)
+    {
+        errors |= CDC_SERIAL_STATE_PARITY;
+    }
+    if (isr & USART_ISR_NE)
+    {
+        errors |= CDC_SERIAL_STATE_FRAMING;
+    }
+    if (isr & USART_ISR_FE)
+    {
+        /* A break is a framing error on a null character: by now the DMA has
+           stored the character in the reception ring */
+        last = (APP_TX_DATA_SIZE + Rx_Pos(port) - 1) % APP_TX_DATA_SIZE;
+        if (UartHandle->pRxBuffPtr[last] == 0x00)
+        {
+            errors |= CDC_SERIAL_STATE_BREAK;
+        }
+        else
+        {
+            errors |= CDC_SERIAL_STATE_FRAMING;
+        }
+    }
+    if (isr & USART_ISR_ORE)
+    {
+        errors |= CDC_SERIAL_STATE_OVERRUN;
+    }
+    modem->Errors |= errors;
+    if (errors != 0)
+    {
+        Rx[port].LineErrors++;
+    }
+
+    /* The sniffer flags share the SERIAL_STATE bits */
+    Sniff[port].Errors |= (uint8_t)errors;
 }
 
 /**
@@ -49,11 +49,23 @@
 #include "stm32f0xx_hal.h"
 #include "usbd_core.h"
 #include "main.h"
+#include "usbd_cdc.h"
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
+/* Allocations done by the registered classes, each rounded to a word */
+#define USBD_ARENA_SIZE           (USBD_ARENA_ALIGN(USBD_CDC_CLASS_DATA_SIZE) + \
+                                   USBD_ARENA_ALIGN(USBD_CDC_USER_DATA_SIZE) + \
+                                   USBD_ARENA_ALIGN(USBD_CDC_MSC_DATA_SIZE))
 /* Private macro -------------------------------------------------------------*/
+#define USBD_ARENA_ALIGN(size)    (((size) + 3U) & ~3U)
+/* Fails to compile when the arena outgrows its budget */
+typedef char USBD_ArenaSizeCheck[(USBD_ARENA_SIZE <= MAX_STATIC_ALLOC_SIZE) ? 1 : -1];
 /* Private variables ---------------------------------------------------------*/
 PCD_HandleTypeDef hpcd;
+static uint32_t USBD_Arena[USBD_ARENA_SIZE / 4];
+static uint32_t USBD_ArenaTop;
+/* Highest arena usage in bytes, for the RAM report alongside the linker totals */
+uint32_t USBD_ArenaHighWater;
 /* Private function prototypes -----------------------------------------------*/
 /* Private functions ---------------------------------------------------------*/
 
@@ -181,6 +193,10 @@ void HAL_PCD_SuspendCallback(PCD_HandleTypeDef *hpcd)
   */
 void HAL_PCD_ResumeCallback(PCD_HandleTypeDef *hpcd)
 {
+    /* The wakeup handler of the PCD driver rewrites the interrupt mask
+       without the start of frame, which the capture and the control channel
+       are timed by */
+    hpcd->Instance->CNTR |= USB_CNTR_SOFM;
 }
 
 /**
@@ -259,6 +275,17 @@ USBD_StatusTypeDef USBD_LL_Init(USBD_HandleTypeDef *pdev)
     HAL_PCDEx_PMAConfig(&hpcd , CDC_OUT_EP2 , PCD_SNG_BUF, 0x1A0);
     HAL_PCDEx_PMAConfig(&hpcd , CDC_CMD_EP2 , PCD_SNG_BUF, 0x190);
 
+    HAL_PCDEx_PMAConfig(&hpcd , HID_CTL_IN_EP , PCD_SNG_BUF, 0x1E0);
+    HAL_PCDEx_PMAConfig(&hpcd , HID_CTL_OUT_EP , PCD_SNG_BUF, 0x220);
+
+    /* Isochronous: the hardware swaps both buffers at each frame */
+    HAL_PCDEx_PMAConfig(&hpcd , CAPTURE_IN_EP , PCD_DBL_BUF, 0x260 | (0x310 << 16));
+
+#if (USBD_STATUS_DRIVE == 1)
+    HAL_PCDEx_PMAConfig(&hpcd , MSC_EPIN_ADDR , PCD_SNG_BUF, 0x3C0);
+    HAL_PCDEx_PMAConfig(&hpcd , MSC_EPOUT_ADDR , PCD_SNG_BUF, 0x3E0);
+#endif
+
     return USBD_OK;
 }
 
@@ -452,24 +479,44 @@ void USBD_LL_Delay(uint32_t Delay)
 }
 
 /**
-  * @brief  static single allocation.
+  * @brief  static allocation from the arena.
   * @param  size: size of allocated memory
   * @retval None
   */
 void *USBD_static_malloc(uint32_t size)
 {
-    static uint32_t mem[MAX_STATIC_ALLOC_SIZE];
-    return mem;
+    uint32_t *p;
+
+    size = USBD_ARENA_ALIGN(size) / 4;
+    if (size > ((USBD_ARENA_SIZE / 4) - USBD_ArenaTop))
+    {
+        return NULL;
+    }
+
+    p = &USBD_Arena[USBD_ArenaTop];
+    USBD_ArenaTop += size;
+    if ((USBD_ArenaTop * 4) > USBD_ArenaHighWater)
+    {
+        USBD_ArenaHighWater = USBD_ArenaTop * 4;
+    }
+
+    return p;
 }
 
 /**
-  * @brief  Dummy memory free
+  * @brief  Memory free, in reverse order of the allocations: the block and
+  *         everything allocated after it are released
   * @param  *p pointer to allocated  memory address
   * @retval None
   */
 void USBD_static_free(void *p)
 {
+    uint32_t *block = (uint32_t *)p;
 
+    if ((block >= &USBD_Arena[0]) && (block < &USBD_Arena[USBD_ArenaTop]))
+    {
+        USBD_ArenaTop = block - &USBD_Arena[0];
+    }
 }
 
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -0,0 +1,267 @@
+/**
+  ******************************************************************************
+  * @file    USB_Device/CDC_Standalone/Src/vcp_config.c
+  * @brief   Settings kept in flash across reboots. They are read once at
+  *          startup; a change is written from the main loop, never from an
+  *          interrupt, as the page erase stalls the core for about 20 ms.
+  *          The pages hold a log: a header, then one record per word of
+  *          VcpConfig written, the last record of a word wins. A change only
+  *          appends records, the pages are erased and the current settings
+  *          written again once the log is full.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "vcp_config.h"
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+#define VCP_CONFIG_WORDS                 (sizeof (VCP_ConfigTypeDef) / 4)
+
+/* Header: [0] magic, written last, [4] erases of the pages so far */
+#define VCP_CONFIG_HEADER                8
+
+/* Record: [0] value, then [4] word index and its check. The check is written
+   last, a record cut short by a reset is ignored */
+#define VCP_CONFIG_RECORD                8
+#define VCP_CONFIG_CHECK                 0x5A5A
+#define VCP_CONFIG_BLANK                 0xFFFFFFFF
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+VCP_ConfigTypeDef VcpConfig;
+static __IO uint8_t ConfigDirty;
+static uint32_t ConfigStored[VCP_CONFIG_WORDS]; /* Settings the flash holds */
+static uint32_t ConfigFree;                     /* Offset of the first blank record */
+static uint32_t ConfigErases;
+
+/* Private function prototypes -----------------------------------------------*/
+static void Config_SetDefaults(VCP_ConfigTypeDef *config);
+static void Config_PortDefaults(VCP_PortConfigTypeDef *cfg);
+static HAL_StatusTypeDef Config_Append(uint32_t key, uint32_t value);
+static void Config_Compact(void);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Read the settings from flash: the defaults, then each record of
+  *         the log in turn. The pages are written again in the current layout
+  *         when they hold the former one.
+  * @param  None
+  * @retval None
+  */
+void VCP_Config_Load(void)
+{
+    const uint32_t *page = (const uint32_t *)VCP_CONFIG_ADDR;
+    uint32_t offset = VCP_CONFIG_HEADER;
+    uint32_t value;
+    uint32_t key;
+
+    Config_SetDefaults(&VcpConfig);
+    memcpy(ConfigStored, &VcpConfig, sizeof (ConfigStored));
+    ConfigErases = 0;
+    ConfigDirty = 0;
+
+    if (page[0] == VCP_CONFIG_MAGIC)
+    {
+        ConfigErases = page[1];
+        for (; (offset + VCP_CONFIG_RECORD) <= VCP_CONFIG_SIZE; offset += VCP_CONFIG_RECORD)
+        {
+            value = page[offset / 4];
+            key = page[(offset / 4) + 1];
+            if ((value == VCP_CONFIG_BLANK) && (key == VCP_CONFIG_BLANK))
+            {
+                break;
+            }
+            if (((key >> 16) == ((key & 0xFFFF) ^ VCP_CONFIG_CHECK)) && ((key & 0xFFFF) < VCP_CONFIG_WORDS))
+            {
+                ConfigStored[key & 0xFFFF] = value;
+            }
+        }
+        memcpy(&VcpConfig, ConfigStored, sizeof (VcpConfig));
+    }
+    else if (page[0] == VCP_CONFIG_MAGIC_V1)
+    {
+        VcpConfig.Passthrough = ((const uint8_t *)VCP_CONFIG_ADDR)[4];
+        ConfigDirty = 1;
+    }
+
+    /* Anything else must be erased before the first record */
+    ConfigFree = (page[0] == VCP_CONFIG_MAGIC) ? offset : VCP_CONFIG_SIZE;
+}
+
+/**
+  * @brief  Put back the built-in profile of a port, 115200 baud 8N1.
+  * @param  port: CDC port index
+  * @retval None
+  */
+void VCP_Config_Defaults(uint8_t port)
+{
+    Config_PortDefaults(&VcpConfig.Port[port]);
+}
+
+/**
+  * @brief  VcpConfig has been modified: have it written by the main loop.
+  * @param  None
+  * @retval None
+  */
+void VCP_Config_Changed(void)
+{
+    ConfigDirty = 1;
+}
+
+/**
+  * @brief  Append a record for each word that has changed, or start the log
+  *         again when it is full.
+  * @param  None
+  * @retval None
+  */
+void VCP_Config_Process(void)
+{
+    const uint32_t *words = (const uint32_t *)&VcpConfig;
+    uint32_t i;
+
+    if (!ConfigDirty)
+    {
+        return;
+    }
+    ConfigDirty = 0;
+
+    HAL_FLASH_Unlock();
+    for (i = 0; i < VCP_CONFIG_WORDS; i++)
+    {
+        if (words[i] == ConfigStored[i])
+        {
+            continue;
+        }
+        if ((ConfigFree + VCP_CONFIG_RECORD) > VCP_CONFIG_SIZE)
+        {
+            /* Writes every word still to be written */
+            Config_Compact();
+            break;
+        }
+        if (Config_Append(i, words[i]) != HAL_OK)
+        {
+            break;
+        }
+    }
+    HAL_FLASH_Lock();
+}
+
+/**
+  * @brief  Number of times the pages have been erased.
+  * @param  None
+  * @retval Erase count
+  */
+uint32_t VCP_Config_Erases(void)
+{
+    return ConfigErases;
+}
+
+/**
+  * @brief  Number of records that can still be appended before the next erase.
+  * @param  None
+  * @retval Free records
+  */
+uint16_t VCP_Config_Free(void)
+{
+    return (uint16_t)((VCP_CONFIG_SIZE - ConfigFree) / VCP_CONFIG_RECORD);
+}
+
+/**
+  * @brief  Fill a configuration with the built-in settings.
+  * @param  config: configuration to fill
+  * @retval None
+  */
+static void Config_SetDefaults(VCP_ConfigTypeDef *config)
+{
+    uint8_t port;
+
+    memset(config, 0, sizeof (*config));
+    for (port = 0; port < 2; port++)
+    {
+        Config_PortDefaults(&config->Port[port]);
+    }
+}
+
+/**
+  * @brief  Fill the profile of a port with the built-in settings.
+  * @param  cfg: profile to fill
+  * @retval None
+  */
+static void Config_PortDefaults(VCP_PortConfigTypeDef *cfg)
+{
+    memset(cfg, 0, sizeof (*cfg));
+    cfg->Bitrate  = 115200;
+    cfg->DataBits = 8;
+}
+
+/**
+  * @brief  Program a record at the end of the log. The slot is used up even
+  *         when programming fails.
+  * @param  key: index of the word in VcpConfig
+  * @param  value: new value of the word
+  * @retval HAL status
+  */
+static HAL_StatusTypeDef Config_Append(uint32_t key, uint32_t value)
+{
+    uint32_t addr = VCP_CONFIG_ADDR + ConfigFree;
+    HAL_StatusTypeDef status;
+
+    ConfigFree += VCP_CONFIG_RECORD;
+    status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr, value);
+    if (status == HAL_OK)
+    {
+        status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr + 4, key | ((key ^ VCP_CONFIG_CHECK) << 16));
+    }
+    if (status == HAL_OK)
+    {
+        ConfigStored[key] = value;
+    }
+    return status;
+}
+
+/**
+  * @brief  Erase the pages and write the words that differ from the
+  *         defaults, then the magic that makes the log valid.
+  * @param  None
+  * @retval None
+  * @note   The flash must be unlocked.
+  */
+static void Config_Compact(void)
+{
+    FLASH_EraseInitTypeDef erase;
+    VCP_ConfigTypeDef defaults;
+    const uint32_t *words = (const uint32_t *)&VcpConfig;
+    const uint32_t *base = (const uint32_t *)&defaults;
+    uint32_t error;
+    uint32_t i;
+
+    erase.TypeErase   = FLASH_TYPEERASE_PAGES;
+    erase.PageAddress = VCP_CONFIG_ADDR;
+    erase.NbPages     = VCP_CONFIG_PAGES;
+
+    if (HAL_FLASHEx_Erase(&erase, &error) != HAL_OK)
+    {
+        return;
+    }
+    ConfigErases++;
+
+    Config_SetDefaults(&defaults);
+    memcpy(ConfigStored, &defaults, sizeof (ConfigStored));
+    ConfigFree = VCP_CONFIG_HEADER;
+
+    if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, VCP_CONFIG_ADDR + 4, ConfigErases) != HAL_OK)
+    {
+        return;
+    }
+    for (i = 0; i < VCP_CONFIG_WORDS; i++)
+    {
+        if ((words[i] != base[i]) && (Config_Append(i, words[i]) != HAL_OK))
+        {
+            return;
+        }
+    }
+    HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, VCP_CONFIG_ADDR, VCP_CONFIG_MAGIC);
+}
@@ -0,0 +1,366 @@
+/**
+  ******************************************************************************
+  * @file    USB_Device/CDC_Standalone/Src/vcp_drive.c
+  * @brief   Status drive: a read-only FAT12 volume made up sector by sector
+  *          as the host reads it, nothing of it is kept in RAM. It holds
+  *          STATUS.TXT, the counters of both ports, and CAPTURE.BIN, the
+  *          last bytes received by port X then by port Y. The reads run in
+  *          the USB interrupt.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "main.h"
+
+#if (USBD_STATUS_DRIVE == 1)
+
+/* Private typedef -----------------------------------------------------------*/
+/* Root directory entry */
+typedef struct
+{
+    char     Name[11];
+    uint8_t  Attr;
+    uint8_t  Reserved[10];           /* Creation and access times, high cluster word */
+    uint16_t Time;
+    uint16_t Date;
+    uint16_t Cluster;
+    uint32_t Size;
+} VCP_DriveEntryTypeDef;
+
+/* Private define ------------------------------------------------------------*/
+#define DRIVE_ATTR_READ_ONLY             0x01
+#define DRIVE_ATTR_VOLUME_ID             0x08
+#define DRIVE_DATE                       ((36 << 9) | (1 << 5) | 1) /* 2016-01-01, no clock here */
+#define DRIVE_CAPTURE_SIZE               (2 * APP_TX_DATA_SIZE)
+#define DRIVE_TEXT_END                   (VCP_DRIVE_SECTOR_SIZE - 2) /* Room left for the last line break */
+
+/* Private macro -------------------------------------------------------------*/
+/* Fails to compile when the entry is not 32 bytes or CAPTURE.BIN not a sector */
+typedef char VCP_DriveEntryCheck[(sizeof (VCP_DriveEntryTypeDef) == 32) ? 1 : -1];
+typedef char VCP_DriveCaptureCheck[(DRIVE_CAPTURE_SIZE == VCP_DRIVE_SECTOR_SIZE) ? 1 : -1];
+
+/* Private variables ---------------------------------------------------------*/
+/* Jump, OEM name and BIOS parameter block */
+static const uint8_t DriveBootSector[] =
+{
+    0xEB, 0x3C, 0x90,
+    'M', 'S', 'D', 'O', 'S', '5', '.', '0',
+    LOBYTE(VCP_DRIVE_SECTOR_SIZE), HIBYTE(VCP_DRIVE_SECTOR_SIZE),
+    0x01,                                                       /* Sectors per cluster */
+    LOBYTE(VCP_DRIVE_FAT_SECTOR), HIBYTE(VCP_DRIVE_FAT_SECTOR), /* Reserved sectors */
+    VCP_DRIVE_FAT_COUNT,
+    LOBYTE(VCP_DRIVE_ROOT_ENTRIES), HIBYTE(VCP_DRIVE_ROOT_ENTRIES),
+    LOBYTE(VCP_DRIVE_SECTORS), HIBYTE(VCP_DRIVE_SECTORS),
+    0xF8,                                                       /* Media: fixed */
+    0x01, 0x00,                                                 /* Sectors per FAT */
+    0x01, 0x00,                                                 /* Sectors per track */
+    0x01, 0x00,                                                 /* Heads */
+    0x00, 0x00, 0x00, 0x00,                                     /* Hidden sectors */
+    0x00, 0x00, 0x00, 0x00,                                     /* Sectors, 32 bits */
+    0x80, 0x00, 0x29,                                           /* Drive number, extended signature */
+    0x42, 0x32, 0x55, 0x54,                                     /* Volume serial number */
+    'T', 'I', 'A', 'N', ' ', 'S', 'T', 'A', 'T', 'U', 'S',
+    'F', 'A', 'T', '1', '2', ' ', ' ', ' ',
+};
+
+static const VCP_DriveEntryTypeDef DriveRoot[] =
+{
+    { "TIAN STATUS", DRIVE_ATTR_VOLUME_ID, { 0 }, 0, DRIVE_DATE, 0, 0 },
+    { "STATUS  TXT", DRIVE_ATTR_READ_ONLY, { 0 }, 0, DRIVE_DATE, 2, VCP_DRIVE_SECTOR_SIZE },
+    { "CAPTURE BIN", DRIVE_ATTR_READ_ONLY, { 0 }, 0, DRIVE_DATE, 3, DRIVE_CAPTURE_SIZE },
+};
+
+/* USB Mass storage Standard Inquiry Data */
+static const int8_t DriveInquiry[STANDARD_INQUIRY_DATA_LEN] =
+{
+    0x00,                                   /* Direct access device */
+    0x80,                                   /* Removable */
+    0x02,
+    0x02,
+    (STANDARD_INQUIRY_DATA_LEN - 5),
+    0x00,
+    0x00,
+    0x00,
+    'A', 'r', 'd', 'u', 'i', 'n', 'o', ' ', /* Manufacturer : 8 bytes */
+    'T', 'i', 'a', 'n', ' ', 's', 't', 'a', /* Product      : 16 Bytes */
+    't', 'u', 's', ' ', ' ', ' ', ' ', ' ',
+    '1', '.', '0', '0',                     /* Version      : 4 Bytes */
+};
+
+/* Private function prototypes -----------------------------------------------*/
+static int8_t Drive_Init(uint8_t lun);
+static int8_t Drive_GetCapacity(uint8_t lun, uint32_t *block_num, uint16_t *block_size);
+static int8_t Drive_IsReady(uint8_t lun);
+static int8_t Drive_IsWriteProtected(uint8_t lun);
+static int8_t Drive_Read(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len);
+static int8_t Drive_Write(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len);
+static int8_t Drive_GetMaxLun(void);
+static void Drive_Sector(uint32_t sector, uint8_t *pbuf);
+static void Drive_Status(uint8_t *pbuf);
+static uint32_t Drive_Port(uint8_t *pbuf, uint32_t pos, uint8_t port);
+static uint32_t Drive_Text(uint8_t *pbuf, uint32_t pos, const char *text);
+static uint32_t Drive_Number(uint8_t *pbuf, uint32_t pos, uint32_t value);
+static uint32_t Drive_Word(const uint8_t *pbuf);
+
+USBD_StorageTypeDef VCP_Drive_fops =
+{
+    Drive_Init,
+    Drive_GetCapacity,
+    Drive_IsReady,
+    Drive_IsWriteProtected,
+    Drive_Read,
+    Drive_Write,
+    Drive_GetMaxLun,
+    (int8_t *)DriveInquiry,
+};
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Nothing to prepare, the volume is made up on each read.
+  * @param  lun: logical unit
+  * @retval USBD_OK
+  */
+static int8_t Drive_Init(uint8_t lun)
+{
+    return (USBD_OK);
+}
+
+/**
+  * @brief  Give the size of the volume.
+  * @param  lun: logical unit
+  * @param  block_num: number of sectors
+  * @param  block_size: sector size
+  * @retval USBD_OK
+  */
+static int8_t Drive_GetCapacity(uint8_t lun, uint32_t *block_num, uint16_t *block_size)
+{
+    *block_num = VCP_DRIVE_SECTORS;
+    *block_size = VCP_DRIVE_SECTOR_SIZE;
+    return (USBD_OK);
+}
+
+/**
+  * @brief  The volume is always there.
+  * @param  lun: logical unit
+  * @retval USBD_OK
+  */
+static int8_t Drive_IsReady(uint8_t lun)
+{
+    return (USBD_OK);
+}
+
+/**
+  * @brief  The host mounts the volume read-only.
+  * @param  lun: logical unit
+  * @retval 1
+  */
+static int8_t Drive_IsWriteProtected(uint8_t lun)
+{
+    return 1;
+}
+
+/**
+  * @brief  Make up the sectors asked for.
+  * @param  lun: logical unit
+  * @param  buf: sectors read
+  * @param  blk_addr: first sector
+  * @param  blk_len: number of sectors
+  * @retval USBD_OK, or USBD_FAIL past the end of the volume
+  */
+static int8_t Drive_Read(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len)
+{
+    if ((blk_addr + blk_len) > VCP_DRIVE_SECTORS)
+    {
+        return (USBD_FAIL);
+    }
+
+    while (blk_len--)
+    {
+        Drive_Sector(blk_addr++, buf);
+        buf += VCP_DRIVE_SECTOR_SIZE;
+    }
+    return (USBD_OK);
+}
+
+/**
+  * @brief  Writes are refused, the volume is write-protected.
+  * @param  lun: logical unit
+  * @param  buf: sectors to write
+  * @param  blk_addr: first sector
+  * @param  blk_len: number of sectors
+  * @retval USBD_FAIL
+  */
+static int8_t Drive_Write(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len)
+{
+    return (USBD_FAIL);
+}
+
+/**
+  * @brief  A single logical unit.
+  * @param  None
+  * @retval Highest logical unit number
+  */
+static int8_t Drive_GetMaxLun(void)
+{
+    return 0;
+}
+
+/**
+  * @brief  Make up one sector of the volume.
+  * @param  sector: sector number
+  * @param  pbuf: VCP_DRIVE_SECTOR_SIZE bytes
+  * @retval None
+  */
+static void Drive_Sector(uint32_t sector, uint8_t *pbuf)
+{
+    memset(pbuf, 0, VCP_DRIVE_SECTOR_SIZE);
+
+    if (sector == 0)
+    {
+        memcpy(pbuf, DriveBootSector, sizeof (DriveBootSector));
+        pbuf[510] = 0x55;
+        pbuf[511] = 0xAA;
+    }
+    else if (sector < VCP_DRIVE_ROOT_SECTOR)
+    {
+        /* 12 bits entries: media, end of chain, then one cluster per file */
+        pbuf[0] = 0xF8;
+        memset(&pbuf[1], 0xFF, 5);
+    }
+    else if (sector == VCP_DRIVE_ROOT_SECTOR)
+    {
+        memcpy(pbuf, DriveRoot, sizeof (DriveRoot));
+    }
+    else if (sector == VCP_DRIVE_STATUS_SECTOR)
+    {
+        Drive_Status(pbuf);
+    }
+    else if (sector == VCP_DRIVE_CAPTURE_SECTOR)
+    {
+        VCP_Rx_Recent(0, pbuf);
+        VCP_Rx_Recent(1, &pbuf[APP_TX_DATA_SIZE]);
+    }
+}
+
+/**
+  * @brief  Write STATUS.TXT, padded with spaces to its fixed size.
+  * @param  pbuf: VCP_DRIVE_SECTOR_SIZE bytes
+  * @retval None
+  */
+static void Drive_Status(uint8_t *pbuf)
+{
+    uint32_t pos;
+
+    pos = Drive_Text(pbuf, 0, "Arduino Tian UART bridge, up ");
+    pos = Drive_Number(pbuf, pos, HAL_GetTick() / 1000);
+    pos = Drive_Text(pbuf, pos, " s\r\n");
+    pos = Drive_Port(pbuf, pos, 0);
+    pos = Drive_Port(pbuf, pos, 1);
+    pos = Drive_Text(pbuf, pos, "\r\nCAPTURE.BIN: last 256 bytes of port X, then of port Y\r\n");
+
+    memset(&pbuf[pos], ' ', DRIVE_TEXT_END - pos);
+    pbuf[DRIVE_TEXT_END] = '\r';
+    pbuf[DRIVE_TEXT_END + 1] = '\n';
+}
+
+/**
+  * @brief  Write the lines of a port, from the answers of its vendor
+  *         requests.
+  * @param  pbuf: STATUS.TXT
+  * @param  pos: where to write
+  * @param  port: CDC port index
+  * @retval Position after the lines
+  */
+static uint32_t Drive_Port(uint8_t *pbuf, uint32_t pos, uint8_t port)
+{
+    static const char parity[] = "NOEMS";
+    static const char *const stop[] = { "1", "1.5", "2" };
+    uint8_t answer[20];
+    char format[3];
+
+    pos = Drive_Text(pbuf, pos, (port == 0) ? "\r\nPort X: " : "\r\nPort Y: ");
+    USBD_CDC_fops[port].Control(CDC_GET_LINE_CODING, answer, 7);
+    pos = Drive_Number(pbuf, pos, Drive_Word(answer));
+    format[0] = (char)('0' + (answer[6] % 10));
+    format[1] = parity[answer[5] % 5];
+    format[2] = '\0';
+    pos = Drive_Text(pbuf, pos, " baud ");
+    pos = Drive_Text(pbuf, pos, format);
+    pos = Drive_Text(pbuf, pos, stop[answer[4] % 3]);
+    pos = Drive_Text(pbuf, pos, "\r\n");
+
+    USBD_CDC_fops[port].Control(VCP_REQ_GET_TX_STATS, answer, 20);
+    pos = Drive_Text(pbuf, pos, "  to host: ");
+    pos = Drive_Number(pbuf, pos, Drive_Word(&answer[4]));
+    pos = Drive_Text(pbuf, pos, " bytes, ");
+    pos = Drive_Number(pbuf, pos, Drive_Word(&answer[8]));
+    pos = Drive_Text(pbuf, pos, " transfers, ");
+    pos = Drive_Number(pbuf, pos, Drive_Word(&answer[12]));
+    pos = Drive_Text(pbuf, pos, " deferred\r\n  latency: ");
+    pos = Drive_Number(pbuf, pos, answer[16] | (answer[17] << 8));
+    pos = Drive_Text(pbuf, pos, " ms, worst ");
+    pos = Drive_Number(pbuf, pos, answer[18] | (answer[19] << 8));
+    pos = Drive_Text(pbuf, pos, " ms\r\n");
+
+    USBD_CDC_fops[port].Control(VCP_REQ_GET_RX_STATS, answer, 16);
+    pos = Drive_Text(pbuf, pos, "  received: ");
+    pos = Drive_Number(pbuf, pos, Drive_Word(&answer[8]));
+    pos = Drive_Text(pbuf, pos, " bytes lost in ");
+    pos = Drive_Number(pbuf, pos, Drive_Word(&answer[4]));
+    pos = Drive_Text(pbuf, pos, " overflows\r\n");
+
+    return pos;
+}
+
+/**
+  * @brief  Append text, as much as fits before the last line break.
+  * @param  pbuf: STATUS.TXT
+  * @param  pos: where to write
+  * @param  text: zero terminated
+  * @retval Position after the text
+  */
+static uint32_t Drive_Text(uint8_t *pbuf, uint32_t pos, const char *text)
+{
+    while ((*text != '\0') && (pos < DRIVE_TEXT_END))
+    {
+        pbuf[pos++] = (uint8_t)*text++;
+    }
+    return pos;
+}
+
+/**
+  * @brief  Append a number in decimal.
+  * @param  pbuf: STATUS.TXT
+  * @param  pos: where to write
+  * @param  value: number
+  * @retval Position after the number
+  */
+static uint32_t Drive_Number(uint8_t *pbuf, uint32_t pos, uint32_t value)
+{
+    char digits[11];
+    uint32_t i = sizeof (digits) - 1;
+
+    digits[i] = '\0';
+    do
+    {
+        digits[--i] = (char)('0' + (value % 10));
+        value /= 10;
+    }
+    while (value != 0);
+
+    return Drive_Text(pbuf, pos, &digits[i]);
+}
+
+/**
+  * @brief  Read a little endian word of a request answer.
+  * @param  pbuf: first byte
+  * @retval Word
+  */
+static uint32_t Drive_Word(const uint8_t *pbuf)
+{
+    return (uint32_t)(pbuf[0] | (pbuf[1] << 8) | (pbuf[2] << 16) | (pbuf[3] << 24));
+}
+
+#endif /* USBD_STATUS_DRIVE */
@@ -0,0 +1,495 @@
+/**
+  ******************************************************************************
+  * @file    USB_Device/CDC_Standalone/Src/vcp_i2c.c
+  * @brief   I2C bridge: the host sends a batch of operations in one control
+  *          transfer, they run from the I2C interrupt one after the other and
+  *          the bytes read come back together in one transfer. The interrupt
+  *          runs at the USB priority, so a request never sees a batch half
+  *          updated; the main loop only ends the delays and the timeouts.
+  *          The sensors of the firmware share the bus through single
+  *          register accesses, run from the interrupt the same way.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "usbd_def.h"
+#include "vcp_i2c.h"
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+    uint8_t  Ops[VCP_I2C_BATCH_SIZE];
+    uint8_t  Data[VCP_I2C_DATA_SIZE];
+    uint8_t  Length;             /* Bytes of operations in the batch */
+    uint8_t  Pos;                /* Offset of the next operation */
+    uint8_t  State;              /* VCP_I2C_xxx */
+    uint8_t  Done;               /* Operations done */
+    uint8_t  Error;              /* HAL_I2C_ERROR_xxx */
+    uint8_t  ReadLength;         /* Bytes read so far */
+    uint8_t  Pending;            /* Bytes of the read running */
+    uint8_t  Delay;              /* 1 while waiting for the end of a delay */
+    uint32_t Deadline;           /* Tick ending the delay or the operation */
+} VCP_I2cTypeDef;
+
+typedef struct
+{
+    uint8_t  Buf[1 + VCP_I2C_REG_SIZE]; /* Register number, then the bytes written */
+    uint8_t *Data;               /* Where the bytes read go, NULL for a write */
+    uint8_t  Addr;
+    uint8_t  Length;             /* Bytes read */
+    __IO uint8_t State;          /* VCP_I2C_xxx */
+    uint32_t Deadline;
+} VCP_I2cRegTypeDef;
+
+/* Private define ------------------------------------------------------------*/
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+static I2C_HandleTypeDef I2cHandle;
+static VCP_I2cTypeDef I2c;
+static VCP_I2cRegTypeDef I2cReg;
+static uint8_t I2cSpeed = VCP_I2C_OFF;
+
+/* Private function prototypes -----------------------------------------------*/
+static void I2c_Next(void);
+static void I2c_Fail(uint8_t error);
+static int8_t I2c_RegStart(uint8_t addr, uint8_t length, uint8_t *data);
+static void I2c_RegEnd(uint8_t state);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Claim PA9/PA10 for the bus at the given speed, or give them back.
+  * @param  speed: VCP_I2C_OFF/100K/400K
+  * @retval USBD_OK, or USBD_FAIL for an unknown speed or while a batch or a
+  *         register access runs
+  */
+int8_t VCP_I2C_Config(uint8_t speed)
+{
+    if ((speed > VCP_I2C_400K) || (I2c.State == VCP_I2C_BUSY) || (I2cReg.State == VCP_I2C_BUSY))
+    {
+        return (USBD_FAIL);
+    }
+
+    if (I2cSpeed != VCP_I2C_OFF)
+    {
+        HAL_I2C_DeInit(&I2cHandle);
+    }
+    I2cSpeed = speed;
+    I2c.State = VCP_I2C_IDLE;
+    if (speed == VCP_I2C_OFF)
+    {
+        return (USBD_OK);
+    }
+
+    /* The kernel clock stays on HSI, whatever the system clock */
+    __HAL_RCC_I2C1_CONFIG(RCC_I2C1CLKSOURCE_HSI);
+
+    I2cHandle.Instance              = I2Cx;
+    I2cHandle.Init.Timing           = (speed == VCP_I2C_400K) ? I2Cx_TIMING_400K : I2Cx_TIMING_100K;
+    I2cHandle.Init.OwnAddress1      = 0;
+    I2cHandle.Init.AddressingMode   = I2C_ADDRESSINGMODE_7BIT;
+    I2cHandle.Init.DualAddressMode  = I2C_DUALADDRESS_DISABLE;
+    I2cHandle.Init.OwnAddress2      = 0;
+    I2cHandle.Init.OwnAddress2Masks = I2C_OA2_NOMASK;
+    I2cHandle.Init.GeneralCallMode  = I2C_GENERALCALL_DISABLE;
+    I2cHandle.Init.NoStretchMode    = I2C_NOSTRETCH_DISABLE;
+
+    if (HAL_I2C_Init(&I2cHandle) != HAL_OK)
+    {
+        I2cSpeed = VCP_I2C_OFF;
+        return (USBD_FAIL);
+    }
+    return (USBD_OK);
+}
+
+/**
+  * @brief  Tell whether a pin is taken by the bus.
+  * @param  GPIOx: GPIO port
+  * @param  pin: GPIO_PIN_x
+  * @retval 1 when the bus is on and uses the pin
+  */
+uint8_t VCP_I2C_PinInUse(GPIO_TypeDef *GPIOx, uint32_t pin)
+{
+    return ((I2cSpeed != VCP_I2C_OFF) && (GPIOx == I2Cx_GPIO_PORT) &&
+            ((pin & (I2Cx_SCL_PIN | I2Cx_SDA_PIN)) != 0)) ? 1 : 0;
+}
+
+/**
+  * @brief  Check a batch of operations and start it.
+  * @param  pbuf: operations, see VCP_I2C_OP_xxx
+  * @param  length: bytes of operations
+  * @retval USBD_OK, or USBD_FAIL when the bus is off, a batch runs, or the
+  *         operations are malformed, read more than a result holds or end
+  *         without a stop
+  */
+int8_t VCP_I2C_Batch(const uint8_t *pbuf, uint16_t length)
+{
+    uint16_t pos = 0;
+    uint16_t read = 0;
+    uint8_t last = 0;
+    uint8_t op;
+
+    if ((I2cSpeed == VCP_I2C_OFF) || (I2c.State == VCP_I2C_BUSY))
+    {
+        return (USBD_FAIL);
+    }
+
+    /* The status stage of an OUT request is not held back: a malformed batch
+       is also told by the result */
+    I2c.Done = 0;
+    I2c.ReadLength = 0;
+    I2c_Fail(HAL_I2C_ERROR_SIZE);
+    if ((length == 0) || (length > VCP_I2C_BATCH_SIZE))
+    {
+        return (USBD_FAIL);
+    }
+
+    while (pos < length)
+    {
+        op = pbuf[pos] & VCP_I2C_OP_MASK;
+        if ((op == VCP_I2C_OP_DELAY) && ((pos + 2) <= length))
+        {
+            pos += 2;
+            continue;
+        }
+        if (((pos + 3) > length) || (pbuf[pos + 1] > 0x7F))
+        {
+            return (USBD_FAIL);
+        }
+        last = pbuf[pos];
+        if (op == VCP_I2C_OP_WRITE)
+        {
+            pos += 3 + pbuf[pos + 2];
+        }
+        else if ((op == VCP_I2C_OP_READ) && (pbuf[pos + 2] != 0))
+        {
+            read += pbuf[pos + 2];
+            pos += 3;
+        }
+        else
+        {
+            return (USBD_FAIL);
+        }
+    }
+    /* The last transfer ends with a stop, or the bus would stay held */
+    if ((pos != length) || (read > VCP_I2C_DATA_SIZE) || (last & VCP_I2C_NOSTOP))
+    {
+        return (USBD_FAIL);
+    }
+
+    memcpy(I2c.Ops, pbuf, length);
+    I2c.Length = (uint8_t)length;
+    I2c.Pos = 0;
+    I2c.Error = HAL_I2C_ERROR_NONE;
+    I2c.Deadline = HAL_GetTick() + VCP_I2C_TIMEOUT;
+    I2c.State = VCP_I2C_BUSY;
+    if (I2cReg.State != VCP_I2C_BUSY)
+    {
+        I2c_Next();
+    }
+
+    return (USBD_OK);
+}
+
+/**
+  * @brief  Report the state of the last batch and the bytes it read
+  *         (VCP_REQ_GET_I2C).
+  * @param  pbuf: response buffer
+  * @param  length: bytes asked by the host
+  * @retval None
+  */
+void VCP_I2C_GetResult(uint8_t *pbuf, uint16_t length)
+{
+    uint8_t header[VCP_I2C_RESULT_HEADER];
+
+    header[0] = I2c.State;
+    header[1] = I2c.Done;
+    header[2] = I2c.Error;
+    header[3] = I2c.ReadLength;
+
+    if (length > (VCP_I2C_RESULT_HEADER + VCP_I2C_DATA_SIZE))
+    {
+        length = VCP_I2C_RESULT_HEADER + VCP_I2C_DATA_SIZE;
+    }
+    memset(pbuf, 0, length);
+    memcpy(pbuf, header, (length < VCP_I2C_RESULT_HEADER) ? length : VCP_I2C_RESULT_HEADER);
+    if (length > VCP_I2C_RESULT_HEADER)
+    {
+        memcpy(&pbuf[VCP_I2C_RESULT_HEADER], I2c.Data, length - VCP_I2C_RESULT_HEADER);
+    }
+}
+
+/**
+  * @brief  Read registers of a device, from the first one on.
+  * @param  addr: 7-bit address
+  * @param  reg: first register
+  * @param  pbuf: where the bytes go, left alone until VCP_I2C_RegState()
+  *         tells the end of the access
+  * @param  length: bytes to read, 1 at least
+  * @retval USBD_OK, or USBD_FAIL when the bus is off or taken
+  */
+int8_t VCP_I2C_RegRead(uint8_t addr, uint8_t reg, uint8_t *pbuf, uint8_t length)
+{
+    if ((length == 0) || (I2cReg.State == VCP_I2C_BUSY))
+    {
+        return (USBD_FAIL);
+    }
+    I2cReg.Buf[0] = reg;
+    return I2c_RegStart(addr, length, pbuf);
+}
+
+/**
+  * @brief  Write registers of a device, from the first one on.
+  * @param  addr: 7-bit address
+  * @param  reg: first register
+  * @param  pbuf: bytes to write, copied
+  * @param  length: bytes to write, VCP_I2C_REG_SIZE at most
+  * @retval USBD_OK, or USBD_FAIL when the bus is off or taken
+  */
+int8_t VCP_I2C_RegWrite(uint8_t addr, uint8_t reg, const uint8_t *pbuf, uint8_t length)
+{
+    if ((length > VCP_I2C_REG_SIZE) || (I2cReg.State == VCP_I2C_BUSY))
+    {
+        return (USBD_FAIL);
+    }
+    I2cReg.Buf[0] = reg;
+    memcpy(&I2cReg.Buf[1], pbuf, length);
+    return I2c_RegStart(addr, length, NULL);
+}
+
+/**
+  * @brief  Tell how the last register access went.
+  * @param  None
+  * @retval VCP_I2C_IDLE/BUSY/DONE/ERROR
+  */
+uint8_t VCP_I2C_RegState(void)
+{
+    return I2cReg.State;
+}
+
+/**
+  * @brief  End the delay of the batch, or the operation stuck on the bus.
+  *         A batch queued behind a register access has not started: its
+  *         time only runs out once the access is over. Called by the main
+  *         loop on each polling tick.
+  * @param  None
+  * @retval None
+  */
+void VCP_I2C_Process(void)
+{
+    __disable_irq();
+    if ((I2cReg.State == VCP_I2C_BUSY) && ((int32_t)(HAL_GetTick() - I2cReg.Deadline) >= 0))
+    {
+        /* The batch waiting, if any, starts on a bus released */
+        HAL_I2C_DeInit(&I2cHandle);
+        HAL_I2C_Init(&I2cHandle);
+        I2c_RegEnd(VCP_I2C_ERROR);
+    }
+    else if ((I2c.State == VCP_I2C_BUSY) && (I2cReg.State != VCP_I2C_BUSY) &&
+             ((int32_t)(HAL_GetTick() - I2c.Deadline) >= 0))
+    {
+        if (I2c.Delay)
+        {
+            I2c.Delay = 0;
+            I2c.Done++;
+            I2c_Next();
+        }
+        else
+        {
+            /* A reset of the peripheral releases the bus */
+            HAL_I2C_DeInit(&I2cHandle);
+            HAL_I2C_Init(&I2cHandle);
+            I2c_Fail(HAL_I2C_ERROR_TIMEOUT);
+        }
+    }
+    __enable_irq();
+}
+
+/**
+  * @brief  Serve the event and error interrupts of the bus.
+  * @param  None
+  * @retval None
+  */
+void VCP_I2C_IRQHandler(void)
+{
+    if (I2cHandle.Instance->ISR & (I2C_FLAG_BERR | I2C_FLAG_ARLO | I2C_FLAG_OVR))
+    {
+        HAL_I2C_ER_IRQHandler(&I2cHandle);
+    }
+    else
+    {
+        HAL_I2C_EV_IRQHandler(&I2cHandle);
+    }
+}
+
+/**
+  * @brief  A write of the batch is done.
+  * @param  hi2c: I2C handle
+  * @retval None
+  */
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+    if (I2cReg.State == VCP_I2C_BUSY)
+    {
+        /* The register number is sent: read from it with a repeated start */
+        if ((I2cReg.Data == NULL) ||
+            (HAL_I2C_Master_Sequential_Receive_IT(&I2cHandle, (uint16_t)(I2cReg.Addr << 1), I2cReg.Data,
+                                                  I2cReg.Length, I2C_LAST_FRAME) != HAL_OK))
+        {
+            I2c_RegEnd((I2cReg.Data == NULL) ? VCP_I2C_DONE : VCP_I2C_ERROR);
+        }
+        return;
+    }
+    I2c.Done++;
+    I2c_Next();
+}
+
+/**
+  * @brief  A read of the batch is done.
+  * @param  hi2c: I2C handle
+  * @retval None
+  */
+void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+    if (I2cReg.State == VCP_I2C_BUSY)
+    {
+        I2c_RegEnd(VCP_I2C_DONE);
+        return;
+    }
+    I2c.ReadLength += I2c.Pending;
+    I2c.Pending = 0;
+    I2c.Done++;
+    I2c_Next();
+}
+
+/**
+  * @brief  An operation failed: no acknowledge, bus error or lost arbitration.
+  * @param  hi2c: I2C handle
+  * @retval None
+  */
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+    if (I2cReg.State == VCP_I2C_BUSY)
+    {
+        I2c_RegEnd(VCP_I2C_ERROR);
+        return;
+    }
+    I2c_Fail((uint8_t)hi2c->ErrorCode);
+}
+
+/**
+  * @brief  Start the next operation of the batch, or end it.
+  * @param  None
+  * @retval None
+  */
+static void I2c_Next(void)
+{
+    uint8_t code;
+    uint8_t addr;
+    uint8_t length;
+    uint32_t options;
+    HAL_StatusTypeDef status;
+
+    if (I2c.Pos >= I2c.Length)
+    {
+        I2c.State = VCP_I2C_DONE;
+        return;
+    }
+
+    code = I2c.Ops[I2c.Pos];
+    if ((code & VCP_I2C_OP_MASK) == VCP_I2C_OP_DELAY)
+    {
+        I2c.Deadline = HAL_GetTick() + I2c.Ops[I2c.Pos + 1];
+        I2c.Delay = 1;
+        I2c.Pos += 2;
+        return;
+    }
+
+    addr = I2c.Ops[I2c.Pos + 1];
+    length = I2c.Ops[I2c.Pos + 2];
+    options = (code & VCP_I2C_NOSTOP) ? I2C_FIRST_FRAME : I2C_FIRST_AND_LAST_FRAME;
+    I2c.Deadline = HAL_GetTick() + VCP_I2C_TIMEOUT;
+
+    if ((code & VCP_I2C_OP_MASK) == VCP_I2C_OP_WRITE)
+    {
+        status = HAL_I2C_Master_Sequential_Transmit_IT(&I2cHandle, (uint16_t)(addr << 1),
+                                                       &I2c.Ops[I2c.Pos + 3], length, options);
+        I2c.Pos += 3 + length;
+    }
+    else
+    {
+        I2c.Pending = length;
+        status = HAL_I2C_Master_Sequential_Receive_IT(&I2cHandle, (uint16_t)(addr << 1),
+                                                      &I2c.Data[I2c.ReadLength], length, options);
+        I2c.Pos += 3;
+    }
+
+    if (status != HAL_OK)
+    {
+        I2c_Fail((uint8_t)I2cHandle.ErrorCode);
+    }
+}
+
+/**
+  * @brief  Stop the batch on an error.
+  * @param  error: HAL_I2C_ERROR_xxx
+  * @retval None
+  */
+static void I2c_Fail(uint8_t error)
+{
+    I2c.Error = error;
+    I2c.Pending = 0;
+    I2c.Delay = 0;
+    I2c.State = VCP_I2C_ERROR;
+}
+
+/**
+  * @brief  Start a register access, unless the bus is off or taken.
+  * @param  addr: 7-bit address
+  * @param  length: bytes to write after the register number, or to read
+  * @param  data: where the bytes read go, NULL for a write
+  * @retval USBD_OK, or USBD_FAIL
+  */
+static int8_t I2c_RegStart(uint8_t addr, uint8_t length, uint8_t *data)
+{
+    int8_t ret = USBD_FAIL;
+
+    /* The main loop calls, a batch may start from the USB interrupt */
+    __disable_irq();
+    if ((I2cSpeed != VCP_I2C_OFF) && (I2c.State != VCP_I2C_BUSY) && (I2cReg.State != VCP_I2C_BUSY))
+    {
+        I2cReg.Addr = addr;
+        I2cReg.Length = length;
+        I2cReg.Data = data;
+        I2cReg.Deadline = HAL_GetTick() + VCP_I2C_TIMEOUT;
+        I2cReg.State = VCP_I2C_BUSY;
+        if (HAL_I2C_Master_Sequential_Transmit_IT(&I2cHandle, (uint16_t)(addr << 1), I2cReg.Buf,
+                                                  (data != NULL) ? 1 : (1 + length),
+                                                  (data != NULL) ? I2C_FIRST_FRAME : I2C_FIRST_AND_LAST_FRAME) == HAL_OK)
+        {
+            ret = USBD_OK;
+        }
+        else
+        {
+            I2c_RegEnd(VCP_I2C_ERROR);
+        }
+    }
+    __enable_irq();
+
+    return (ret);
+}
+
+/**
+  * @brief  End the register access, and start the batch waiting for the bus.
+  * @param  state: VCP_I2C_DONE or VCP_I2C_ERROR
+  * @retval None
+  */
+static void I2c_RegEnd(uint8_t state)
+{
+    I2cReg.State = state;
+    if (I2c.State == VCP_I2C_BUSY)
+    {
+        I2c_Next();
+    }
+}
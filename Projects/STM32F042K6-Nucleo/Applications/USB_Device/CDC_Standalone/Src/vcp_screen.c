@@ -0,0 +1,777 @@
+/**
+  ******************************************************************************
+  * @file    USB_Device/CDC_Standalone/Src/vcp_screen.c
+  * @brief   Status screen on an ST7735 panel: the rate, the load and the
+  *          errors of both ports. There is no frame buffer: each widget
+  *          keeps what it shows, a change marks the cells that differ, and
+  *          only those are sent again, each span in a window of its own
+  *          filled by a single memory write. Everything runs from the main
+  *          loop, a pass never sends more than VCP_SCREEN_BUDGET pixels.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+/* Before main.h: the LL functions name their argument SPIx, a macro of vcp_spi.h */
+#include "stm32f0xx_ll_spi.h"
+#include "main.h"
+#include "st7735.h"
+
+/* Private typedef -----------------------------------------------------------*/
+/* Widget of the screen: a line of text or a bar graph */
+typedef struct
+{
+    uint8_t  Type;               /* SCREEN_TEXT or SCREEN_BAR */
+    uint8_t  X;
+    uint8_t  Y;
+    uint8_t  Size;               /* Characters of a text, width of a bar */
+} VCP_WidgetTypeDef;
+
+/* What a widget shows, and the part of it the panel does not show yet */
+typedef struct
+{
+    uint16_t Color;              /* RGB565 */
+    uint8_t  Level;              /* Filled width of a bar */
+    uint8_t  DirtyFrom;          /* First cell to send: character or column */
+    uint8_t  DirtyTo;            /* Cell after the last, DirtyFrom when clean */
+} VCP_WidgetStateTypeDef;
+
+typedef struct
+{
+    __IO uint8_t On;             /* Asked for by the host, the main loop follows */
+    uint8_t  State;              /* SCREEN_xxx */
+    uint8_t  Row;                /* Rows cleared so far */
+    uint32_t Deadline;           /* End of a reset or wake up delay, or next refresh */
+    uint32_t LastTick;           /* Of the last sample */
+    uint32_t Received[2];        /* Counters at the last sample */
+    uint32_t Sent[2];
+    uint32_t Errors[2];
+    uint32_t Refreshes;
+    uint32_t Pixels;
+    uint32_t BusyUs;
+} VCP_ScreenTypeDef;
+
+/* Private define ------------------------------------------------------------*/
+#define SCREEN_OFF                       0
+#define SCREEN_RESET                     1 /* Software reset sent */
+#define SCREEN_WAKE                      2 /* Sleep out sent */
+#define SCREEN_CLEAR                     3
+#define SCREEN_RUN                       4
+
+#define SCREEN_RESET_DELAY               150 /* in ms */
+#define SCREEN_WAKE_DELAY                120 /* in ms */
+
+#define SCREEN_TEXT                      0
+#define SCREEN_BAR                       1
+
+/* 5x7 characters in 6x8 cells */
+#define SCREEN_CELL_WIDTH                6
+#define SCREEN_CELL_HEIGHT               8
+#define SCREEN_COLUMNS                   20
+#define SCREEN_BAR_WIDTH                 120
+#define SCREEN_BAR_HEIGHT                6
+
+/* Widgets of a port, then the same for the other port 80 rows below */
+#define SCREEN_PORT_WIDGETS              6
+#define SCREEN_WIDGETS                   (2 * SCREEN_PORT_WIDGETS)
+#define SCREEN_W_TITLE                   0
+#define SCREEN_W_RX                      1
+#define SCREEN_W_RX_BAR                  2
+#define SCREEN_W_TX                      3
+#define SCREEN_W_TX_BAR                  4
+#define SCREEN_W_ERRORS                  5
+
+#define SCREEN_BLACK                     0x0000
+#define SCREEN_WHITE                     0xFFFF
+#define SCREEN_GREY                      0x7BEF
+#define SCREEN_DARK                      0x2104
+#define SCREEN_CYAN                      0x07FF
+#define SCREEN_GREEN                     0x07E0
+#define SCREEN_YELLOW                    0xFFE0
+#define SCREEN_RED                       0xF800
+
+/* Private macro -------------------------------------------------------------*/
+#define SCREEN_CS(level)                 (SCREEN_GPIO_PORT->BSRR = (level) ? SCREEN_CS_PIN : ((uint32_t)SCREEN_CS_PIN << 16))
+#define SCREEN_DC(level)                 (SCREEN_GPIO_PORT->BSRR = (level) ? SCREEN_DC_PIN : ((uint32_t)SCREEN_DC_PIN << 16))
+
+/* Private variables ---------------------------------------------------------*/
+static const VCP_WidgetTypeDef ScreenWidgets[SCREEN_PORT_WIDGETS] =
+{
+    { SCREEN_TEXT, 2, 2,  SCREEN_COLUMNS },
+    { SCREEN_TEXT, 2, 14, SCREEN_COLUMNS },
+    { SCREEN_BAR,  4, 23, SCREEN_BAR_WIDTH },
+    { SCREEN_TEXT, 2, 32, SCREEN_COLUMNS },
+    { SCREEN_BAR,  4, 41, SCREEN_BAR_WIDTH },
+    { SCREEN_TEXT, 2, 50, SCREEN_COLUMNS },
+};
+
+/* Command, number of arguments, arguments: the settings of the BSP driver */
+static const uint8_t ScreenInit[] =
+{
+    LCD_REG_177, 3, 0x01, 0x2C, 0x2D,
+    LCD_REG_178, 3, 0x01, 0x2C, 0x2D,
+    LCD_REG_179, 6, 0x01, 0x2C, 0x2D, 0x01, 0x2C, 0x2D,
+    LCD_REG_180, 1, 0x07,
+    LCD_REG_192, 3, 0xA2, 0x02, 0x84,
+    LCD_REG_193, 1, 0xC5,
+    LCD_REG_194, 2, 0x0A, 0x00,
+    LCD_REG_195, 2, 0x8A, 0x2A,
+    LCD_REG_196, 2, 0x8A, 0xEE,
+    LCD_REG_197, 1, 0x0E,
+    LCD_REG_32,  0,
+    LCD_REG_58,  1, 0x05,                      /* 16 bits per pixel */
+    LCD_REG_54,  1, 0xC0,
+    LCD_REG_224, 16, 0x02, 0x1C, 0x07, 0x12, 0x37, 0x32, 0x29, 0x2D,
+                     0x29, 0x25, 0x2B, 0x39, 0x00, 0x01, 0x03, 0x10,
+    LCD_REG_225, 16, 0x03, 0x1D, 0x07, 0x06, 0x2E, 0x2C, 0x29, 0x2D,
+                     0x2E, 0x2E, 0x37, 0x3F, 0x00, 0x00, 0x02, 0x10,
+    LCD_REG_19,  0,
+    LCD_REG_41,  0,
+};
+
+/* Characters ' ' to 'Z', one byte per column, bit 0 at the top */
+static const uint8_t ScreenFont[][5] =
+{
+    { 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x5F, 0x00, 0x00 }, /*   ! */
+    { 0x00, 0x07, 0x00, 0x07, 0x00 }, { 0x14, 0x7F, 0x14, 0x7F, 0x14 }, /* " # */
+    { 0x24, 0x2A, 0x7F, 0x2A, 0x12 }, { 0x23, 0x13, 0x08, 0x64, 0x62 }, /* $ % */
+    { 0x36, 0x49, 0x56, 0x20, 0x50 }, { 0x00, 0x05, 0x03, 0x00, 0x00 }, /* & ' */
+    { 0x00, 0x1C, 0x22, 0x41, 0x00 }, { 0x00, 0x41, 0x22, 0x1C, 0x00 }, /* ( ) */
+    { 0x2A, 0x1C, 0x7F, 0x1C, 0x2A }, { 0x08, 0x08, 0x3E, 0x08, 0x08 }, /* * + */
+    { 0x00, 0x50, 0x30, 0x00, 0x00 }, { 0x08, 0x08, 0x08, 0x08, 0x08 }, /* , - */
+    { 0x00, 0x60, 0x60, 0x00, 0x00 }, { 0x20, 0x10, 0x08, 0x04, 0x02 }, /* . / */
+    { 0x3E, 0x51, 0x49, 0x45, 0x3E }, { 0x00, 0x42, 0x7F, 0x40, 0x00 }, /* 0 1 */
+    { 0x42, 0x61, 0x51, 0x49, 0x46 }, { 0x21, 0x41, 0x45, 0x4B, 0x31 }, /* 2 3 */
+    { 0x18, 0x14, 0x12, 0x7F, 0x10 }, { 0x27, 0x45, 0x45, 0x45, 0x39 }, /* 4 5 */
+    { 0x3C, 0x4A, 0x49, 0x49, 0x30 }, { 0x01, 0x71, 0x09, 0x05, 0x03 }, /* 6 7 */
+    { 0x36, 0x49, 0x49, 0x49, 0x36 }, { 0x06, 0x49, 0x49, 0x29, 0x1E }, /* 8 9 */
+    { 0x00, 0x36, 0x36, 0x00, 0x00 }, { 0x00, 0x56, 0x36, 0x00, 0x00 }, /* : ; */
+    { 0x08, 0x14, 0x22, 0x41, 0x00 }, { 0x14, 0x14, 0x14, 0x14, 0x14 }, /* < = */
+    { 0x00, 0x41, 0x22, 0x14, 0x08 }, { 0x02, 0x01, 0x51, 0x09, 0x06 }, /* > ? */
+    { 0x32, 0x49, 0x79, 0x41, 0x3E }, { 0x7E, 0x11, 0x11, 0x11, 0x7E }, /* @ A */
+    { 0x7F, 0x49, 0x49, 0x49, 0x36 }, { 0x3E, 0x41, 0x41, 0x41, 0x22 }, /* B C */
+    { 0x7F, 0x41, 0x41, 0x22, 0x1C }, { 0x7F, 0x49, 0x49, 0x49, 0x41 }, /* D E */
+    { 0x7F, 0x09, 0x09, 0x09, 0x01 }, { 0x3E, 0x41, 0x49, 0x49, 0x7A }, /* F G */
+    { 0x7F, 0x08, 0x08, 0x08, 0x7F }, { 0x00, 0x41, 0x7F, 0x41, 0x00 }, /* H I */
+    { 0x20, 0x40, 0x41, 0x3F, 0x01 }, { 0x7F, 0x08, 0x14, 0x22, 0x41 }, /* J K */
+    { 0x7F, 0x40, 0x40, 0x40, 0x40 }, { 0x7F, 0x02, 0x0C, 0x02, 0x7F }, /* L M */
+    { 0x7F, 0x04, 0x08, 0x10, 0x7F }, { 0x3E, 0x41, 0x41, 0x41, 0x3E }, /* N O */
+    { 0x7F, 0x09, 0x09, 0x09, 0x06 }, { 0x3E, 0x41, 0x51, 0x21, 0x5E }, /* P Q */
+    { 0x7F, 0x09, 0x19, 0x29, 0x46 }, { 0x46, 0x49, 0x49, 0x49, 0x31 }, /* R S */
+    { 0x01, 0x01, 0x7F, 0x01, 0x01 }, { 0x3F, 0x40, 0x40, 0x40, 0x3F }, /* T U */
+    { 0x1F, 0x20, 0x40, 0x20, 0x1F }, { 0x3F, 0x40, 0x38, 0x40, 0x3F }, /* V W */
+    { 0x63, 0x14, 0x08, 0x14, 0x63 }, { 0x07, 0x08, 0x70, 0x08, 0x07 }, /* X Y */
+    { 0x61, 0x51, 0x49, 0x45, 0x43 },                                   /* Z */
+};
+
+static VCP_ScreenTypeDef Screen;
+static VCP_WidgetStateTypeDef ScreenState[SCREEN_WIDGETS];
+static char ScreenText[SCREEN_WIDGETS][SCREEN_COLUMNS]; /* Used by the text widgets */
+
+/* Private function prototypes -----------------------------------------------*/
+static void Screen_Open(void);
+static void Screen_Close(void);
+static void Screen_Command(uint8_t cmd, const uint8_t *args, uint8_t length);
+static void Screen_Window(uint8_t x, uint8_t y, uint8_t width, uint8_t height);
+static void Screen_Wait(void);
+static void Screen_End(void);
+static void Screen_Fill(uint16_t color, uint32_t count);
+static void Screen_Sample(void);
+static void Screen_SetText(uint8_t widget, const char *text, uint16_t color);
+static void Screen_SetBar(uint8_t widget, uint32_t value, uint32_t max);
+static void Screen_Mark(uint8_t widget, uint8_t from, uint8_t to);
+static uint32_t Screen_Draw(uint32_t budget);
+static char *Screen_Number(char *p, uint32_t value);
+static char *Screen_Append(char *p, const char *text);
+static uint32_t Screen_Rate(uint32_t *last, uint32_t value, uint32_t elapsed);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Turn the screen on or off. The main loop brings the panel up or
+  *         gives the pins back, the pins are taken as soon as it is asked.
+  * @param  on: 1 to show the status
+  * @retval None
+  */
+void VCP_Screen_Config(uint8_t on)
+{
+    Screen.On = on ? 1 : 0;
+}
+
+/**
+  * @brief  Tell whether a pin is taken by the screen.
+  * @param  GPIOx: GPIO port
+  * @param  pin: GPIO_PIN_x
+  * @retval 1 when the screen is on, or still going off, and uses the pin
+  */
+uint8_t VCP_Screen_PinInUse(GPIO_TypeDef *GPIOx, uint32_t pin)
+{
+    return ((Screen.On || (Screen.State != SCREEN_OFF)) && (GPIOx == SCREEN_GPIO_PORT) &&
+            ((pin & SCREEN_PINS) != 0)) ? 1 : 0;
+}
+
+/**
+  * @brief  Bring the panel up, refresh the widgets every VCP_SCREEN_PERIOD
+  *         and send what changed, VCP_SCREEN_BUDGET pixels at most.
+  *         Called by the main loop on each polling tick.
+  * @param  None
+  * @retval None
+  */
+void VCP_Screen_Process(void)
+{
+    uint32_t start = SysTick->VAL;
+    uint32_t end;
+    uint32_t now = HAL_GetTick();
+    uint8_t pos;
+
+    if (Screen.On && (Screen.State == SCREEN_OFF))
+    {
+        Screen_Open();
+    }
+    else if (!Screen.On && (Screen.State != SCREEN_OFF))
+    {
+        Screen_Close();
+        return;
+    }
+
+    switch (Screen.State)
+    {
+    case SCREEN_RESET:
+        if ((int32_t)(now - Screen.Deadline) >= 0)
+        {
+            Screen_Command(LCD_REG_17, NULL, 0);
+            Screen_End();
+            Screen.Deadline = now + SCREEN_WAKE_DELAY;
+            Screen.State = SCREEN_WAKE;
+        }
+        break;
+
+    case SCREEN_WAKE:
+        if ((int32_t)(now - Screen.Deadline) >= 0)
+        {
+            for (pos = 0; pos < sizeof (ScreenInit); pos += 2 + ScreenInit[pos + 1])
+            {
+                Screen_Command(ScreenInit[pos], &ScreenInit[pos + 2], ScreenInit[pos + 1]);
+            }
+            Screen_End();
+            Screen.Row = 0;
+            Screen.State = SCREEN_CLEAR;
+        }
+        break;
+
+    case SCREEN_CLEAR:
+        Screen_Window(0, Screen.Row, ST7735_LCD_PIXEL_WIDTH, VCP_SCREEN_BUDGET / ST7735_LCD_PIXEL_WIDTH);
+        Screen_Fill(SCREEN_BLACK, VCP_SCREEN_BUDGET);
+        Screen_End();
+        Screen.Row += VCP_SCREEN_BUDGET / ST7735_LCD_PIXEL_WIDTH;
+        if (Screen.Row >= ST7735_LCD_PIXEL_HEIGHT)
+        {
+            /* The panel is black: every widget is drawn in full by the first
+               sample, the rates start from here */
+            memset(ScreenState, 0, sizeof (ScreenState));
+            memset(ScreenText, ' ', sizeof (ScreenText));
+            Screen_Sample();
+            Screen.Deadline = now + VCP_SCREEN_PERIOD;
+            Screen.State = SCREEN_RUN;
+        }
+        break;
+
+    case SCREEN_RUN:
+        if ((int32_t)(now - Screen.Deadline) >= 0)
+        {
+            Screen.Deadline = now + VCP_SCREEN_PERIOD;
+            Screen_Sample();
+            Screen.Refreshes++;
+        }
+        Screen.Pixels += Screen_Draw(VCP_SCREEN_BUDGET);
+        break;
+
+    default:
+        break;
+    }
+
+    /* A pass is short of the 1 ms SysTick period */
+    end = SysTick->VAL;
+    if (end > start)
+    {
+        start += SysTick->LOAD + 1;
+    }
+    Screen.BusyUs += (start - end) / (SystemCoreClock / 1000000);
+}
+
+/**
+  * @brief  Report the state of the screen (VCP_REQ_GET_SCREEN).
+  * @param  pbuf: response buffer, 16 bytes
+  * @retval None
+  */
+void VCP_Screen_GetStats(uint8_t *pbuf)
+{
+    uint32_t words[3];
+    uint8_t i;
+
+    pbuf[0] = Screen.On;
+    pbuf[1] = Screen.State;
+    pbuf[2] = 0;
+    pbuf[3] = 0;
+
+    words[0] = Screen.Refreshes;
+    words[1] = Screen.Pixels;
+    words[2] = Screen.BusyUs;
+    for (i = 0; i < 12; i++)
+    {
+        pbuf[4 + i] = (uint8_t)(words[i / 4] >> (8 * (i % 4)));
+    }
+}
+
+/**
+  * @brief  Take the pins, set SPI1 up to transmit only at 12 MHz and reset
+  *         the panel.
+  * @param  None
+  * @retval None
+  */
+static void Screen_Open(void)
+{
+    GPIO_InitTypeDef GPIO_InitStruct;
+
+    __HAL_RCC_GPIOA_CLK_ENABLE();
+    __HAL_RCC_SPI1_CLK_ENABLE();
+
+    SCREEN_GPIO_PORT->BSRR = SCREEN_CS_PIN | SCREEN_DC_PIN;
+    GPIO_InitStruct.Pin       = SCREEN_CS_PIN | SCREEN_DC_PIN;
+    GPIO_InitStruct.Mode      = GPIO_MODE_OUTPUT_PP;
+    GPIO_InitStruct.Pull      = GPIO_NOPULL;
+    GPIO_InitStruct.Speed     = GPIO_SPEED_FREQ_HIGH;
+    GPIO_InitStruct.Alternate = 0;
+    HAL_GPIO_Init(SCREEN_GPIO_PORT, &GPIO_InitStruct);
+
+    GPIO_InitStruct.Pin       = SCREEN_SCK_PIN | SCREEN_SDA_PIN;
+    GPIO_InitStruct.Mode      = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Alternate = SCREEN_AF;
+    HAL_GPIO_Init(SCREEN_GPIO_PORT, &GPIO_InitStruct);
+
+    /* Single line transmit, 8 bits, PCLK / 4; the pixel loops write two
+       bytes at a time, the FIFO sends the low one first */
+    SCREEN_SPI->CR1 = SPI_CR1_BIDIMODE | SPI_CR1_BIDIOE | SPI_CR1_SSM | SPI_CR1_SSI |
+                      SPI_CR1_MSTR | SPI_CR1_BR_0;
+    SCREEN_SPI->CR2 = SPI_CR2_DS_2 | SPI_CR2_DS_1 | SPI_CR2_DS_0;
+    SCREEN_SPI->CR1 |= SPI_CR1_SPE;
+
+    Screen_Command(LCD_REG_1, NULL, 0);
+    Screen_End();
+    Screen.Deadline = HAL_GetTick() + SCREEN_RESET_DELAY;
+    Screen.State = SCREEN_RESET;
+}
+
+/**
+  * @brief  Give SPI1 and the pins back.
+  * @param  None
+  * @retval None
+  */
+static void Screen_Close(void)
+{
+    __HAL_RCC_SPI1_FORCE_RESET();
+    __HAL_RCC_SPI1_RELEASE_RESET();
+    HAL_GPIO_DeInit(SCREEN_GPIO_PORT, SCREEN_PINS);
+    Screen.State = SCREEN_OFF;
+}
+
+/**
+  * @brief  Send a command and its arguments. The chip select stays low and
+  *         the data selected for the pixels that may follow.
+  * @param  cmd: LCD_REG_xxx
+  * @param  args: arguments
+  * @param  length: number of arguments
+  * @retval None
+  */
+static void Screen_Command(uint8_t cmd, const uint8_t *args, uint8_t length)
+{
+    Screen_End();
+    SCREEN_DC(0);
+    SCREEN_CS(0);
+    LL_SPI_TransmitData8(SCREEN_SPI, cmd);
+    Screen_Wait();
+    SCREEN_DC(1);
+    while (length--)
+    {
+        while (!LL_SPI_IsActiveFlag_TXE(SCREEN_SPI))
+        {
+        }
+        LL_SPI_TransmitData8(SCREEN_SPI, *args++);
+    }
+}
+
+/**
+  * @brief  Open a window and start the memory write that fills it.
+  * @param  x: first column
+  * @param  y: first row
+  * @param  width: columns
+  * @param  height: rows
+  * @retval None
+  */
+static void Screen_Window(uint8_t x, uint8_t y, uint8_t width, uint8_t height)
+{
+    uint8_t args[4];
+
+    args[0] = 0;
+    args[1] = x;
+    args[2] = 0;
+    args[3] = (uint8_t)(x + width - 1);
+    Screen_Command(LCD_REG_42, args, 4);
+    args[1] = y;
+    args[3] = (uint8_t)(y + height - 1);
+    Screen_Command(LCD_REG_43, args, 4);
+    Screen_Command(LCD_REG_44, NULL, 0);
+}
+
+/**
+  * @brief  Wait for the last byte to leave.
+  * @param  None
+  * @retval None
+  */
+static void Screen_Wait(void)
+{
+    while ((LL_SPI_GetTxFIFOLevel(SCREEN_SPI) != LL_SPI_TX_FIFO_EMPTY) || LL_SPI_IsActiveFlag_BSY(SCREEN_SPI))
+    {
+    }
+}
+
+/**
+  * @brief  Wait for the last byte to leave and release the chip select.
+  * @param  None
+  * @retval None
+  */
+static void Screen_End(void)
+{
+    Screen_Wait();
+    SCREEN_CS(1);
+}
+
+/**
+  * @brief  Send pixels of a single color.
+  * @param  color: RGB565
+  * @param  count: pixels
+  * @retval None
+  */
+static void Screen_Fill(uint16_t color, uint32_t count)
+{
+    uint16_t data = (uint16_t)((color >> 8) | (color << 8));
+
+    while (count--)
+    {
+        while (!LL_SPI_IsActiveFlag_TXE(SCREEN_SPI))
+        {
+        }
+        LL_SPI_TransmitData16(SCREEN_SPI, data);
+    }
+}
+
+/**
+  * @brief  Read the counters of both ports and update the widgets.
+  * @param  None
+  * @retval None
+  */
+static void Screen_Sample(void)
+{
+    static const char parity[] = "NOEMS";
+    static const char *const stop[] = { "1", "1.5", "2" };
+    VCP_PortStatusTypeDef status;
+    uint32_t now = HAL_GetTick();
+    uint32_t elapsed = (now != Screen.LastTick) ? (now - Screen.LastTick) : 1;
+    uint32_t rate;
+    uint32_t max;
+    uint32_t errors;
+    uint8_t base;
+    uint8_t port;
+    char text[32];               /* Longer than a widget, cut by Screen_SetText */
+    char *p;
+
+    Screen.LastTick = now;
+    for (port = 0; port < 2; port++)
+    {
+        VCP_Port_Status(port, &status);
+        base = port * SCREEN_PORT_WIDGETS;
+        /* A character is 10 bits on the line with 8N1 */
+        max = (status.Bitrate / 10) ? (status.Bitrate / 10) : 1;
+
+        p = Screen_Append(text, (port == 0) ? "X " : "Y ");
+        p = Screen_Number(p, status.Bitrate);
+        *p++ = ' ';
+        *p++ = (char)('0' + (status.DataBits % 10));
+        *p++ = parity[status.Parity % 5];
+        p = Screen_Append(p, stop[status.StopBits % 3]);
+        *p = '\0';
+        Screen_SetText(base + SCREEN_W_TITLE, text, SCREEN_CYAN);
+
+        rate = Screen_Rate(&Screen.Received[port], status.Received, elapsed);
+        p = Screen_Append(text, "RX ");
+        p = Screen_Number(p, rate);
+        Screen_Append(p, " B/S");
+        Screen_SetText(base + SCREEN_W_RX, text, SCREEN_WHITE);
+        Screen_SetBar(base + SCREEN_W_RX_BAR, rate, max);
+
+        rate = Screen_Rate(&Screen.Sent[port], status.Sent, elapsed);
+        p = Screen_Append(text, "TX ");
+        p = Screen_Number(p, rate);
+        Screen_Append(p, " B/S");
+        Screen_SetText(base + SCREEN_W_TX, text, SCREEN_WHITE);
+        Screen_SetBar(base + SCREEN_W_TX_BAR, rate, max);
+
+        /* Red while new errors or losses keep coming */
+        errors = status.LineErrors + status.Lost;
+        p = Screen_Append(text, "ERR ");
+        p = Screen_Number(p, status.LineErrors);
+        p = Screen_Append(p, " LOST ");
+        Screen_Number(p, status.Lost);
+        Screen_SetText(base + SCREEN_W_ERRORS, text, (errors != Screen.Errors[port]) ? SCREEN_RED : SCREEN_GREY);
+        Screen.Errors[port] = errors;
+    }
+}
+
+/**
+  * @brief  Change the text of a widget, padded with spaces: the characters
+  *         that differ are to be sent, all of them for a new color.
+  * @param  widget: widget index
+  * @param  text: zero terminated
+  * @param  color: RGB565
+  * @retval None
+  */
+static void Screen_SetText(uint8_t widget, const char *text, uint16_t color)
+{
+    VCP_WidgetStateTypeDef *state = &ScreenState[widget];
+    char *shown = ScreenText[widget];
+    uint8_t size = ScreenWidgets[widget % SCREEN_PORT_WIDGETS].Size;
+    uint8_t i;
+    char c;
+
+    if (state->Color != color)
+    {
+        state->Color = color;
+        Screen_Mark(widget, 0, size);
+    }
+    for (i = 0; i < size; i++)
+    {
+        c = *text ? *text++ : ' ';
+        if (shown[i] != c)
+        {
+            shown[i] = c;
+            Screen_Mark(widget, i, i + 1);
+        }
+    }
+}
+
+/**
+  * @brief  Change the level of a bar: the columns between the old and new
+  *         levels are to be sent, all of them for a new color. Green up to
+  *         75 % of the line rate, yellow up to 95 %, red above.
+  * @param  widget: widget index
+  * @param  value: rate
+  * @param  max: rate filling the bar
+  * @retval None
+  */
+static void Screen_SetBar(uint8_t widget, uint32_t value, uint32_t max)
+{
+    VCP_WidgetStateTypeDef *state = &ScreenState[widget];
+    uint8_t size = ScreenWidgets[widget % SCREEN_PORT_WIDGETS].Size;
+    uint8_t level = (value >= max) ? size : (uint8_t)((value * size) / max);
+    uint16_t color = SCREEN_GREEN;
+
+    if ((value * 100) >= (max * 95))
+    {
+        color = SCREEN_RED;
+    }
+    else if ((value * 100) >= (max * 75))
+    {
+        color = SCREEN_YELLOW;
+    }
+
+    if (state->Color != color)
+    {
+        state->Color = color;
+        Screen_Mark(widget, 0, size);
+    }
+    if (level != state->Level)
+    {
+        Screen_Mark(widget, (level < state->Level) ? level : state->Level,
+                    (level > state->Level) ? level : state->Level);
+        state->Level = level;
+    }
+}
+
+/**
+  * @brief  Add cells to the part of a widget to send again.
+  * @param  widget: widget index
+  * @param  from: first cell
+  * @param  to: cell after the last
+  * @retval None
+  */
+static void Screen_Mark(uint8_t widget, uint8_t from, uint8_t to)
+{
+    VCP_WidgetStateTypeDef *state = &ScreenState[widget];
+
+    if (state->DirtyFrom >= state->DirtyTo)
+    {
+        state->DirtyFrom = from;
+        state->DirtyTo = to;
+        return;
+    }
+    if (from < state->DirtyFrom)
+    {
+        state->DirtyFrom = from;
+    }
+    if (to > state->DirtyTo)
+    {
+        state->DirtyTo = to;
+    }
+}
+
+/**
+  * @brief  Send the parts of the widgets to send again, in one window per
+  *         span, until the budget is spent.
+  * @param  budget: pixels
+  * @retval Pixels sent
+  */
+static uint32_t Screen_Draw(uint32_t budget)
+{
+    const VCP_WidgetTypeDef *w;
+    VCP_WidgetStateTypeDef *state;
+    const uint8_t *glyph;
+    uint16_t fore;
+    uint16_t back;
+    uint32_t sent = 0;
+    uint8_t widget;
+    uint8_t y;
+    uint8_t count;
+    uint8_t row;
+    uint8_t i;
+    uint8_t col;
+    uint8_t c;
+
+    for (widget = 0; widget < SCREEN_WIDGETS; widget++)
+    {
+        state = &ScreenState[widget];
+        w = &ScreenWidgets[widget % SCREEN_PORT_WIDGETS];
+        y = (uint8_t)(w->Y + ((widget / SCREEN_PORT_WIDGETS) * (ST7735_LCD_PIXEL_HEIGHT / 2)));
+        if (state->DirtyFrom >= state->DirtyTo)
+        {
+            continue;
+        }
+
+        fore = (uint16_t)((state->Color >> 8) | (state->Color << 8));
+        if (w->Type == SCREEN_TEXT)
+        {
+            count = state->DirtyTo - state->DirtyFrom;
+            if ((count * SCREEN_CELL_WIDTH * SCREEN_CELL_HEIGHT) > (budget - sent))
+            {
+                count = (uint8_t)((budget - sent) / (SCREEN_CELL_WIDTH * SCREEN_CELL_HEIGHT));
+            }
+            if (count == 0)
+            {
+                break;
+            }
+            Screen_Window(w->X + (state->DirtyFrom * SCREEN_CELL_WIDTH), y,
+                          count * SCREEN_CELL_WIDTH, SCREEN_CELL_HEIGHT);
+            for (row = 0; row < SCREEN_CELL_HEIGHT; row++)
+            {
+                for (i = state->DirtyFrom; i < (state->DirtyFrom + count); i++)
+                {
+                    c = (uint8_t)ScreenText[widget][i];
+                    c = ((c >= 'a') && (c <= 'z')) ? (c - 'a' + 'A') : c;
+                    glyph = ScreenFont[((c >= ' ') && (c <= 'Z')) ? (c - ' ') : ('?' - ' ')];
+                    for (col = 0; col < SCREEN_CELL_WIDTH; col++)
+                    {
+                        while (!LL_SPI_IsActiveFlag_TXE(SCREEN_SPI))
+                        {
+                        }
+                        LL_SPI_TransmitData16(SCREEN_SPI,
+                            ((col < 5) && (glyph[col] & (1 << row))) ? fore : SCREEN_BLACK);
+                    }
+                }
+            }
+            sent += count * SCREEN_CELL_WIDTH * SCREEN_CELL_HEIGHT;
+        }
+        else
+        {
+            count = state->DirtyTo - state->DirtyFrom;
+            if ((count * SCREEN_BAR_HEIGHT) > (budget - sent))
+            {
+                count = (uint8_t)((budget - sent) / SCREEN_BAR_HEIGHT);
+            }
+            if (count == 0)
+            {
+                break;
+            }
+            back = (uint16_t)((SCREEN_DARK >> 8) | (SCREEN_DARK << 8));
+            Screen_Window(w->X + state->DirtyFrom, y, count, SCREEN_BAR_HEIGHT);
+            for (row = 0; row < SCREEN_BAR_HEIGHT; row++)
+            {
+                for (i = state->DirtyFrom; i < (state->DirtyFrom + count); i++)
+                {
+                    while (!LL_SPI_IsActiveFlag_TXE(SCREEN_SPI))
+                    {
+                    }
+                    LL_SPI_TransmitData16(SCREEN_SPI, (i < state->Level) ? fore : back);
+                }
+            }
+            sent += count * SCREEN_BAR_HEIGHT;
+        }
+        Screen_End();
+        state->DirtyFrom += count;
+    }
+
+    return sent;
+}
+
+/**
+  * @brief  Write a number in decimal.
+  * @param  p: where to write
+  * @param  value: number
+  * @retval Position after the number
+  */
+static char *Screen_Number(char *p, uint32_t value)
+{
+    char digits[11];
+    uint32_t i = sizeof (digits) - 1;
+
+    digits[i] = '\0';
+    do
+    {
+        digits[--i] = (char)('0' + (value % 10));
+        value /= 10;
+    }
+    while (value != 0);
+
+    return Screen_Append(p, &digits[i]);
+}
+
+/**
+  * @brief  Write text, zero terminated.
+  * @param  p: where to write
+  * @param  text: zero terminated
+  * @retval Position of the terminating zero
+  */
+static char *Screen_Append(char *p, const char *text)
+{
+    while (*text != '\0')
+    {
+        *p++ = *text++;
+    }
+    *p = '\0';
+    return p;
+}
+
+/**
+  * @brief  Turn a counter into bytes per second since its last sample.
+  * @param  last: value at the last sample, updated
+  * @param  value: value now
+  * @param  elapsed: ms since the last sample
+  * @retval Bytes per second
+  */
+static uint32_t Screen_Rate(uint32_t *last, uint32_t value, uint32_t elapsed)
+{
+    /* The counter starts again from zero when the port is opened again */
+    uint32_t delta = (value >= *last) ? (value - *last) : value;
+
+    *last = value;
+    /* No 64 bits division on the Cortex-M0 */
+    return (delta < (0xFFFFFFFF / 1000)) ? ((delta * 1000) / elapsed) : ((delta / elapsed) * 1000);
+}
@@ -0,0 +1,327 @@
+/**
+  ******************************************************************************
+  * @file    USB_Device/CDC_Standalone/Src/vcp_sensor.c
+  * @brief   Sensor scheduler: the STLM75 temperature and the L3GD20 rates
+  *          are read at their own period, each read a register access run
+  *          from the I2C interrupt, so the main loop never waits for the
+  *          bus: a pass starts at most one access and takes its result on a
+  *          later pass. The latest readings are kept for the host, and the
+  *          temperature sets the highest bitrate a line coding may ask.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+#include "stlm75.h"
+#include "l3gd20.h"
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+    __IO uint8_t Asked;          /* Period asked for by the host, the main loop follows */
+    uint8_t  Period;             /* In VCP_SENSOR_UNIT, 0 = off */
+    uint8_t  State;              /* VCP_SENSOR_xxx */
+    uint8_t  Step;               /* SENSOR_xxx, next access */
+    uint16_t Errors;
+    uint32_t Deadline;           /* Of the next access */
+    uint32_t Stamp;              /* Tick of the last reading */
+} VCP_SensorTypeDef;
+
+typedef struct
+{
+    int8_t   Temp;               /* Degrees C */
+    uint32_t Bitrate;
+} VCP_DerateTypeDef;
+
+/* Private define ------------------------------------------------------------*/
+#define SENSOR_COUNT                     2
+#define SENSOR_NONE                      0xFF
+
+/* Accesses, in order for the gyroscope: its identity, then its set up, then
+   the rates for good */
+#define SENSOR_ID                        0
+#define SENSOR_SETUP                     1
+#define SENSOR_READ                      2
+
+/* Register number of the L3GD20 with the increment bit, for a burst */
+#define GYRO_BURST(reg)                  ((uint8_t)((reg) | 0x80))
+#define I_AM_L3GD20H                     ((uint8_t)0xD7)
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+static VCP_SensorTypeDef Sensor[SENSOR_COUNT];
+static uint8_t SensorBusy = SENSOR_NONE; /* Sensor whose access runs */
+static uint8_t SensorBuf[6];             /* Bytes of the access */
+static int16_t Temperature;              /* Degrees C x 256 */
+static int16_t Rates[3];
+static uint8_t Derate;                   /* Entries of SensorDerate in force */
+static __IO uint32_t MaxBitrate = VCP_SENSOR_NO_LIMIT;
+
+/* CTRL_REG1 to CTRL_REG4: 95 Hz, the three axes on, 250 dps, the two bytes
+   of an axis from the same sample */
+static const uint8_t GyroSetup[4] =
+{
+    L3GD20_MODE_ACTIVE | L3GD20_OUTPUT_DATARATE_1 | L3GD20_BANDWIDTH_1 | L3GD20_AXES_ENABLE,
+    0x00,
+    0x00,
+    L3GD20_BlockDataUpdate_Single | L3GD20_BLE_LSB | L3GD20_FULLSCALE_250
+};
+
+static const VCP_DerateTypeDef SensorDerate[] =
+{
+    { VCP_SENSOR_HOT,      VCP_SENSOR_HOT_BITRATE },
+    { VCP_SENSOR_CRITICAL, VCP_SENSOR_CRITICAL_BITRATE },
+};
+
+/* Private function prototypes -----------------------------------------------*/
+static int8_t Sensor_Start(uint8_t i);
+static void Sensor_Done(uint8_t i, uint8_t ok, uint32_t now);
+static void Sensor_Derate(void);
+static uint16_t Sensor_Age(uint8_t i, uint32_t now);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Set the periods of the sensors; the main loop takes them on its
+  *         next pass.
+  * @param  temp: temperature period in VCP_SENSOR_UNIT, 0 = off
+  * @param  gyro: gyroscope period in VCP_SENSOR_UNIT, 0 = off
+  * @retval None
+  */
+void VCP_Sensor_Config(uint8_t temp, uint8_t gyro)
+{
+    Sensor[VCP_SENSOR_TEMP].Asked = temp;
+    Sensor[VCP_SENSOR_GYRO].Asked = gyro;
+}
+
+/**
+  * @brief  Take the result of the access that ended, and start the next
+  *         one due. Called by the main loop on each polling tick.
+  * @param  None
+  * @retval None
+  */
+void VCP_Sensor_Process(void)
+{
+    VCP_SensorTypeDef *s;
+    uint32_t now = HAL_GetTick();
+    uint8_t state;
+    uint8_t i;
+
+    if (SensorBusy != SENSOR_NONE)
+    {
+        state = VCP_I2C_RegState();
+        if (state == VCP_I2C_BUSY)
+        {
+            return;
+        }
+        Sensor_Done(SensorBusy, (state == VCP_I2C_DONE) ? 1 : 0, now);
+        SensorBusy = SENSOR_NONE;
+    }
+
+    for (i = 0; i < SENSOR_COUNT; i++)
+    {
+        s = &Sensor[i];
+        if (s->Period != s->Asked)
+        {
+            s->Period = s->Asked;
+            s->State = s->Period ? VCP_SENSOR_PROBE : VCP_SENSOR_OFF;
+            s->Step = (i == VCP_SENSOR_GYRO) ? SENSOR_ID : SENSOR_READ;
+            s->Deadline = now;
+            if ((i == VCP_SENSOR_TEMP) && !s->Period)
+            {
+                Derate = 0;
+                MaxBitrate = VCP_SENSOR_NO_LIMIT;
+            }
+        }
+    }
+
+    /* One access per pass. The bus may be off, or busy with a batch of the
+       host: the access is then tried again on the next pass */
+    for (i = 0; i < SENSOR_COUNT; i++)
+    {
+        s = &Sensor[i];
+        if (s->Period && ((int32_t)(now - s->Deadline) >= 0))
+        {
+            if (Sensor_Start(i) == USBD_OK)
+            {
+                SensorBusy = i;
+                s->Deadline += s->Period * VCP_SENSOR_UNIT;
+                if ((int32_t)(now - s->Deadline) >= 0)
+                {
+                    /* Too far behind, the bus was off: start the cadence over */
+                    s->Deadline = now + (s->Period * VCP_SENSOR_UNIT);
+                }
+            }
+            break;
+        }
+    }
+}
+
+/**
+  * @brief  Give the highest bitrate the temperature allows.
+  * @param  None
+  * @retval Bitrate, or VCP_SENSOR_NO_LIMIT
+  */
+uint32_t VCP_Sensor_MaxBitrate(void)
+{
+    return MaxBitrate;
+}
+
+/**
+  * @brief  Report the latest readings (VCP_REQ_GET_SENSOR).
+  * @param  pbuf: response buffer, VCP_SENSOR_REPORT_SIZE bytes
+  * @retval None
+  */
+void VCP_Sensor_GetReadings(uint8_t *pbuf)
+{
+    uint32_t now = HAL_GetTick();
+    uint16_t words[6];
+    uint32_t limit = MaxBitrate;
+    uint8_t i;
+
+    pbuf[0] = Sensor[VCP_SENSOR_TEMP].State;
+    pbuf[1] = Sensor[VCP_SENSOR_GYRO].State;
+
+    words[0] = (uint16_t)Temperature;
+    words[1] = (uint16_t)Rates[0];
+    words[2] = (uint16_t)Rates[1];
+    words[3] = (uint16_t)Rates[2];
+    words[4] = Sensor_Age(VCP_SENSOR_TEMP, now);
+    words[5] = Sensor_Age(VCP_SENSOR_GYRO, now);
+    for (i = 0; i < 12; i++)
+    {
+        pbuf[2 + i] = (uint8_t)(words[i / 2] >> (8 * (i % 2)));
+    }
+    pbuf[14] = Derate ? VCP_SENSOR_DERATED : 0;
+    pbuf[15] = 0;
+
+    for (i = 0; i < 4; i++)
+    {
+        pbuf[16 + i] = (uint8_t)(limit >> (8 * i));
+    }
+    pbuf[20] = (uint8_t)(Sensor[VCP_SENSOR_TEMP].Errors);
+    pbuf[21] = (uint8_t)(Sensor[VCP_SENSOR_TEMP].Errors >> 8);
+    pbuf[22] = (uint8_t)(Sensor[VCP_SENSOR_GYRO].Errors);
+    pbuf[23] = (uint8_t)(Sensor[VCP_SENSOR_GYRO].Errors >> 8);
+}
+
+/**
+  * @brief  Start the next access of a sensor.
+  * @param  i: VCP_SENSOR_xxx
+  * @retval USBD_OK, or USBD_FAIL when the bus cannot take it now
+  */
+static int8_t Sensor_Start(uint8_t i)
+{
+    if (i == VCP_SENSOR_TEMP)
+    {
+        return VCP_I2C_RegRead(VCP_SENSOR_TEMP_ADDR, LM75_REG_TEMP, SensorBuf, 2);
+    }
+
+    switch (Sensor[i].Step)
+    {
+    case SENSOR_ID:
+        return VCP_I2C_RegRead(VCP_SENSOR_GYRO_ADDR, L3GD20_WHO_AM_I_ADDR, SensorBuf, 1);
+
+    case SENSOR_SETUP:
+        return VCP_I2C_RegWrite(VCP_SENSOR_GYRO_ADDR, GYRO_BURST(L3GD20_CTRL_REG1_ADDR),
+                                GyroSetup, sizeof (GyroSetup));
+
+    default:
+        return VCP_I2C_RegRead(VCP_SENSOR_GYRO_ADDR, GYRO_BURST(L3GD20_OUT_X_L_ADDR), SensorBuf, 6);
+    }
+}
+
+/**
+  * @brief  Take the result of an access.
+  * @param  i: VCP_SENSOR_xxx
+  * @param  ok: 1 when the access went through
+  * @param  now: current tick
+  * @retval None
+  */
+static void Sensor_Done(uint8_t i, uint8_t ok, uint32_t now)
+{
+    VCP_SensorTypeDef *s = &Sensor[i];
+
+    /* The gyroscope may have been unplugged: it is set up again */
+    if (!ok || ((s->Step == SENSOR_ID) && (SensorBuf[0] != I_AM_L3GD20) &&
+                (SensorBuf[0] != I_AM_L3GD20_TR) && (SensorBuf[0] != I_AM_L3GD20H)))
+    {
+        s->Errors++;
+        s->State = VCP_SENSOR_FAIL;
+        s->Step = (i == VCP_SENSOR_GYRO) ? SENSOR_ID : SENSOR_READ;
+        return;
+    }
+
+    switch (s->Step)
+    {
+    case SENSOR_ID:
+        /* The set up, then the first read, follow on the next passes */
+        s->Step = SENSOR_SETUP;
+        s->Deadline = now;
+        return;
+
+    case SENSOR_SETUP:
+        s->Step = SENSOR_READ;
+        s->Deadline = now;
+        return;
+
+    default:
+        break;
+    }
+
+    if (i == VCP_SENSOR_TEMP)
+    {
+        /* Two's complement, the 9 bits left aligned */
+        Temperature = (int16_t)((SensorBuf[0] << 8) | SensorBuf[1]);
+        Sensor_Derate();
+    }
+    else
+    {
+        /* The host never sees the three axes from two samples */
+        __disable_irq();
+        Rates[0] = (int16_t)(SensorBuf[0] | (SensorBuf[1] << 8));
+        Rates[1] = (int16_t)(SensorBuf[2] | (SensorBuf[3] << 8));
+        Rates[2] = (int16_t)(SensorBuf[4] | (SensorBuf[5] << 8));
+        __enable_irq();
+    }
+    s->Stamp = now;
+    s->State = VCP_SENSOR_RUN;
+}
+
+/**
+  * @brief  Set the highest bitrate from the temperature: a limit stays until
+  *         the board is cooler than its threshold by VCP_SENSOR_HYSTERESIS.
+  * @param  None
+  * @retval None
+  */
+static void Sensor_Derate(void)
+{
+    int16_t temp = Temperature / 256;
+    uint8_t level = 0;
+
+    while ((level < (sizeof (SensorDerate) / sizeof (SensorDerate[0]))) &&
+           (temp >= (SensorDerate[level].Temp - ((level < Derate) ? VCP_SENSOR_HYSTERESIS : 0))))
+    {
+        level++;
+    }
+
+    Derate = level;
+    MaxBitrate = level ? SensorDerate[level - 1].Bitrate : VCP_SENSOR_NO_LIMIT;
+}
+
+/**
+  * @brief  Tell how old the last reading of a sensor is.
+  * @param  i: VCP_SENSOR_xxx
+  * @param  now: current tick
+  * @retval ms, 65535 at most or when never read
+  */
+static uint16_t Sensor_Age(uint8_t i, uint32_t now)
+{
+    uint32_t age = now - Sensor[i].Stamp;
+
+    if ((Sensor[i].Stamp == 0) || (age > 0xFFFF))
+    {
+        return 0xFFFF;
+    }
+    return (uint16_t)age;
+}
@@ -0,0 +1,271 @@
+/**
+  ******************************************************************************
+  * @file    USB_Device/CDC_Standalone/Src/vcp_spi.c
+  * @brief   SPI bridge: each exchange the host sends is clocked from the SPI
+  *          interrupt, the USB interrupt only starts it. The bytes received
+  *          are kept for the next request, and the end of the exchange is
+  *          told to the application, which may owe them to the host.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "usbd_def.h"
+#include "vcp_spi.h"
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+    uint8_t  Data[VCP_SPI_DATA_SIZE]; /* Sent, then received in place */
+    uint8_t  Length;             /* Bytes received */
+    __IO uint8_t State;          /* VCP_SPI_xxx */
+    uint8_t  Error;              /* HAL_SPI_ERROR_xxx */
+    uint8_t  Hold;               /* 1 while the chip select is held low */
+} VCP_SpiTypeDef;
+
+/* Private define ------------------------------------------------------------*/
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+static SPI_HandleTypeDef SpiHandle;
+static VCP_SpiTypeDef Spi;
+static uint8_t SpiClock = VCP_SPI_OFF;
+
+/* Private function prototypes -----------------------------------------------*/
+static void Spi_End(uint8_t state);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Claim PA4 to PA7 for the bus at the given clock and mode, or give
+  *         them back.
+  * @param  clock: VCP_SPI_OFF, or 1 to VCP_SPI_CLOCK_MAX
+  * @param  mode: SPI mode 0 to 3 | VCP_SPI_LSB_FIRST
+  * @retval USBD_OK, or USBD_FAIL for an unknown clock or while an exchange
+  *         runs
+  */
+int8_t VCP_SPI_Config(uint8_t clock, uint8_t mode)
+{
+    if ((clock > VCP_SPI_CLOCK_MAX) || (Spi.State == VCP_SPI_BUSY))
+    {
+        return (USBD_FAIL);
+    }
+
+    if (SpiClock != VCP_SPI_OFF)
+    {
+        HAL_SPI_DeInit(&SpiHandle);
+    }
+    SpiClock = clock;
+    memset(&Spi, 0, sizeof (Spi));
+    if (clock == VCP_SPI_OFF)
+    {
+        return (USBD_OK);
+    }
+
+    SpiHandle.Instance               = SPIx;
+    SpiHandle.Init.Mode              = SPI_MODE_MASTER;
+    SpiHandle.Init.Direction         = SPI_DIRECTION_2LINES;
+    SpiHandle.Init.DataSize          = SPI_DATASIZE_8BIT;
+    SpiHandle.Init.CLKPolarity       = (mode & 0x02) ? SPI_POLARITY_HIGH : SPI_POLARITY_LOW;
+    SpiHandle.Init.CLKPhase          = (mode & 0x01) ? SPI_PHASE_2EDGE : SPI_PHASE_1EDGE;
+    SpiHandle.Init.NSS               = SPI_NSS_SOFT;
+    SpiHandle.Init.BaudRatePrescaler = (uint32_t)clock << 3; /* SPI_BAUDRATEPRESCALER_xxx */
+    SpiHandle.Init.FirstBit          = (mode & VCP_SPI_LSB_FIRST) ? SPI_FIRSTBIT_LSB : SPI_FIRSTBIT_MSB;
+    SpiHandle.Init.TIMode            = SPI_TIMODE_DISABLE;
+    SpiHandle.Init.CRCCalculation    = SPI_CRCCALCULATION_DISABLE;
+    SpiHandle.Init.CRCPolynomial     = 7;
+    SpiHandle.Init.CRCLength         = SPI_CRC_LENGTH_DATASIZE;
+    SpiHandle.Init.NSSPMode          = SPI_NSS_PULSE_DISABLE;
+
+    if (HAL_SPI_Init(&SpiHandle) != HAL_OK)
+    {
+        SpiClock = VCP_SPI_OFF;
+        return (USBD_FAIL);
+    }
+    return (USBD_OK);
+}
+
+/**
+  * @brief  Tell whether a pin is taken by the bus.
+  * @param  GPIOx: GPIO port
+  * @param  pin: GPIO_PIN_x
+  * @retval 1 when the bus is on and uses the pin
+  */
+uint8_t VCP_SPI_PinInUse(GPIO_TypeDef *GPIOx, uint32_t pin)
+{
+    return ((SpiClock != VCP_SPI_OFF) && (GPIOx == SPIx_GPIO_PORT) &&
+            ((pin & SPIx_PINS) != 0)) ? 1 : 0;
+}
+
+/**
+  * @brief  Start an exchange on the bus; VCP_SPI_DoneCallback tells its end.
+  * @param  pbuf: [0] VCP_SPI_xxx flags, then the bytes to send, or their
+  *         number with VCP_SPI_FILL
+  * @param  length: bytes of pbuf
+  * @retval USBD_OK, USBD_BUSY while the previous exchange runs, or USBD_FAIL
+  *         when the bus is off, the exchange malformed or longer than a
+  *         result holds
+  */
+int8_t VCP_SPI_Transfer(const uint8_t *pbuf, uint16_t length)
+{
+    uint16_t count;
+
+    if (SpiClock == VCP_SPI_OFF)
+    {
+        return (USBD_FAIL);
+    }
+    if (Spi.State == VCP_SPI_BUSY)
+    {
+        return (USBD_BUSY);
+    }
+
+    /* As for the I2C batch, a malformed exchange is also told by the result */
+    Spi.Length = 0;
+    Spi.State = VCP_SPI_ERROR;
+    Spi.Error = VCP_SPI_MALFORMED;
+    if (length < 2)
+    {
+        return (USBD_FAIL);
+    }
+    count = (pbuf[0] & VCP_SPI_FILL) ? pbuf[1] : (length - 1);
+    if ((count == 0) || (count > VCP_SPI_DATA_SIZE) || ((pbuf[0] & VCP_SPI_FILL) && (length != 2)))
+    {
+        return (USBD_FAIL);
+    }
+
+    if (pbuf[0] & VCP_SPI_FILL)
+    {
+        memset(Spi.Data, 0xFF, count);
+    }
+    else
+    {
+        memcpy(Spi.Data, &pbuf[1], count);
+    }
+
+    Spi.Hold = (pbuf[0] & VCP_SPI_HOLD_CS) ? 1 : 0;
+    Spi.Length = (uint8_t)count;
+    Spi.Error = HAL_SPI_ERROR_NONE;
+    Spi.State = VCP_SPI_BUSY;
+
+    HAL_GPIO_WritePin(SPIx_GPIO_PORT, SPIx_CS_PIN, GPIO_PIN_RESET);
+    if (HAL_SPI_TransmitReceive_IT(&SpiHandle, Spi.Data, Spi.Data, count) != HAL_OK)
+    {
+        Spi.Hold = 0;
+        HAL_GPIO_WritePin(SPIx_GPIO_PORT, SPIx_CS_PIN, GPIO_PIN_SET);
+        Spi.Length = 0;
+        Spi.State = VCP_SPI_ERROR;
+        Spi.Error = (uint8_t)SpiHandle.ErrorCode;
+        return (USBD_FAIL);
+    }
+
+    return (USBD_OK);
+}
+
+/**
+  * @brief  Give the state of the last exchange.
+  * @param  None
+  * @retval VCP_SPI_xxx
+  */
+uint8_t VCP_SPI_State(void)
+{
+    return Spi.State;
+}
+
+/**
+  * @brief  Report the last exchange and the bytes it received
+  *         (VCP_REQ_GET_SPI).
+  * @param  pbuf: response buffer
+  * @param  length: bytes asked by the host
+  * @retval None
+  */
+void VCP_SPI_GetResult(uint8_t *pbuf, uint16_t length)
+{
+    uint8_t header[VCP_SPI_RESULT_HEADER];
+
+    header[0] = Spi.State;
+    header[1] = Spi.Hold;
+    header[2] = Spi.Error;
+    header[3] = Spi.Length;
+
+    if (length > (VCP_SPI_RESULT_HEADER + VCP_SPI_DATA_SIZE))
+    {
+        length = VCP_SPI_RESULT_HEADER + VCP_SPI_DATA_SIZE;
+    }
+    memset(pbuf, 0, length);
+    memcpy(pbuf, header, (length < VCP_SPI_RESULT_HEADER) ? length : VCP_SPI_RESULT_HEADER);
+    if (length > VCP_SPI_RESULT_HEADER)
+    {
+        memcpy(&pbuf[VCP_SPI_RESULT_HEADER], Spi.Data,
+               ((length - VCP_SPI_RESULT_HEADER) < Spi.Length) ? (length - VCP_SPI_RESULT_HEADER) : Spi.Length);
+    }
+}
+
+/**
+  * @brief  Copy the bytes received by the last exchange, zeros past them.
+  * @param  pbuf: destination
+  * @param  length: bytes to copy
+  * @retval None
+  */
+void VCP_SPI_GetData(uint8_t *pbuf, uint16_t length)
+{
+    memset(pbuf, 0, length);
+    memcpy(pbuf, Spi.Data, (length < Spi.Length) ? length : Spi.Length);
+}
+
+/**
+  * @brief  Serve the interrupt of the bus.
+  * @param  None
+  * @retval None
+  */
+void VCP_SPI_IRQHandler(void)
+{
+    HAL_SPI_IRQHandler(&SpiHandle);
+}
+
+/**
+  * @brief  The last byte of the exchange is clocked.
+  * @param  hspi: SPI handle
+  * @retval None
+  */
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+    Spi_End(VCP_SPI_DONE);
+}
+
+/**
+  * @brief  The exchange failed: overrun or mode fault.
+  * @param  hspi: SPI handle
+  * @retval None
+  */
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+    Spi.Error = (uint8_t)hspi->ErrorCode;
+    Spi.Length = 0;
+    Spi.Hold = 0;
+    Spi_End(VCP_SPI_ERROR);
+}
+
+/**
+  * @brief  End of an exchange, called from the SPI interrupt. To be
+  *         implemented by the application.
+  * @param  None
+  * @retval None
+  */
+__weak void VCP_SPI_DoneCallback(void)
+{
+}
+
+/**
+  * @brief  Release the chip select unless it is held, and tell the
+  *         application.
+  * @param  state: VCP_SPI_DONE or VCP_SPI_ERROR
+  * @retval None
+  */
+static void Spi_End(uint8_t state)
+{
+    if (!Spi.Hold)
+    {
+        HAL_GPIO_WritePin(SPIx_GPIO_PORT, SPIx_CS_PIN, GPIO_PIN_SET);
+    }
+    Spi.State = state;
+    VCP_SPI_DoneCallback();
+}